@@ -82,6 +82,7 @@
 #include "ofxsMaskMix.h"
 #include "ofxsMerging.h"
 #include "ofxsMacros.h"
+#include "ColorKernels.h"
 #include "ofxNatron.h"
 
 #define kPluginName "AddOFX"
@@ -109,214 +110,16 @@
 using namespace OFX;
 
 
-namespace {
-    struct RGBAValues {
-        double r,g,b,a;
-        RGBAValues(double v) : r(v), g(v), b(v), a(v) {}
-        RGBAValues() : r(0), g(0), b(0), a(0) {}
-    };
-}
-
-class AddProcessorBase : public OFX::ImageProcessor
-{
-protected:
-    const OFX::Image *_srcImg;
-    const OFX::Image *_maskImg;
-    bool _processR;
-    bool _processG;
-    bool _processB;
-    bool _processA;
-    RGBAValues _value;
-    bool _premult;
-    int _premultChannel;
-    bool   _doMasking;
-    double _mix;
-    bool _maskInvert;
-
-public:
-    
-    AddProcessorBase(OFX::ImageEffect &instance)
-    : OFX::ImageProcessor(instance)
-    , _srcImg(0)
-    , _maskImg(0)
-    , _processR(true)
-    , _processG(true)
-    , _processB(true)
-    , _processA(false)
-    , _value()
-    , _premult(false)
-    , _premultChannel(3)
-    , _doMasking(false)
-    , _mix(1.)
-    , _maskInvert(false)
-    {
-    }
-    
-    void setSrcImg(const OFX::Image *v) {_srcImg = v;}
-    
-    void setMaskImg(const OFX::Image *v, bool maskInvert) { _maskImg = v; _maskInvert = maskInvert; }
-    
-    void doMasking(bool v) {_doMasking = v;}
-    
-    void setValues(bool processR,
-                   bool processG,
-                   bool processB,
-                   bool processA,
-                   const RGBAValues& value,
-                   bool premult,
-                   int premultChannel,
-                   double mix)
-    {
-        _processR = processR;
-        _processG = processG;
-        _processB = processB;
-        _processA = processA;
-        _value = value;
-        _premult = premult;
-        _premultChannel = premultChannel;
-        _mix = mix;
-    }
-
-private:
-};
-
-
+typedef PixelKernelProcessorBase<AddKernel> AddProcessorBase;
 
 template <class PIX, int nComponents, int maxValue>
-class AddProcessor : public AddProcessorBase
+class AddProcessor : public PixelKernelProcessor<AddKernel, PIX, nComponents, maxValue>
 {
 public:
     AddProcessor(OFX::ImageEffect &instance)
-    : AddProcessorBase(instance)
+    : PixelKernelProcessor<AddKernel, PIX, nComponents, maxValue>(instance)
     {
     }
-    
-private:
-
-    void multiThreadProcessImages(OfxRectI procWindow)
-    {
-        const bool r = _processR && (nComponents != 1);
-        const bool g = _processG && (nComponents >= 2);
-        const bool b = _processB && (nComponents >= 3);
-        const bool a = _processA && (nComponents == 1 || nComponents == 4);
-        if (r) {
-            if (g) {
-                if (b) {
-                    if (a) {
-                        return process<true ,true ,true ,true >(procWindow); // RGBA
-                    } else {
-                        return process<true ,true ,true ,false>(procWindow); // RGBa
-                    }
-                } else {
-                    if (a) {
-                        return process<true ,true ,false,true >(procWindow); // RGbA
-                    } else {
-                        return process<true ,true ,false,false>(procWindow); // RGba
-                    }
-                }
-            } else {
-                if (b) {
-                    if (a) {
-                        return process<true ,false,true ,true >(procWindow); // RgBA
-                    } else {
-                        return process<true ,false,true ,false>(procWindow); // RgBa
-                    }
-                } else {
-                    if (a) {
-                        return process<true ,false,false,true >(procWindow); // RgbA
-                    } else {
-                        return process<true ,false,false,false>(procWindow); // Rgba
-                    }
-                }
-            }
-        } else {
-            if (g) {
-                if (b) {
-                    if (a) {
-                        return process<false,true ,true ,true >(procWindow); // rGBA
-                    } else {
-                        return process<false,true ,true ,false>(procWindow); // rGBa
-                    }
-                } else {
-                    if (a) {
-                        return process<false,true ,false,true >(procWindow); // rGbA
-                    } else {
-                        return process<false,true ,false,false>(procWindow); // rGba
-                    }
-                }
-            } else {
-                if (b) {
-                    if (a) {
-                        return process<false,false,true ,true >(procWindow); // rgBA
-                    } else {
-                        return process<false,false,true ,false>(procWindow); // rgBa
-                    }
-                } else {
-                    if (a) {
-                        return process<false,false,false,true >(procWindow); // rgbA
-                    } else {
-                        return process<false,false,false,false>(procWindow); // rgba
-                    }
-                }
-            }
-        }
-    }
-
-    template<bool processR, bool processG, bool processB, bool processA>
-    void process(const OfxRectI& procWindow)
-    {
-        assert(nComponents == 1 || nComponents == 3 || nComponents == 4);
-        assert(_dstImg);
-        float unpPix[4];
-        float tmpPix[4];
-        for (int y = procWindow.y1; y < procWindow.y2; y++) {
-            if (_effect.abort()) {
-                break;
-            }
-
-            PIX *dstPix = (PIX *) _dstImg->getPixelAddress(procWindow.x1, y);
-
-            for (int x = procWindow.x1; x < procWindow.x2; x++) {
-                const PIX *srcPix = (const PIX *)  (_srcImg ? _srcImg->getPixelAddress(x, y) : 0);
-                ofxsUnPremult<PIX, nComponents, maxValue>(srcPix, unpPix, _premult, _premultChannel);
-                for (int c = 0; c < 4; ++c) {
-                    if (processR && c == 0) {
-                        tmpPix[0] = unpPix[0] + (float)_value.r;
-                    } else if (processG && c == 1) {
-                        tmpPix[1] = unpPix[1] + (float)_value.g;
-                    } else if (processB && c == 2) {
-                        tmpPix[2] = unpPix[2] + (float)_value.b;
-                    } else if (processA && c == 3) {
-                        tmpPix[3] = unpPix[3] + (float)_value.a;
-                    } else {
-                        tmpPix[c] = unpPix[c];
-                    }
-                }
-                ofxsPremultMaskMixPix<PIX, nComponents, maxValue, true>(tmpPix, _premult, _premultChannel, x, y, srcPix, _doMasking, _maskImg, (float)_mix, _maskInvert, dstPix);
-                // copy back original values from unprocessed channels
-                if (nComponents == 1) {
-                    if (!processA) {
-                        dstPix[0] = srcPix ? srcPix[0] : PIX();
-                    }
-                } else if (nComponents == 3 || nComponents == 4) {
-                    if (!processR) {
-                        dstPix[0] = srcPix ? srcPix[0] : PIX();
-                    }
-                    if (!processG) {
-                        dstPix[1] = srcPix ? srcPix[1] : PIX();
-                    }
-                    if (!processB) {
-                        dstPix[2] = srcPix ? srcPix[2] : PIX();
-                    }
-                    if (!processA && nComponents == 4) {
-                        dstPix[3] = srcPix ? srcPix[3] : PIX();
-                    }
-                }
-                // increment the dst pixel
-                dstPix += nComponents;
-            }
-        }
-    }
 };
 
 
@@ -451,7 +254,8 @@ AddPlugin::setupAndProcess(AddProcessorBase &processor, const OFX::RenderArgumen
     double mix;
     _mix->getValueAtTime(args.time, mix);
     processor.setValues(processR, processG, processB, processA,
-                        value, premult, premultChannel, mix);
+                        premult, premultChannel, mix);
+    processor.setKernel(AddKernel(value));
  
     // Call the base class process member, this will call the derived templated process code
     processor.process();
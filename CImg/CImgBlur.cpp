@@ -495,42 +495,59 @@ public:
     {
         // PROCESSING.
         // This is the only place where the actual processing takes place
-        double sx = args.renderScale.x * params.sizex;
-        double sy = args.renderScale.y * params.sizey;
+        if (params.filter == eFilterQuasiGaussian || params.filter == eFilterGaussian) {
+            float sigmax = (float)(args.renderScale.x * params.sizex / 2.4);
+            float sigmay = (float)(args.renderScale.y * params.sizey / 2.4);
+            if (sigmax < 0.1 && sigmay < 0.1 && params.orderX == 0 && params.orderY == 0) {
+                return;
+            }
+        }
         CImg<float> cimg0;
         if (_isLaplacian) {
             cimg0 = cimg;
         }
+        renderLines(args, params, 'x', cimg);
+        if (abort()) { return; }
+        renderLines(args, params, 'y', cimg);
+        if (_isLaplacian) {
+            cimg *= -1;
+            cimg += cimg0;
+        }
+    }
+
+    // the blur is separable, but the Laplacian also needs the original image
+    virtual CImgFilterThreadingEnum getThreading(const CImgBlurParams& /*params*/) OVERRIDE FINAL
+    {
+        return _isLaplacian ? eCImgFilterThreadingTiles : eCImgFilterThreadingSeparable;
+    }
+
+    virtual void renderLines(const OFX::RenderArguments &args, const CImgBlurParams& params, char axis, cimg_library::CImg<float>& cimg) OVERRIDE FINAL
+    {
+        double sx = args.renderScale.x * params.sizex;
+        double sy = args.renderScale.y * params.sizey;
+        const double s = (axis == 'x') ? sx : sy;
+        const int order = (axis == 'x') ? params.orderX : params.orderY;
         if (params.filter == eFilterQuasiGaussian || params.filter == eFilterGaussian) {
             float sigmax = (float)(sx / 2.4);
             float sigmay = (float)(sy / 2.4);
             if (sigmax < 0.1 && sigmay < 0.1 && params.orderX == 0 && params.orderY == 0) {
                 return;
             }
+            float sigma = (float)(s / 2.4);
             // VanVliet filter was inexistent before 1.53, and buggy before CImg.h from
             // 57ffb8393314e5102c00e5f9f8fa3dcace179608 Thu Dec 11 10:57:13 2014 +0100
             if (params.filter == eFilterGaussian) {
-                cimg.vanvliet(sigmax, params.orderX, 'x', (bool)params.boundary_i);
-                if (abort()) { return; }
-                cimg.vanvliet(sigmay, params.orderY, 'y', (bool)params.boundary_i);
+                cimg.vanvliet(sigma, order, axis, (bool)params.boundary_i);
             } else {
-                cimg.deriche(sigmax, params.orderX, 'x', (bool)params.boundary_i);
-                if (abort()) { return; }
-                cimg.deriche(sigmay, params.orderY, 'y', (bool)params.boundary_i);
+                cimg.deriche(sigma, order, axis, (bool)params.boundary_i);
             }
         } else if (params.filter == eFilterBox || params.filter == eFilterTriangle || params.filter == eFilterQuadratic) {
             int iter = (params.filter == eFilterBox ? 1 :
                         (params.filter == eFilterTriangle ? 2 : 3));
-            box(cimg, sx, iter, params.orderX, 'x', (bool)params.boundary_i);
-            if (abort()) { return; }
-            box(cimg, sy, iter, params.orderY, 'y', (bool)params.boundary_i);
+            box(cimg, s, iter, order, axis, (bool)params.boundary_i);
         } else {
             assert(false);
         }
-        if (_isLaplacian) {
-            cimg *= -1;
-            cimg += cimg0;
-        }
     }
 
     virtual bool isIdentity(const OFX::IsIdentityArguments &args, const CImgBlurParams& params) OVERRIDE FINAL
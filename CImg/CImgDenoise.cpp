@@ -210,6 +210,9 @@ public:
                         params.fast_approx);
     }
 
+    // not separable: cut the image into tiles padded by getRoI()
+    virtual CImgFilterThreadingEnum getThreading(const CImgDenoiseParams& /*params*/) OVERRIDE FINAL { return eCImgFilterThreadingTiles; }
+
     virtual bool isIdentity(const OFX::IsIdentityArguments &/*args*/, const CImgDenoiseParams& params) OVERRIDE FINAL
     {
         return (params.sigma_s == 0. && params.sigma_r == 0.);
@@ -173,6 +173,29 @@ public:
         }
     }
 
+    // erosion and dilation by a rectangle are separable. If sx and sy have opposite signs, render()
+    // applies both operations on the whole image one after the other, which is not the same as
+    // splitting them by axis: keep that order.
+    virtual CImgFilterThreadingEnum getThreading(const CImgDilateParams& params) OVERRIDE FINAL
+    {
+        if ((params.sx > 0 && params.sy < 0) || (params.sx < 0 && params.sy > 0)) {
+            return eCImgFilterThreadingNone;
+        }
+        return eCImgFilterThreadingSeparable;
+    }
+
+    virtual void renderLines(const OFX::RenderArguments &args, const CImgDilateParams& params, char axis, cimg_library::CImg<float>& cimg) OVERRIDE FINAL
+    {
+        const int s = (axis == 'x') ? params.sx : params.sy;
+        const double scale = (axis == 'x') ? args.renderScale.x : args.renderScale.y;
+        const unsigned int size = (unsigned int)std::floor(std::abs(s) * scale) * 2 + 1;
+        if (s > 0) {
+            cimg.dilate(axis == 'x' ? size : 1, axis == 'x' ? 1 : size);
+        } else if (s < 0) {
+            cimg.erode(axis == 'x' ? size : 1, axis == 'x' ? 1 : size);
+        }
+    }
+
     virtual bool isIdentity(const OFX::IsIdentityArguments &args, const CImgDilateParams& params) OVERRIDE FINAL
     {
         return (std::floor(params.sx * args.renderScale.x) == 0 && std::floor(params.sy * args.renderScale.y) == 0);
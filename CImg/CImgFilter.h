@@ -15,10 +15,16 @@
 #include "ofxsPixelProcessor.h"
 #include "ofxsCopier.h"
 #include "ofxsMerging.h"
+#include "ofxsMultiThread.h"
 #include "ofxNatron.h"
+#include "CImgScratch.h"
 
 #include <cassert>
 #include <memory>
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <vector>
 
 //#define CIMG_DEBUG
 
@@ -35,6 +41,17 @@ CLANG_DIAG_OFF(shorten-64-to-32)
 #include "CImg.h"
 CLANG_DIAG_ON(shorten-64-to-32)
 
+// minimum size of the tiles or line bands processed by each thread, in pixels
+#define kCImgFilterMinTileSize 16
+
+/// how the processing of a cimg may be split between threads, see CImgFilterPluginHelper::getThreading()
+enum CImgFilterThreadingEnum
+{
+    eCImgFilterThreadingNone = 0, //!< render() is called once on the whole image
+    eCImgFilterThreadingSeparable, //!< the filter is separable: renderLines() is called concurrently on bands of rows ('x'), then on bands of columns ('y')
+    eCImgFilterThreadingTiles, //!< render() may be called concurrently on tiles, each padded by getRoI(). The result on a tile must only depend on the pixels within getRoI() of that tile
+};
+
 template <class Params, bool sourceIsOptional>
 class CImgFilterPluginHelper : public OFX::ImageEffect
 {
@@ -63,6 +80,7 @@ public:
     , _supportsRenderScale(supportsRenderScale)
     , _defaultUnpremult(defaultUnpremult)
     , _defaultProcessAlphaOnRGBA(defaultProcessAlphaOnRGBA)
+    , _scratch(this)
     {
         _dstClip = fetchClip(kOfxImageEffectOutputClipName);
         assert(_dstClip && (_dstClip->getPixelComponents() == OFX::ePixelComponentRGB || _dstClip->getPixelComponents() == OFX::ePixelComponentRGBA));
@@ -96,6 +114,12 @@ public:
 
     virtual bool isIdentity(const OFX::IsIdentityArguments &args, OFX::Clip* &identityClip, double &identityTime) OVERRIDE FINAL;
 
+    // free the scratch buffers
+    virtual void purgeCaches() OVERRIDE
+    {
+        _scratch.purge();
+    }
+
     virtual void changedClip(const OFX::InstanceChangedArgs &args, const std::string &clipName) OVERRIDE FINAL
     {
         if (clipName == kOfxImageEffectSimpleSourceClipName && _srcClip && args.reason == OFX::eChangeUserEdit) {
@@ -148,6 +172,13 @@ public:
 
     virtual void render(const OFX::RenderArguments &args, const Params& params, int x1, int y1,cimg_library::CImg<float>& cimg) = 0;
 
+    // how render() may be split between threads. The default is to call render() once on the whole image.
+    virtual CImgFilterThreadingEnum getThreading(const Params& /*params*/) { return eCImgFilterThreadingNone; }
+
+    // for separable filters (see getThreading()): apply the filter along axis ('x' or 'y') only.
+    // cimg only contains complete lines along that axis, and has a single channel.
+    virtual void renderLines(const OFX::RenderArguments &/*args*/, const Params& /*params*/, char /*axis*/, cimg_library::CImg<float>& /*cimg*/) { assert(false); }
+
     virtual bool isIdentity(const OFX::IsIdentityArguments &/*args*/, const Params& /*params*/) { return false; };
 
     // 0: Black/Dirichlet, 1: Nearest/Neumann, 2: Repeat/Periodic
@@ -425,6 +456,246 @@ private:
         return true;
     }
 
+    // map coordinate c to the interval [c1,c2) according to the boundary conditions.
+    // returns false if the pixel is outside of the image and black.
+    static
+    bool
+    boundaryCoord(int c, int c1, int c2, int boundary, int* cb)
+    {
+        if (c1 <= c && c < c2) {
+            *cb = c;
+            return true;
+        }
+        if (c1 >= c2) {
+            return false;
+        }
+        switch (boundary) {
+            case 1: // Nearest/Neumann
+                *cb = (c < c1) ? c1 : (c2 - 1);
+                return true;
+            case 2: { // Repeat/Periodic
+                const int n = c2 - c1;
+                int m = (c - c1) % n;
+                if (m < 0) {
+                    m += n;
+                }
+                *cb = c1 + m;
+                return true;
+            }
+            default: // Black/Dirichlet
+                return false;
+        }
+    }
+
+    // copy the srcRoI area of a float src image to a coplanar cimg of size srcRoI, processing all channels.
+    static
+    void
+    copySrcToCImg(const float* srcPixelData,
+                  const OfxRectI& srcBounds,
+                  int srcNComponents,
+                  int srcRowBytes,
+                  int srcBoundary,
+                  const OfxRectI& srcRoI,
+                  cimg_library::CImg<float>& cimg)
+    {
+        const int cimgWidth = srcRoI.x2 - srcRoI.x1;
+        // the part of each line which is within srcBounds can be copied without boundary checks
+        const int xIn1 = std::min(std::max(srcRoI.x1, srcBounds.x1), srcRoI.x2);
+        const int xIn2 = std::max(std::min(srcRoI.x2, srcBounds.x2), xIn1);
+
+        for (int y = srcRoI.y1; y < srcRoI.y2; ++y) {
+            const size_t cimgOffset = (size_t)(y - srcRoI.y1) * cimgWidth;
+            int sy;
+            if (!boundaryCoord(y, srcBounds.y1, srcBounds.y2, srcBoundary, &sy)) {
+                for (int c = 0; c < srcNComponents; ++c) {
+                    std::fill(cimg.data(0,0,0,c) + cimgOffset, cimg.data(0,0,0,c) + cimgOffset + cimgWidth, 0.f);
+                }
+                continue;
+            }
+            const float* srcLine = (const float*)((const char*)srcPixelData + (ptrdiff_t)(sy - srcBounds.y1) * srcRowBytes);
+            for (int c = 0; c < srcNComponents; ++c) {
+                float *dst = cimg.data(0,0,0,c) + cimgOffset;
+                // left and right borders
+                for (int x = srcRoI.x1; x < srcRoI.x2; ++x) {
+                    if (x == xIn1) {
+                        x = xIn2;
+                        if (x >= srcRoI.x2) {
+                            break;
+                        }
+                    }
+                    int sx;
+                    dst[x - srcRoI.x1] = boundaryCoord(x, srcBounds.x1, srcBounds.x2, srcBoundary, &sx) ? srcLine[(sx - srcBounds.x1) * srcNComponents + c] : 0.f;
+                }
+                // interior
+                const float *src = srcLine + (xIn1 - srcBounds.x1) * srcNComponents + c;
+                dst += xIn1 - srcRoI.x1;
+                for (int x = xIn1; x < xIn2; ++x, src += srcNComponents, ++dst) {
+                    *dst = *src;
+                }
+            }
+        }
+    }
+
+    // copy the processWindow area of a coplanar cimg of size srcRoI to dst, all channels.
+    static
+    void
+    copyCImgToDst(const cimg_library::CImg<float>& cimg,
+                  const OfxRectI& srcRoI,
+                  const OfxRectI& processWindow,
+                  float* dstPixelData,
+                  const OfxRectI& dstBounds,
+                  int dstNComponents,
+                  int dstRowBytes)
+    {
+        assert(cimg.spectrum() == dstNComponents &&
+               srcRoI.x1 <= processWindow.x1 && processWindow.x2 <= srcRoI.x2 &&
+               srcRoI.y1 <= processWindow.y1 && processWindow.y2 <= srcRoI.y2);
+        for (int y = processWindow.y1; y < processWindow.y2; ++y) {
+            float* dstLine = (float*)((char*)dstPixelData + (ptrdiff_t)(y - dstBounds.y1) * dstRowBytes) + (processWindow.x1 - dstBounds.x1) * dstNComponents;
+            for (int c = 0; c < dstNComponents; ++c) {
+                const float *src = cimg.data(processWindow.x1 - srcRoI.x1, y - srcRoI.y1, 0, c);
+                float *dst = dstLine + c;
+                for (int x = processWindow.x1; x < processWindow.x2; ++x, ++src, dst += dstNComponents) {
+                    *dst = *src;
+                }
+            }
+        }
+    }
+
+    // process a cimg of size srcRoI, where only processWindow has to be computed, splitting the work between threads if possible
+    void renderThreaded(const OFX::RenderArguments &args,
+                        const Params& params,
+                        const OfxRectI& srcRoI,
+                        const OfxRectI& processWindow,
+                        cimg_library::CImg<float>& cimg);
+
+    // calls renderLines() on bands of lines along one axis
+    class LinesProcessor : public OFX::MultiThread::Processor
+    {
+    public:
+        LinesProcessor(CImgFilterPluginHelper& effect,
+                       const OFX::RenderArguments &args,
+                       const Params& params,
+                       char axis,
+                       cimg_library::CImg<float>& cimg)
+        : _effect(effect)
+        , _args(args)
+        , _params(params)
+        , _axis(axis)
+        , _cimg(cimg)
+        {
+        }
+
+        virtual void multiThreadFunction(unsigned int threadID, unsigned int nThreads) OVERRIDE FINAL
+        {
+            const int width = _cimg.width();
+            const int height = _cimg.height();
+            const int n = (_axis == 'x') ? height : width;
+            const int begin = (int)(((long long)n * threadID) / nThreads);
+            const int end = (int)(((long long)n * (threadID + 1)) / nThreads);
+            if (begin >= end) {
+                return;
+            }
+            if (_axis == 'x') {
+                // rows are contiguous: process them in place
+                for (int c = 0; c < _cimg.spectrum(); ++c) {
+                    if (_effect.abort()) {
+                        return;
+                    }
+                    cimg_library::CImg<float> lines(_cimg.data(0, begin, 0, c), width, end - begin, 1, 1, true);
+                    _effect.renderLines(_args, _params, 'x', lines);
+                }
+            } else {
+                // columns are copied to a contiguous buffer
+                const int bandWidth = end - begin;
+                CImgScratchPool::Buffer linesData(_effect._scratch, (size_t)bandWidth * height * sizeof(float));
+                cimg_library::CImg<float> lines(linesData.data(), bandWidth, height, 1, 1, true);
+                for (int c = 0; c < _cimg.spectrum(); ++c) {
+                    if (_effect.abort()) {
+                        return;
+                    }
+                    for (int y = 0; y < height; ++y) {
+                        std::memcpy(lines.data(0, y), _cimg.data(begin, y, 0, c), bandWidth * sizeof(float));
+                    }
+                    _effect.renderLines(_args, _params, 'y', lines);
+                    for (int y = 0; y < height; ++y) {
+                        std::memcpy(_cimg.data(begin, y, 0, c), lines.data(0, y), bandWidth * sizeof(float));
+                    }
+                }
+            }
+        }
+
+    private:
+        CImgFilterPluginHelper& _effect;
+        const OFX::RenderArguments& _args;
+        const Params& _params;
+        const char _axis;
+        cimg_library::CImg<float>& _cimg;
+    };
+
+    // calls render() on tiles of the processWindow, each padded by getRoI()
+    class TilesProcessor : public OFX::MultiThread::Processor
+    {
+    public:
+        TilesProcessor(CImgFilterPluginHelper& effect,
+                       const OFX::RenderArguments &args,
+                       const Params& params,
+                       const OfxRectI& srcRoI,
+                       const std::vector<OfxRectI>& tiles,
+                       const cimg_library::CImg<float>& src,
+                       cimg_library::CImg<float>& dst)
+        : _effect(effect)
+        , _args(args)
+        , _params(params)
+        , _srcRoI(srcRoI)
+        , _tiles(tiles)
+        , _src(src)
+        , _dst(dst)
+        {
+        }
+
+        virtual void multiThreadFunction(unsigned int threadID, unsigned int nThreads) OVERRIDE FINAL
+        {
+            for (size_t i = threadID; i < _tiles.size(); i += nThreads) {
+                if (_effect.abort()) {
+                    return;
+                }
+                const OfxRectI& tile = _tiles[i];
+                OfxRectI tileRoI;
+                _effect.getRoI(tile, _args.renderScale, _params, &tileRoI);
+                OFX::MergeImages2D::rectIntersection(tileRoI, _srcRoI, &tileRoI);
+                assert(tileRoI.x1 <= tile.x1 && tile.x2 <= tileRoI.x2 && tileRoI.y1 <= tile.y1 && tile.y2 <= tileRoI.y2);
+                const int tileWidth = tileRoI.x2 - tileRoI.x1;
+                const int tileHeight = tileRoI.y2 - tileRoI.y1;
+                const int spectrum = _src.spectrum();
+                CImgScratchPool::Buffer tileData(_effect._scratch, (size_t)tileWidth * tileHeight * spectrum * sizeof(float));
+                cimg_library::CImg<float> tileCImg(tileData.data(), tileWidth, tileHeight, 1, spectrum, true);
+                for (int c = 0; c < spectrum; ++c) {
+                    for (int y = tileRoI.y1; y < tileRoI.y2; ++y) {
+                        std::memcpy(tileCImg.data(0, y - tileRoI.y1, 0, c), _src.data(tileRoI.x1 - _srcRoI.x1, y - _srcRoI.y1, 0, c), tileWidth * sizeof(float));
+                    }
+                }
+                _effect.render(_args, _params, tileRoI.x1, tileRoI.y1, tileCImg);
+                assert(tileCImg.width() == tileWidth && tileCImg.height() == tileHeight && tileCImg.depth() == 1 && tileCImg.spectrum() == spectrum);
+                // only the tile itself is valid
+                for (int c = 0; c < spectrum; ++c) {
+                    for (int y = tile.y1; y < tile.y2; ++y) {
+                        std::memcpy(_dst.data(tile.x1 - _srcRoI.x1, y - _srcRoI.y1, 0, c), tileCImg.data(tile.x1 - tileRoI.x1, y - tileRoI.y1, 0, c), (tile.x2 - tile.x1) * sizeof(float));
+                    }
+                }
+            }
+        }
+
+    private:
+        CImgFilterPluginHelper& _effect;
+        const OFX::RenderArguments& _args;
+        const Params& _params;
+        const OfxRectI _srcRoI;
+        const std::vector<OfxRectI>& _tiles;
+        const cimg_library::CImg<float>& _src;
+        cimg_library::CImg<float>& _dst;
+    };
+
 protected:
     // do not need to delete these, the ImageEffect is managing them for us
     OFX::Clip *_dstClip;
@@ -447,6 +718,7 @@ private:
     bool _supportsRenderScale;
     bool _defaultUnpremult; //!< unpremult by default
     bool _defaultProcessAlphaOnRGBA; //!< process alpha by default on RGBA images
+    CImgScratchPool _scratch; //!< scratch buffers, reused across renders
 };
 
 
@@ -867,6 +1139,32 @@ CImgFilterPluginHelper<Params,sourceIsOptional>::render(const OFX::RenderArgumen
     int srcNComponents = ((srcPixelComponents == OFX::ePixelComponentAlpha) ? 1 :
                           ((srcPixelComponents == OFX::ePixelComponentRGB) ? 3 : 4));
 
+    // fast path: if all channels are processed, and there is no unpremult, no mask and no mix,
+    // the cimg is filled directly from src and the result is written directly to dst (no tmp image).
+    const bool processAllChannels = ((srcNComponents == 1) ? processA :
+                                     (processR && processG && processB && (srcNComponents == 3 || processA)));
+    if (src.get() && processAllChannels && !(premult && srcPixelComponents == OFX::ePixelComponentRGBA) && mix == 1. && !doMasking) {
+        assert(srcBitDepth == OFX::eBitDepthFloat && srcPixelComponents == dstPixelComponents);
+        const int cimgWidth = srcRoI.x2 - srcRoI.x1;
+        const int cimgHeight = srcRoI.y2 - srcRoI.y1;
+        const size_t cimgSize = (size_t)cimgWidth * cimgHeight * srcNComponents * sizeof(float);
+        assert(cimgSize > 0);
+        CImgScratchPool::Buffer cimgData(_scratch, cimgSize);
+        float *cimgPixelData = cimgData.data();
+        cimg_library::CImg<float> cimg(cimgPixelData, cimgWidth, cimgHeight, 1, srcNComponents, true);
+
+        copySrcToCImg((const float*)srcPixelData, srcBounds, srcNComponents, srcRowBytes, srcBoundary, srcRoI, cimg);
+
+        printRectI("render srcRoI", srcRoI);
+        renderThreaded(args, params, srcRoI, processWindow, cimg);
+        // check that the dimensions didn't change
+        assert(cimg.width() == cimgWidth && cimg.height() == cimgHeight && cimg.depth() == 1 && cimg.spectrum() == srcNComponents);
+
+        copyCImgToDst(cimg, srcRoI, processWindow, (float*)dstPixelData, dstBounds, dstPixelComponentCount, dstRowBytes);
+
+        return;
+    }
+
     // from here on, we do the following steps:
     // 1- copy & unpremult all channels from srcRoI, from src to a tmp image of size srcRoI
     // 2- extract channels to be processed from tmp to a cimg of size srcRoI (and do the interleaved to coplanar conversion)
@@ -887,8 +1185,8 @@ CImgFilterPluginHelper<Params,sourceIsOptional>::render(const OFX::RenderArgumen
     size_t tmpSize = tmpRowBytes * tmpHeight;
 
     assert(tmpSize > 0);
-    std::auto_ptr<OFX::ImageMemory> tmpData(new OFX::ImageMemory(tmpSize, this));
-    float *tmpPixelData = (float*)tmpData->lock();
+    CImgScratchPool::Buffer tmpData(_scratch, tmpSize);
+    float *tmpPixelData = tmpData.data();
 
     {
         std::auto_ptr<OFX::PixelProcessorFilterBase> fred;
@@ -964,8 +1262,8 @@ CImgFilterPluginHelper<Params,sourceIsOptional>::render(const OFX::RenderArgumen
     }
 
     if (cimgSize) { // may be zero if no channel is processed
-        std::auto_ptr<OFX::ImageMemory> cimgData(new OFX::ImageMemory(cimgSize, this));
-        float *cimgPixelData = (float*)cimgData->lock();
+        CImgScratchPool::Buffer cimgData(_scratch, cimgSize);
+        float *cimgPixelData = cimgData.data();
         cimg_library::CImg<float> cimg(cimgPixelData, cimgWidth, cimgHeight, 1, cimgSpectrum, true);
 
 
@@ -980,7 +1278,7 @@ CImgFilterPluginHelper<Params,sourceIsOptional>::render(const OFX::RenderArgumen
         //////////////////////////////////////////////////////////////////////////////////////////
         // 3- process the cimg
         printRectI("render srcRoI", srcRoI);
-        render(args, params, srcRoI.x1, srcRoI.y1, cimg);
+        renderThreaded(args, params, srcRoI, processWindow, cimg);
         // check that the dimensions didn't change
         assert(cimg.width() == cimgWidth && cimg.height() == cimgHeight && cimg.depth() == 1 && cimg.spectrum() == cimgSpectrum);
 
@@ -1050,6 +1348,72 @@ CImgFilterPluginHelper<Params,sourceIsOptional>::render(const OFX::RenderArgumen
 
 
 
+template <class Params, bool sourceIsOptional>
+void
+CImgFilterPluginHelper<Params,sourceIsOptional>::renderThreaded(const OFX::RenderArguments &args,
+                                                                const Params& params,
+                                                                const OfxRectI& srcRoI,
+                                                                const OfxRectI& processWindow,
+                                                                cimg_library::CImg<float>& cimg)
+{
+    const CImgFilterThreadingEnum threading = getThreading(params);
+    const unsigned int nCPUs = OFX::MultiThread::getNumCPUs();
+    const int cimgWidth = cimg.width();
+    const int cimgHeight = cimg.height();
+
+    if (threading == eCImgFilterThreadingSeparable && nCPUs > 1) {
+        {
+            LinesProcessor processor(*this, args, params, 'x', cimg);
+            processor.multiThread(std::min(nCPUs, (unsigned int)std::max(1, cimgHeight / kCImgFilterMinTileSize)));
+        }
+        if (abort()) {
+            return;
+        }
+        {
+            LinesProcessor processor(*this, args, params, 'y', cimg);
+            processor.multiThread(std::min(nCPUs, (unsigned int)std::max(1, cimgWidth / kCImgFilterMinTileSize)));
+        }
+        return;
+    }
+
+    if (threading == eCImgFilterThreadingTiles && nCPUs > 1) {
+        // cut the processWindow into horizontal bands. Each band is padded by the filter support,
+        // so bands should not be much smaller than the padding.
+        OfxRectI paddedWindow;
+        getRoI(processWindow, args.renderScale, params, &paddedWindow);
+        const int processHeight = processWindow.y2 - processWindow.y1;
+        const int pad = std::max(processWindow.y1 - paddedWindow.y1, paddedWindow.y2 - processWindow.y2);
+        const int nTiles = std::min((int)nCPUs, std::max(1, processHeight / std::max(kCImgFilterMinTileSize, pad)));
+        if (nTiles > 1) {
+            std::vector<OfxRectI> tiles(nTiles);
+            for (int i = 0; i < nTiles; ++i) {
+                tiles[i].x1 = processWindow.x1;
+                tiles[i].x2 = processWindow.x2;
+                tiles[i].y1 = processWindow.y1 + (int)(((long long)processHeight * i) / nTiles);
+                tiles[i].y2 = processWindow.y1 + (int)(((long long)processHeight * (i + 1)) / nTiles);
+            }
+            // tiles read from cimg, so the result is written to another buffer
+            CImgScratchPool::Buffer resultData(_scratch, (size_t)cimgWidth * cimgHeight * cimg.spectrum() * sizeof(float));
+            cimg_library::CImg<float> result(resultData.data(), cimgWidth, cimgHeight, 1, cimg.spectrum(), true);
+            {
+                TilesProcessor processor(*this, args, params, srcRoI, tiles, cimg, result);
+                processor.multiThread(nTiles);
+            }
+            // copy back the processWindow (the rest of cimg is not used)
+            const int processWidth = processWindow.x2 - processWindow.x1;
+            for (int c = 0; c < cimg.spectrum(); ++c) {
+                for (int y = processWindow.y1; y < processWindow.y2; ++y) {
+                    std::memcpy(cimg.data(processWindow.x1 - srcRoI.x1, y - srcRoI.y1, 0, c), result.data(processWindow.x1 - srcRoI.x1, y - srcRoI.y1, 0, c), processWidth * sizeof(float));
+                }
+            }
+
+            return;
+        }
+    }
+
+    render(args, params, srcRoI.x1, srcRoI.y1, cimg);
+}
+
 // override the roi call
 // Required if the plugin requires a region from the inputs which is different from the rendered region of the output.
 // (this is the case here)
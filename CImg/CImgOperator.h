@@ -15,6 +15,7 @@
 #include "ofxsPixelProcessor.h"
 #include "ofxsCopier.h"
 #include "ofxsMerging.h"
+#include "CImgScratch.h"
 
 #include <cassert>
 #include <memory>
@@ -60,6 +61,7 @@ public:
     , _supportsRenderScale(supportsRenderScale)
     , _defaultUnpremult(defaultUnpremult)
     , _defaultProcessAlphaOnRGBA(defaultProcessAlphaOnRGBA)
+    , _scratch(this)
     {
         _dstClip = fetchClip(kOfxImageEffectOutputClipName);
         assert(_dstClip && (_dstClip->getPixelComponents() == OFX::ePixelComponentRGB || _dstClip->getPixelComponents() == OFX::ePixelComponentRGBA));
@@ -83,6 +85,12 @@ public:
 
     virtual bool isIdentity(const OFX::IsIdentityArguments &args, OFX::Clip* &identityClip, double &identityTime) OVERRIDE FINAL;
 
+    // free the scratch buffers
+    virtual void purgeCaches() OVERRIDE
+    {
+        _scratch.purge();
+    }
+
     virtual void changedClip(const OFX::InstanceChangedArgs &args, const std::string &clipName) OVERRIDE FINAL
     {
         if (clipName == _srcAClipName && _srcAClip && args.reason == OFX::eChangeUserEdit) {
@@ -258,6 +266,7 @@ private:
     bool _supportsRenderScale;
     bool _defaultUnpremult; //!< unpremult by default
     bool _defaultProcessAlphaOnRGBA; //!< process alpha by default on RGBA images
+    CImgScratchPool _scratch; //!< scratch buffers, reused across renders
 };
 
 
@@ -579,8 +588,8 @@ CImgOperatorPluginHelper<Params>::render(const OFX::RenderArguments &args)
     size_t tmpSize = tmpRowBytes * tmpHeight;
 
     assert(tmpSize > 0);
-    std::auto_ptr<OFX::ImageMemory> tmpAData(new OFX::ImageMemory(tmpSize, this));
-    float *tmpAPixelData = (float*)tmpAData->lock();
+    CImgScratchPool::Buffer tmpAData(_scratch, tmpSize);
+    float *tmpAPixelData = tmpAData.data();
 
     {
         std::auto_ptr<OFX::PixelProcessorFilterBase> fred;
@@ -613,8 +622,8 @@ CImgOperatorPluginHelper<Params>::render(const OFX::RenderArguments &args)
         }
     }
     
-    std::auto_ptr<OFX::ImageMemory> tmpBData(new OFX::ImageMemory(tmpSize, this));
-    float *tmpBPixelData = (float*)tmpBData->lock();
+    CImgScratchPool::Buffer tmpBData(_scratch, tmpSize);
+    float *tmpBPixelData = tmpBData.data();
 
     {
         std::auto_ptr<OFX::PixelProcessorFilterBase> fred;
@@ -655,8 +664,8 @@ CImgOperatorPluginHelper<Params>::render(const OFX::RenderArguments &args)
         }
     }
 
-    std::auto_ptr<OFX::ImageMemory> tmpData(new OFX::ImageMemory(tmpSize, this));
-    float *tmpPixelData = (float*)tmpData->lock();
+    CImgScratchPool::Buffer tmpData(_scratch, tmpSize);
+    float *tmpPixelData = tmpData.data();
 
     //////////////////////////////////////////////////////////////////////////////////////////
     // 2- extract channels to be processed from tmp to a cimg of size srcRoI (and do the interleaved to coplanar conversion)
@@ -669,8 +678,8 @@ CImgOperatorPluginHelper<Params>::render(const OFX::RenderArguments &args)
 
 
     if (cimgSize) { // may be zero if no channel is processed
-        std::auto_ptr<OFX::ImageMemory> cimgAData(new OFX::ImageMemory(cimgSize, this));
-        float *cimgAPixelData = (float*)cimgAData->lock();
+        CImgScratchPool::Buffer cimgAData(_scratch, cimgSize);
+        float *cimgAPixelData = cimgAData.data();
         cimg_library::CImg<float> cimgA(cimgAPixelData, cimgWidth, cimgHeight, 1, cimgSpectrum, true);
 
         for (int c=0; c < cimgSpectrum; ++c) {
@@ -681,8 +690,8 @@ CImgOperatorPluginHelper<Params>::render(const OFX::RenderArguments &args)
             }
         }
 
-        std::auto_ptr<OFX::ImageMemory> cimgBData(new OFX::ImageMemory(cimgSize, this));
-        float *cimgBPixelData = (float*)cimgBData->lock();
+        CImgScratchPool::Buffer cimgBData(_scratch, cimgSize);
+        float *cimgBPixelData = cimgBData.data();
         cimg_library::CImg<float> cimgB(cimgBPixelData, cimgWidth, cimgHeight, 1, cimgSpectrum, true);
 
         for (int c=0; c < cimgSpectrum; ++c) {
@@ -0,0 +1,221 @@
+//
+//  CImgScratch.h
+//
+//  A thread-safe pool of float scratch buffers, owned by a CImg plugin instance and reused across renders.
+//  The buffers are OFX::ImageMemory allocated for the instance, so that the host accounts for them,
+//  and they are unlocked while they are not used.
+//
+//  Copyright (c) 2014 OpenFX. All rights reserved.
+//
+
+#ifndef Misc_CImgScratch_h
+#define Misc_CImgScratch_h
+
+#include "ofxsImageEffect.h"
+#include "ofxsMultiThread.h"
+
+#include <cassert>
+#include <cstddef>
+#include <vector>
+#ifdef CIMG_DEBUG
+#include <cstdio>
+#endif
+
+// smallest size class, in bytes. Size classes are quarter-octaves: size class 4*i+j holds buffers
+// of (kCImgScratchMinBytes << i) * (4 + j) / 4 bytes, so that a buffer is at most 25% larger than requested.
+#define kCImgScratchMinBytes (64 * 1024)
+
+// unused buffers are freed instead of being kept when the pool already holds more than this number of bytes
+#define kCImgScratchMaxCachedBytes ((size_t)256 * 1024 * 1024)
+
+// unused buffers are freed if they were not reused during the last kCImgScratchMaxIdle renders
+#define kCImgScratchMaxIdle 4
+
+class CImgScratchPool
+{
+public:
+    class Buffer;
+    friend class Buffer;
+
+    /// a scratch buffer, which is given back to the pool when it goes out of scope
+    class Buffer
+    {
+    public:
+        Buffer(CImgScratchPool& pool, size_t nBytes)
+        : _pool(pool)
+        , _sizeClass(0)
+        , _mem(0)
+        , _data(0)
+        {
+            _mem = _pool.acquire(nBytes, &_sizeClass);
+            try {
+                _data = (float*)_mem->lock();
+            } catch (...) {
+                _pool.release(_mem, _sizeClass);
+                throw;
+            }
+        }
+
+        ~Buffer()
+        {
+            _mem->unlock();
+            _pool.release(_mem, _sizeClass);
+        }
+
+        float* data() const { return _data; }
+
+    private:
+        Buffer(const Buffer&); // not implemented
+        Buffer& operator=(const Buffer&); // not implemented
+
+        CImgScratchPool& _pool;
+        int _sizeClass;
+        OFX::ImageMemory* _mem;
+        float* _data;
+    };
+
+    /// effect is the instance the memory is allocated for
+    explicit CImgScratchPool(OFX::ImageEffect* effect)
+    : _effect(effect)
+    , _free()
+    , _inUseCount(0)
+    , _inUseBytes(0)
+    , _cachedBytes(0)
+    , _highWaterMark(0)
+    , _generation(0)
+    , _mutex()
+    {
+    }
+
+    ~CImgScratchPool()
+    {
+        assert(_inUseCount == 0);
+        purge();
+    }
+
+    /// free all buffers that are not currently used (e.g. when the host calls purgeCaches)
+    void purge()
+    {
+        OFX::MultiThread::AutoMutex lock(_mutex);
+        trimUnlocked(0);
+    }
+
+    /// the maximum number of bytes that were simultaneously handed out by this pool
+    size_t highWaterMark() const
+    {
+        OFX::MultiThread::AutoMutex lock(_mutex);
+        return _highWaterMark;
+    }
+
+    /// the number of bytes held by unused buffers
+    size_t cachedBytes() const
+    {
+        OFX::MultiThread::AutoMutex lock(_mutex);
+        return _cachedBytes;
+    }
+
+private:
+    struct Entry
+    {
+        OFX::ImageMemory* mem;
+        unsigned int lastUse; //!< value of _generation when this buffer was last given back
+    };
+
+    CImgScratchPool(const CImgScratchPool&); // not implemented
+    CImgScratchPool& operator=(const CImgScratchPool&); // not implemented
+
+    static size_t classBytes(int sizeClass)
+    {
+        return ((size_t)kCImgScratchMinBytes << (sizeClass / 4)) / 4 * (4 + sizeClass % 4);
+    }
+
+    OFX::ImageMemory* acquire(size_t nBytes, int* sizeClass)
+    {
+        int k = 0;
+        while (classBytes(k) < nBytes) {
+            ++k;
+        }
+        *sizeClass = k;
+        {
+            OFX::MultiThread::AutoMutex lock(_mutex);
+            ++_inUseCount;
+            _inUseBytes += classBytes(k);
+            if (_inUseBytes > _highWaterMark) {
+                _highWaterMark = _inUseBytes;
+            }
+            if (k < (int)_free.size() && !_free[k].empty()) {
+                OFX::ImageMemory* mem = _free[k].back().mem;
+                _free[k].pop_back();
+                _cachedBytes -= classBytes(k);
+                return mem;
+            }
+        }
+        // allocate outside of the lock
+        try {
+            return new OFX::ImageMemory(classBytes(k), _effect);
+        } catch (...) {
+            OFX::MultiThread::AutoMutex lock(_mutex);
+            --_inUseCount;
+            _inUseBytes -= classBytes(k);
+            throw;
+        }
+    }
+
+    void release(OFX::ImageMemory* mem, int sizeClass)
+    {
+        if (!mem) {
+            return;
+        }
+        OFX::MultiThread::AutoMutex lock(_mutex);
+        assert(_inUseCount > 0);
+        if (_cachedBytes + classBytes(sizeClass) > kCImgScratchMaxCachedBytes) {
+            delete mem;
+        } else {
+            if ((int)_free.size() <= sizeClass) {
+                _free.resize(sizeClass + 1);
+            }
+            Entry e = { mem, _generation };
+            _free[sizeClass].push_back(e);
+            _cachedBytes += classBytes(sizeClass);
+        }
+        --_inUseCount;
+        _inUseBytes -= classBytes(sizeClass);
+        if (_inUseCount == 0) {
+            // the pool is idle: this is the end of a render
+            ++_generation;
+            trimUnlocked(kCImgScratchMaxIdle);
+#         ifdef CIMG_DEBUG
+            printf("CImgScratchPool: high-water mark = %lu bytes, cached = %lu bytes\n", (unsigned long)_highWaterMark, (unsigned long)_cachedBytes);
+#         endif
+        }
+    }
+
+    // free the unused buffers that were not used during the last maxIdle generations (must be called with _mutex locked)
+    void trimUnlocked(unsigned int maxIdle)
+    {
+        for (size_t k = 0; k < _free.size(); ++k) {
+            std::vector<Entry>& entries = _free[k];
+            size_t j = 0;
+            for (size_t i = 0; i < entries.size(); ++i) {
+                if (maxIdle == 0 || _generation - entries[i].lastUse > maxIdle) {
+                    delete entries[i].mem;
+                    _cachedBytes -= classBytes((int)k);
+                } else {
+                    entries[j++] = entries[i];
+                }
+            }
+            entries.resize(j);
+        }
+    }
+
+    OFX::ImageEffect* _effect;
+    std::vector<std::vector<Entry> > _free; //!< unused buffers, indexed by size class
+    unsigned int _inUseCount;
+    size_t _inUseBytes;
+    size_t _cachedBytes;
+    size_t _highWaterMark;
+    unsigned int _generation; //!< incremented each time the pool becomes idle
+    mutable OFX::MultiThread::Mutex _mutex;
+};
+
+#endif
@@ -84,6 +84,7 @@
 #include "ofxsMaskMix.h"
 #include "ofxsMerging.h"
 #include "ofxsMacros.h"
+#include "PixelKernelProcessor.h"
 
 
 #define kPluginName "ClampOFX"
@@ -148,283 +149,89 @@ namespace {
         RGBAValues(double v) : r(v), g(v), b(v), a(v) {}
         RGBAValues() : r(0), g(0), b(0), a(0) {}
     };
-}
-
-// Base class for the RGBA and the Alpha processor
-class ClampBase : public OFX::ImageProcessor
-{
-protected:
-    const OFX::Image *_srcImg;
-    const OFX::Image *_maskImg;
-    bool _processR;
-    bool _processG;
-    bool _processB;
-    bool _processA;
-    RGBAValues _minimum;
-    bool _minimumEnable;
-    RGBAValues _maximum;
-    bool _maximumEnable;
-    RGBAValues _minClampTo;
-    bool _minClampToEnable;
-    RGBAValues _maxClampTo;
-    bool _maxClampToEnable;
-    bool   _doMasking;
-    bool _premult;
-    int _premultChannel;
-    double _mix;
-    bool _maskInvert;
-
-public:
-    /** @brief no arg ctor */
-    ClampBase(OFX::ImageEffect &instance)
-    : OFX::ImageProcessor(instance)
-    , _srcImg(0)
-    , _maskImg(0)
-    , _processR(true)
-    , _processG(true)
-    , _processB(true)
-    , _processA(false)
-    , _minimum(0.)
-    , _minimumEnable(true)
-    , _maximum(1.)
-    , _maximumEnable(true)
-    , _minClampTo(0.)
-    , _minClampToEnable(false)
-    , _maxClampTo(1.)
-    , _maxClampToEnable(false)
-    , _doMasking(false)
-    , _premult(false)
-    , _premultChannel(3)
-    , _mix(1.)
-    , _maskInvert(false)
-    {
-    }
 
-    /** @brief set the src image */
-    void setSrcImg(const OFX::Image *v) {_srcImg = v;}
-
-    void setMaskImg(const OFX::Image *v, bool maskInvert) { _maskImg = v; _maskInvert = maskInvert; }
-
-    void doMasking(bool v) {_doMasking = v;}
-
-    void setValues(bool processR,
-                   bool processG,
-                   bool processB,
-                   bool processA,
-                   const RGBAValues& minimum,
-                   bool minimumEnable,
-                   const RGBAValues& maximum,
-                   bool maximumEnable,
-                   const RGBAValues& minClampTo,
-                   bool minClampToEnable,
-                   const RGBAValues& maxClampTo,
-                   bool maxClampToEnable,
-                   bool premult,
-                   int premultChannel,
-                   double mix)
-    {
-        _processR = processR;
-        _processG = processG;
-        _processB = processB;
-        _processA = processA;
-        _minimum = minimum;
-        _minimumEnable = minimumEnable;
-        _maximum = maximum;
-        _maximumEnable = maximumEnable;
-        _minClampTo = minClampTo;
-        _minClampToEnable = minClampToEnable;
-        _maxClampTo = maxClampTo;
-        _maxClampToEnable = maxClampToEnable;
-        _premult = premult;
-        _premultChannel = premultChannel;
-        _mix = mix;
-    }
-};
-
-// template to do the RGBA processing
-template <class PIX, int nComponents, int maxValue>
-class ImageClamper : public ClampBase
-{
-  public:
-    // ctor
-    ImageClamper(OFX::ImageEffect &instance)
-            : ClampBase(instance)
+    // clamp the selected channels
+    struct ClampKernel : public PixelKernel<ClampKernel>
     {
-    }
+        ClampKernel()
+        : _minimum(0.)
+        , _minimumEnable(true)
+        , _maximum(1.)
+        , _maximumEnable(true)
+        , _minClampTo(0.)
+        , _minClampToEnable(false)
+        , _maxClampTo(1.)
+        , _maxClampToEnable(false)
+        {
+        }
 
-  private:
-    // and do some processing
-    void multiThreadProcessImages(OfxRectI procWindow)
-    {
-        const bool r = _processR && (nComponents != 1);
-        const bool g = _processG && (nComponents >= 2);
-        const bool b = _processB && (nComponents >= 3);
-        const bool a = _processA && (nComponents == 1 || nComponents == 4);
-        if (r) {
-            if (g) {
-                if (b) {
-                    if (a) {
-                        return process<true ,true ,true ,true >(procWindow); // RGBA
-                    } else {
-                        return process<true ,true ,true ,false>(procWindow); // RGBa
-                    }
-                } else {
-                    if (a) {
-                        return process<true ,true ,false,true >(procWindow); // RGbA
-                    } else {
-                        return process<true ,true ,false,false>(procWindow); // RGba
-                    }
-                }
-            } else {
-                if (b) {
-                    if (a) {
-                        return process<true ,false,true ,true >(procWindow); // RgBA
-                    } else {
-                        return process<true ,false,true ,false>(procWindow); // RgBa
-                    }
-                } else {
-                    if (a) {
-                        return process<true ,false,false,true >(procWindow); // RgbA
-                    } else {
-                        return process<true ,false,false,false>(procWindow); // Rgba
-                    }
-                }
-            }
-        } else {
-            if (g) {
-                if (b) {
-                    if (a) {
-                        return process<false,true ,true ,true >(procWindow); // rGBA
-                    } else {
-                        return process<false,true ,true ,false>(procWindow); // rGBa
-                    }
-                } else {
-                    if (a) {
-                        return process<false,true ,false,true >(procWindow); // rGbA
-                    } else {
-                        return process<false,true ,false,false>(procWindow); // rGba
-                    }
-                }
-            } else {
-                if (b) {
-                    if (a) {
-                        return process<false,false,true ,true >(procWindow); // rgBA
-                    } else {
-                        return process<false,false,true ,false>(procWindow); // rgBa
-                    }
-                } else {
-                    if (a) {
-                        return process<false,false,false,true >(procWindow); // rgbA
-                    } else {
-                        return process<false,false,false,false>(procWindow); // rgba
-                    }
-                }
-            }
+        ClampKernel(const RGBAValues& minimum,
+                    bool minimumEnable,
+                    const RGBAValues& maximum,
+                    bool maximumEnable,
+                    const RGBAValues& minClampTo,
+                    bool minClampToEnable,
+                    const RGBAValues& maxClampTo,
+                    bool maxClampToEnable)
+        : _minimum(minimum)
+        , _minimumEnable(minimumEnable)
+        , _maximum(maximum)
+        , _maximumEnable(maximumEnable)
+        , _minClampTo(minClampTo)
+        , _minClampToEnable(minClampToEnable)
+        , _maxClampTo(maxClampTo)
+        , _maxClampToEnable(maxClampToEnable)
+        {
         }
-    }
 
-  private:
-    template<bool processR, bool processG, bool processB, bool processA>
-    void process(const OfxRectI& procWindow)
-    {
-        if (_minimumEnable) {
-            if (_maximumEnable) {
-                processClamp<processR, processG, processB, processA, true, true>(procWindow);
-            } else {
-                processClamp<processR, processG, processB, processA, true, false>(procWindow);
-            }
-        } else {
-            if (_maximumEnable) {
-                processClamp<processR, processG, processB, processA, false, true>(procWindow);
-            } else {
-                processClamp<processR, processG, processB, processA, false, false>(procWindow);
-            }
+        // The enable flags are the same for the whole image, so that testing them at each pixel
+        // costs less than instantiating the processor for each combination.
+        template<bool processR, bool processG, bool processB, bool processA>
+        void process(const float *unpPix, float *tmpPix) const
+        {
+            tmpPix[0] = processR ? (float)clamp(unpPix[0], _minimum.r, _maximum.r, _minClampTo.r, _maxClampTo.r) : unpPix[0];
+            tmpPix[1] = processG ? (float)clamp(unpPix[1], _minimum.g, _maximum.g, _minClampTo.g, _maxClampTo.g) : unpPix[1];
+            tmpPix[2] = processB ? (float)clamp(unpPix[2], _minimum.b, _maximum.b, _minClampTo.b, _maxClampTo.b) : unpPix[2];
+            tmpPix[3] = processA ? (float)clamp(unpPix[3], _minimum.a, _maximum.a, _minClampTo.a, _maxClampTo.a) : unpPix[3];
         }
-    }
 
-    template<bool processR, bool processG, bool processB, bool processA, bool minimumEnable, bool maximumEnable>
-    void processClamp(const OfxRectI& procWindow)
-    {
-        if (minimumEnable && _minClampToEnable) {
-            if (maximumEnable && _maxClampToEnable) {
-                processClampTo<processR, processG, processB, processA, minimumEnable, maximumEnable, true, true>(procWindow);
-            } else {
-                processClampTo<processR, processG, processB, processA, minimumEnable, maximumEnable, true, false>(procWindow);
+    private:
+        double clamp(double value, double minimum, double maximum, double minClampTo, double maxClampTo) const
+        {
+            if (_minimumEnable && value < minimum) {
+                return _minClampToEnable ? minClampTo : minimum;
             }
-        } else {
-            if (maximumEnable && _maxClampToEnable) {
-                processClampTo<processR, processG, processB, processA, minimumEnable, maximumEnable, false, true>(procWindow);
-            } else {
-                processClampTo<processR, processG, processB, processA, minimumEnable, maximumEnable, false, false>(procWindow);
+            if (_maximumEnable && value > maximum) {
+                return _maxClampToEnable ? maxClampTo : maximum;
             }
+            return value;
         }
 
-    }
-
-    template<bool processR, bool processG, bool processB, bool processA, bool minimumEnable, bool maximumEnable, bool minClampToEnable, bool maxClampToEnable>
-    void processClampTo(const OfxRectI& procWindow)
-    {
-        float unpPix[4];
-        float tmpPix[4];
-        for (int y = procWindow.y1; y < procWindow.y2; y++) {
-            if (_effect.abort()) {
-                break;
-            }
+        RGBAValues _minimum;
+        bool _minimumEnable;
+        RGBAValues _maximum;
+        bool _maximumEnable;
+        RGBAValues _minClampTo;
+        bool _minClampToEnable;
+        RGBAValues _maxClampTo;
+        bool _maxClampToEnable;
+    };
+}
 
-            PIX *dstPix = (PIX *) _dstImg->getPixelAddress(procWindow.x1, y);
-
-            for (int x = procWindow.x1; x < procWindow.x2; x++) {
-
-                const PIX *srcPix = (const PIX *)  (_srcImg ? _srcImg->getPixelAddress(x, y) : 0);
-
-                // do we have a source image to scale up
-                ofxsUnPremult<PIX, nComponents, maxValue>(srcPix, unpPix, _premult, _premultChannel);
-                if (!processR) {
-                    tmpPix[0] = unpPix[0];
-                } else {
-                    tmpPix[0] = (float)clamp<minimumEnable, maximumEnable, minClampToEnable, maxClampToEnable>(unpPix[0],
-                                                                                                        _minimum.r, _maximum.r,
-                                                                                                        _minClampTo.r, _maxClampTo.r);
-                }
-                if (!processG) {
-                    tmpPix[1] = unpPix[1];
-                } else {
-                    tmpPix[1] = (float)clamp<minimumEnable, maximumEnable, minClampToEnable, maxClampToEnable>(unpPix[1],
-                                                                                                        _minimum.g, _maximum.g,
-                                                                                                        _minClampTo.g, _maxClampTo.g);
-                }
-                if (!processB) {
-                    tmpPix[2] = unpPix[2];
-                } else {
-                    tmpPix[2] = (float)clamp<minimumEnable, maximumEnable, minClampToEnable, maxClampToEnable>(unpPix[2],
-                                                                                                        _minimum.b, _maximum.b,
-                                                                                                        _minClampTo.b, _maxClampTo.b);
-                }
-                if (!processA) {
-                    tmpPix[3] = unpPix[3];
-                } else {
-                    tmpPix[3] = (float)clamp<minimumEnable, maximumEnable, minClampToEnable, maxClampToEnable>(unpPix[3],
-                                                                                                        _minimum.a, _maximum.a,
-                                                                                                        _minClampTo.a, _maxClampTo.a);
-                }
-                ofxsPremultMaskMixPix<PIX, nComponents, maxValue, true>(tmpPix, _premult, _premultChannel, x, y, srcPix, _doMasking, _maskImg, (float)_mix, _maskInvert, dstPix);
-
-                // increment the dst pixel
-                dstPix += nComponents;
-            }
-        }
-    }
+// Base class for the RGBA and the Alpha processor
+typedef PixelKernelProcessorBase<ClampKernel> ClampBase;
 
-    template<bool minimumEnable, bool maximumEnable, bool minClampToEnable, bool maxClampToEnable>
-    static double clamp(double value, double minimum, double maximum, double minClampTo, double maxClampTo)
+// template to do the RGBA processing
+template <class PIX, int nComponents, int maxValue>
+class ImageClamper : public PixelKernelProcessor<ClampKernel, PIX, nComponents, maxValue>
+{
+  public:
+    // ctor
+    ImageClamper(OFX::ImageEffect &instance)
+            : PixelKernelProcessor<ClampKernel, PIX, nComponents, maxValue>(instance)
     {
-        if (minimumEnable && value < minimum) {
-            return minClampToEnable ? minClampTo : minimum;
-        }
-        if (maximumEnable && value > maximum) {
-            return maxClampToEnable ? maxClampTo : maximum;
-        }
-        return value;
+        // the unprocessed channels go through premult/mask/mix
+        this->setCopyUnprocessed(false);
     }
 };
 
@@ -612,10 +419,9 @@ ClampPlugin::setupAndProcess(ClampBase &processor, const OFX::RenderArguments &a
     _premultChannel->getValueAtTime(args.time, premultChannel);
     double mix;
     _mix->getValueAtTime(args.time, mix);
-    processor.setValues(processR, processG, processB, processA,
-                        minimum, minimumEnable, maximum, maximumEnable,
-                        minClampTo, minClampToEnable, maxClampTo, maxClampToEnable,
-                        premult, premultChannel, mix);
+    processor.setValues(processR, processG, processB, processA, premult, premultChannel, mix);
+    processor.setKernel(ClampKernel(minimum, minimumEnable, maximum, maximumEnable,
+                                    minClampTo, minClampToEnable, maxClampTo, maxClampToEnable));
 
     // set the images
     processor.setDstImg(dst.get());
@@ -81,6 +81,7 @@
 #include "ofxsMaskMix.h"
 #include "ofxsMerging.h"
 #include "ofxsMacros.h"
+#include "ColorKernels.h"
 
 #define kPluginName "ColorCorrectOFX"
 #define kPluginGrouping "Color"
@@ -91,8 +92,9 @@
 // History:
 // version 1.0: initial version
 // version 2.0: use kNatronOfxParamProcess* parameters
+// version 2.1: add the precision parameter
 #define kPluginVersionMajor 2 // Incrementing this number means that you have broken backwards compatibility of the plug-in.
-#define kPluginVersionMinor 0 // Increment this when you have fixed a bug or made it faster.
+#define kPluginVersionMinor 1 // Increment this when you have fixed a bug or made it faster.
 
 #define kSupportsTiles 1
 #define kSupportsMultiResolution 1
@@ -127,489 +129,23 @@ static const std::string kParamOffset = std::string("Offset");
 #define kParamClampWhiteLabel "Clamp White"
 #define kParamClampWhiteHint "All colors above 1 on output are set to 1."
 
-#define LUT_MAX_PRECISION 100
-
-// Rec.709 luminance:
-//Y = 0.2126 R + 0.7152 G + 0.0722 B
-static const double s_rLum = 0.2126;
-static const double s_gLum = 0.7152;
-static const double s_bLum = 0.0722;
-
 using namespace OFX;
 
 
-namespace {
-    struct ColorControlValues {
-        double r;
-        double g;
-        double b;
-        double a;
-
-        ColorControlValues() : r(0.), g(0.), b(0.),a(0.) {}
-
-        void getValueFrom(double time, OFX::RGBAParam* p)
-        {
-            p->getValueAtTime(time, r, g, b, a);
-        }
-    };
-
-    struct ColorControlGroup {
-        ColorControlValues saturation;
-        ColorControlValues contrast;
-        ColorControlValues gamma;
-        ColorControlValues gain;
-        ColorControlValues offset;
-    };
-    
-    template<bool processR, bool processG, bool processB, bool processA>
-    struct RGBAPixel {
-        double r, g, b,a;
-
-        RGBAPixel(double r_, double g_, double b_,double a_)
-        : r(r_)
-        , g(g_)
-        , b(b_)
-        , a(a_)
-        {
-        }
-
-        void applySMH(const ColorControlGroup& sValues,
-                      double s_scale,
-                      const ColorControlGroup& mValues,
-                      double m_scale,
-                      const ColorControlGroup& hValues,
-                      double h_scale,
-                      const ColorControlGroup& masterValues)
-        {
-            RGBAPixel s = *this;
-            RGBAPixel m = *this;
-            RGBAPixel h = *this;
-            s.applyGroup(sValues);
-            m.applyGroup(mValues);
-            h.applyGroup(hValues);
-            
-            if (processR) {
-                r = s.r * s_scale + m.r * m_scale + h.r * h_scale;
-            }
-            if (processG) {
-                g = s.g * s_scale + m.g * m_scale + h.g * h_scale;
-            }
-            if (processB) {
-                b = s.b * s_scale + m.b * m_scale + h.b * h_scale;
-            }
-            if (processA) {
-                a = s.a * s_scale + m.a * m_scale + h.a * h_scale;
-            }
-            applyGroup(masterValues);
-        }
-
-    private:
-        void applySaturation(const ColorControlValues &c)
-        {
-            double tmp_r ,tmp_g,tmp_b ;
-            if (processR) {
-                tmp_r = r *((1.f - c.r) * s_rLum + c.r) + g *((1.f-c.r) * s_gLum) + b *((1.f-c.r) * s_bLum);
-            }
-            if (processG) {
-                tmp_g = g *((1.f - c.g) * s_gLum + c.g) + r *((1.f-c.g) * s_rLum) + b *((1.f-c.g) * s_bLum);
-            }
-            if (processB) {
-                tmp_b = b *((1.f - c.b) * s_bLum + c.b) + g *((1.f-c.b) * s_gLum) + r *((1.f-c.b) * s_rLum);
-            }
-            if (processR) {
-                r = tmp_r;
-            }
-            if (processG) {
-                g = tmp_g;
-            }
-            if (processB) {
-                b = tmp_b;
-            }
-        }
-
-        void applyContrast(const ColorControlValues &c)
-        {
-            if (processR) {
-                r = (r - 0.5f) * c.r  + 0.5f;
-            }
-            if (processG) {
-                g = (g - 0.5f) * c.g  + 0.5f;
-            }
-            if (processB) {
-                b = (b - 0.5f) * c.b  + 0.5f;
-            }
-            if (processA) {
-                a = (a - 0.5f) * c.a  + 0.5f;
-            }
-        }
-
-        void applyGain(const ColorControlValues &c)
-        {
-            if (processR) {
-                r = r * c.r;
-            }
-            if (processG) {
-                g = g * c.g;
-            }
-            if (processB) {
-                b = b * c.b;
-            }
-            if (processA) {
-                a = a * c.a;
-            }
-        }
-
-        void applyGamma(const ColorControlValues &c)
-        {
-            if (processR && r > 0) {
-                r = std::pow(r ,1. / c.r);
-            }
-            if (processG && g > 0) {
-                g = std::pow(g ,1. / c.g);
-            }
-            if (processB && b > 0) {
-                b = std::pow(b ,1. / c.b);
-            }
-            if (processA && a > 0) {
-                a = std::pow(a ,1. / c.a);
-            }
-        }
-
-        void applyOffset(const ColorControlValues &c)
-        {
-            if (processR) {
-                r = r + c.r;
-            }
-            if (processG) {
-                g = g + c.g;
-            }
-            if (processB) {
-                b = b + c.b;
-            }
-            if (processA) {
-                a = a + c.a;
-            }
-        }
-
-        void applyGroup(const ColorControlGroup& group)
-        {
-            applySaturation(group.saturation);
-            applyContrast(group.contrast);
-            applyGamma(group.gamma);
-            applyGain(group.gain);
-            applyOffset(group.offset);
-        }
-
-    };
-}
-
-class ColorCorrecterBase : public OFX::ImageProcessor
-{
-protected:
-    const OFX::Image *_srcImg;
-    const OFX::Image *_maskImg;
-    bool _premult;
-    int _premultChannel;
-    bool   _doMasking;
-    double _mix;
-    bool _maskInvert;
-    bool _processR, _processG, _processB, _processA;
-public:
-    ColorCorrecterBase(OFX::ImageEffect &instance,const OFX::RenderArguments &/*args*/)
-    : OFX::ImageProcessor(instance)
-    , _srcImg(0)
-    , _maskImg(0)
-    , _premult(false)
-    , _premultChannel(3)
-    , _doMasking(false)
-    , _mix(1.)
-    , _maskInvert(false)
-    , _processR(false)
-    , _processG(false)
-    , _processB(false)
-    , _processA(false)
-    , _clampBlack(true)
-    , _clampWhite(true)
-    {
-        
-    }
-
-    void setSrcImg(const OFX::Image *v) {_srcImg = v;}
-
-    void setMaskImg(const OFX::Image *v, bool maskInvert) {_maskImg = v; _maskInvert = maskInvert;}
-
-    void doMasking(bool v) {_doMasking = v;}
-
-    void setColorControlValues(const ColorControlGroup& master,
-                               const ColorControlGroup& shadow,
-                               const ColorControlGroup& midtone,
-                               const ColorControlGroup& hightlights,
-                               bool clampBlack,
-                               bool clampWhite,
-                               bool premult,
-                               int premultChannel,
-                               double mix,
-                               bool processR,
-                               bool processG,
-                               bool processB,
-                               bool processA)
-    {
-        _masterValues = master;
-        _shadowValues = shadow;
-        _midtoneValues = midtone;
-        _highlightsValues = hightlights;
-        _clampBlack = clampBlack;
-        _clampWhite = clampWhite;
-        _premult = premult;
-        _premultChannel = premultChannel;
-        _mix = mix;
-        _processR = processR;
-        _processG = processG;
-        _processB = processB;
-        _processA = processA;
-    }
-
-    template<bool processR, bool processG, bool processB, bool processA>
-    void colorTransform(double *r, double *g, double *b,double *a)
-    {
-        double luminance = *r * s_rLum + *g * s_gLum + *b * s_bLum;
-        double s_scale = interpolate(0, luminance);
-        double h_scale = interpolate(1, luminance);
-        double m_scale = 1.f - s_scale - h_scale;
-
-        RGBAPixel<processR,processG,processB,processA> p(*r, *g, *b, *a);
-        p.applySMH(_shadowValues, s_scale,
-                   _midtoneValues, m_scale,
-                   _highlightsValues, h_scale,
-                   _masterValues);
-        if (processR) {
-            *r = clamp(p.r);
-        }
-        if (processG) {
-            *g = clamp(p.g);
-        }
-        if (processB) {
-            *b = clamp(p.b);
-        }
-        if (processA) {
-            *a = clamp(p.a);
-        }
-    }
-
-private:
-    double clamp(double comp)
-    {
-        if (_clampBlack && comp < 0.) {
-            comp = 0.;
-        } else  if (_clampWhite && comp > 1.0) {
-            comp = 1.0;
-        }
-        return comp;
-    }
-
-    double interpolate(int curve, double value)
-    {
-        if (value < 0.) {
-            return _lookupTable[curve][0];
-        } else if (value >= 1.) {
-            return _lookupTable[curve][LUT_MAX_PRECISION];
-        } else {
-            double i_d = std::floor(value * LUT_MAX_PRECISION);
-            int i = (int)i_d;
-            assert(i < LUT_MAX_PRECISION);
-            double alpha = value * LUT_MAX_PRECISION - i_d;
-            assert(0. <= alpha && alpha < 1.);
-            return _lookupTable[curve][i] * (1.-alpha) + _lookupTable[curve][i] * alpha;
-        }
-    }
-
-private:
-    ColorControlGroup _masterValues;
-    ColorControlGroup _shadowValues;
-    ColorControlGroup _midtoneValues;
-    ColorControlGroup _highlightsValues;
-    bool _clampBlack;
-    bool _clampWhite;
-    
-protected:
-    
-    // clamp for integer types
-    template<class PIX>
-    double clamp(double value, int maxValue)
-    {
-        return std::max(0., std::min(value, double(maxValue)));
-    }
-
-    double _lookupTable[2][LUT_MAX_PRECISION + 1];
-};
-
-
+typedef PixelKernelProcessorBase<ColorCorrectKernel> ColorCorrecterBase;
 
 template <class PIX, int nComponents, int maxValue>
-class ColorCorrecter : public ColorCorrecterBase
+class ColorCorrecter : public PixelKernelProcessor<ColorCorrectKernel, PIX, nComponents, maxValue>
 {
-    
 public:
-    ColorCorrecter(OFX::ImageEffect &instance, const OFX::RenderArguments &args, bool supportsParametricParameter)
-    : ColorCorrecterBase(instance,args)
+    ColorCorrecter(OFX::ImageEffect &instance)
+    : PixelKernelProcessor<ColorCorrectKernel, PIX, nComponents, maxValue>(instance)
     {
-        // build the LUT
-        OFX::ParametricParam  *lookupTable = 0;
-        if (supportsParametricParameter) {
-            lookupTable = instance.fetchParametricParam(kParamColorCorrectToneRanges);
-        }
-        for (int curve = 0; curve < 2; ++curve) {
-            for (int position = 0; position <= LUT_MAX_PRECISION; ++position) {
-                // position to evaluate the param at
-                double parametricPos = double(position)/LUT_MAX_PRECISION;
-
-                // evaluate the parametric param
-                double value;
-                if (lookupTable) {
-                    value = lookupTable->getValue(curve, args.time, parametricPos);
-                } else if (curve == 0) {
-                    if (parametricPos < 0.09) {
-                        value = 1. - parametricPos/0.09;
-                    } else {
-                        value = 0.;
-                    }
-                } else {
-                    assert(curve == 1);
-                    if (parametricPos <= 0.5) {
-                        value = 0.;
-                    } else {
-                        value = (parametricPos - 0.5) / 0.5;
-                    }
-                }
-                // set that in the lut
-                _lookupTable[curve][position] = (float)clamp<PIX>(value, maxValue);
-            }
-        }
-
-    }
-
-    void multiThreadProcessImages(OfxRectI procWindow)
-    {
-        const bool r = _processR && (nComponents != 1);
-        const bool g = _processG && (nComponents >= 2);
-        const bool b = _processB && (nComponents >= 3);
-        const bool a = _processA && (nComponents == 1 || nComponents == 4);
-        if (r) {
-            if (g) {
-                if (b) {
-                    if (a) {
-                        return process<true ,true ,true ,true >(procWindow); // RGBA
-                    } else {
-                        return process<true ,true ,true ,false>(procWindow); // RGBa
-                    }
-                } else {
-                    if (a) {
-                        return process<true ,true ,false,true >(procWindow); // RGbA
-                    } else {
-                        return process<true ,true ,false,false>(procWindow); // RGba
-                    }
-                }
-            } else {
-                if (b) {
-                    if (a) {
-                        return process<true ,false,true ,true >(procWindow); // RgBA
-                    } else {
-                        return process<true ,false,true ,false>(procWindow); // RgBa
-                    }
-                } else {
-                    if (a) {
-                        return process<true ,false,false,true >(procWindow); // RgbA
-                    } else {
-                        return process<true ,false,false,false>(procWindow); // Rgba
-                    }
-                }
-            }
-        } else {
-            if (g) {
-                if (b) {
-                    if (a) {
-                        return process<false,true ,true ,true >(procWindow); // rGBA
-                    } else {
-                        return process<false,true ,true ,false>(procWindow); // rGBa
-                    }
-                } else {
-                    if (a) {
-                        return process<false,true ,false,true >(procWindow); // rGbA
-                    } else {
-                        return process<false,true ,false,false>(procWindow); // rGba
-                    }
-                }
-            } else {
-                if (b) {
-                    if (a) {
-                        return process<false,false,true ,true >(procWindow); // rgBA
-                    } else {
-                        return process<false,false,true ,false>(procWindow); // rgBa
-                    }
-                } else {
-                    if (a) {
-                        return process<false,false,false,true >(procWindow); // rgbA
-                    } else {
-                        return process<false,false,false,false>(procWindow); // rgba
-                    }
-                }
-            }
-        }
-    }
-
-private:
-    
-    
-    template<bool processR, bool processG, bool processB, bool processA>
-    void process(OfxRectI procWindow)
-    {
-        assert((!processR && !processG && !processB) || (nComponents == 3 || nComponents == 4));
-        assert(!processA || (nComponents == 1 || nComponents == 4));
-        assert(nComponents == 3 || nComponents == 4);
-        float unpPix[4];
-        float tmpPix[4];
-        for (int y = procWindow.y1; y < procWindow.y2; y++) {
-            if (_effect.abort()) {
-                break;
-            }
-
-            PIX *dstPix = (PIX *) _dstImg->getPixelAddress(procWindow.x1, y);
-            for (int x = procWindow.x1; x < procWindow.x2; x++) {
-                const PIX *srcPix = (const PIX *)  (_srcImg ? _srcImg->getPixelAddress(x, y) : 0);
-                ofxsUnPremult<PIX, nComponents, maxValue>(srcPix, unpPix, _premult, _premultChannel);
-                double t_r = unpPix[0];
-                double t_g = unpPix[1];
-                double t_b = unpPix[2];
-                double t_a = unpPix[3];
-                colorTransform<processR,processG,processB,processA>(&t_r, &t_g, &t_b,&t_a);
-                tmpPix[0] = (float)t_r;
-                tmpPix[1] = (float)t_g;
-                tmpPix[2] = (float)t_b;
-                tmpPix[3] = (float)t_a;
-                ofxsPremultMaskMixPix<PIX, nComponents, maxValue, true>(tmpPix, _premult, _premultChannel, x, y, srcPix, _doMasking, _maskImg, (float)_mix, _maskInvert, dstPix);
-                dstPix += nComponents;
-            }
-        }
+        // the unprocessed channels go through premult, mask and mix like the processed ones
+        this->setCopyUnprocessed(false);
     }
 };
 
-namespace {
-    struct ColorControlParamGroup {
-        ColorControlParamGroup()
-        : saturation(0)
-        , contrast(0)
-        , gamma(0)
-        , gain(0)
-        , offset(0) {}
-
-        OFX::RGBAParam* saturation;
-        OFX::RGBAParam* contrast;
-        OFX::RGBAParam* gamma;
-        OFX::RGBAParam* gain;
-        OFX::RGBAParam* offset;
-    };
-}
-
 ////////////////////////////////////////////////////////////////////////////////
 /** @brief The plugin that does our work */
 class ColorCorrectPlugin : public OFX::ImageEffect
@@ -637,6 +173,7 @@ public:
     , _rangesParam(0)
     , _clampBlack(0)
     , _clampWhite(0)
+    , _precision(0)
     , _premult(0)
     , _premultChannel(0)
     , _mix(0)
@@ -659,6 +196,8 @@ public:
         _clampBlack = fetchBooleanParam(kParamClampBlack);
         _clampWhite = fetchBooleanParam(kParamClampWhite);
         assert(_clampBlack && _clampWhite);
+        _precision = fetchChoiceParam(kParamPrecision);
+        assert(_precision);
         _premult = fetchBooleanParam(kParamPremult);
         _premultChannel = fetchChoiceParam(kParamPremultChannel);
         assert(_premult && _premultChannel);
@@ -731,6 +270,7 @@ private:
     OFX::ParametricParam* _rangesParam;
     OFX::BooleanParam* _clampBlack;
     OFX::BooleanParam* _clampWhite;
+    OFX::ChoiceParam* _precision;
     OFX::BooleanParam* _premult;
     OFX::ChoiceParam* _premultChannel;
     OFX::DoubleParam* _mix;
@@ -832,8 +372,14 @@ ColorCorrectPlugin::setupAndProcess(ColorCorrecterBase &processor, const OFX::Re
     _processB->getValue(processB);
     _processA->getValue(processA);
 
-    processor.setColorControlValues(masterValues, shadowValues, midtoneValues, highlightValues, clampBlack, clampWhite, premult, premultChannel, mix,
-                                    processR,processG,processB,processA);
+    processor.setValues(processR, processG, processB, processA,
+                        premult, premultChannel, mix);
+    int precision;
+    _precision->getValueAtTime(args.time, precision);
+    ColorCorrectKernel kernel(masterValues, shadowValues, midtoneValues, highlightValues, clampBlack, clampWhite);
+    kernel.setLookupTable(_rangesParam, args.time);
+    kernel.setFastPow(precision == ePrecisionFast);
+    processor.setKernel(kernel);
     processor.process();
 }
 
@@ -852,17 +398,17 @@ ColorCorrectPlugin::render(const OFX::RenderArguments &args)
     if (dstComponents == OFX::ePixelComponentRGBA) {
         switch (dstBitDepth) {
             case OFX::eBitDepthUByte: {
-                ColorCorrecter<unsigned char, 4, 255> fred(*this, args, _supportsParametricParameter);
+                ColorCorrecter<unsigned char, 4, 255> fred(*this);
                 setupAndProcess(fred, args);
                 break;
             }
             case OFX::eBitDepthUShort: {
-                ColorCorrecter<unsigned short, 4, 65535> fred(*this, args, _supportsParametricParameter);
+                ColorCorrecter<unsigned short, 4, 65535> fred(*this);
                 setupAndProcess(fred, args);
                 break;
             }
             case OFX::eBitDepthFloat: {
-                ColorCorrecter<float, 4, 1> fred(*this, args, _supportsParametricParameter);
+                ColorCorrecter<float, 4, 1> fred(*this);
                 setupAndProcess(fred, args);
                 break;
             }
@@ -874,17 +420,17 @@ ColorCorrectPlugin::render(const OFX::RenderArguments &args)
         assert(dstComponents == OFX::ePixelComponentRGB);
         switch (dstBitDepth) {
             case OFX::eBitDepthUByte: {
-                ColorCorrecter<unsigned char, 3, 255> fred(*this, args, _supportsParametricParameter);
+                ColorCorrecter<unsigned char, 3, 255> fred(*this);
                 setupAndProcess(fred, args);
                 break;
             }
             case OFX::eBitDepthUShort: {
-                ColorCorrecter<unsigned short, 3, 65535> fred(*this, args, _supportsParametricParameter);
+                ColorCorrecter<unsigned short, 3, 65535> fred(*this);
                 setupAndProcess(fred, args);
                 break;
             }
             case OFX::eBitDepthFloat: {
-                ColorCorrecter<float, 3, 1> fred(*this, args, _supportsParametricParameter);
+                ColorCorrecter<float, 3, 1> fred(*this);
                 setupAndProcess(fred, args);
                 break;
             }
@@ -896,32 +442,6 @@ ColorCorrectPlugin::render(const OFX::RenderArguments &args)
     //std::cout << "render! OK\n";
 }
 
-static bool
-groupIsIdentity(const ColorControlGroup& group)
-{
-    return (group.saturation.r == 1. &&
-            group.saturation.g == 1. &&
-            group.saturation.b == 1. &&
-            group.saturation.a == 1. &&
-            group.contrast.r == 1. &&
-            group.contrast.g == 1. &&
-            group.contrast.b == 1. &&
-            group.contrast.a == 1. &&
-            group.gamma.r == 1. &&
-            group.gamma.g == 1. &&
-            group.gamma.b == 1. &&
-            group.gamma.a == 1. &&
-            group.gain.r == 1. &&
-            group.gain.g == 1. &&
-            group.gain.b == 1. &&
-            group.gain.a == 1. &&
-            group.offset.r == 0. &&
-            group.offset.g == 0. &&
-            group.offset.b == 0. &&
-            group.offset.a == 0.);
-
-}
-
 bool
 ColorCorrectPlugin::isIdentity(const IsIdentityArguments &args, Clip * &identityClip, double &/*identityTime*/)
 {
@@ -1226,6 +746,8 @@ void ColorCorrectPluginFactory::describeInContext(OFX::ImageEffectDescriptor &de
         }
     }
 
+    describePrecisionParam(desc, page);
+
     ofxsPremultDescribeParams(desc, page);
     ofxsMaskMixDescribeParams(desc, page);
     //std::cout << "describeInCotext! OK\n";
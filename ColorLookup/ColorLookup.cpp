@@ -74,6 +74,11 @@
 #include "ColorLookup.h"
 
 #include <cmath>
+#include <list>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
 
 #ifdef _WINDOWS
 #include <windows.h>
@@ -91,6 +96,7 @@ using std::isnan;
 #include "ofxsProcessing.H"
 #include "ofxsMaskMix.h"
 #include "ofxsMerging.h"
+#include "ofxsMultiThread.h"
 #include "ofxsMacros.h"
 
 #define kPluginName "ColorLookupOFX"
@@ -167,6 +173,11 @@ using std::isnan;
 #define kCurveAlpha 4
 #define kCurveNb 5
 
+// number of values in the LUT minus 1, for float images
+#define kColorLookupFloatLUTValues 4095
+// maximum number of lookup tables kept by each instance (e.g. for animated curves)
+#define kColorLookupTableCacheSize 4
+
 using namespace OFX;
 
 class ColorLookupProcessorBase : public OFX::ImageProcessor {
@@ -259,6 +270,220 @@ componentToCurve(int comp)
 
 
 
+// What a lookup table depends on: the range, the number of values, and the curves.
+// A curve is fully determined by its control points, so that an animated curve only
+// needs a new table when its control points are different from an already built one.
+struct ColorLookupTableKey
+{
+    double rangeMin;
+    double rangeMax;
+    int nbValues;
+    std::vector<std::pair<double, double> > controlPoints[kCurveNb];
+
+    bool operator==(const ColorLookupTableKey &other) const
+    {
+        if (rangeMin != other.rangeMin || rangeMax != other.rangeMax || nbValues != other.nbValues) {
+            return false;
+        }
+        for (int curve = 0; curve < kCurveNb; ++curve) {
+            if (controlPoints[curve] != other.controlPoints[curve]) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+// Unclamped lookup tables for the red, green, blue (combined with the master curve) and alpha curves,
+// sampled at nbValues+1 regular positions in [rangeMin,rangeMax].
+class ColorLookupTable
+{
+public:
+    explicit ColorLookupTable(const ColorLookupTableKey &key)
+    : _key(key)
+    {
+    }
+
+    const ColorLookupTableKey& key() const { return _key; }
+
+    /// the table for a curve (kCurveRed...kCurveAlpha)
+    const float* getLUT(int curve) const
+    {
+        assert(kCurveRed <= curve && curve <= kCurveAlpha);
+        return &_lut[curve - kCurveRed][0];
+    }
+
+    void build(OFX::ParametricParam *lookupTableParam, double time)
+    {
+        const int nbValues = _key.nbValues;
+        for (int curve = kCurveRed; curve <= kCurveAlpha; ++curve) {
+            _lut[curve - kCurveRed].resize(nbValues + 1);
+        }
+        for (int position = 0; position <= nbValues; ++position) {
+            // position to evaluate the param at
+            double parametricPos = _key.rangeMin + (_key.rangeMax - _key.rangeMin) * double(position)/nbValues;
+            // the master curve is evaluated once for the red, green and blue curves
+            double master = lookupTableParam->getValue(kCurveMaster, time, parametricPos) - parametricPos;
+            for (int curve = kCurveRed; curve <= kCurveAlpha; ++curve) {
+                double value = lookupTableParam->getValue(curve, time, parametricPos);
+                if (curve != kCurveAlpha) {
+                    value += master;
+                }
+                _lut[curve - kCurveRed][position] = (float)value;
+            }
+        }
+    }
+
+private:
+    ColorLookupTableKey _key;
+    std::vector<float> _lut[kCurveAlpha - kCurveRed + 1];
+};
+
+// The lookup tables of a plugin instance, shared by all renders.
+// Tables are built once and invalidated when the curves are edited.
+class ColorLookupTableCache
+{
+public:
+    /// RAII access to a table of the cache: the table is not freed while a Handle holds it
+    class Handle
+    {
+    public:
+        Handle(ColorLookupTableCache &cache, const ColorLookupTableKey &key, OFX::ParametricParam *lookupTableParam, double time)
+        : _cache(cache)
+        , _table(0)
+        {
+            _table = _cache.acquire(key, lookupTableParam, time);
+        }
+
+        ~Handle()
+        {
+            _cache.release(_table);
+        }
+
+        /// the table, or NULL if it could not be allocated
+        const ColorLookupTable* get() const { return _table; }
+
+    private:
+        Handle(const Handle&); // not implemented
+        Handle& operator=(const Handle&); // not implemented
+
+        ColorLookupTableCache &_cache;
+        ColorLookupTable *_table;
+    };
+
+    ColorLookupTableCache()
+    : _entries()
+    , _generation(0)
+    , _mutex()
+    {
+    }
+
+    ~ColorLookupTableCache()
+    {
+        for (std::list<Entry>::iterator it = _entries.begin(); it != _entries.end(); ++it) {
+            assert(it->useCount == 0);
+            delete it->table;
+        }
+    }
+
+    /// the curves changed: tables that are currently used are freed when released, the others are freed now
+    void invalidate()
+    {
+        OFX::MultiThread::AutoMutex lock(_mutex);
+        ++_generation;
+        trimUnlocked(kColorLookupTableCacheSize);
+    }
+
+    /// free all tables that are not currently used (e.g. when the host calls purgeCaches)
+    void purge()
+    {
+        OFX::MultiThread::AutoMutex lock(_mutex);
+        trimUnlocked(0);
+    }
+
+private:
+    struct Entry
+    {
+        ColorLookupTable *table;
+        int generation;
+        int useCount;
+    };
+
+    ColorLookupTableCache(const ColorLookupTableCache&); // not implemented
+    ColorLookupTableCache& operator=(const ColorLookupTableCache&); // not implemented
+
+    ColorLookupTable* acquire(const ColorLookupTableKey &key, OFX::ParametricParam *lookupTableParam, double time)
+    {
+        OFX::MultiThread::AutoMutex lock(_mutex);
+        for (std::list<Entry>::iterator it = _entries.begin(); it != _entries.end(); ++it) {
+            if (it->generation == _generation && it->table->key() == key) {
+                _entries.splice(_entries.begin(), _entries, it);
+                ++_entries.front().useCount;
+                return _entries.front().table;
+            }
+        }
+        // the table is built while holding the lock, so that concurrent renders do not build the same table
+        std::auto_ptr<ColorLookupTable> table;
+        try {
+            table.reset(new ColorLookupTable(key));
+            table->build(lookupTableParam, time);
+        } catch (const std::bad_alloc&) {
+            return 0;
+        }
+        Entry e;
+        e.table = table.release();
+        e.generation = _generation;
+        e.useCount = 1;
+        _entries.push_front(e);
+        trimUnlocked(kColorLookupTableCacheSize);
+
+        return e.table;
+    }
+
+    void release(ColorLookupTable *table)
+    {
+        if (!table) {
+            return;
+        }
+        OFX::MultiThread::AutoMutex lock(_mutex);
+        for (std::list<Entry>::iterator it = _entries.begin(); it != _entries.end(); ++it) {
+            if (it->table == table) {
+                assert(it->useCount > 0);
+                --it->useCount;
+                break;
+            }
+        }
+        trimUnlocked(kColorLookupTableCacheSize);
+    }
+
+    // free the tables that are not in use and were invalidated, then the least recently used ones,
+    // until at most maxEntries remain (must be called with _mutex locked)
+    void trimUnlocked(size_t maxEntries)
+    {
+        for (std::list<Entry>::iterator it = _entries.begin(); it != _entries.end();) {
+            if (it->useCount == 0 && it->generation != _generation) {
+                delete it->table;
+                it = _entries.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        std::list<Entry>::iterator it = _entries.end();
+        while (_entries.size() > maxEntries && it != _entries.begin()) {
+            --it;
+            if (it->useCount == 0) {
+                delete it->table;
+                it = _entries.erase(it);
+            }
+        }
+    }
+
+    std::list<Entry> _entries; // most recently used first
+    int _generation;
+    OFX::MultiThread::Mutex _mutex;
+};
+
+
 // template to do the processing.
 // nbValues is the number of values in the LUT minus 1. For integer types, it should be the same as
 // maxValue
@@ -267,37 +492,22 @@ class ColorLookupProcessor : public ColorLookupProcessorBase
 {
 public:
     // ctor
-    ColorLookupProcessor(OFX::ImageEffect &instance, const OFX::RenderArguments &args, OFX::ParametricParam  *lookupTableParam, double rangeMin, double rangeMax, bool clampBlack, bool clampWhite)
+    ColorLookupProcessor(OFX::ImageEffect &instance, const OFX::RenderArguments &args, OFX::ParametricParam  *lookupTableParam, const ColorLookupTable &lookupTable, bool clampBlack, bool clampWhite)
     : ColorLookupProcessorBase(instance, clampBlack, clampWhite)
     , _lookupTableParam(lookupTableParam)
-    , _rangeMin(std::min(rangeMin,rangeMax))
-    , _rangeMax(std::max(rangeMin,rangeMax))
+    , _time(args.time)
+    , _rangeMin(lookupTable.key().rangeMin)
+    , _rangeMax(lookupTable.key().rangeMax)
     {
-        // build the LUT
         assert(_lookupTableParam);
-        _time = args.time;
-        if (_rangeMin == _rangeMax) {
-            // avoid divisions by zero
-            _rangeMax = _rangeMin + 1.;
-        }
+        assert(_rangeMin < _rangeMax);
+        assert(lookupTable.key().nbValues == nbValues);
         assert((PIX)maxValue == maxValue);
         // except for float, maxValue is the same as nbValues
         assert(maxValue == 1 || (maxValue == nbValues));
         for (int component = 0; component < nComponents; ++component) {
-            _lookupTable[component].resize(nbValues+1);
             int lutIndex = nComponents == 1 ? kCurveAlpha : componentToCurve(component); // special case for components == alpha only
-            for (int position = 0; position <= nbValues; ++position) {
-                // position to evaluate the param at
-                double parametricPos = _rangeMin + (_rangeMax - _rangeMin) * double(position)/nbValues;
-
-                // evaluate the parametric param
-                double value = _lookupTableParam->getValue(lutIndex, _time, parametricPos);
-                if (nComponents != 1 && lutIndex != kCurveAlpha) {
-                    value += _lookupTableParam->getValue(kCurveMaster, _time, parametricPos) - parametricPos;
-                }
-                // set that in the lut
-                _lookupTable[component][position] = (float)clamp<PIX>(value, maxValue);
-            }
+            _lookupTable[component] = lookupTable.getLUT(lutIndex);
         }
     }
 
@@ -355,20 +565,22 @@ private:
             if (nComponents != 1 && lutIndex != kCurveAlpha) {
                 ret += _lookupTableParam->getValue(kCurveMaster, _time, value) - value;
             }
-            return (float)clamp<PIX>(ret, maxValue);;
+            return (float)clamp<PIX>(ret, maxValue);
         } else {
             float x = (float)(value - _rangeMin) / (float)(_rangeMax - _rangeMin);
-            int i = (int)(x * nbValues);
+            int i = std::min((int)(x * nbValues), nbValues);
             assert(0 <= i && i <= nbValues);
             float alpha = std::max(0.f,std::min(x * nbValues - i, 1.f));
             float a = _lookupTable[component][i];
             float b = (i  < nbValues) ? _lookupTable[component][i+1] : 0.f;
-            return a * (1.f - alpha) + b * alpha;
+            // the table is not clamped, so that it can be shared by all renders:
+            // clamp the result to [0,maxValue], as the slow version does
+            return (float)clamp<PIX>((double)(a * (1.f - alpha) + b * alpha), maxValue);
         }
     }
 
 private:
-    std::vector<float> _lookupTable[nComponents];
+    const float *_lookupTable[nComponents];
     OFX::ParametricParam*  _lookupTableParam;
     double _time;
     double _rangeMin;
@@ -387,6 +599,7 @@ public:
     , _dstClip(0)
     , _srcClip(0)
     , _maskClip(0)
+    , _lookupTableCache()
     {
         _dstClip = fetchClip(kOfxImageEffectOutputClipName);
         assert(_dstClip && (_dstClip->getPixelComponents() == ePixelComponentAlpha || _dstClip->getPixelComponents() == ePixelComponentRGB || _dstClip->getPixelComponents() == ePixelComponentRGBA));
@@ -420,13 +633,26 @@ private:
     /** @brief called when a clip has just been changed in some way (a rewire maybe) */
     virtual void changedClip(const InstanceChangedArgs &args, const std::string &clipName) OVERRIDE FINAL;
 
+    /** @brief free the lookup tables that are not used by a render */
+    virtual void purgeCaches(void) OVERRIDE FINAL
+    {
+        _lookupTableCache.purge();
+    }
+
     template <int nComponents>
     void renderForComponents(const OFX::RenderArguments &args, OFX::BitDepthEnum dstBitDepth);
 
+    template <class PIX, int nComponents, int maxValue, int nbValues>
+    void renderForBitDepth(const OFX::RenderArguments &args, double rangeMin, double rangeMax, bool clampBlack, bool clampWhite);
+
     void setupAndProcess(ColorLookupProcessorBase &, const OFX::RenderArguments &args);
     
     virtual void changedParam(const OFX::InstanceChangedArgs &args, const std::string &paramName) OVERRIDE FINAL
     {
+        if (paramName == kParamLookupTable) {
+            // the curves may have changed in a way that the control points do not show (e.g. interpolation)
+            _lookupTableCache.invalidate();
+        }
         if (paramName == kParamSetMaster && args.reason == eChangeUserEdit) {
             double source[4];
             double target[4];
@@ -557,6 +783,7 @@ private:
     OFX::ChoiceParam* _premultChannel;
     OFX::DoubleParam* _mix;
     OFX::BooleanParam* _maskInvert;
+    ColorLookupTableCache _lookupTableCache;
 };
 
 
@@ -639,6 +866,33 @@ ColorLookupPlugin::setupAndProcess(ColorLookupProcessorBase &processor,
     processor.process();
 }
 
+template <class PIX, int nComponents, int maxValue, int nbValues>
+void
+ColorLookupPlugin::renderForBitDepth(const OFX::RenderArguments &args, double rangeMin, double rangeMax, bool clampBlack, bool clampWhite)
+{
+    ColorLookupTableKey key;
+    key.rangeMin = std::min(rangeMin, rangeMax);
+    key.rangeMax = std::max(rangeMin, rangeMax);
+    if (key.rangeMin == key.rangeMax) {
+        // avoid divisions by zero
+        key.rangeMax = key.rangeMin + 1.;
+    }
+    key.nbValues = nbValues;
+    for (int curve = 0; curve < kCurveNb; ++curve) {
+        int n = _lookupTable->getNControlPoints(curve, args.time);
+        key.controlPoints[curve].reserve(n);
+        for (int i = 0; i < n; ++i) {
+            key.controlPoints[curve].push_back(_lookupTable->getNthControlPoint(curve, args.time, i));
+        }
+    }
+    ColorLookupTableCache::Handle lookupTable(_lookupTableCache, key, _lookupTable, args.time);
+    if (!lookupTable.get()) {
+        OFX::throwSuiteStatusException(kOfxStatErrMemory);
+    }
+    ColorLookupProcessor<PIX, nComponents, maxValue, nbValues> fred(*this, args, _lookupTable, *lookupTable.get(), clampBlack, clampWhite);
+    setupAndProcess(fred, args);
+}
+
 // the internal render function
 template <int nComponents>
 void
@@ -651,16 +905,13 @@ ColorLookupPlugin::renderForComponents(const OFX::RenderArguments &args, OFX::Bi
     _clampWhite->getValueAtTime(args.time, clampWhite);
     switch(dstBitDepth) {
         case OFX::eBitDepthUByte: {
-            ColorLookupProcessor<unsigned char, nComponents, 255, 255> fred(*this, args, _lookupTable, rangeMin, rangeMax, clampBlack, clampWhite);
-            setupAndProcess(fred, args);
+            renderForBitDepth<unsigned char, nComponents, 255, 255>(args, rangeMin, rangeMax, clampBlack, clampWhite);
         }   break;
         case OFX::eBitDepthUShort: {
-            ColorLookupProcessor<unsigned short, nComponents, 65535, 65535> fred(*this, args, _lookupTable, rangeMin, rangeMax, clampBlack, clampWhite);
-            setupAndProcess(fred, args);
+            renderForBitDepth<unsigned short, nComponents, 65535, 65535>(args, rangeMin, rangeMax, clampBlack, clampWhite);
         }   break;
         case OFX::eBitDepthFloat: {
-            ColorLookupProcessor<float, nComponents, 1, 1023> fred(*this, args, _lookupTable, rangeMin, rangeMax, clampBlack, clampWhite);
-            setupAndProcess(fred, args);
+            renderForBitDepth<float, nComponents, 1, kColorLookupFloatLUTValues>(args, rangeMin, rangeMax, clampBlack, clampWhite);
         }   break;
         default :
             OFX::throwSuiteStatusException(kOfxStatErrUnsupported);
@@ -82,6 +82,7 @@
 #include "ofxsMaskMix.h"
 #include "ofxsMerging.h"
 #include "ofxsMacros.h"
+#include "ColorKernels.h"
 
 #define kPluginName "ColorMatrixOFX"
 #define kPluginGrouping "Color/Math"
@@ -128,234 +129,16 @@
 using namespace OFX;
 
 
-namespace {
-    struct RGBAValues {
-        double r,g,b,a;
-        RGBAValues(double v) : r(v), g(v), b(v), a(v) {}
-        RGBAValues() : r(0), g(0), b(0), a(0) {}
-    };
-}
-
-class ColorMatrixProcessorBase : public OFX::ImageProcessor
-{
-protected:
-    const OFX::Image *_srcImg;
-    const OFX::Image *_maskImg;
-    bool _processR;
-    bool _processG;
-    bool _processB;
-    bool _processA;
-    RGBAValues _matrix[4];
-    bool _clampBlack;
-    bool _clampWhite;
-    bool _premult;
-    int _premultChannel;
-    bool   _doMasking;
-    double _mix;
-    bool _maskInvert;
-
-public:
-    
-    ColorMatrixProcessorBase(OFX::ImageEffect &instance)
-    : OFX::ImageProcessor(instance)
-    , _srcImg(0)
-    , _maskImg(0)
-    , _processR(true)
-    , _processG(true)
-    , _processB(true)
-    , _processA(false)
-    , _clampBlack(true)
-    , _clampWhite(true)
-    , _premult(false)
-    , _premultChannel(3)
-    , _doMasking(false)
-    , _mix(1.)
-    , _maskInvert(false)
-    {
-    }
-    
-    void setSrcImg(const OFX::Image *v) {_srcImg = v;}
-    
-    void setMaskImg(const OFX::Image *v, bool maskInvert) { _maskImg = v; _maskInvert = maskInvert; }
-    
-    void doMasking(bool v) {_doMasking = v;}
-    
-    void setValues(bool processR,
-                   bool processG,
-                   bool processB,
-                   bool processA,
-                   const RGBAValues& outputRed,
-                   const RGBAValues& outputGreen,
-                   const RGBAValues& outputBlue,
-                   const RGBAValues& outputAlpha,
-                   bool clampBlack,
-                   bool clampWhite,
-                   bool premult,
-                   int premultChannel,
-                   double mix)
-    {
-        _processR = processR;
-        _processG = processG;
-        _processB = processB;
-        _processA = processA;
-        _matrix[0] = outputRed;
-        _matrix[1] = outputGreen;
-        _matrix[2] = outputBlue;
-        _matrix[3] = outputAlpha;
-        _clampBlack = clampBlack;
-        _clampWhite = clampWhite;
-        _premult = premult;
-        _premultChannel = premultChannel;
-        _mix = mix;
-    }
-
-private:
-};
-
-
+typedef PixelKernelProcessorBase<ColorMatrixKernel> ColorMatrixProcessorBase;
 
 template <class PIX, int nComponents, int maxValue>
-class ColorMatrixProcessor : public ColorMatrixProcessorBase
+class ColorMatrixProcessor : public PixelKernelProcessor<ColorMatrixKernel, PIX, nComponents, maxValue>
 {
 public:
     ColorMatrixProcessor(OFX::ImageEffect &instance)
-    : ColorMatrixProcessorBase(instance)
+    : PixelKernelProcessor<ColorMatrixKernel, PIX, nComponents, maxValue>(instance)
     {
     }
-    
-private:
-
-    double apply(int c, double inR, double inG, double inB, double inA) {
-        double comp = _matrix[c].r * inR + _matrix[c].g * inG + _matrix[c].b * inB + _matrix[c].a * inA;
-        if (_clampBlack && comp < 0.) {
-            comp = 0.;
-        } else  if (_clampWhite && comp > maxValue) {
-            comp = maxValue;
-        }
-        return comp;
-    }
-
-    void multiThreadProcessImages(OfxRectI procWindow)
-    {
-        const bool r = _processR && (nComponents != 1);
-        const bool g = _processG && (nComponents >= 2);
-        const bool b = _processB && (nComponents >= 3);
-        const bool a = _processA && (nComponents == 1 || nComponents == 4);
-        if (r) {
-            if (g) {
-                if (b) {
-                    if (a) {
-                        return process<true ,true ,true ,true >(procWindow); // RGBA
-                    } else {
-                        return process<true ,true ,true ,false>(procWindow); // RGBa
-                    }
-                } else {
-                    if (a) {
-                        return process<true ,true ,false,true >(procWindow); // RGbA
-                    } else {
-                        return process<true ,true ,false,false>(procWindow); // RGba
-                    }
-                }
-            } else {
-                if (b) {
-                    if (a) {
-                        return process<true ,false,true ,true >(procWindow); // RgBA
-                    } else {
-                        return process<true ,false,true ,false>(procWindow); // RgBa
-                    }
-                } else {
-                    if (a) {
-                        return process<true ,false,false,true >(procWindow); // RgbA
-                    } else {
-                        return process<true ,false,false,false>(procWindow); // Rgba
-                    }
-                }
-            }
-        } else {
-            if (g) {
-                if (b) {
-                    if (a) {
-                        return process<false,true ,true ,true >(procWindow); // rGBA
-                    } else {
-                        return process<false,true ,true ,false>(procWindow); // rGBa
-                    }
-                } else {
-                    if (a) {
-                        return process<false,true ,false,true >(procWindow); // rGbA
-                    } else {
-                        return process<false,true ,false,false>(procWindow); // rGba
-                    }
-                }
-            } else {
-                if (b) {
-                    if (a) {
-                        return process<false,false,true ,true >(procWindow); // rgBA
-                    } else {
-                        return process<false,false,true ,false>(procWindow); // rgBa
-                    }
-                } else {
-                    if (a) {
-                        return process<false,false,false,true >(procWindow); // rgbA
-                    } else {
-                        return process<false,false,false,false>(procWindow); // rgba
-                    }
-                }
-            }
-        }
-    }
-
-    template<bool processR, bool processG, bool processB, bool processA>
-    void process(const OfxRectI& procWindow)
-    {
-        assert(nComponents == 1 || nComponents == 3 || nComponents == 4);
-        assert(_dstImg);
-        float unpPix[4];
-        float tmpPix[4];
-        for (int y = procWindow.y1; y < procWindow.y2; y++) {
-            if (_effect.abort()) {
-                break;
-            }
-
-            PIX *dstPix = (PIX *) _dstImg->getPixelAddress(procWindow.x1, y);
-
-            for (int x = procWindow.x1; x < procWindow.x2; x++) {
-                const PIX *srcPix = (const PIX *)  (_srcImg ? _srcImg->getPixelAddress(x, y) : 0);
-                ofxsUnPremult<PIX, nComponents, maxValue>(srcPix, unpPix, _premult, _premultChannel);
-                for (int c = 0; c < 4; ++c) { // tmpPix has 4 components
-                    if ((processR && c == 0) ||
-                        (processG && c == 1) ||
-                        (processB && c == 2) ||
-                        (processA && c == 3)) {
-                        tmpPix[c] = (float)apply(c, unpPix[0], unpPix[1], unpPix[2], unpPix[3]);
-                    } else {
-                        tmpPix[c] = unpPix[c];
-                    }
-                }
-                ofxsPremultMaskMixPix<PIX, nComponents, maxValue, true>(tmpPix, _premult, _premultChannel, x, y, srcPix, _doMasking, _maskImg, (float)_mix, _maskInvert, dstPix);
-                // copy back original values from unprocessed channels
-                if (nComponents == 1) {
-                    if (!processA) {
-                        dstPix[0] = srcPix ? srcPix[0] : PIX();
-                    }
-                } else if (nComponents == 3 || nComponents == 4) {
-                    if (!processR) {
-                        dstPix[0] = srcPix ? srcPix[0] : PIX();
-                    }
-                    if (!processG) {
-                        dstPix[1] = srcPix ? srcPix[1] : PIX();
-                    }
-                    if (!processB) {
-                        dstPix[2] = srcPix ? srcPix[2] : PIX();
-                    }
-                    if (!processA && nComponents == 4) {
-                        dstPix[3] = srcPix ? srcPix[3] : PIX();
-                    }
-                }
-                // increment the dst pixel
-                dstPix += nComponents;
-            }
-        }
-    }
 };
 
 
@@ -520,7 +303,8 @@ ColorMatrixPlugin::setupAndProcess(ColorMatrixProcessorBase &processor, const OF
     double mix;
     _mix->getValueAtTime(args.time, mix);
     processor.setValues(processR, processG, processB, processA,
-                        r, g, b, a, clampBlack, clampWhite, premult, premultChannel, mix);
+                        premult, premultChannel, mix);
+    processor.setKernel(ColorMatrixKernel(r, g, b, a, clampBlack, clampWhite));
  
     // Call the base class process member, this will call the derived templated process code
     processor.process();
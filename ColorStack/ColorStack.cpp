@@ -0,0 +1,1398 @@
+/*
+ OFX ColorStack plugin.
+ 
+ Copyright (C) 2014 INRIA
+ 
+ Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+ 
+ Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+ 
+ Redistributions in binary form must reproduce the above copyright notice, this
+ list of conditions and the following disclaimer in the documentation and/or
+ other materials provided with the distribution.
+ 
+ Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ INRIA
+ Domaine de Voluceau
+ Rocquencourt - B.P. 105
+ 78153 Le Chesnay Cedex - France
+ 
+ */
+
+#include "ColorStack.h"
+
+#include <cmath>
+#include <sstream>
+#ifdef _WINDOWS
+#include <windows.h>
+#endif
+
+#include "ofxsProcessing.H"
+#include "ofxsMaskMix.h"
+#include "ofxsMerging.h"
+#include "ofxsMacros.h"
+#include "ColorKernels.h"
+#include "ofxNatron.h"
+
+#define kPluginName "ColorStackOFX"
+#define kPluginGrouping "Color"
+#define kPluginDescription "Apply a stack of color operations (Grade, ColorCorrect, Saturation, ColorMatrix, Gamma, Clamp), in any order, in a single pass over the image. " \
+                          "The image is unpremultiplied once before the first operation and premultiplied once after the last one. " \
+                          "Consecutive linear operations are combined into a single color matrix and offset.\n" \
+                          "Each operation works as the corresponding plugin, but without its Clamp Black and Clamp White parameters: use the Clamp operation instead."
+#define kPluginIdentifier "net.sf.openfx.ColorStackPlugin"
+// History:
+// version 1.0: initial version
+#define kPluginVersionMajor 1 // Incrementing this number means that you have broken backwards compatibility of the plug-in.
+#define kPluginVersionMinor 0 // Increment this when you have fixed a bug or made it faster.
+
+#define kSupportsTiles 1
+#define kSupportsMultiResolution 1
+#define kSupportsRenderScale 1
+#define kSupportsMultipleClipPARs false
+#define kSupportsMultipleClipDepths false
+#define kRenderThreadSafety eRenderFullySafe
+
+#define kColorStackOperationCount 6
+
+#define kParamOperation "operation"
+#define kParamOperationLabel "Operation "
+#define kParamOperationHint "Color operation applied at this position of the stack. The operations are applied from first to last."
+#define kParamOperationOptionNone "None"
+#define kParamOperationOptionNoneHint "No operation."
+#define kParamOperationOptionGrade "Grade"
+#define kParamOperationOptionGradeHint "Apply the parameters of the Grade group."
+#define kParamOperationOptionColorCorrect "ColorCorrect"
+#define kParamOperationOptionColorCorrectHint "Apply the parameters of the ColorCorrect group."
+#define kParamOperationOptionSaturation "Saturation"
+#define kParamOperationOptionSaturationHint "Apply the parameters of the Saturation group."
+#define kParamOperationOptionColorMatrix "ColorMatrix"
+#define kParamOperationOptionColorMatrixHint "Apply the parameters of the ColorMatrix group."
+#define kParamOperationOptionGamma "Gamma"
+#define kParamOperationOptionGammaHint "Apply the parameters of the Gamma group."
+#define kParamOperationOptionClamp "Clamp"
+#define kParamOperationOptionClampHint "Apply the parameters of the Clamp group."
+
+#define kGroupGrade "gradeGroup"
+#define kGroupGradeLabel "Grade"
+
+#define kParamGradeBlackPoint "gradeBlackPoint"
+#define kParamGradeBlackPointLabel "Black Point"
+#define kParamGradeBlackPointHint "Set the color of the darkest pixels in the image"
+
+#define kParamGradeWhitePoint "gradeWhitePoint"
+#define kParamGradeWhitePointLabel "White Point"
+#define kParamGradeWhitePointHint "Set the color of the brightest pixels in the image"
+
+#define kParamGradeBlack "gradeBlack"
+#define kParamGradeBlackLabel "Black"
+#define kParamGradeBlackHint "Colors corresponding to the blackpoint are set to this value"
+
+#define kParamGradeWhite "gradeWhite"
+#define kParamGradeWhiteLabel "White"
+#define kParamGradeWhiteHint "Colors corresponding to the whitepoint are set to this value"
+
+#define kParamGradeMultiply "gradeMultiply"
+#define kParamGradeMultiplyLabel "Multiply"
+#define kParamGradeMultiplyHint "Multiplies the result by this value"
+
+#define kParamGradeOffset "gradeOffset"
+#define kParamGradeOffsetLabel "Offset"
+#define kParamGradeOffsetHint "Adds this value to the result (this applies to black and white)"
+
+#define kParamGradeGamma "gradeGamma"
+#define kParamGradeGammaLabel "Gamma"
+#define kParamGradeGammaHint "Final gamma correction"
+
+#define kGroupColorCorrect "colorCorrectGroup"
+#define kGroupColorCorrectLabel "ColorCorrect"
+
+////std strings because the ColorCorrect parameter names are built from them
+static const std::string kGroupMaster = std::string("Master");
+static const std::string kGroupShadows = std::string("Shadows");
+static const std::string kGroupMidtones = std::string("Midtones");
+static const std::string kGroupHighlights = std::string("Highlights");
+
+static const std::string kParamSaturation = std::string("Saturation");
+static const std::string kParamContrast = std::string("Contrast");
+static const std::string kParamGamma = std::string("Gamma");
+static const std::string kParamGain = std::string("Gain");
+static const std::string kParamOffset = std::string("Offset");
+
+#define kParamColorCorrectToneRanges "toneRanges"
+#define kParamColorCorrectToneRangesLabel "Tone Ranges"
+#define kParamColorCorrectToneRangesHint "Tone ranges lookup table of the ColorCorrect operation"
+#define kParamColorCorrectToneRangesDim0 "Shadow"
+#define kParamColorCorrectToneRangesDim1 "Highlight"
+
+#define kGroupSaturation "saturationGroup"
+#define kGroupSaturationLabel "Saturation"
+
+#define kParamSaturationValue "saturation"
+#define kParamSaturationValueLabel "Saturation"
+#define kParamSaturationValueHint "Color saturation factor to apply. 0 produces grayscale."
+
+#define kParamLuminanceMath "luminanceMath"
+#define kParamLuminanceMathLabel "Luminance Math"
+#define kParamLuminanceMathHint "Formula used to compute luminance from RGB values."
+#define kParamLuminanceMathOptionRec709 "Rec. 709"
+#define kParamLuminanceMathOptionRec709Hint "Use Rec. 709 (0.2126r + 0.7152g + 0.0722b)."
+#define kParamLuminanceMathOptionCcir601 "CCIR 601"
+#define kParamLuminanceMathOptionCcir601Hint "Use CCIR 601 (0.299r + 0.587g + 0.114b)."
+#define kParamLuminanceMathOptionAverage "Average"
+#define kParamLuminanceMathOptionAverageHint "Use average of r, g, b."
+#define kParamLuminanceMathOptionMaximum "Max"
+#define kParamLuminanceMathOptionMaximumHint "Use max or r, g, b."
+
+#define kGroupColorMatrix "colorMatrixGroup"
+#define kGroupColorMatrixLabel "ColorMatrix"
+
+#define kParamOutputRedName  "outputRed"
+#define kParamOutputRedLabel "Output Red"
+#define kParamOutputRedHint  "values for red output component."
+
+#define kParamOutputGreenName  "outputGreen"
+#define kParamOutputGreenLabel "Output Green"
+#define kParamOutputGreenHint  "values for green output component."
+
+#define kParamOutputBlueName  "outputBlue"
+#define kParamOutputBlueLabel "Output Blue"
+#define kParamOutputBlueHint  "values for blue output component."
+
+#define kParamOutputAlphaName  "outputAlpha"
+#define kParamOutputAlphaLabel "Output Alpha"
+#define kParamOutputAlphaHint  "values for alpha output component."
+
+#define kGroupGamma "gammaGroup"
+#define kGroupGammaLabel "Gamma"
+
+#define kParamGammaValue "gammaValue"
+#define kParamGammaValueLabel "Value"
+#define kParamGammaValueHint "Gamma value to apply to the selected channels."
+
+#define kGroupClamp "clampGroup"
+#define kGroupClampLabel "Clamp"
+
+#define kParamClampMinimum "clampMinimum"
+#define kParamClampMinimumLabel "Minimum"
+#define kParamClampMinimumHint "If enabled, all values that are lower than this number are set to this value."
+
+#define kParamClampMinimumEnable "clampMinimumEnable"
+#define kParamClampMinimumEnableLabel "Enable Minimum"
+#define kParamClampMinimumEnableHint "Whether to clamp selected channels to a minimum value."
+
+#define kParamClampMaximum "clampMaximum"
+#define kParamClampMaximumLabel "Maximum"
+#define kParamClampMaximumHint "If enabled, all values that are higher than this number are set to this value."
+
+#define kParamClampMaximumEnable "clampMaximumEnable"
+#define kParamClampMaximumEnableLabel "Enable Maximum"
+#define kParamClampMaximumEnableHint "Whether to clamp selected channels to a maximum value."
+
+using namespace OFX;
+
+enum ColorStackOperationEnum {
+    eColorStackOperationNone = 0,
+    eColorStackOperationGrade,
+    eColorStackOperationColorCorrect,
+    eColorStackOperationSaturation,
+    eColorStackOperationColorMatrix,
+    eColorStackOperationGamma,
+    eColorStackOperationClamp,
+};
+
+// clamp the selected channels
+struct ClampKernel
+{
+    ClampKernel()
+    : _minimum(0.)
+    , _maximum(1.)
+    , _minimumEnable(false)
+    , _maximumEnable(false)
+    {
+    }
+
+    ClampKernel(const RGBAValues& minimum,
+                bool minimumEnable,
+                const RGBAValues& maximum,
+                bool maximumEnable)
+    : _minimum(minimum)
+    , _maximum(maximum)
+    , _minimumEnable(minimumEnable)
+    , _maximumEnable(maximumEnable)
+    {
+    }
+
+    template<bool processR, bool processG, bool processB, bool processA>
+    void apply(double *r, double *g, double *b, double *a) const
+    {
+        if (_minimumEnable) {
+            if (processR) {
+                *r = std::max(_minimum.r, *r);
+            }
+            if (processG) {
+                *g = std::max(_minimum.g, *g);
+            }
+            if (processB) {
+                *b = std::max(_minimum.b, *b);
+            }
+            if (processA) {
+                *a = std::max(_minimum.a, *a);
+            }
+        }
+        if (_maximumEnable) {
+            if (processR) {
+                *r = std::min(_maximum.r, *r);
+            }
+            if (processG) {
+                *g = std::min(_maximum.g, *g);
+            }
+            if (processB) {
+                *b = std::min(_maximum.b, *b);
+            }
+            if (processA) {
+                *a = std::min(_maximum.a, *a);
+            }
+        }
+    }
+
+private:
+    RGBAValues _minimum;
+    RGBAValues _maximum;
+    bool _minimumEnable;
+    bool _maximumEnable;
+};
+
+// A stage of the compiled stack: either a single operation, or consecutive affine
+// operations collapsed into out = matrix * in + offset.
+struct ColorStackStage
+{
+    ColorStackOperationEnum operation; // eColorStackOperationNone for an affine stage
+    double matrix[4][4];
+    double offset[4];
+};
+
+// apply the stack of operations, on double precision values
+class ColorStackKernel : public PixelKernel<ColorStackKernel>
+{
+public:
+    ColorStackKernel()
+    : _nStages(0)
+    {
+        _processed[0] = _processed[1] = _processed[2] = _processed[3] = true;
+    }
+
+    /// The channels are the ones the processor really processes (e.g. no alpha for RGB images).
+    ColorStackKernel(bool processR, bool processG, bool processB, bool processA)
+    : _nStages(0)
+    {
+        _processed[0] = processR;
+        _processed[1] = processG;
+        _processed[2] = processB;
+        _processed[3] = processA;
+    }
+
+    void setGrade(const GradeKernel& grade) { _grade = grade; }
+    void setColorCorrect(const ColorCorrectKernel& colorCorrect) { _colorCorrect = colorCorrect; }
+    void setSaturation(const SaturationKernel& saturation) { _saturation = saturation; }
+    void setColorMatrix(const ColorMatrixKernel& colorMatrix) { _colorMatrix = colorMatrix; }
+    void setGamma(const GammaKernel& gamma) { _gamma = gamma; }
+    void setClamp(const ClampKernel& clamp) { _clamp = clamp; }
+
+    /// Append an operation at the end of the stack. The kernel of the operation must be set before.
+    /// If the operation is affine on the processed channels, it is collapsed with the previous
+    /// stage when that stage is affine too, and the stages that end up doing nothing are removed.
+    void addOperation(ColorStackOperationEnum operation, bool affine)
+    {
+        if (operation == eColorStackOperationNone) {
+            return;
+        }
+        assert(_nStages < kColorStackOperationCount);
+        if (!affine) {
+            _stages[_nStages].operation = operation;
+            ++_nStages;
+            return;
+        }
+
+        // the offset is the image of 0, and the matrix columns are given by the images of the unit vectors
+        ColorStackStage stage;
+        stage.operation = eColorStackOperationNone;
+        double p0[4] = { 0., 0., 0., 0. };
+        applyOperation<true, true, true, true>(operation, p0);
+        for (int j = 0; j < 4; ++j) {
+            double p[4] = { 0., 0., 0., 0. };
+            p[j] = 1.;
+            applyOperation<true, true, true, true>(operation, p);
+            for (int i = 0; i < 4; ++i) {
+                stage.matrix[i][j] = p[i] - p0[i];
+            }
+        }
+        for (int i = 0; i < 4; ++i) {
+            stage.offset[i] = p0[i];
+            if (!_processed[i]) {
+                // unprocessed channels are left as is
+                for (int j = 0; j < 4; ++j) {
+                    stage.matrix[i][j] = (i == j) ? 1. : 0.;
+                }
+                stage.offset[i] = 0.;
+            }
+        }
+
+        if (_nStages > 0 && _stages[_nStages - 1].operation == eColorStackOperationNone) {
+            // stage(prev(x)) = stage.matrix * (prev.matrix * x + prev.offset) + stage.offset
+            ColorStackStage &prev = _stages[_nStages - 1];
+            ColorStackStage combined;
+            combined.operation = eColorStackOperationNone;
+            for (int i = 0; i < 4; ++i) {
+                for (int j = 0; j < 4; ++j) {
+                    combined.matrix[i][j] = 0.;
+                    for (int k = 0; k < 4; ++k) {
+                        combined.matrix[i][j] += stage.matrix[i][k] * prev.matrix[k][j];
+                    }
+                }
+                combined.offset[i] = stage.offset[i];
+                for (int k = 0; k < 4; ++k) {
+                    combined.offset[i] += stage.matrix[i][k] * prev.offset[k];
+                }
+            }
+            prev = combined;
+        } else {
+            _stages[_nStages] = stage;
+            ++_nStages;
+        }
+
+        if (isIdentity(_stages[_nStages - 1])) {
+            --_nStages;
+        }
+    }
+
+    /// true if the stack does nothing
+    bool isIdentity() const
+    {
+        return _nStages == 0;
+    }
+
+    template<bool processR, bool processG, bool processB, bool processA>
+    void process(const float *unpPix, float *tmpPix) const
+    {
+        // the values stay in double precision from one stage to the next
+        double p[4] = { unpPix[0], unpPix[1], unpPix[2], unpPix[3] };
+        for (int s = 0; s < _nStages; ++s) {
+            const ColorStackStage &stage = _stages[s];
+            if (stage.operation == eColorStackOperationNone) {
+                applyAffine<processR, processG, processB, processA>(stage, p);
+            } else {
+                applyOperation<processR, processG, processB, processA>(stage.operation, p);
+            }
+        }
+        tmpPix[0] = (float)p[0];
+        tmpPix[1] = (float)p[1];
+        tmpPix[2] = (float)p[2];
+        tmpPix[3] = (float)p[3];
+    }
+
+private:
+    template<bool processR, bool processG, bool processB, bool processA>
+    void applyOperation(ColorStackOperationEnum operation, double *p) const
+    {
+        switch (operation) {
+            case eColorStackOperationNone:
+                break;
+            case eColorStackOperationGrade:
+                _grade.apply<processR, processG, processB, processA>(&p[0], &p[1], &p[2], &p[3]);
+                break;
+            case eColorStackOperationColorCorrect:
+                _colorCorrect.apply<processR, processG, processB, processA>(&p[0], &p[1], &p[2], &p[3]);
+                break;
+            case eColorStackOperationSaturation:
+                _saturation.apply<processR, processG, processB, processA>(&p[0], &p[1], &p[2], &p[3]);
+                break;
+            case eColorStackOperationColorMatrix:
+                _colorMatrix.apply<processR, processG, processB, processA>(&p[0], &p[1], &p[2], &p[3]);
+                break;
+            case eColorStackOperationGamma:
+                _gamma.apply<processR, processG, processB, processA>(&p[0], &p[1], &p[2], &p[3]);
+                break;
+            case eColorStackOperationClamp:
+                _clamp.apply<processR, processG, processB, processA>(&p[0], &p[1], &p[2], &p[3]);
+                break;
+        }
+    }
+
+    template<bool processR, bool processG, bool processB, bool processA>
+    static void applyAffine(const ColorStackStage &stage, double *p)
+    {
+        const double in[4] = { p[0], p[1], p[2], p[3] };
+        const bool processed[4] = { processR, processG, processB, processA };
+        for (int i = 0; i < 4; ++i) {
+            if (processed[i]) {
+                p[i] = (stage.matrix[i][0] * in[0] + stage.matrix[i][1] * in[1] +
+                        stage.matrix[i][2] * in[2] + stage.matrix[i][3] * in[3] + stage.offset[i]);
+            }
+        }
+    }
+
+    static bool isIdentity(const ColorStackStage &stage)
+    {
+        if (stage.operation != eColorStackOperationNone) {
+            return false;
+        }
+        for (int i = 0; i < 4; ++i) {
+            if (stage.offset[i] != 0.) {
+                return false;
+            }
+            for (int j = 0; j < 4; ++j) {
+                if (stage.matrix[i][j] != ((i == j) ? 1. : 0.)) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    GradeKernel _grade;
+    ColorCorrectKernel _colorCorrect;
+    SaturationKernel _saturation;
+    ColorMatrixKernel _colorMatrix;
+    GammaKernel _gamma;
+    ClampKernel _clamp;
+    bool _processed[4];
+    ColorStackStage _stages[kColorStackOperationCount];
+    int _nStages;
+};
+
+typedef PixelKernelProcessorBase<ColorStackKernel> ColorStackProcessorBase;
+
+template <class PIX, int nComponents, int maxValue>
+class ColorStackProcessor : public PixelKernelProcessor<ColorStackKernel, PIX, nComponents, maxValue>
+{
+public:
+    ColorStackProcessor(OFX::ImageEffect &instance)
+    : PixelKernelProcessor<ColorStackKernel, PIX, nComponents, maxValue>(instance)
+    {
+    }
+};
+
+static std::string
+operationParamName(int i)
+{
+    std::ostringstream oss;
+    oss << kParamOperation << i + 1;
+    return oss.str();
+}
+
+// the values of the processed channels are all equal to v
+static bool
+processedValuesEqual(const RGBAValues& values, double v, bool processR, bool processG, bool processB, bool processA)
+{
+    return ((!processR || values.r == v) &&
+            (!processG || values.g == v) &&
+            (!processB || values.b == v) &&
+            (!processA || values.a == v));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/** @brief The plugin that does our work */
+class ColorStackPlugin : public OFX::ImageEffect
+{
+public:
+    /** @brief ctor */
+    ColorStackPlugin(OfxImageEffectHandle handle, bool supportsParametricParameter)
+    : ImageEffect(handle)
+    , _supportsParametricParameter(supportsParametricParameter)
+    , _dstClip(0)
+    , _srcClip(0)
+    , _maskClip(0)
+    , _processR(0)
+    , _processG(0)
+    , _processB(0)
+    , _processA(0)
+    , _gradeBlackPoint(0)
+    , _gradeWhitePoint(0)
+    , _gradeBlack(0)
+    , _gradeWhite(0)
+    , _gradeMultiply(0)
+    , _gradeOffset(0)
+    , _gradeGamma(0)
+    , _rangesParam(0)
+    , _saturation(0)
+    , _luminanceMath(0)
+    , _outputRed(0)
+    , _outputGreen(0)
+    , _outputBlue(0)
+    , _outputAlpha(0)
+    , _gammaValue(0)
+    , _clampMinimum(0)
+    , _clampMinimumEnable(0)
+    , _clampMaximum(0)
+    , _clampMaximumEnable(0)
+    , _precision(0)
+    , _premult(0)
+    , _premultChannel(0)
+    , _mix(0)
+    , _maskInvert(0)
+    {
+        _dstClip = fetchClip(kOfxImageEffectOutputClipName);
+        assert(_dstClip && (_dstClip->getPixelComponents() == ePixelComponentRGB || _dstClip->getPixelComponents() == ePixelComponentRGBA));
+        _srcClip = fetchClip(kOfxImageEffectSimpleSourceClipName);
+        assert(_srcClip && (_srcClip->getPixelComponents() == ePixelComponentRGB || _srcClip->getPixelComponents() == ePixelComponentRGBA));
+        _maskClip = getContext() == OFX::eContextFilter ? NULL : fetchClip(getContext() == OFX::eContextPaint ? "Brush" : "Mask");
+        assert(!_maskClip || _maskClip->getPixelComponents() == ePixelComponentAlpha);
+
+        for (int i = 0; i < kColorStackOperationCount; ++i) {
+            _operation[i] = fetchChoiceParam(operationParamName(i));
+            assert(_operation[i]);
+        }
+
+        _gradeBlackPoint = fetchRGBAParam(kParamGradeBlackPoint);
+        _gradeWhitePoint = fetchRGBAParam(kParamGradeWhitePoint);
+        _gradeBlack = fetchRGBAParam(kParamGradeBlack);
+        _gradeWhite = fetchRGBAParam(kParamGradeWhite);
+        _gradeMultiply = fetchRGBAParam(kParamGradeMultiply);
+        _gradeOffset = fetchRGBAParam(kParamGradeOffset);
+        _gradeGamma = fetchRGBAParam(kParamGradeGamma);
+        assert(_gradeBlackPoint && _gradeWhitePoint && _gradeBlack && _gradeWhite && _gradeMultiply && _gradeOffset && _gradeGamma);
+
+        fetchColorControlGroup(kGroupMaster, &_masterParamsGroup);
+        fetchColorControlGroup(kGroupShadows, &_shadowsParamsGroup);
+        fetchColorControlGroup(kGroupMidtones, &_midtonesParamsGroup);
+        fetchColorControlGroup(kGroupHighlights, &_highlightsParamsGroup);
+        if (_supportsParametricParameter) {
+            _rangesParam = fetchParametricParam(kParamColorCorrectToneRanges);
+            assert(_rangesParam);
+        }
+
+        _saturation = fetchDoubleParam(kParamSaturationValue);
+        _luminanceMath = fetchChoiceParam(kParamLuminanceMath);
+        assert(_saturation && _luminanceMath);
+
+        _outputRed = fetchRGBAParam(kParamOutputRedName);
+        _outputGreen = fetchRGBAParam(kParamOutputGreenName);
+        _outputBlue = fetchRGBAParam(kParamOutputBlueName);
+        _outputAlpha = fetchRGBAParam(kParamOutputAlphaName);
+        assert(_outputRed && _outputGreen && _outputBlue && _outputAlpha);
+
+        _gammaValue = fetchRGBAParam(kParamGammaValue);
+        assert(_gammaValue);
+
+        _clampMinimum = fetchRGBAParam(kParamClampMinimum);
+        _clampMinimumEnable = fetchBooleanParam(kParamClampMinimumEnable);
+        _clampMaximum = fetchRGBAParam(kParamClampMaximum);
+        _clampMaximumEnable = fetchBooleanParam(kParamClampMaximumEnable);
+        assert(_clampMinimum && _clampMinimumEnable && _clampMaximum && _clampMaximumEnable);
+
+        _precision = fetchChoiceParam(kParamPrecision);
+        assert(_precision);
+
+        _premult = fetchBooleanParam(kParamPremult);
+        _premultChannel = fetchChoiceParam(kParamPremultChannel);
+        assert(_premult && _premultChannel);
+        _mix = fetchDoubleParam(kParamMix);
+        _maskInvert = fetchBooleanParam(kParamMaskInvert);
+        assert(_mix && _maskInvert);
+
+        _processR = fetchBooleanParam(kNatronOfxParamProcessR);
+        _processG = fetchBooleanParam(kNatronOfxParamProcessG);
+        _processB = fetchBooleanParam(kNatronOfxParamProcessB);
+        _processA = fetchBooleanParam(kNatronOfxParamProcessA);
+        assert(_processR && _processG && _processB && _processA);
+    }
+
+private:
+    /* Override the render */
+    virtual void render(const OFX::RenderArguments &args) OVERRIDE FINAL;
+
+    /* set up and run a processor */
+    void setupAndProcess(ColorStackProcessorBase &, const OFX::RenderArguments &args);
+
+    virtual bool isIdentity(const IsIdentityArguments &args, Clip * &identityClip, double &identityTime) OVERRIDE FINAL;
+
+    /** @brief called when a clip has just been changed in some way (a rewire maybe) */
+    virtual void changedClip(const InstanceChangedArgs &args, const std::string &clipName) OVERRIDE FINAL;
+
+    void fetchColorControlGroup(const std::string& groupName, ColorControlParamGroup* group) {
+        assert(group);
+        group->saturation = fetchRGBAParam(groupName  + kParamSaturation);
+        group->contrast = fetchRGBAParam(groupName +  kParamContrast);
+        group->gamma = fetchRGBAParam(groupName  + kParamGamma);
+        group->gain = fetchRGBAParam(groupName + kParamGain);
+        group->offset = fetchRGBAParam(groupName + kParamOffset);
+        assert(group->saturation && group->contrast && group->gamma && group->gain && group->offset);
+    }
+
+    static void getColorControlGroupValues(double time, const ColorControlParamGroup& group, ColorControlGroup* groupValues)
+    {
+        groupValues->saturation.getValueFrom(time, group.saturation);
+        groupValues->contrast.getValueFrom(time, group.contrast);
+        groupValues->gamma.getValueFrom(time, group.gamma);
+        groupValues->gain.getValueFrom(time, group.gain);
+        groupValues->offset.getValueFrom(time, group.offset);
+    }
+
+    /* build the stack of operations at the given time */
+    void setupKernel(double time, ColorStackKernel* kernel, bool processR, bool processG, bool processB, bool processA);
+
+private:
+    bool _supportsParametricParameter;
+    // do not need to delete these, the ImageEffect is managing them for us
+    OFX::Clip *_dstClip;
+    OFX::Clip *_srcClip;
+    OFX::Clip *_maskClip;
+    BooleanParam* _processR;
+    BooleanParam* _processG;
+    BooleanParam* _processB;
+    BooleanParam* _processA;
+    ChoiceParam* _operation[kColorStackOperationCount];
+    RGBAParam* _gradeBlackPoint;
+    RGBAParam* _gradeWhitePoint;
+    RGBAParam* _gradeBlack;
+    RGBAParam* _gradeWhite;
+    RGBAParam* _gradeMultiply;
+    RGBAParam* _gradeOffset;
+    RGBAParam* _gradeGamma;
+    ColorControlParamGroup _masterParamsGroup;
+    ColorControlParamGroup _shadowsParamsGroup;
+    ColorControlParamGroup _midtonesParamsGroup;
+    ColorControlParamGroup _highlightsParamsGroup;
+    OFX::ParametricParam* _rangesParam;
+    DoubleParam* _saturation;
+    ChoiceParam* _luminanceMath;
+    RGBAParam* _outputRed;
+    RGBAParam* _outputGreen;
+    RGBAParam* _outputBlue;
+    RGBAParam* _outputAlpha;
+    RGBAParam* _gammaValue;
+    RGBAParam* _clampMinimum;
+    BooleanParam* _clampMinimumEnable;
+    RGBAParam* _clampMaximum;
+    BooleanParam* _clampMaximumEnable;
+    ChoiceParam* _precision;
+    BooleanParam* _premult;
+    ChoiceParam* _premultChannel;
+    DoubleParam* _mix;
+    BooleanParam* _maskInvert;
+};
+
+
+void
+ColorStackPlugin::setupKernel(double time, ColorStackKernel* kernel, bool processR, bool processG, bool processB, bool processA)
+{
+    *kernel = ColorStackKernel(processR, processG, processB, processA);
+    int precision;
+    _precision->getValueAtTime(time, precision);
+    const bool fastPow = (precision == ePrecisionFast);
+    for (int i = 0; i < kColorStackOperationCount; ++i) {
+        int operation_i;
+        _operation[i]->getValueAtTime(time, operation_i);
+        ColorStackOperationEnum operation = (ColorStackOperationEnum)operation_i;
+        // the operations are affine on the processed channels when they have no gamma, and
+        // the ones that are known to do nothing are skipped
+        bool affine = false;
+        switch (operation) {
+            case eColorStackOperationNone:
+                break;
+            case eColorStackOperationGrade: {
+                RGBAValues blackPoint, whitePoint, black, white, multiply, offset, gamma;
+                _gradeBlackPoint->getValueAtTime(time, blackPoint.r, blackPoint.g, blackPoint.b, blackPoint.a);
+                _gradeWhitePoint->getValueAtTime(time, whitePoint.r, whitePoint.g, whitePoint.b, whitePoint.a);
+                _gradeBlack->getValueAtTime(time, black.r, black.g, black.b, black.a);
+                _gradeWhite->getValueAtTime(time, white.r, white.g, white.b, white.a);
+                _gradeMultiply->getValueAtTime(time, multiply.r, multiply.g, multiply.b, multiply.a);
+                _gradeOffset->getValueAtTime(time, offset.r, offset.g, offset.b, offset.a);
+                _gradeGamma->getValueAtTime(time, gamma.r, gamma.g, gamma.b, gamma.a);
+                GradeKernel grade(blackPoint, whitePoint, black, white, multiply, offset, gamma, false, false);
+                grade.setFastPow(fastPow);
+                kernel->setGrade(grade);
+                affine = processedValuesEqual(gamma, 1., processR, processG, processB, processA);
+                break;
+            }
+            case eColorStackOperationColorCorrect: {
+                ColorControlGroup masterValues, shadowValues, midtoneValues, highlightValues;
+                getColorControlGroupValues(time, _masterParamsGroup, &masterValues);
+                getColorControlGroupValues(time, _shadowsParamsGroup, &shadowValues);
+                getColorControlGroupValues(time, _midtonesParamsGroup, &midtoneValues);
+                getColorControlGroupValues(time, _highlightsParamsGroup, &highlightValues);
+                const bool smhIdentity = (groupIsIdentity(shadowValues) &&
+                                          groupIsIdentity(midtoneValues) &&
+                                          groupIsIdentity(highlightValues));
+                if (smhIdentity && groupIsIdentity(masterValues)) {
+                    operation = eColorStackOperationNone;
+                    break;
+                }
+                // without shadows, midtones and highlights, the tone ranges have no effect
+                ColorCorrectKernel colorCorrect(masterValues, shadowValues, midtoneValues, highlightValues, false, false);
+                if (!smhIdentity) {
+                    colorCorrect.setLookupTable(_rangesParam, time);
+                }
+                colorCorrect.setFastPow(fastPow);
+                kernel->setColorCorrect(colorCorrect);
+                RGBAValues masterGamma;
+                masterGamma.r = masterValues.gamma.r;
+                masterGamma.g = masterValues.gamma.g;
+                masterGamma.b = masterValues.gamma.b;
+                masterGamma.a = masterValues.gamma.a;
+                affine = smhIdentity && processedValuesEqual(masterGamma, 1., processR, processG, processB, processA);
+                break;
+            }
+            case eColorStackOperationSaturation: {
+                double saturation;
+                _saturation->getValueAtTime(time, saturation);
+                int luminanceMath_i;
+                _luminanceMath->getValueAtTime(time, luminanceMath_i);
+                LuminanceMathEnum luminanceMath = (LuminanceMathEnum)luminanceMath_i;
+                kernel->setSaturation(SaturationKernel(saturation, luminanceMath, false, false));
+                affine = (luminanceMath != eLuminanceMathMaximum);
+                break;
+            }
+            case eColorStackOperationColorMatrix: {
+                RGBAValues r, g, b, a;
+                _outputRed->getValueAtTime(time, r.r, r.g, r.b, r.a);
+                _outputGreen->getValueAtTime(time, g.r, g.g, g.b, g.a);
+                _outputBlue->getValueAtTime(time, b.r, b.g, b.b, b.a);
+                _outputAlpha->getValueAtTime(time, a.r, a.g, a.b, a.a);
+                kernel->setColorMatrix(ColorMatrixKernel(r, g, b, a, false, false));
+                affine = true;
+                break;
+            }
+            case eColorStackOperationGamma: {
+                RGBAValues value;
+                _gammaValue->getValueAtTime(time, value.r, value.g, value.b, value.a);
+                if (processedValuesEqual(value, 1., processR, processG, processB, processA)) {
+                    operation = eColorStackOperationNone;
+                    break;
+                }
+                GammaKernel gamma(value);
+                gamma.setFastPow(fastPow);
+                kernel->setGamma(gamma);
+                break;
+            }
+            case eColorStackOperationClamp: {
+                RGBAValues minimum, maximum;
+                bool minimumEnable, maximumEnable;
+                _clampMinimum->getValueAtTime(time, minimum.r, minimum.g, minimum.b, minimum.a);
+                _clampMinimumEnable->getValueAtTime(time, minimumEnable);
+                _clampMaximum->getValueAtTime(time, maximum.r, maximum.g, maximum.b, maximum.a);
+                _clampMaximumEnable->getValueAtTime(time, maximumEnable);
+                if (!minimumEnable && !maximumEnable) {
+                    operation = eColorStackOperationNone;
+                    break;
+                }
+                kernel->setClamp(ClampKernel(minimum, minimumEnable, maximum, maximumEnable));
+                break;
+            }
+        }
+        kernel->addOperation(operation, affine);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/** @brief render for the filter */
+
+////////////////////////////////////////////////////////////////////////////////
+// basic plugin render function, just a skelington to instantiate templates from
+
+/* set up and run a processor */
+void
+ColorStackPlugin::setupAndProcess(ColorStackProcessorBase &processor, const OFX::RenderArguments &args)
+{
+    std::auto_ptr<OFX::Image> dst(_dstClip->fetchImage(args.time));
+    if (!dst.get()) {
+        OFX::throwSuiteStatusException(kOfxStatFailed);
+    }
+    OFX::BitDepthEnum         dstBitDepth    = dst->getPixelDepth();
+    OFX::PixelComponentEnum   dstComponents  = dst->getPixelComponents();
+    if (dstBitDepth != _dstClip->getPixelDepth() ||
+        dstComponents != _dstClip->getPixelComponents()) {
+        setPersistentMessage(OFX::Message::eMessageError, "", "OFX Host gave image with wrong depth or components");
+        OFX::throwSuiteStatusException(kOfxStatFailed);
+    }
+    if (dst->getRenderScale().x != args.renderScale.x ||
+        dst->getRenderScale().y != args.renderScale.y ||
+        (dst->getField() != OFX::eFieldNone /* for DaVinci Resolve */ && dst->getField() != args.fieldToRender)) {
+        setPersistentMessage(OFX::Message::eMessageError, "", "OFX Host gave image with wrong scale or field properties");
+        OFX::throwSuiteStatusException(kOfxStatFailed);
+    }
+    std::auto_ptr<const OFX::Image> src((_srcClip && _srcClip->isConnected()) ?
+                                        _srcClip->fetchImage(args.time) : 0);
+    if (src.get()) {
+        if (src->getRenderScale().x != args.renderScale.x ||
+            src->getRenderScale().y != args.renderScale.y ||
+            (src->getField() != OFX::eFieldNone /* for DaVinci Resolve */ && src->getField() != args.fieldToRender)) {
+            setPersistentMessage(OFX::Message::eMessageError, "", "OFX Host gave image with wrong scale or field properties");
+            OFX::throwSuiteStatusException(kOfxStatFailed);
+        }
+        OFX::BitDepthEnum    srcBitDepth      = src->getPixelDepth();
+        OFX::PixelComponentEnum srcComponents = src->getPixelComponents();
+        if (srcBitDepth != dstBitDepth || srcComponents != dstComponents) {
+            OFX::throwSuiteStatusException(kOfxStatErrImageFormat);
+        }
+    }
+    std::auto_ptr<const OFX::Image> mask((getContext() != OFX::eContextFilter && _maskClip && _maskClip->isConnected()) ?
+                                         _maskClip->fetchImage(args.time) : 0);
+    if (getContext() != OFX::eContextFilter && _maskClip && _maskClip->isConnected()) {
+        if (mask.get()) {
+            if (mask->getRenderScale().x != args.renderScale.x ||
+                mask->getRenderScale().y != args.renderScale.y ||
+                (mask->getField() != OFX::eFieldNone /* for DaVinci Resolve */ && mask->getField() != args.fieldToRender)) {
+                setPersistentMessage(OFX::Message::eMessageError, "", "OFX Host gave image with wrong scale or field properties");
+                OFX::throwSuiteStatusException(kOfxStatFailed);
+            }
+        }
+        bool maskInvert;
+        _maskInvert->getValueAtTime(args.time, maskInvert);
+        processor.doMasking(true);
+        processor.setMaskImg(mask.get(), maskInvert);
+    }
+
+    processor.setDstImg(dst.get());
+    processor.setSrcImg(src.get());
+    processor.setRenderWindow(args.renderWindow);
+
+    bool premult;
+    int premultChannel;
+    _premult->getValueAtTime(args.time, premult);
+    _premultChannel->getValueAtTime(args.time, premultChannel);
+    double mix;
+    _mix->getValueAtTime(args.time, mix);
+
+    bool processR, processG, processB, processA;
+    _processR->getValue(processR);
+    _processG->getValue(processG);
+    _processB->getValue(processB);
+    _processA->getValue(processA);
+
+    processor.setValues(processR, processG, processB, processA,
+                        premult, premultChannel, mix);
+    ColorStackKernel kernel;
+    setupKernel(args.time, &kernel, processR, processG, processB, processA && dstComponents == OFX::ePixelComponentRGBA);
+    processor.setKernel(kernel);
+    processor.process();
+}
+
+// the overridden render function
+void
+ColorStackPlugin::render(const OFX::RenderArguments &args)
+{
+    // instantiate the render code based on the pixel depth of the dst clip
+    OFX::BitDepthEnum       dstBitDepth    = _dstClip->getPixelDepth();
+    OFX::PixelComponentEnum dstComponents  = _dstClip->getPixelComponents();
+
+    assert(kSupportsMultipleClipPARs   || !_srcClip || _srcClip->getPixelAspectRatio() == _dstClip->getPixelAspectRatio());
+    assert(kSupportsMultipleClipDepths || !_srcClip || _srcClip->getPixelDepth()       == _dstClip->getPixelDepth());
+    assert(dstComponents == OFX::ePixelComponentRGB || dstComponents == OFX::ePixelComponentRGBA);
+    if (dstComponents == OFX::ePixelComponentRGBA) {
+        switch (dstBitDepth) {
+            case OFX::eBitDepthUByte: {
+                ColorStackProcessor<unsigned char, 4, 255> fred(*this);
+                setupAndProcess(fred, args);
+                break;
+            }
+            case OFX::eBitDepthUShort: {
+                ColorStackProcessor<unsigned short, 4, 65535> fred(*this);
+                setupAndProcess(fred, args);
+                break;
+            }
+            case OFX::eBitDepthFloat: {
+                ColorStackProcessor<float, 4, 1> fred(*this);
+                setupAndProcess(fred, args);
+                break;
+            }
+            default:
+                OFX::throwSuiteStatusException(kOfxStatErrUnsupported);
+        }
+    } else {
+        assert(dstComponents == OFX::ePixelComponentRGB);
+        switch (dstBitDepth) {
+            case OFX::eBitDepthUByte: {
+                ColorStackProcessor<unsigned char, 3, 255> fred(*this);
+                setupAndProcess(fred, args);
+                break;
+            }
+            case OFX::eBitDepthUShort: {
+                ColorStackProcessor<unsigned short, 3, 65535> fred(*this);
+                setupAndProcess(fred, args);
+                break;
+            }
+            case OFX::eBitDepthFloat: {
+                ColorStackProcessor<float, 3, 1> fred(*this);
+                setupAndProcess(fred, args);
+                break;
+            }
+            default :
+                OFX::throwSuiteStatusException(kOfxStatErrUnsupported);
+        }
+    }
+}
+
+
+bool
+ColorStackPlugin::isIdentity(const IsIdentityArguments &args, Clip * &identityClip, double &/*identityTime*/)
+{
+    double mix;
+    _mix->getValueAtTime(args.time, mix);
+
+    if (mix == 0.) {
+        identityClip = _srcClip;
+        return true;
+    }
+
+    bool processR;
+    bool processG;
+    bool processB;
+    bool processA;
+    _processR->getValueAtTime(args.time, processR);
+    _processG->getValueAtTime(args.time, processG);
+    _processB->getValueAtTime(args.time, processB);
+    _processA->getValueAtTime(args.time, processA);
+    if (!processR && !processG && !processB && !processA) {
+        identityClip = _srcClip;
+        return true;
+    }
+
+    {
+        ColorStackKernel kernel;
+        setupKernel(args.time, &kernel, processR, processG, processB, processA && _dstClip->getPixelComponents() == OFX::ePixelComponentRGBA);
+        if (kernel.isIdentity()) {
+            identityClip = _srcClip;
+            return true;
+        }
+    }
+
+    if (_maskClip && _maskClip->isConnected()) {
+        bool maskInvert;
+        _maskInvert->getValueAtTime(args.time, maskInvert);
+        if (!maskInvert) {
+            OfxRectI maskRoD;
+            OFX::MergeImages2D::toPixelEnclosing(_maskClip->getRegionOfDefinition(args.time), args.renderScale, _maskClip->getPixelAspectRatio(), &maskRoD);
+            // effect is identity if the renderWindow doesn't intersect the mask RoD
+            if (!OFX::MergeImages2D::rectIntersection<OfxRectI>(args.renderWindow, maskRoD, 0)) {
+                identityClip = _srcClip;
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+void
+ColorStackPlugin::changedClip(const InstanceChangedArgs &args, const std::string &clipName)
+{
+    if (clipName == kOfxImageEffectSimpleSourceClipName && _srcClip && args.reason == OFX::eChangeUserEdit) {
+        switch (_srcClip->getPreMultiplication()) {
+            case eImageOpaque:
+                _premult->setValue(false);
+                break;
+            case eImagePreMultiplied:
+                _premult->setValue(true);
+                break;
+            case eImageUnPreMultiplied:
+                _premult->setValue(false);
+                break;
+        }
+    }
+}
+
+mDeclarePluginFactory(ColorStackPluginFactory, {}, {});
+
+void
+ColorStackPluginFactory::describe(OFX::ImageEffectDescriptor &desc)
+{
+    // basic labels
+    desc.setLabel(kPluginName);
+    desc.setPluginGrouping(kPluginGrouping);
+    desc.setPluginDescription(kPluginDescription);
+
+    desc.addSupportedContext(eContextFilter);
+    desc.addSupportedContext(eContextGeneral);
+    desc.addSupportedContext(eContextPaint);
+    desc.addSupportedBitDepth(eBitDepthUByte);
+    desc.addSupportedBitDepth(eBitDepthUShort);
+    desc.addSupportedBitDepth(eBitDepthFloat);
+
+    // set a few flags
+    desc.setSingleInstance(false);
+    desc.setHostFrameThreading(false);
+    desc.setSupportsMultiResolution(kSupportsMultiResolution);
+    desc.setSupportsTiles(kSupportsTiles);
+    desc.setTemporalClipAccess(false);
+    desc.setRenderTwiceAlways(false);
+    desc.setSupportsMultipleClipPARs(kSupportsMultipleClipPARs);
+    desc.setSupportsMultipleClipDepths(kSupportsMultipleClipDepths);
+    desc.setRenderThreadSafety(kRenderThreadSafety);
+#ifdef OFX_EXTENSIONS_NATRON
+    desc.setChannelSelector(OFX::ePixelComponentNone); // we have our own channel selector
+#endif
+}
+
+static void
+defineRGBAScaleParam(OFX::ImageEffectDescriptor &desc,
+                     const std::string &name,
+                     const std::string &label,
+                     const std::string &hint,
+                     GroupParamDescriptor *parent,
+                     PageParamDescriptor* page,
+                     double def,
+                     double min,
+                     double max)
+{
+    RGBAParamDescriptor *param = desc.defineRGBAParam(name);
+    param->setLabel(label);
+    param->setHint(hint);
+    param->setDefault(def,def,def,def);
+    param->setDisplayRange(min,min,min,min,max,max,max,max);
+    if (parent) {
+        param->setParent(*parent);
+    }
+    if (page) {
+        page->addChild(*param);
+    }
+}
+
+static void
+defineColorGroup(const std::string& groupName,
+                 const std::string& hint,
+                 GroupParamDescriptor *parent,
+                 PageParamDescriptor* page,
+                 OFX::ImageEffectDescriptor &desc,
+                 bool open)
+{
+    GroupParamDescriptor* param = desc.defineGroupParam(groupName);
+    param->setLabel(groupName);
+    param->setHint(hint);
+    param->setOpen(open);
+    if (parent) {
+        param->setParent(*parent);
+    }
+
+    defineRGBAScaleParam(desc, groupName + kParamSaturation, kParamSaturation, hint, param, page, 1, 0, 4);
+    defineRGBAScaleParam(desc, groupName + kParamContrast, kParamContrast, hint, param, page, 1, 0, 4);
+    defineRGBAScaleParam(desc, groupName + kParamGamma, kParamGamma, hint, param, page, 1, 0.2, 5);
+    defineRGBAScaleParam(desc, groupName + kParamGain, kParamGain, hint, param, page, 1, 0, 4);
+    defineRGBAScaleParam(desc, groupName + kParamOffset, kParamOffset, hint, param, page, 0, -1, 1);
+    if (page) {
+        page->addChild(*param);
+    }
+}
+
+static GroupParamDescriptor*
+defineOperationGroup(OFX::ImageEffectDescriptor &desc,
+                     const std::string &name,
+                     const std::string &label,
+                     PageParamDescriptor* page)
+{
+    GroupParamDescriptor* group = desc.defineGroupParam(name);
+    group->setLabel(label);
+    group->setOpen(false);
+    if (page) {
+        page->addChild(*group);
+    }
+    return group;
+}
+
+void
+ColorStackPluginFactory::describeInContext(OFX::ImageEffectDescriptor &desc, OFX::ContextEnum context)
+{
+    // Source clip only in the filter context
+    // create the mandated source clip
+    ClipDescriptor *srcClip = desc.defineClip(kOfxImageEffectSimpleSourceClipName);
+    srcClip->addSupportedComponent(ePixelComponentRGBA);
+    srcClip->addSupportedComponent(ePixelComponentRGB);
+    srcClip->setTemporalClipAccess(false);
+    srcClip->setSupportsTiles(kSupportsTiles);
+    srcClip->setIsMask(false);
+
+    // create the mandated output clip
+    ClipDescriptor *dstClip = desc.defineClip(kOfxImageEffectOutputClipName);
+    dstClip->addSupportedComponent(ePixelComponentRGBA);
+    dstClip->addSupportedComponent(ePixelComponentRGB);
+    dstClip->setSupportsTiles(kSupportsTiles);
+
+    if (context == eContextGeneral || context == eContextPaint) {
+        ClipDescriptor *maskClip = context == eContextGeneral ? desc.defineClip("Mask") : desc.defineClip("Brush");
+        maskClip->addSupportedComponent(ePixelComponentAlpha);
+        maskClip->setTemporalClipAccess(false);
+        if (context == eContextGeneral) {
+            maskClip->setOptional(true);
+        }
+        maskClip->setSupportsTiles(kSupportsTiles);
+        maskClip->setIsMask(true);
+    }
+
+    // make some pages and to things in
+    PageParamDescriptor *page = desc.definePageParam("Controls");
+
+    {
+        OFX::BooleanParamDescriptor* param = desc.defineBooleanParam(kNatronOfxParamProcessR);
+        param->setLabel(kNatronOfxParamProcessRLabel);
+        param->setHint(kNatronOfxParamProcessRHint);
+        param->setDefault(true);
+        param->setLayoutHint(eLayoutHintNoNewLine);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+    {
+        OFX::BooleanParamDescriptor* param = desc.defineBooleanParam(kNatronOfxParamProcessG);
+        param->setLabel(kNatronOfxParamProcessGLabel);
+        param->setHint(kNatronOfxParamProcessGHint);
+        param->setDefault(true);
+        param->setLayoutHint(eLayoutHintNoNewLine);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+    {
+        OFX::BooleanParamDescriptor* param = desc.defineBooleanParam(kNatronOfxParamProcessB);
+        param->setLabel(kNatronOfxParamProcessBLabel);
+        param->setHint(kNatronOfxParamProcessBHint);
+        param->setDefault(true);
+        param->setLayoutHint(eLayoutHintNoNewLine);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+    {
+        OFX::BooleanParamDescriptor* param = desc.defineBooleanParam(kNatronOfxParamProcessA);
+        param->setLabel(kNatronOfxParamProcessALabel);
+        param->setHint(kNatronOfxParamProcessAHint);
+        param->setDefault(false);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+
+    // the operations, by default in the usual order of a color pipeline
+    for (int i = 0; i < kColorStackOperationCount; ++i) {
+        std::ostringstream label;
+        label << kParamOperationLabel << i + 1;
+        OFX::ChoiceParamDescriptor* param = desc.defineChoiceParam(operationParamName(i));
+        param->setLabel(label.str());
+        param->setHint(kParamOperationHint);
+        assert(param->getNOptions() == eColorStackOperationNone);
+        param->appendOption(kParamOperationOptionNone, kParamOperationOptionNoneHint);
+        assert(param->getNOptions() == eColorStackOperationGrade);
+        param->appendOption(kParamOperationOptionGrade, kParamOperationOptionGradeHint);
+        assert(param->getNOptions() == eColorStackOperationColorCorrect);
+        param->appendOption(kParamOperationOptionColorCorrect, kParamOperationOptionColorCorrectHint);
+        assert(param->getNOptions() == eColorStackOperationSaturation);
+        param->appendOption(kParamOperationOptionSaturation, kParamOperationOptionSaturationHint);
+        assert(param->getNOptions() == eColorStackOperationColorMatrix);
+        param->appendOption(kParamOperationOptionColorMatrix, kParamOperationOptionColorMatrixHint);
+        assert(param->getNOptions() == eColorStackOperationGamma);
+        param->appendOption(kParamOperationOptionGamma, kParamOperationOptionGammaHint);
+        assert(param->getNOptions() == eColorStackOperationClamp);
+        param->appendOption(kParamOperationOptionClamp, kParamOperationOptionClampHint);
+        param->setDefault(eColorStackOperationGrade + i);
+        param->setAnimates(false);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+
+    // Grade
+    {
+        GroupParamDescriptor* group = defineOperationGroup(desc, kGroupGrade, kGroupGradeLabel, page);
+        defineRGBAScaleParam(desc, kParamGradeBlackPoint, kParamGradeBlackPointLabel, kParamGradeBlackPointHint, group, page, 0., -1., 1.);
+        defineRGBAScaleParam(desc, kParamGradeWhitePoint, kParamGradeWhitePointLabel, kParamGradeWhitePointHint, group, page, 1., 0., 4.);
+        defineRGBAScaleParam(desc, kParamGradeBlack, kParamGradeBlackLabel, kParamGradeBlackHint, group, page, 0., -1., 1.);
+        defineRGBAScaleParam(desc, kParamGradeWhite, kParamGradeWhiteLabel, kParamGradeWhiteHint, group, page, 1., 0., 4.);
+        defineRGBAScaleParam(desc, kParamGradeMultiply, kParamGradeMultiplyLabel, kParamGradeMultiplyHint, group, page, 1., 0., 4.);
+        defineRGBAScaleParam(desc, kParamGradeOffset, kParamGradeOffsetLabel, kParamGradeOffsetHint, group, page, 0., -1., 1.);
+        defineRGBAScaleParam(desc, kParamGradeGamma, kParamGradeGammaLabel, kParamGradeGammaHint, group, page, 1., 0.2, 5.);
+    }
+
+    // ColorCorrect
+    {
+        GroupParamDescriptor* group = defineOperationGroup(desc, kGroupColorCorrect, kGroupColorCorrectLabel, page);
+        defineColorGroup(kGroupMaster, "", group, page, desc, true);
+        defineColorGroup(kGroupShadows, "", group, page, desc, false);
+        defineColorGroup(kGroupMidtones, "", group, page, desc, false);
+        defineColorGroup(kGroupHighlights, "", group, page, desc, false);
+
+        PageParamDescriptor* ranges = desc.definePageParam("Ranges");
+
+        const ImageEffectHostDescription &gHostDescription = *OFX::getImageEffectHostDescription();
+        const bool supportsParametricParameter = (gHostDescription.supportsParametricParameter &&
+                                                  !(gHostDescription.hostName == "uk.co.thefoundry.nuke" &&
+                                                    (gHostDescription.versionMajor == 8 || gHostDescription.versionMajor == 9))); // Nuke 8 and 9 are known to *not* support Parametric
+        if (supportsParametricParameter) {
+            OFX::ParametricParamDescriptor* param = desc.defineParametricParam(kParamColorCorrectToneRanges);
+            assert(param);
+            param->setLabel(kParamColorCorrectToneRangesLabel);
+            param->setHint(kParamColorCorrectToneRangesHint);
+
+            // define it as two dimensional
+            param->setDimension(2);
+
+            param->setDimensionLabel(kParamColorCorrectToneRangesDim0, 0);
+            param->setDimensionLabel(kParamColorCorrectToneRangesDim1, 1);
+
+            // set the UI colour for each dimension
+            const OfxRGBColourD shadow   = {0.6,0.4,0.6};
+            const OfxRGBColourD highlight  =  {0.8,0.7,0.6};
+            param->setUIColour( 0, shadow );
+            param->setUIColour( 1, highlight );
+
+            // set the min/max parametric range to 0..1
+            param->setRange(0.0, 1.0);
+
+            // same default curves as ColorCorrect
+            param->addControlPoint(0, 0.0, 0.0, 1.0, false);
+            param->addControlPoint(0, 0.0, 0.09, 0.0, false);
+            param->addControlPoint(1, 0.0, 0.5, 0.0, false);
+            param->addControlPoint(1, 0.0, 1.0, 1.0, false);
+            ranges->addChild(*param);
+        }
+    }
+
+    // Saturation
+    {
+        GroupParamDescriptor* group = defineOperationGroup(desc, kGroupSaturation, kGroupSaturationLabel, page);
+        {
+            OFX::DoubleParamDescriptor* param = desc.defineDoubleParam(kParamSaturationValue);
+            param->setLabel(kParamSaturationValueLabel);
+            param->setHint(kParamSaturationValueHint);
+            param->setDisplayRange(0., 4.);
+            param->setDefault(1.);
+            param->setParent(*group);
+            if (page) {
+                page->addChild(*param);
+            }
+        }
+        {
+            OFX::ChoiceParamDescriptor* param = desc.defineChoiceParam(kParamLuminanceMath);
+            param->setLabel(kParamLuminanceMathLabel);
+            param->setHint(kParamLuminanceMathHint);
+            assert(param->getNOptions() == eLuminanceMathRec709);
+            param->appendOption(kParamLuminanceMathOptionRec709, kParamLuminanceMathOptionRec709Hint);
+            assert(param->getNOptions() == eLuminanceMathCcir601);
+            param->appendOption(kParamLuminanceMathOptionCcir601, kParamLuminanceMathOptionCcir601Hint);
+            assert(param->getNOptions() == eLuminanceMathAverage);
+            param->appendOption(kParamLuminanceMathOptionAverage, kParamLuminanceMathOptionAverageHint);
+            assert(param->getNOptions() == eLuminanceMathMaximum);
+            param->appendOption(kParamLuminanceMathOptionMaximum, kParamLuminanceMathOptionMaximumHint);
+            param->setParent(*group);
+            if (page) {
+                page->addChild(*param);
+            }
+        }
+    }
+
+    // ColorMatrix
+    {
+        GroupParamDescriptor* group = defineOperationGroup(desc, kGroupColorMatrix, kGroupColorMatrixLabel, page);
+        {
+            RGBAParamDescriptor *param = desc.defineRGBAParam(kParamOutputRedName);
+            param->setLabel(kParamOutputRedLabel);
+            param->setHint(kParamOutputRedHint);
+            param->setDefault(1.0, 0.0, 0.0, 0.0);
+            param->setParent(*group);
+            if (page) {
+                page->addChild(*param);
+            }
+        }
+        {
+            RGBAParamDescriptor *param = desc.defineRGBAParam(kParamOutputGreenName);
+            param->setLabel(kParamOutputGreenLabel);
+            param->setHint(kParamOutputGreenHint);
+            param->setDefault(0.0, 1.0, 0.0, 0.0);
+            param->setParent(*group);
+            if (page) {
+                page->addChild(*param);
+            }
+        }
+        {
+            RGBAParamDescriptor *param = desc.defineRGBAParam(kParamOutputBlueName);
+            param->setLabel(kParamOutputBlueLabel);
+            param->setHint(kParamOutputBlueHint);
+            param->setDefault(0.0, 0.0, 1.0, 0.0);
+            param->setParent(*group);
+            if (page) {
+                page->addChild(*param);
+            }
+        }
+        {
+            RGBAParamDescriptor *param = desc.defineRGBAParam(kParamOutputAlphaName);
+            param->setLabel(kParamOutputAlphaLabel);
+            param->setHint(kParamOutputAlphaHint);
+            param->setDefault(0.0, 0.0, 0.0, 1.0);
+            param->setParent(*group);
+            if (page) {
+                page->addChild(*param);
+            }
+        }
+    }
+
+    // Gamma
+    {
+        GroupParamDescriptor* group = defineOperationGroup(desc, kGroupGamma, kGroupGammaLabel, page);
+        defineRGBAScaleParam(desc, kParamGammaValue, kParamGammaValueLabel, kParamGammaValueHint, group, page, 1., 0., 4.);
+    }
+
+    // Clamp
+    {
+        GroupParamDescriptor* group = defineOperationGroup(desc, kGroupClamp, kGroupClampLabel, page);
+        defineRGBAScaleParam(desc, kParamClampMinimum, kParamClampMinimumLabel, kParamClampMinimumHint, group, page, 0., 0., 1.);
+        {
+            BooleanParamDescriptor *param = desc.defineBooleanParam(kParamClampMinimumEnable);
+            param->setLabel(kParamClampMinimumEnableLabel);
+            param->setHint(kParamClampMinimumEnableHint);
+            param->setDefault(false);
+            param->setAnimates(true);
+            param->setParent(*group);
+            if (page) {
+                page->addChild(*param);
+            }
+        }
+        defineRGBAScaleParam(desc, kParamClampMaximum, kParamClampMaximumLabel, kParamClampMaximumHint, group, page, 1., 0., 1.);
+        {
+            BooleanParamDescriptor *param = desc.defineBooleanParam(kParamClampMaximumEnable);
+            param->setLabel(kParamClampMaximumEnableLabel);
+            param->setHint(kParamClampMaximumEnableHint);
+            param->setDefault(false);
+            param->setAnimates(true);
+            param->setParent(*group);
+            if (page) {
+                page->addChild(*param);
+            }
+        }
+    }
+
+    describePrecisionParam(desc, page);
+
+    ofxsPremultDescribeParams(desc, page);
+    ofxsMaskMixDescribeParams(desc, page);
+}
+
+OFX::ImageEffect*
+ColorStackPluginFactory::createInstance(OfxImageEffectHandle handle, OFX::ContextEnum /*context*/)
+{
+    const ImageEffectHostDescription &gHostDescription = *OFX::getImageEffectHostDescription();
+    const bool supportsParametricParameter = (gHostDescription.supportsParametricParameter &&
+                                              !(gHostDescription.hostName == "uk.co.thefoundry.nuke" &&
+                                                (gHostDescription.versionMajor == 8 || gHostDescription.versionMajor == 9)));
+    return new ColorStackPlugin(handle, supportsParametricParameter);
+}
+
+void getColorStackPluginID(OFX::PluginFactoryArray &ids)
+{
+    static ColorStackPluginFactory p(kPluginIdentifier, kPluginVersionMajor, kPluginVersionMinor);
+    ids.push_back(&p);
+}
@@ -0,0 +1,12 @@
+#include "ColorStack.h"
+
+namespace OFX
+{
+    namespace Plugin
+    {
+        void getPluginIDs(OFX::PluginFactoryArray &ids)
+        {
+            getColorStackPluginID(ids);
+        }
+    }
+}
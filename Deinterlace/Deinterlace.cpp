@@ -78,8 +78,12 @@
 #include "ofxsImageEffect.h"
 #include "ofxsMultiThread.h"
 #include "ofxsProcessing.H"
+#include "ofxsCopier.h"
+#include "ofxsMerging.h"
 #include "ofxsMacros.h"
 
+#include "DeinterlaceYadif.h"
+
 #define kPluginName          "DeinterlaceOFX"
 #define kPluginGrouping      "Time"
 #define kPluginDescription \
@@ -97,7 +101,7 @@
 #define kPluginVersionMajor 1 // Incrementing this number means that you have broken backwards compatibility of the plug-in.
 #define kPluginVersionMinor 0 // Increment this when you have fixed a bug or made it faster.
 
-#define kSupportsTiles 0
+#define kSupportsTiles 1
 #define kSupportsMultiResolution 0
 #define kSupportsRenderScale 1 // are images still fielded at any renderscale?
 #define kSupportsMultipleClipPARs false
@@ -173,6 +177,8 @@ enum YadifModeEnum {
     eYadifModeTemporal,
 };
 
+class DeinterlaceProcessorBase;
+
 class DeinterlacePlugin : public OFX::ImageEffect 
 {
 public:
@@ -184,11 +190,18 @@ public:
         mode = fetchChoiceParam("mode");
         fieldOrder = fetchChoiceParam("fieldOrder");
         parity = fetchChoiceParam("parity");
+        yadifMode = fetchChoiceParam(kParamYadifMode);
     }
 
 private:
     virtual void render(const OFX::RenderArguments &args) OVERRIDE FINAL;
 
+    template <int nComponents>
+    void renderInternal(const OFX::RenderArguments &args, OFX::BitDepthEnum dstBitDepth);
+
+    /* set up and run a processor */
+    void setupAndProcess(DeinterlaceProcessorBase &processor, const OFX::RenderArguments &args);
+
     /** @brief get the clip preferences */
     virtual void getClipPreferences(OFX::ClipPreferencesSetter &clipPreferences) OVERRIDE FINAL;
 
@@ -201,250 +214,163 @@ private:
     /** Override the get frames needed action */
     virtual void getFramesNeeded(const OFX::FramesNeededArguments &args, OFX::FramesNeededSetter &frames) OVERRIDE FINAL;
 
+    // override the roi call
+    virtual void getRegionsOfInterest(const OFX::RegionsOfInterestArguments &args, OFX::RegionOfInterestSetter &rois) OVERRIDE FINAL;
+
 private:
     // do not need to delete these, the ImageEffect is managing them for us
     OFX::Clip *_dstClip;
     OFX::Clip *_srcClip;
 
-    OFX::ChoiceParam *fieldOrder, *mode, *parity;
+    OFX::ChoiceParam *fieldOrder, *mode, *parity, *yadifMode;
     
 };
 
 
 
-// =========== GNU Lesser General Public License code start =================
 
-// Yadif (yet another deinterlacing filter)
-// http://avisynth.org.ru/yadif/yadif.html
-// http://mplayerhq.hu
-
-// Original port to OFX/Vegas by George Yohng http://yohng.com
-// Rewritten after yadif relicensing to LGPL:
-// http://git.videolan.org/?p=ffmpeg.git;a=commit;h=194ef56ba7e659196fe554782d797b1b45c3915f
-
-
-// Copyright notice and licence from the original libavfilter/vf_yadif.c file:
-/*
- * Copyright (C) 2006-2011 Michael Niedermayer <michaelni@gmx.at>
- *               2010      James Darnley <james.darnley@gmail.com>
- *
- * FFmpeg is free software; you can redistribute it and/or
- * modify it under the terms of the GNU Lesser General Public
- * License as published by the Free Software Foundation; either
- * version 2.1 of the License, or (at your option) any later version.
- *
- * FFmpeg is distributed in the hope that it will be useful,
- * but WITHOUT ANY WARRANTY; without even the implied warranty of
- * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
- * Lesser General Public License for more details.
- *
- * You should have received a copy of the GNU Lesser General Public
- * License along with FFmpeg; if not, write to the Free Software
- * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
- */
+class DeinterlaceProcessorBase : public OFX::ImageProcessor
+{
+protected:
+    const OFX::Image *_prevImg;
+    const OFX::Image *_srcImg;
+    const OFX::Image *_nextImg;
+    DeinterlaceModeEnum _mode;
+    int _yadifMode; // 2 skips the spatial interlacing check
+    int _parity;
+    int _tff;
+    OfxRectI _srcRoDPixel; // the lines are numbered from the bottom of the source RoD, and the edges are the ones of the RoD
 
-//#define FFMIN(a,b) ((a) > (b) ? (b) : (a))
-//#define FFMAX(a,b) ((a) < (b) ? (b) : (a))
-//#define FFABS(a) ((a) > 0 ? (a) : (-(a)))
-#define FFMIN(a,b) std::min(a,b)
-#define FFMAX(a,b) std::max(a,b)
-#define FFABS(a) std::abs(a)
-
-#define FFMIN3(a,b,c) FFMIN(FFMIN(a,b),c)
-#define FFMAX3(a,b,c) FFMAX(FFMAX(a,b),c)
-
-inline float halven(float f) { return f*0.5f; }
-inline int halven(int i) { return i>>1; }
-
-inline int one1(unsigned char *) { return 1; }
-inline int one1(unsigned short *) { return 1; }
-inline float one1(float *) { return 0.f; }
-
-#define CHECK(j)\
-    {   Diff score = FFABS(cur[mrefs + ch * (- 1 + (j))] - cur[prefs + ch * (- 1 - (j))])\
-                 + FFABS(cur[mrefs   + ch * (j)] - cur[prefs   - ch * (j)])\
-                 + FFABS(cur[mrefs + ch * (1 + (j))] - cur[prefs + ch * (1 - (j))]);\
-        if(score < spatial_score){\
-            spatial_score= score;\
-            spatial_pred= halven(cur[mrefs  + ch * (j)] + cur[prefs  - ch * (j)]);\
-
-/* The is_not_edge argument here controls when the code will enter a branch
- * which reads up to and including x-3 and x+3. */
-
-#define FILTER(start, end, is_not_edge) \
-    for (x = start;  x < end; x++) { \
-        Diff c= cur[mrefs]; \
-        Diff d= halven(prev2[0] + next2[0]); \
-        Diff e= cur[prefs]; \
-        Diff temporal_diff0= FFABS(prev2[0] - next2[0]); \
-        Diff temporal_diff1=halven( FFABS(prev[mrefs] - c) + FFABS(prev[prefs] - e) ); \
-        Diff temporal_diff2=halven( FFABS(next[mrefs] - c) + FFABS(next[prefs] - e) ); \
-        Diff diff= FFMAX3(halven(temporal_diff0), temporal_diff1, temporal_diff2); \
-        Diff spatial_pred= halven(c+e); \
- \
-        if (is_not_edge) {\
-            Diff spatial_score = FFABS(cur[mrefs-ch] - cur[prefs-ch]) + FFABS(c-e) \
-                              + FFABS(cur[mrefs+ch] - cur[prefs+ch]) - one1((Comp*)0); \
-            CHECK(-1) CHECK(-2) }} }} \
-            CHECK( 1) CHECK( 2) }} }} \
-        }\
- \
-        if (!(mode&2)) { \
-            Diff b = halven(prev2[2 * mrefs] + next2[2 * mrefs]); \
-            Diff f = halven(prev2[2 * prefs] + next2[2 * prefs]); \
-            Diff max = FFMAX3(d - e, d - c, FFMIN(b - c, f - e)); \
-            Diff min = FFMIN3(d - e, d - c, FFMAX(b - c, f - e)); \
- \
-            diff = FFMAX3(diff, min, -max); \
-        } \
- \
-        if (spatial_pred > d + diff) \
-           spatial_pred = d + diff; \
-        else if (spatial_pred < d - diff) \
-           spatial_pred = d - diff; \
- \
-        dst[0] = (Comp)spatial_pred; \
- \
-        dst += ch; \
-        cur += ch; \
-        prev += ch; \
-        next += ch; \
-        prev2 += ch; \
-        next2 += ch; \
+public:
+    DeinterlaceProcessorBase(OFX::ImageEffect &instance)
+    : OFX::ImageProcessor(instance)
+    , _prevImg(0)
+    , _srcImg(0)
+    , _nextImg(0)
+    , _mode(eDeinterlaceModeYadif)
+    , _yadifMode(0)
+    , _parity(0)
+    , _tff(0)
+    {
+        _srcRoDPixel.x1 = _srcRoDPixel.y1 = _srcRoDPixel.x2 = _srcRoDPixel.y2 = 0;
     }
 
-template<int ch,typename Comp,typename Diff>
-inline void filter_line_c(Comp *dst1,
-                          const Comp *prev1, const Comp *cur1, const Comp *next1,
-                          int w, int prefs, int mrefs, int parity, int mode)
-{
-    Comp *dst  = dst1;
-    const Comp *prev = prev1;
-    const Comp *cur  = cur1;
-    const Comp *next = next1;
-    int x;
-    const Comp *prev2 = parity ? prev : cur ;
-    const Comp *next2 = parity ? cur  : next;
-
-    /* The function is called with the pointers already pointing to data[3] and
-     * with 6 subtracted from the width.  This allows the FILTER macro to be
-     * called so that it processes all the pixels normally.  A constant value of
-     * true for is_not_edge lets the compiler ignore the if statement. */
-    FILTER(0, w, 1)
-}
+    /** @brief set the source images. prev and next are only used by Yadif, and may be NULL. */
+    void setSrcImgs(const OFX::Image *prev, const OFX::Image *src, const OFX::Image *next) {_prevImg = prev; _srcImg = src; _nextImg = next;}
 
-#define MAX_ALIGN 8
-template<int ch,typename Comp,typename Diff>
-inline void filter_edges(Comp *dst1,
-                         const Comp *prev1, const Comp *cur1, const Comp *next1,
-                         int w, int prefs, int mrefs, int parity, int mode)
-{
-    Comp *dst  = dst1;
-    const Comp *prev = prev1;
-    const Comp *cur  = cur1;
-    const Comp *next = next1;
-    int x;
-    const Comp *prev2 = parity ? prev : cur ;
-    const Comp *next2 = parity ? cur  : next;
-
-    /* Only edge pixels need to be processed here.  A constant value of false
-     * for is_not_edge should let the compiler ignore the whole branch. */
-    FILTER(0, 3, 0)
-
-    dst  = dst1  + (w - 3)*ch;
-    prev = prev1 + (w - 3)*ch;
-    cur  = cur1  + (w - 3)*ch;
-    next = next1 + (w - 3)*ch;
-    prev2 = parity ? prev : cur;
-    next2 = parity ? cur  : next;
-
-    FILTER(w - 3, w, 0)
-}
-
-inline void interpolate(unsigned char *dst, const unsigned char *cur0,  const unsigned char *cur2, int w)
-{
-    int x;
-    for (x=0; x<w; x++) {
-        dst[x] = (cur0[x] + cur2[x] + 1)>>1; // simple average
+    void setValues(DeinterlaceModeEnum mode, int yadifMode, int parity, int tff, const OfxRectI &srcRoDPixel)
+    {
+        _mode = mode;
+        _yadifMode = yadifMode;
+        _parity = parity;
+        _tff = tff;
+        _srcRoDPixel = srcRoDPixel;
     }
-}
+};
 
-inline void interpolate(float *dst, const float *cur0,  const float *cur2, int w)
+// Each line only depends on the two lines above and below, so the image is processed by bands of lines
+template<int ch,typename Comp,typename Diff>
+class DeinterlaceProcessor : public DeinterlaceProcessorBase
 {
-    int x;
-    for (x=0; x<w; x++) {
-        dst[x] = (cur0[x] + cur2[x] )*0.5f; // simple average
+public:
+    DeinterlaceProcessor(OFX::ImageEffect &instance)
+    : DeinterlaceProcessorBase(instance)
+    , _lineFunction(DeinterlaceRowKernels::getLineFunction<ch,Comp>())
+    {
     }
-}
 
+private:
+    void multiThreadProcessImages(OfxRectI procWindow) OVERRIDE FINAL
+    {
+        const int w = _srcRoDPixel.x2 - _srcRoDPixel.x1;
+        const int h = _srcRoDPixel.y2 - _srcRoDPixel.y1;
+        const int n = (procWindow.x2 - procWindow.x1) * ch;
+        const int refs = _srcImg->getRowBytes() / (int)sizeof(Comp);
 
-template<int ch,typename Comp,typename Diff>
-static void filter_plane(int mode, Comp *dst, int dst_stride,
-                         const Comp *prev0, const Comp *cur0, const Comp *next0,
-                         int refs, int w, int h, int parity, int tff)
-{
-    int pix_3 = 3 * ch;
-    for (int y = 0; y < h; ++y) {
-        if (((y ^ parity) & 1)) {
-            const Comp *prev= prev0 + y*refs;
-            const Comp *cur = cur0 + y*refs;
-            const Comp *next= next0 + y*refs;
-            Comp *dst2= dst + y*dst_stride;
-            int mode2 = y == 1 || y + 2 == h ? 2 : mode;
-
-            for (int c = 0; c < ch; ++c) {
-                filter_line_c<ch,Comp,Diff>(dst2 + c + pix_3, prev + c + pix_3, cur + c + pix_3, next + c + pix_3, w - 6,
-                                            y + 1 < h ? refs : -refs,
-                                            y ? -refs : refs,
-                                            parity ^ tff, mode2);
-                filter_edges<ch,Comp,Diff>(dst2 + c, prev + c, cur + c, next + c, w,
-                                           y + 1 < h ? refs : -refs,
-                                           y ? -refs : refs,
-                                           parity ^ tff, mode2);
+        for (int y = procWindow.y1; y < procWindow.y2; ++y) {
+            if (_effect.abort()) {
+                break;
+            }
+            const int yy = y - _srcRoDPixel.y1;
+            Comp *dst = (Comp*)_dstImg->getPixelAddress(procWindow.x1, y);
+            const Comp *cur = (const Comp*)_srcImg->getPixelAddress(procWindow.x1, y);
+            assert(dst && cur);
+            const Comp *above = yy > 0 ? cur - refs : 0; // line yy-1
+            const Comp *below = yy + 1 < h ? cur + refs : 0; // line yy+1
+            const bool interpolated = ((yy ^ _parity) & 1);
+
+            switch (_mode) {
+                case eDeinterlaceModeWeave:
+                    std::memcpy(dst, cur, n * sizeof(Comp));
+                    break;
+                case eDeinterlaceModeBlend:
+                    if (above) {
+                        interpolate(dst, above, cur, n);
+                    } else {
+                        std::memcpy(dst, cur, n * sizeof(Comp));
+                    }
+                    break;
+                case eDeinterlaceModeBob:
+                case eDeinterlaceModeDiscard:
+                    // at full resolution, discarding a field also doubles the lines of the other field
+                    if (interpolated && (above || below)) {
+                        std::memcpy(dst, above ? above : below, n * sizeof(Comp));
+                    } else {
+                        std::memcpy(dst, cur, n * sizeof(Comp));
+                    }
+                    break;
+                case eDeinterlaceModeLinear:
+                    if (interpolated && above && below) {
+                        interpolate(dst, above, below, n);
+                    } else if (interpolated && (above || below)) {
+                        std::memcpy(dst, above ? above : below, n * sizeof(Comp));
+                    } else {
+                        std::memcpy(dst, cur, n * sizeof(Comp));
+                    }
+                    break;
+                case eDeinterlaceModeMean: {
+                    // both lines of each pair get the average of the pair
+                    const Comp *other = (yy & 1) ? above : below;
+                    if (other) {
+                        interpolate(dst, cur, other, n);
+                    } else {
+                        std::memcpy(dst, cur, n * sizeof(Comp));
+                    }
+                    break;
+                }
+                case eDeinterlaceModeYadif:
+                    if (interpolated) {
+                        const Comp *prev = _prevImg ? (const Comp*)_prevImg->getPixelAddress(procWindow.x1, y) : cur;
+                        const Comp *next = _nextImg ? (const Comp*)_nextImg->getPixelAddress(procWindow.x1, y) : cur;
+                        filter_line<ch,Comp,Diff>(dst, prev, cur, next,
+                                                  procWindow.x1 - _srcRoDPixel.x1, procWindow.x2 - _srcRoDPixel.x1, w,
+                                                  yy + 1 < h ? refs : -refs,
+                                                  yy ? -refs : refs,
+                                                  _parity ^ _tff, yy == 1 || yy + 2 == h ? 2 : _yadifMode,
+                                                  _lineFunction);
+                    } else {
+                        std::memcpy(dst, cur, n * sizeof(Comp)); // copy original
+                    }
+                    break;
             }
-        } else {
-            std::memcpy(&dst[y * dst_stride],
-                   &cur0[y * refs], w * ch * sizeof(Comp)); // copy original
         }
     }
-    
-}
 
-template<int ch,typename Comp,typename Diff>
-static void filter_plane_ofx(int mode,
-                             OFX::Image *dst_,
-                             const OFX::Image *srcp,
-                             const OFX::Image *src,
-                             const OFX::Image *srcn,
-                             int parity, int tff)
+    // the vectorized Yadif function, or NULL
+    typename DeinterlaceRowKernels::YadifLine<Comp>::Function _lineFunction;
+};
+
+static bool
+rectContains(const OfxRectI &outer, const OfxRectI &inner)
 {
-    Comp *dst = (Comp*)dst_->getPixelData(); // change this when we support renderWindow
-    int dst_stride = dst_->getRowBytes() / sizeof(Comp);
-    const Comp *prev0 = (const Comp*)(srcp ? srcp->getPixelData() : src->getPixelData());
-    const Comp *cur0 = (const Comp*)src->getPixelData();
-    const Comp *next0 = (const Comp*)(srcn ? srcn->getPixelData() : src->getPixelData());
-    int refs = src->getRowBytes() / sizeof(Comp);
-    const OfxRectI bounds = dst_->getBounds();
-    filter_plane<ch, Comp, Diff>(mode, dst, dst_stride,
-                                 prev0, cur0, next0,
-                                 refs,
-                                 bounds.x2 - bounds.x1, bounds.y2 - bounds.y1,
-                                 parity, tff);
+    return outer.x1 <= inner.x1 && inner.x2 <= outer.x2 && outer.y1 <= inner.y1 && inner.y2 <= outer.y2;
 }
 
-// =========== GNU Lesser General Public License code end =================
-
-void DeinterlacePlugin::render(const OFX::RenderArguments &args)
+/* set up and run a processor */
+void
+DeinterlacePlugin::setupAndProcess(DeinterlaceProcessorBase &processor,
+                                   const OFX::RenderArguments &args)
 {
-    if (!kSupportsRenderScale && (args.renderScale.x != 1. || args.renderScale.y != 1.)) {
-        OFX::throwSuiteStatusException(kOfxStatFailed);
-    }
-
-    OFX::BitDepthEnum       dstBitDepth    = _dstClip->getPixelDepth();
-    OFX::PixelComponentEnum dstComponents  = _dstClip->getPixelComponents();
-
-    assert(kSupportsMultipleClipPARs   || !_srcClip || _srcClip->getPixelAspectRatio() == _dstClip->getPixelAspectRatio());
-    assert(kSupportsMultipleClipDepths || !_srcClip || _srcClip->getPixelDepth()       == _dstClip->getPixelDepth());
     std::auto_ptr<OFX::Image> dst(_dstClip->fetchImage(args.time));
     if (!dst.get()) {
         OFX::throwSuiteStatusException(kOfxStatFailed);
@@ -456,11 +382,23 @@ void DeinterlacePlugin::render(const OFX::RenderArguments &args)
         OFX::throwSuiteStatusException(kOfxStatFailed);
     }
 
+    int imode       = 0;
+    int ifieldOrder = 2;
+    int iparity     = 0;
+    int iyadifMode  = 0;
+
+    mode->getValueAtTime(args.time,imode);
+    fieldOrder->getValueAtTime(args.time,ifieldOrder);
+    parity->getValueAtTime(args.time,iparity);
+    yadifMode->getValueAtTime(args.time,iyadifMode);
+
+    // only Yadif uses the previous and next frames
+    const bool yadif = ((DeinterlaceModeEnum)imode == eDeinterlaceModeYadif);
     std::auto_ptr<const OFX::Image> src((_srcClip && _srcClip->isConnected()) ?
                                         _srcClip->fetchImage(args.time) : 0);
-    std::auto_ptr<const OFX::Image> srcp((_srcClip && _srcClip->isConnected()) ?
+    std::auto_ptr<const OFX::Image> srcp((yadif && _srcClip && _srcClip->isConnected()) ?
                                          _srcClip->fetchImage(args.time-1) : 0);
-    std::auto_ptr<const OFX::Image> srcn((_srcClip && _srcClip->isConnected()) ?
+    std::auto_ptr<const OFX::Image> srcn((yadif && _srcClip && _srcClip->isConnected()) ?
                                          _srcClip->fetchImage(args.time+1) : 0);
     if (src.get()) {
         if (src->getRenderScale().x != args.renderScale.x ||
@@ -487,20 +425,36 @@ void DeinterlacePlugin::render(const OFX::RenderArguments &args)
         }
     }
 
-    const OfxRectI rect = dst->getBounds();
-
-    int width=rect.x2-rect.x1;
-    int height=rect.y2-rect.y1;
+    OfxRectI srcRoDPixel;
+    OFX::MergeImages2D::toPixelEnclosing(_srcClip->getRegionOfDefinition(args.time), args.renderScale, _srcClip->getPixelAspectRatio(), &srcRoDPixel);
+    int width = srcRoDPixel.x2 - srcRoDPixel.x1;
+    int height = srcRoDPixel.y2 - srcRoDPixel.y1;
 
-    int imode       = 0;
-    int ifieldOrder = 2;
-    int iparity     = 0;
-
-    mode->getValueAtTime(args.time,imode);
-    fieldOrder->getValueAtTime(args.time,ifieldOrder);
-    parity->getValueAtTime(args.time,iparity);
+    if (!src.get() || width < 3 || height < 3) {
+        // Video of less than 3 columns or lines is not supported
+        // just copy src to dst
+        copyPixels(*this, args.renderWindow, src.get(), dst.get());
+        return;
+    }
 
-    imode*=2;
+    // the part of the source images that is read (see getRegionsOfInterest)
+    OfxRectI srcWindow = args.renderWindow;
+    srcWindow.x1 -= 3;
+    srcWindow.x2 += 3;
+    srcWindow.y1 -= 2;
+    srcWindow.y2 += 2;
+    OFX::MergeImages2D::rectIntersection(srcWindow, srcRoDPixel, &srcWindow);
+    if (!rectContains(src->getBounds(), srcWindow)) {
+        setPersistentMessage(OFX::Message::eMessageError, "", "OFX Host gave source image with wrong dimensions");
+        OFX::throwSuiteStatusException(kOfxStatFailed);
+    }
+    // the lines of the current frame are used in place of a missing or incompatible previous or next frame
+    if (srcp.get() && (srcp->getRowBytes() != src->getRowBytes() || !rectContains(srcp->getBounds(), srcWindow))) {
+        srcp.reset(0);
+    }
+    if (srcn.get() && (srcn->getRowBytes() != src->getRowBytes() || !rectContains(srcn->getBounds(), srcWindow))) {
+        srcn.reset(0);
+    }
 
     if (ifieldOrder==2) {
         if (width>1024) {
@@ -510,119 +464,66 @@ void DeinterlacePlugin::render(const OFX::RenderArguments &args)
         }
     }
 
+    processor.setDstImg(dst.get());
+    processor.setSrcImgs(srcp.get(), src.get(), srcn.get());
+    processor.setRenderWindow(args.renderWindow);
+    processor.setValues((DeinterlaceModeEnum)imode,
+                        (YadifModeEnum)iyadifMode == eYadifModeTemporal ? 2 : 0,
+                        iparity, ifieldOrder, // parity, tff
+                        srcRoDPixel);
 
-    if (width < 3 || height < 3) {
-        // Video of less than 3 columns or lines is not supported
-        // just copy sc to dst
-        for (int y=0; y<height; y++) {
-            std::memcpy(dst->getPixelAddress(0,y),src->getPixelAddress(0,y),abs(src->getRowBytes()));
-        }
-    } else {
-        if (dstComponents == OFX::ePixelComponentRGBA) {
-            switch(dstBitDepth) {
-            case OFX::eBitDepthUByte:
-                filter_plane_ofx<4,unsigned char,int>(imode, // mode
-                                                      dst.get(),
-                                                      srcp.get(), src.get(), srcn.get(),
-                                                      iparity,ifieldOrder); // parity, tff
-                break;
-
-            case OFX::eBitDepthUShort:
-                filter_plane_ofx<4,unsigned short,int>(imode, // mode
-                                                       dst.get(),
-                                                       srcp.get(), src.get(), srcn.get(),
-                                                       iparity,ifieldOrder); // parity, tff
-                    break;
-                    
-            case OFX::eBitDepthFloat:
-                    filter_plane_ofx<4,float,float>(imode, // mode
-                                                    dst.get(),
-                                                    srcp.get(), src.get(), srcn.get(),
-                                                    iparity,ifieldOrder); // parity, tff
-                    break;
-
-            default:
-                break;
-            }
-        } else if (dstComponents == OFX::ePixelComponentRGB) {
-            switch(dstBitDepth) {
-                case OFX::eBitDepthUByte:
-                    filter_plane_ofx<3,unsigned char,int>(imode, // mode
-                                                          dst.get(),
-                                                          srcp.get(), src.get(), srcn.get(),
-                                                          iparity,ifieldOrder); // parity, tff
-                    break;
-
-                case OFX::eBitDepthUShort:
-                    filter_plane_ofx<3,unsigned short,int>(imode, // mode
-                                                           dst.get(),
-                                                           srcp.get(), src.get(), srcn.get(),
-                                                           iparity,ifieldOrder); // parity, tff
-                    break;
-
-                case OFX::eBitDepthFloat:
-                    filter_plane_ofx<3,float,float>(imode, // mode
-                                                    dst.get(),
-                                                    srcp.get(), src.get(), srcn.get(),
-                                                    iparity,ifieldOrder); // parity, tff
-                    break;
-
-                default:
-                    break;
-            }
-        } else if (dstComponents == OFX::ePixelComponentXY) {
-            switch(dstBitDepth) {
-                case OFX::eBitDepthUByte:
-                    filter_plane_ofx<2,unsigned char,int>(imode, // mode
-                                                          dst.get(),
-                                                          srcp.get(), src.get(), srcn.get(),
-                                                          iparity,ifieldOrder); // parity, tff
-                    break;
-
-                case OFX::eBitDepthUShort:
-                    filter_plane_ofx<2,unsigned short,int>(imode, // mode
-                                                           dst.get(),
-                                                           srcp.get(), src.get(), srcn.get(),
-                                                           iparity,ifieldOrder); // parity, tff
-                    break;
+    // Call the base class process member, this will call the derived templated process code
+    processor.process();
+}
 
-                case OFX::eBitDepthFloat:
-                    filter_plane_ofx<2,float,float>(imode, // mode
-                                                    dst.get(),
-                                                    srcp.get(), src.get(), srcn.get(),
-                                                    iparity,ifieldOrder); // parity, tff
-                    break;
+// the internal render function
+template <int nComponents>
+void
+DeinterlacePlugin::renderInternal(const OFX::RenderArguments &args,
+                                  OFX::BitDepthEnum dstBitDepth)
+{
+    switch (dstBitDepth) {
+        case OFX::eBitDepthUByte: {
+            DeinterlaceProcessor<nComponents, unsigned char, int> fred(*this);
+            setupAndProcess(fred, args);
+            break;
+        }
+        case OFX::eBitDepthUShort: {
+            DeinterlaceProcessor<nComponents, unsigned short, int> fred(*this);
+            setupAndProcess(fred, args);
+            break;
+        }
+        case OFX::eBitDepthFloat: {
+            DeinterlaceProcessor<nComponents, float, float> fred(*this);
+            setupAndProcess(fred, args);
+            break;
+        }
+        default:
+            OFX::throwSuiteStatusException(kOfxStatErrUnsupported);
+    }
+}
 
-                default:
-                    break;
-            }
-        } else if (dstComponents == OFX::ePixelComponentAlpha) {
-            switch(dstBitDepth) {
-            case OFX::eBitDepthUByte:
-                    filter_plane_ofx<1,unsigned char,int>(imode, // mode
-                                                          dst.get(),
-                                                          srcp.get(), src.get(), srcn.get(),
-                                                          iparity,ifieldOrder); // parity, tff
-                    break;
+void DeinterlacePlugin::render(const OFX::RenderArguments &args)
+{
+    if (!kSupportsRenderScale && (args.renderScale.x != 1. || args.renderScale.y != 1.)) {
+        OFX::throwSuiteStatusException(kOfxStatFailed);
+    }
 
-            case OFX::eBitDepthUShort:
-                    filter_plane_ofx<1,unsigned short,int>(imode, // mode
-                                                           dst.get(),
-                                                           srcp.get(), src.get(), srcn.get(),
-                                                           iparity,ifieldOrder); // parity, tff
-                    break;
+    OFX::BitDepthEnum       dstBitDepth    = _dstClip->getPixelDepth();
+    OFX::PixelComponentEnum dstComponents  = _dstClip->getPixelComponents();
 
-            case OFX::eBitDepthFloat:
-                    filter_plane_ofx<1,float,float>(imode, // mode
-                                                    dst.get(),
-                                                    srcp.get(), src.get(), srcn.get(),
-                                                    iparity,ifieldOrder); // parity, tff
-                    break;
+    assert(kSupportsMultipleClipPARs   || !_srcClip || _srcClip->getPixelAspectRatio() == _dstClip->getPixelAspectRatio());
+    assert(kSupportsMultipleClipDepths || !_srcClip || _srcClip->getPixelDepth()       == _dstClip->getPixelDepth());
 
-            default:
-                break;
-            }
-        }
+    if (dstComponents == OFX::ePixelComponentRGBA) {
+        renderInternal<4>(args, dstBitDepth);
+    } else if (dstComponents == OFX::ePixelComponentRGB) {
+        renderInternal<3>(args, dstBitDepth);
+    } else if (dstComponents == OFX::ePixelComponentXY) {
+        renderInternal<2>(args, dstBitDepth);
+    } else {
+        assert(dstComponents == OFX::ePixelComponentAlpha);
+        renderInternal<1>(args, dstBitDepth);
     }
 }
 
@@ -647,13 +548,21 @@ DeinterlacePlugin::getRegionOfDefinition(const OFX::RegionOfDefinitionArguments
 
 bool
 DeinterlacePlugin::isIdentity(const OFX::IsIdentityArguments &args,
-                              OFX::Clip * &/*identityClip*/,
-                              double &/*identityTime*/)
+                              OFX::Clip * &identityClip,
+                              double &identityTime)
 {
     if (!kSupportsRenderScale && (args.renderScale.x != 1. || args.renderScale.y != 1.)) {
         OFX::throwSuiteStatusException(kOfxStatFailed);
     }
 
+    int imode;
+    mode->getValueAtTime(args.time, imode);
+    if ((DeinterlaceModeEnum)imode == eDeinterlaceModeWeave) {
+        identityClip = _srcClip;
+        identityTime = args.time;
+        return true;
+    }
+
     return false;
 }
 
@@ -661,12 +570,35 @@ void
 DeinterlacePlugin::getFramesNeeded(const OFX::FramesNeededArguments &args,
                                    OFX::FramesNeededSetter &frames)
 {
+    int imode;
+    mode->getValueAtTime(args.time, imode);
     OfxRangeD range;
-    range.min = args.time - 1;
-    range.max = args.time + 1;
+    if ((DeinterlaceModeEnum)imode == eDeinterlaceModeYadif) {
+        range.min = args.time - 1;
+        range.max = args.time + 1;
+    } else {
+        // the other modes only use the current frame
+        range.min = args.time;
+        range.max = args.time;
+    }
     frames.setFramesNeeded(*_srcClip, range);
 }
 
+void
+DeinterlacePlugin::getRegionsOfInterest(const OFX::RegionsOfInterestArguments &args,
+                                        OFX::RegionOfInterestSetter &rois)
+{
+    // Yadif reads 3 pixels on each side and 2 lines above and below each pixel
+    const double par = _srcClip->getPixelAspectRatio();
+    OfxRectD roi = args.regionOfInterest;
+    roi.x1 -= 3 * par / args.renderScale.x;
+    roi.x2 += 3 * par / args.renderScale.x;
+    roi.y1 -= 2 / args.renderScale.y;
+    roi.y2 += 2 / args.renderScale.y;
+    OFX::MergeImages2D::rectIntersection(roi, _srcClip->getRegionOfDefinition(args.time), &roi);
+    rois.setRegionOfInterest(*_srcClip, roi);
+}
+
 mDeclarePluginFactory(DeinterlacePluginFactory, {}, {});
 
 using namespace OFX;
@@ -748,7 +680,6 @@ void DeinterlacePluginFactory::describeInContext(OFX::ImageEffectDescriptor &des
         param->appendOption(kParamModeOptionYadif, kParamModeOptionYadifHint);
         param->setDefault(int(eDeinterlaceModeYadif));
         param->setAnimates(true); // can animate
-        param->setIsSecret(true); // Not yet implemented!
         if (page) {
             page->addChild(*param);
         }
@@ -0,0 +1,395 @@
+/*
+ OFX Deinterlace plugin: vectorized Yadif kernels.
+
+ These kernels compute the same function as the filter_line_c function of DeinterlaceYadif.h,
+ which comes from the yadif filter of FFmpeg (libavfilter/vf_yadif.c), and give exactly the
+ same results (see tests/DeinterlaceRowKernelsTest.cpp).
+
+ Copyright notice and licence from the original libavfilter/vf_yadif.c file:
+
+ * Copyright (C) 2006-2011 Michael Niedermayer <michaelni@gmx.at>
+ *               2010      James Darnley <james.darnley@gmail.com>
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef Misc_DeinterlaceRowKernels_h
+#define Misc_DeinterlaceRowKernels_h
+
+#include <algorithm>
+
+// SSE2 is part of the x86-64 baseline, and is enabled on 32-bit x86 by -msse2 or /arch:SSE2
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define kDeinterlaceRowKernelsSSE2 1
+#include <emmintrin.h>
+#else
+#define kDeinterlaceRowKernelsSSE2 0
+#endif
+
+// The AVX2 kernels are compiled with a target attribute (no compiler flag is needed), and are
+// only used if the CPU supports AVX2.
+#if kDeinterlaceRowKernelsSSE2 && (defined(__clang__) || (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+#define kDeinterlaceRowKernelsAVX2 1
+#define DEINTERLACE_TARGET_AVX2 __attribute__((target("avx2")))
+#include <immintrin.h>
+#elif kDeinterlaceRowKernelsSSE2 && defined(_MSC_VER) && _MSC_VER >= 1700
+#define kDeinterlaceRowKernelsAVX2 1
+#define DEINTERLACE_TARGET_AVX2
+#include <immintrin.h>
+#include <intrin.h>
+#else
+#define kDeinterlaceRowKernelsAVX2 0
+#endif
+
+// a line function may only be called on at least that many components (w*ch)
+#define kDeinterlaceRowKernelsMinElements 8
+
+namespace DeinterlaceRowKernels {
+
+/// Yadif on all the components of w pixels of a line, which must be at least 3 pixels away
+/// from the edges of the image (same arguments as filter_line_c, but the pointers point to the first component).
+template <typename Comp>
+struct YadifLine
+{
+    typedef void (*Function)(Comp *dst, const Comp *prev, const Comp *cur, const Comp *next,
+                             int w, int prefs, int mrefs, int parity, int mode);
+};
+
+#if kDeinterlaceRowKernelsSSE2
+// The operations of the yadif formula on a vector of components, with the same rounding as the scalar code.
+template <typename Comp>
+struct VecSSE2;
+
+// 8 components in 16-bit lanes: all intermediate values fit
+template <>
+struct VecSSE2<unsigned char>
+{
+    typedef __m128i V;
+    enum { N = 8 };
+    static inline V load(const unsigned char *p) { return _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)p), _mm_setzero_si128()); }
+    // the scalar code casts the result to unsigned char, which keeps the low byte
+    static inline void store(unsigned char *p, V v) { v = _mm_and_si128(v, _mm_set1_epi16(0xff)); _mm_storel_epi64((__m128i*)p, _mm_packus_epi16(v, v)); }
+    static inline V add(V a, V b) { return _mm_add_epi16(a, b); }
+    static inline V sub(V a, V b) { return _mm_sub_epi16(a, b); }
+    static inline V neg(V a) { return _mm_sub_epi16(_mm_setzero_si128(), a); }
+    static inline V absdiff(V a, V b) { V d = sub(a, b); return _mm_max_epi16(d, neg(d)); }
+    static inline V half(V a) { return _mm_srai_epi16(a, 1); }
+    static inline V max(V a, V b) { return _mm_max_epi16(a, b); }
+    static inline V min(V a, V b) { return _mm_min_epi16(a, b); }
+    static inline V lt(V a, V b) { return _mm_cmplt_epi16(a, b); }
+    static inline V gt(V a, V b) { return _mm_cmpgt_epi16(a, b); }
+    static inline V and_(V m, V n) { return _mm_and_si128(m, n); }
+    static inline V andnot(V m, V n) { return _mm_andnot_si128(m, n); }
+    static inline V select(V m, V a, V b) { return _mm_or_si128(_mm_and_si128(m, a), _mm_andnot_si128(m, b)); }
+    static inline V scoreBias() { return _mm_set1_epi16(1); }
+};
+
+// 4 components in 32-bit lanes, since the sums of two components do not fit in 16 bits.
+// SSE2 has no 32-bit min and max, so they are made from comparisons.
+template <>
+struct VecSSE2<unsigned short>
+{
+    typedef __m128i V;
+    enum { N = 4 };
+    static inline V load(const unsigned short *p) { return _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)p), _mm_setzero_si128()); }
+    // the scalar code casts the result to unsigned short, which keeps the low 16 bits:
+    // sign-extend them so that the signed saturation of packs does not change them
+    static inline void store(unsigned short *p, V v) { v = _mm_srai_epi32(_mm_slli_epi32(v, 16), 16); _mm_storel_epi64((__m128i*)p, _mm_packs_epi32(v, v)); }
+    static inline V add(V a, V b) { return _mm_add_epi32(a, b); }
+    static inline V sub(V a, V b) { return _mm_sub_epi32(a, b); }
+    static inline V neg(V a) { return _mm_sub_epi32(_mm_setzero_si128(), a); }
+    static inline V select(V m, V a, V b) { return _mm_or_si128(_mm_and_si128(m, a), _mm_andnot_si128(m, b)); }
+    static inline V max(V a, V b) { return select(_mm_cmpgt_epi32(a, b), a, b); }
+    static inline V min(V a, V b) { return select(_mm_cmpgt_epi32(a, b), b, a); }
+    static inline V absdiff(V a, V b) { V d = sub(a, b); return max(d, neg(d)); }
+    static inline V half(V a) { return _mm_srai_epi32(a, 1); }
+    static inline V lt(V a, V b) { return _mm_cmplt_epi32(a, b); }
+    static inline V gt(V a, V b) { return _mm_cmpgt_epi32(a, b); }
+    static inline V and_(V m, V n) { return _mm_and_si128(m, n); }
+    static inline V andnot(V m, V n) { return _mm_andnot_si128(m, n); }
+    static inline V scoreBias() { return _mm_set1_epi32(1); }
+};
+
+template <>
+struct VecSSE2<float>
+{
+    typedef __m128 V;
+    enum { N = 4 };
+    static inline V load(const float *p) { return _mm_loadu_ps(p); }
+    static inline void store(float *p, V v) { _mm_storeu_ps(p, v); }
+    static inline V add(V a, V b) { return _mm_add_ps(a, b); }
+    static inline V sub(V a, V b) { return _mm_sub_ps(a, b); }
+    // -x flips the sign bit (0-x would give +0 for +0)
+    static inline V neg(V a) { return _mm_xor_ps(a, _mm_set1_ps(-0.f)); }
+    static inline V absdiff(V a, V b) { return _mm_andnot_ps(_mm_set1_ps(-0.f), sub(a, b)); }
+    static inline V half(V a) { return _mm_mul_ps(a, _mm_set1_ps(0.5f)); }
+    // std::max(a,b) returns a unless a < b, which is what maxps(b,a) does (also for NaN and signed zeroes)
+    static inline V max(V a, V b) { return _mm_max_ps(b, a); }
+    // std::min(a,b) returns a unless b < a, which is what minps(b,a) does
+    static inline V min(V a, V b) { return _mm_min_ps(b, a); }
+    static inline V lt(V a, V b) { return _mm_cmplt_ps(a, b); }
+    static inline V gt(V a, V b) { return _mm_cmpgt_ps(a, b); }
+    static inline V and_(V m, V n) { return _mm_and_ps(m, n); }
+    static inline V andnot(V m, V n) { return _mm_andnot_ps(m, n); }
+    static inline V select(V m, V a, V b) { return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+    // one1() is 0 for float
+    static inline V scoreBias() { return _mm_setzero_ps(); }
+};
+#endif // kDeinterlaceRowKernelsSSE2
+
+#if kDeinterlaceRowKernelsAVX2
+// The same operations on twice as many components
+template <typename Comp>
+struct VecAVX2;
+
+// 16 components in 16-bit lanes
+template <>
+struct VecAVX2<unsigned char>
+{
+    typedef __m256i V;
+    enum { N = 16 };
+    DEINTERLACE_TARGET_AVX2 static inline V load(const unsigned char *p) { return _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)p)); }
+    DEINTERLACE_TARGET_AVX2 static inline void store(unsigned char *p, V v) { v = _mm256_and_si256(v, _mm256_set1_epi16(0xff)); _mm_storeu_si128((__m128i*)p, _mm_packus_epi16(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1))); }
+    DEINTERLACE_TARGET_AVX2 static inline V add(V a, V b) { return _mm256_add_epi16(a, b); }
+    DEINTERLACE_TARGET_AVX2 static inline V sub(V a, V b) { return _mm256_sub_epi16(a, b); }
+    DEINTERLACE_TARGET_AVX2 static inline V neg(V a) { return _mm256_sub_epi16(_mm256_setzero_si256(), a); }
+    DEINTERLACE_TARGET_AVX2 static inline V absdiff(V a, V b) { return _mm256_abs_epi16(sub(a, b)); }
+    DEINTERLACE_TARGET_AVX2 static inline V half(V a) { return _mm256_srai_epi16(a, 1); }
+    DEINTERLACE_TARGET_AVX2 static inline V max(V a, V b) { return _mm256_max_epi16(a, b); }
+    DEINTERLACE_TARGET_AVX2 static inline V min(V a, V b) { return _mm256_min_epi16(a, b); }
+    DEINTERLACE_TARGET_AVX2 static inline V lt(V a, V b) { return _mm256_cmpgt_epi16(b, a); }
+    DEINTERLACE_TARGET_AVX2 static inline V gt(V a, V b) { return _mm256_cmpgt_epi16(a, b); }
+    DEINTERLACE_TARGET_AVX2 static inline V and_(V m, V n) { return _mm256_and_si256(m, n); }
+    DEINTERLACE_TARGET_AVX2 static inline V andnot(V m, V n) { return _mm256_andnot_si256(m, n); }
+    DEINTERLACE_TARGET_AVX2 static inline V select(V m, V a, V b) { return _mm256_or_si256(_mm256_and_si256(m, a), _mm256_andnot_si256(m, b)); }
+    DEINTERLACE_TARGET_AVX2 static inline V scoreBias() { return _mm256_set1_epi16(1); }
+};
+
+// 8 components in 32-bit lanes
+template <>
+struct VecAVX2<unsigned short>
+{
+    typedef __m256i V;
+    enum { N = 8 };
+    DEINTERLACE_TARGET_AVX2 static inline V load(const unsigned short *p) { return _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)p)); }
+    DEINTERLACE_TARGET_AVX2 static inline void store(unsigned short *p, V v) { v = _mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16); _mm_storeu_si128((__m128i*)p, _mm_packs_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1))); }
+    DEINTERLACE_TARGET_AVX2 static inline V add(V a, V b) { return _mm256_add_epi32(a, b); }
+    DEINTERLACE_TARGET_AVX2 static inline V sub(V a, V b) { return _mm256_sub_epi32(a, b); }
+    DEINTERLACE_TARGET_AVX2 static inline V neg(V a) { return _mm256_sub_epi32(_mm256_setzero_si256(), a); }
+    DEINTERLACE_TARGET_AVX2 static inline V absdiff(V a, V b) { return _mm256_abs_epi32(sub(a, b)); }
+    DEINTERLACE_TARGET_AVX2 static inline V half(V a) { return _mm256_srai_epi32(a, 1); }
+    DEINTERLACE_TARGET_AVX2 static inline V max(V a, V b) { return _mm256_max_epi32(a, b); }
+    DEINTERLACE_TARGET_AVX2 static inline V min(V a, V b) { return _mm256_min_epi32(a, b); }
+    DEINTERLACE_TARGET_AVX2 static inline V lt(V a, V b) { return _mm256_cmpgt_epi32(b, a); }
+    DEINTERLACE_TARGET_AVX2 static inline V gt(V a, V b) { return _mm256_cmpgt_epi32(a, b); }
+    DEINTERLACE_TARGET_AVX2 static inline V and_(V m, V n) { return _mm256_and_si256(m, n); }
+    DEINTERLACE_TARGET_AVX2 static inline V andnot(V m, V n) { return _mm256_andnot_si256(m, n); }
+    DEINTERLACE_TARGET_AVX2 static inline V select(V m, V a, V b) { return _mm256_or_si256(_mm256_and_si256(m, a), _mm256_andnot_si256(m, b)); }
+    DEINTERLACE_TARGET_AVX2 static inline V scoreBias() { return _mm256_set1_epi32(1); }
+};
+
+template <>
+struct VecAVX2<float>
+{
+    typedef __m256 V;
+    enum { N = 8 };
+    DEINTERLACE_TARGET_AVX2 static inline V load(const float *p) { return _mm256_loadu_ps(p); }
+    DEINTERLACE_TARGET_AVX2 static inline void store(float *p, V v) { _mm256_storeu_ps(p, v); }
+    DEINTERLACE_TARGET_AVX2 static inline V add(V a, V b) { return _mm256_add_ps(a, b); }
+    DEINTERLACE_TARGET_AVX2 static inline V sub(V a, V b) { return _mm256_sub_ps(a, b); }
+    DEINTERLACE_TARGET_AVX2 static inline V neg(V a) { return _mm256_xor_ps(a, _mm256_set1_ps(-0.f)); }
+    DEINTERLACE_TARGET_AVX2 static inline V absdiff(V a, V b) { return _mm256_andnot_ps(_mm256_set1_ps(-0.f), sub(a, b)); }
+    DEINTERLACE_TARGET_AVX2 static inline V half(V a) { return _mm256_mul_ps(a, _mm256_set1_ps(0.5f)); }
+    DEINTERLACE_TARGET_AVX2 static inline V max(V a, V b) { return _mm256_max_ps(b, a); }
+    DEINTERLACE_TARGET_AVX2 static inline V min(V a, V b) { return _mm256_min_ps(b, a); }
+    // the same predicates as cmpltps and cmpgtps
+    DEINTERLACE_TARGET_AVX2 static inline V lt(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_LT_OS); }
+    DEINTERLACE_TARGET_AVX2 static inline V gt(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_GT_OS); }
+    DEINTERLACE_TARGET_AVX2 static inline V and_(V m, V n) { return _mm256_and_ps(m, n); }
+    DEINTERLACE_TARGET_AVX2 static inline V andnot(V m, V n) { return _mm256_andnot_ps(m, n); }
+    DEINTERLACE_TARGET_AVX2 static inline V select(V m, V a, V b) { return _mm256_or_ps(_mm256_and_ps(m, a), _mm256_andnot_ps(m, b)); }
+    DEINTERLACE_TARGET_AVX2 static inline V scoreBias() { return _mm256_setzero_ps(); }
+};
+#endif // kDeinterlaceRowKernelsAVX2
+
+// The yadif formula on vectors of S::N components, S being VecSSE2<Comp> or VecAVX2<Comp>.
+// The functions are defined by a macro, so that they can be compiled for each instruction set:
+// a function may only be inlined in a function compiled for the same or a larger instruction set.
+#define DEINTERLACE_YADIF_FUNCTIONS(TARGET, isa) \
+/* spatial score and prediction of the CHECK(j) macro */ \
+template <int ch, typename Comp> \
+TARGET inline void \
+yadifCheck##isa(const Comp *cur, int prefs, int mrefs, int j, \
+                typename Vec##isa<Comp>::V *score, typename Vec##isa<Comp>::V *pred) \
+{ \
+    typedef Vec##isa<Comp> S; \
+    *score = S::add(S::add(S::absdiff(S::load(cur + mrefs + ch * (-1 + j)), S::load(cur + prefs + ch * (-1 - j))), \
+                           S::absdiff(S::load(cur + mrefs + ch * j), S::load(cur + prefs - ch * j))), \
+                    S::absdiff(S::load(cur + mrefs + ch * (1 + j)), S::load(cur + prefs + ch * (1 - j)))); \
+    *pred = S::half(S::add(S::load(cur + mrefs + ch * j), S::load(cur + prefs - ch * j))); \
+} \
+ \
+/* the FILTER macro with is_not_edge=1, on S::N consecutive components */ \
+template <int ch, typename Comp> \
+TARGET inline void \
+yadifVector##isa(Comp *dst, const Comp *prev, const Comp *cur, const Comp *next, \
+                 int prefs, int mrefs, int parity, int mode) \
+{ \
+    typedef Vec##isa<Comp> S; \
+    typedef typename S::V V; \
+    const Comp *prev2 = parity ? prev : cur; \
+    const Comp *next2 = parity ? cur  : next; \
+ \
+    const V c = S::load(cur + mrefs); \
+    const V p20 = S::load(prev2); \
+    const V n20 = S::load(next2); \
+    const V d = S::half(S::add(p20, n20)); \
+    const V e = S::load(cur + prefs); \
+    const V temporal_diff0 = S::absdiff(p20, n20); \
+    const V temporal_diff1 = S::half(S::add(S::absdiff(S::load(prev + mrefs), c), S::absdiff(S::load(prev + prefs), e))); \
+    const V temporal_diff2 = S::half(S::add(S::absdiff(S::load(next + mrefs), c), S::absdiff(S::load(next + prefs), e))); \
+    V diff = S::max(S::max(S::half(temporal_diff0), temporal_diff1), temporal_diff2); \
+    V spatial_pred = S::half(S::add(c, e)); \
+    V spatial_score = S::sub(S::add(S::add(S::absdiff(S::load(cur + mrefs - ch), S::load(cur + prefs - ch)), \
+                                           S::absdiff(c, e)), \
+                                    S::absdiff(S::load(cur + mrefs + ch), S::load(cur + prefs + ch))), \
+                             S::scoreBias()); \
+ \
+    /* CHECK(-1) CHECK(-2) and CHECK(1) CHECK(2): the second check is only done where the first one succeeded */ \
+    for (int side = -1; side <= 1; side += 2) { \
+        V score, pred; \
+        yadifCheck##isa<ch, Comp>(cur, prefs, mrefs, side, &score, &pred); \
+        V m = S::lt(score, spatial_score); \
+        spatial_score = S::select(m, score, spatial_score); \
+        spatial_pred = S::select(m, pred, spatial_pred); \
+        yadifCheck##isa<ch, Comp>(cur, prefs, mrefs, 2 * side, &score, &pred); \
+        m = S::and_(m, S::lt(score, spatial_score)); \
+        spatial_score = S::select(m, score, spatial_score); \
+        spatial_pred = S::select(m, pred, spatial_pred); \
+    } \
+ \
+    if (!(mode&2)) { \
+        const V b = S::half(S::add(S::load(prev2 + 2 * mrefs), S::load(next2 + 2 * mrefs))); \
+        const V f = S::half(S::add(S::load(prev2 + 2 * prefs), S::load(next2 + 2 * prefs))); \
+        const V de = S::sub(d, e); \
+        const V dc = S::sub(d, c); \
+        const V bc = S::sub(b, c); \
+        const V fe = S::sub(f, e); \
+        const V max = S::max(S::max(de, dc), S::min(bc, fe)); \
+        const V min = S::min(S::min(de, dc), S::max(bc, fe)); \
+ \
+        diff = S::max(S::max(diff, min), S::neg(max)); \
+    } \
+ \
+    const V dplus = S::add(d, diff); \
+    const V dminus = S::sub(d, diff); \
+    const V above = S::gt(spatial_pred, dplus); \
+    const V below = S::andnot(above, S::lt(spatial_pred, dminus)); \
+    spatial_pred = S::select(above, dplus, spatial_pred); \
+    spatial_pred = S::select(below, dminus, spatial_pred); \
+ \
+    S::store(dst, spatial_pred); \
+} \
+ \
+/* all the components of the line, which must have at least S::N components */ \
+template <int ch, typename Comp> \
+TARGET void \
+yadifLineVectors##isa(Comp *dst, const Comp *prev, const Comp *cur, const Comp *next, \
+                      int w, int prefs, int mrefs, int parity, int mode) \
+{ \
+    const int N = Vec##isa<Comp>::N; \
+    const int n = w * ch; \
+    /* the last vector overlaps the previous one, rather than leaving a tail for the scalar code */ \
+    for (int i = 0; ; i = std::min(i + N, n - N)) { \
+        yadifVector##isa<ch, Comp>(dst + i, prev + i, cur + i, next + i, prefs, mrefs, parity, mode); \
+        if (i + N >= n) { \
+            break; \
+        } \
+    } \
+}
+
+#if kDeinterlaceRowKernelsSSE2
+#define DEINTERLACE_TARGET_SSE2
+DEINTERLACE_YADIF_FUNCTIONS(DEINTERLACE_TARGET_SSE2, SSE2)
+
+template <int ch, typename Comp>
+void
+yadifLineSSE2(Comp *dst, const Comp *prev, const Comp *cur, const Comp *next,
+              int w, int prefs, int mrefs, int parity, int mode)
+{
+    yadifLineVectorsSSE2<ch, Comp>(dst, prev, cur, next, w, prefs, mrefs, parity, mode);
+}
+#endif // kDeinterlaceRowKernelsSSE2
+
+#if kDeinterlaceRowKernelsAVX2
+DEINTERLACE_YADIF_FUNCTIONS(DEINTERLACE_TARGET_AVX2, AVX2)
+
+template <int ch, typename Comp>
+DEINTERLACE_TARGET_AVX2 void
+yadifLineAVX2(Comp *dst, const Comp *prev, const Comp *cur, const Comp *next,
+              int w, int prefs, int mrefs, int parity, int mode)
+{
+    if (w * ch < VecAVX2<Comp>::N) {
+        // too short for one AVX2 vector
+        yadifLineVectorsSSE2<ch, Comp>(dst, prev, cur, next, w, prefs, mrefs, parity, mode);
+    } else {
+        yadifLineVectorsAVX2<ch, Comp>(dst, prev, cur, next, w, prefs, mrefs, parity, mode);
+    }
+}
+
+/// true if the CPU and the OS support AVX2
+inline bool
+cpuHasAVX2()
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    __cpuid(info, 1);
+    // OSXSAVE, and the OS saves the XMM and YMM registers
+    if (!(info[2] & (1 << 27)) || (_xgetbv(0) & 6) != 6) {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif // kDeinterlaceRowKernelsAVX2
+
+/// Return the fastest line function that is available on this CPU, or NULL if the scalar
+/// function must be used. The line functions give exactly the same results as filter_line_c.
+template <int ch, typename Comp>
+typename YadifLine<Comp>::Function
+getLineFunction()
+{
+#if kDeinterlaceRowKernelsAVX2
+    if (cpuHasAVX2()) {
+        return &yadifLineAVX2<ch, Comp>;
+    }
+#endif
+#if kDeinterlaceRowKernelsSSE2
+    return &yadifLineSSE2<ch, Comp>;
+#else
+    return 0;
+#endif
+}
+
+} // namespace DeinterlaceRowKernels
+
+#endif // Misc_DeinterlaceRowKernels_h
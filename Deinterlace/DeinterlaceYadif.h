@@ -0,0 +1,262 @@
+/*
+ OFX Deinterlace plugin: scalar Yadif functions.
+
+ Copyright (C) 2014 INRIA
+
+ Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+
+ Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+
+ Redistributions in binary form must reproduce the above copyright notice, this
+ list of conditions and the following disclaimer in the documentation and/or
+ other materials provided with the distribution.
+
+ Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ INRIA
+ Domaine de Voluceau
+ Rocquencourt - B.P. 105
+ 78153 Le Chesnay Cedex - France
+ */
+
+// The Yadif line filter and the line interpolation of Deinterlace, which do not depend on OFX,
+// so that the vectorized kernels can be tested against them (see tests/DeinterlaceRowKernelsTest.cpp).
+
+#ifndef Misc_DeinterlaceYadif_h
+#define Misc_DeinterlaceYadif_h
+
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+
+#include "DeinterlaceRowKernels.h"
+
+// =========== GNU Lesser General Public License code start =================
+
+// Yadif (yet another deinterlacing filter)
+// http://avisynth.org.ru/yadif/yadif.html
+// http://mplayerhq.hu
+
+// Original port to OFX/Vegas by George Yohng http://yohng.com
+// Rewritten after yadif relicensing to LGPL:
+// http://git.videolan.org/?p=ffmpeg.git;a=commit;h=194ef56ba7e659196fe554782d797b1b45c3915f
+
+
+// Copyright notice and licence from the original libavfilter/vf_yadif.c file:
+/*
+ * Copyright (C) 2006-2011 Michael Niedermayer <michaelni@gmx.at>
+ *               2010      James Darnley <james.darnley@gmail.com>
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+//#define FFMIN(a,b) ((a) > (b) ? (b) : (a))
+//#define FFMAX(a,b) ((a) < (b) ? (b) : (a))
+//#define FFABS(a) ((a) > 0 ? (a) : (-(a)))
+#define FFMIN(a,b) std::min(a,b)
+#define FFMAX(a,b) std::max(a,b)
+#define FFABS(a) std::abs(a)
+
+#define FFMIN3(a,b,c) FFMIN(FFMIN(a,b),c)
+#define FFMAX3(a,b,c) FFMAX(FFMAX(a,b),c)
+
+inline float halven(float f) { return f*0.5f; }
+inline int halven(int i) { return i>>1; }
+
+inline int one1(unsigned char *) { return 1; }
+inline int one1(unsigned short *) { return 1; }
+inline float one1(float *) { return 0.f; }
+
+#define CHECK(j)\
+    {   Diff score = FFABS(cur[mrefs + ch * (- 1 + (j))] - cur[prefs + ch * (- 1 - (j))])\
+                 + FFABS(cur[mrefs   + ch * (j)] - cur[prefs   - ch * (j)])\
+                 + FFABS(cur[mrefs + ch * (1 + (j))] - cur[prefs + ch * (1 - (j))]);\
+        if(score < spatial_score){\
+            spatial_score= score;\
+            spatial_pred= halven(cur[mrefs  + ch * (j)] + cur[prefs  - ch * (j)]);\
+
+/* The is_not_edge argument here controls when the code will enter a branch
+ * which reads up to and including x-3 and x+3. */
+
+#define FILTER(start, end, is_not_edge) \
+    for (x = start;  x < end; x++) { \
+        Diff c= cur[mrefs]; \
+        Diff d= halven(prev2[0] + next2[0]); \
+        Diff e= cur[prefs]; \
+        Diff temporal_diff0= FFABS(prev2[0] - next2[0]); \
+        Diff temporal_diff1=halven( FFABS(prev[mrefs] - c) + FFABS(prev[prefs] - e) ); \
+        Diff temporal_diff2=halven( FFABS(next[mrefs] - c) + FFABS(next[prefs] - e) ); \
+        Diff diff= FFMAX3(halven(temporal_diff0), temporal_diff1, temporal_diff2); \
+        Diff spatial_pred= halven(c+e); \
+ \
+        if (is_not_edge) {\
+            Diff spatial_score = FFABS(cur[mrefs-ch] - cur[prefs-ch]) + FFABS(c-e) \
+                              + FFABS(cur[mrefs+ch] - cur[prefs+ch]) - one1((Comp*)0); \
+            CHECK(-1) CHECK(-2) }} }} \
+            CHECK( 1) CHECK( 2) }} }} \
+        }\
+ \
+        if (!(mode&2)) { \
+            Diff b = halven(prev2[2 * mrefs] + next2[2 * mrefs]); \
+            Diff f = halven(prev2[2 * prefs] + next2[2 * prefs]); \
+            Diff max = FFMAX3(d - e, d - c, FFMIN(b - c, f - e)); \
+            Diff min = FFMIN3(d - e, d - c, FFMAX(b - c, f - e)); \
+ \
+            diff = FFMAX3(diff, min, -max); \
+        } \
+ \
+        if (spatial_pred > d + diff) \
+           spatial_pred = d + diff; \
+        else if (spatial_pred < d - diff) \
+           spatial_pred = d - diff; \
+ \
+        dst[0] = (Comp)spatial_pred; \
+ \
+        dst += ch; \
+        cur += ch; \
+        prev += ch; \
+        next += ch; \
+        prev2 += ch; \
+        next2 += ch; \
+    }
+
+template<int ch,typename Comp,typename Diff>
+inline void filter_line_c(Comp *dst1,
+                          const Comp *prev1, const Comp *cur1, const Comp *next1,
+                          int w, int prefs, int mrefs, int parity, int mode)
+{
+    Comp *dst  = dst1;
+    const Comp *prev = prev1;
+    const Comp *cur  = cur1;
+    const Comp *next = next1;
+    int x;
+    const Comp *prev2 = parity ? prev : cur ;
+    const Comp *next2 = parity ? cur  : next;
+
+    /* The function is only called on the pixels that are at least 3 pixels away
+     * from the edges of the line.  This allows the FILTER macro to be
+     * called so that it processes all the pixels normally.  A constant value of
+     * true for is_not_edge lets the compiler ignore the if statement. */
+    FILTER(0, w, 1)
+}
+
+/* filter_line_c on all the components of the pixels (the reference for the vectorized line functions). */
+template<int ch,typename Comp,typename Diff>
+static void filter_line_c_all(Comp *dst, const Comp *prev, const Comp *cur, const Comp *next,
+                              int w, int prefs, int mrefs, int parity, int mode)
+{
+    for (int c = 0; c < ch; ++c) {
+        filter_line_c<ch,Comp,Diff>(dst + c, prev + c, cur + c, next + c, w,
+                                    prefs, mrefs, parity, mode);
+    }
+}
+
+/* Only edge pixels need to be processed here.  A constant value of false
+ * for is_not_edge should let the compiler ignore the whole branch. */
+template<int ch,typename Comp,typename Diff>
+inline void filter_edges(Comp *dst1,
+                         const Comp *prev1, const Comp *cur1, const Comp *next1,
+                         int w, int prefs, int mrefs, int parity, int mode)
+{
+    Comp *dst  = dst1;
+    const Comp *prev = prev1;
+    const Comp *cur  = cur1;
+    const Comp *next = next1;
+    int x;
+    const Comp *prev2 = parity ? prev : cur ;
+    const Comp *next2 = parity ? cur  : next;
+
+    FILTER(0, w, 0)
+}
+
+/* Filter the pixels x1 to x2-1 of a line of an image of width w (at least 3).
+ * The pointers point to pixel x1 of the line. The three pixels at each end of the
+ * full line are edge pixels, so that the result does not depend on x1 and x2.
+ * If line is not NULL, it is used instead of filter_line_c_all on the other pixels. */
+template<int ch,typename Comp,typename Diff>
+static void filter_line(Comp *dst,
+                        const Comp *prev, const Comp *cur, const Comp *next,
+                        int x1, int x2, int w, int prefs, int mrefs, int parity, int mode,
+                        typename DeinterlaceRowKernels::YadifLine<Comp>::Function line)
+{
+    const int xl = std::min(x2, 3);
+    const int xr = std::max(std::max(x1, 3), w - 3);
+    const int xs = std::max(x1, 3);
+    const int xe = std::min(x2, w - 3);
+    for (int c = 0; c < ch; ++c) {
+        if (x1 < xl) {
+            filter_edges<ch,Comp,Diff>(dst + c, prev + c, cur + c, next + c, xl - x1,
+                                       prefs, mrefs, parity, mode);
+        }
+        if (xr < x2) {
+            const int o = (xr - x1) * ch + c;
+            filter_edges<ch,Comp,Diff>(dst + o, prev + o, cur + o, next + o, x2 - xr,
+                                       prefs, mrefs, parity, mode);
+        }
+    }
+    if (xs < xe) {
+        const int o = (xs - x1) * ch;
+        if (line && (xe - xs) * ch >= kDeinterlaceRowKernelsMinElements) {
+            line(dst + o, prev + o, cur + o, next + o, xe - xs,
+                 prefs, mrefs, parity, mode);
+        } else {
+            filter_line_c_all<ch,Comp,Diff>(dst + o, prev + o, cur + o, next + o, xe - xs,
+                                            prefs, mrefs, parity, mode);
+        }
+    }
+}
+
+inline void interpolate(unsigned char *dst, const unsigned char *cur0,  const unsigned char *cur2, int w)
+{
+    int x;
+    for (x=0; x<w; x++) {
+        dst[x] = (cur0[x] + cur2[x] + 1)>>1; // simple average
+    }
+}
+
+inline void interpolate(unsigned short *dst, const unsigned short *cur0,  const unsigned short *cur2, int w)
+{
+    int x;
+    for (x=0; x<w; x++) {
+        dst[x] = (cur0[x] + cur2[x] + 1)>>1; // simple average
+    }
+}
+
+inline void interpolate(float *dst, const float *cur0,  const float *cur2, int w)
+{
+    int x;
+    for (x=0; x<w; x++) {
+        dst[x] = (cur0[x] + cur2[x] )*0.5f; // simple average
+    }
+}
+
+// =========== GNU Lesser General Public License code end =================
+
+#endif // Misc_DeinterlaceYadif_h
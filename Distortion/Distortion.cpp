@@ -89,6 +89,10 @@
 #include <iostream>
 #include <sstream>
 #include <vector>
+#include <limits>
+#include <list>
+#include <memory>
+#include <new> // for std::bad_alloc
 
 #ifdef __APPLE__
 #include <OpenGL/gl.h>
@@ -97,6 +101,7 @@
 #endif
 
 #include "ofxsImageEffect.h"
+#include "ofxsMultiThread.h"
 #include "ofxsProcessing.H"
 #include "ofxsMerging.h"
 #include "ofxsMaskMix.h"
@@ -135,9 +140,7 @@
 #define kPluginLensDistortionIdentifier "net.sf.openfx.LensDistortion"
 
 /* LensDistortion TODO:
- - cache the STmap for a set of input parameter and input image size
  - output the STmap (which is not frame-varying even if the input changes, so isIdentity should use this on Natron if no parameter is animated)
- - compute the inverse map and undistort
  - implement other distortion models (PFBarrel, OpenCV)
 */
 
@@ -227,6 +230,23 @@ enum WrapEnum {
 #define kParamDistortionModelOptionNuke "Nuke"
 #define kParamDistortionModelOptionNukeHint "The model used in Nuke's LensDistortion plugin (reverse engineered)."
 
+#define kParamDirection "direction"
+#define kParamDirectionLabel "Direction"
+#define kParamDirectionHint "Direction of the distortion."
+#define kParamDirectionOptionUndistort "Undistort"
+#define kParamDirectionOptionUndistortHint "Remove the lens distortion from the input: the distortion model is evaluated at each output pixel."
+#define kParamDirectionOptionDistort "Distort"
+#define kParamDirectionOptionDistortHint "Apply the lens distortion to the input (e.g. to match undistorted CG with the original plate). The inverse of the distortion model is solved once on a grid for each set of parameters, and interpolated."
+
+enum DirectionEnum {
+    eDirectionUndistort = 0,
+    eDirectionDistort,
+};
+
+#define kParamDistortError "distortError"
+#define kParamDistortErrorLabel "Max Error"
+#define kParamDistortErrorHint "Maximum round-trip error, in pixels at full resolution, of the interpolated inverse distortion grid used in the Distort direction, i.e. the maximum distance between an output pixel and the distortion model applied to its source position. Updated when the parameters or the source change."
+
 /*
  Possible distortion models:
  (see also <http://michaelkarp.net/distortion.htm>)
@@ -281,8 +301,16 @@ enum DistortionModelEnum {
 #define kParamAsymmetricLabel "Asymmetric"
 #define kParamAsymmetricHint "Asymmetric distortion (only for anamorphic lens)."
 
+#define kLensDistortionGridCacheSize 2 // number of LensDistortion grids kept by each instance (e.g. one for full-res and one for proxy)
+#define kLensDistortionGridMaxNodes (1 << 22) // larger grids (24 bytes per node) are not built, and the pixels are computed directly
+#define kLensDistortionInverseGridStep 8 // distance in pixels between the nodes of the inverse distortion grid
+#define kLensDistortionInverseMaxIterations 20
+#define kLensDistortionInverseTolerance 1e-6 // in pixels
+
 using namespace OFX;
 
+class LensDistortionGrid;
+
 class DistortionProcessorBase : public OFX::ImageProcessor
 {
 protected:
@@ -304,6 +332,7 @@ protected:
     WrapEnum _uWrap;
     WrapEnum _vWrap;
     DistortionModelEnum _distortionModel;
+    DirectionEnum _direction;
     double _par;
     double _k1;
     double _k2;
@@ -315,6 +344,8 @@ protected:
     double _squeeze;
     double _ax;
     double _ay;
+    OfxRectI _lensSrcBounds; // the source bounds that define the LensDistortion frame
+    const LensDistortionGrid *_lensDistortionGrid;
     bool _blackOutside;
     bool _doMasking;
     double _mix;
@@ -342,6 +373,7 @@ public:
     , _uWrap(eWrapClamp)
     , _vWrap(eWrapClamp)
     , _distortionModel(eDistortionModelNuke)
+    , _direction(eDirectionUndistort)
     , _par(1.)
     , _k1(0.)
     , _k2(0.)
@@ -353,6 +385,8 @@ public:
     , _squeeze(1.)
     , _ax(0.)
     , _ay(0.)
+    , _lensSrcBounds()
+    , _lensDistortionGrid(0)
     , _blackOutside(false)
     , _doMasking(false)
     , _mix(1.)
@@ -366,6 +400,8 @@ public:
 
     void doMasking(bool v) {_doMasking = v;}
 
+    void setLensDistortion(const OfxRectI &srcBounds, const LensDistortionGrid *grid) { _lensSrcBounds = srcBounds; _lensDistortionGrid = grid; }
+
     void setValues(bool processR,
                    bool processG,
                    bool processB,
@@ -381,6 +417,7 @@ public:
                    WrapEnum uWrap,
                    WrapEnum vWrap,
                    DistortionModelEnum distortionModel,
+                   DirectionEnum direction,
                    double par,
                    double k1, double k2, double k3,
                    double p1, double p2,
@@ -405,6 +442,7 @@ public:
         _uWrap = uWrap;
         _vWrap = vWrap;
         _distortionModel = distortionModel;
+        _direction = direction;
         _par = par;
         _k1 = k1;
         _k2 = k2;
@@ -431,7 +469,8 @@ distort_nuke(double xu, double yu, // undistorted position in normalized coordin
              double cx, double cy, // distortion center, (0,0) at center of image
              double squeeze, // anamorphic squeeze
              double ax, double ay, // asymmetric distortion
-             double *xd, double *yd) // distorted position in normalized coordinates
+             double *xd, double *yd, // distorted position in normalized coordinates
+             double *xdxu, double *xdyu, double *ydxu, double *ydyu) // Jacobian of the distorted position
 {
     // nuke?
     // k1 = radial distortion 1
@@ -450,8 +489,508 @@ distort_nuke(double xu, double yu, // undistorted position in normalized coordin
     //double krx = 1 + (k2r2pk1*x2 + (k2r2pk1 + ax)*y2)/squeeze;
     double krx = 1 + (k2r2pk1*r2 + ax*y2)/squeeze;
     *xd = (x/krx) + cx;
+
+    // derivatives of krx and kry, using d(k2r2pk1*r2)/d(r2) = 2*k2*r2 + k1
+    double dr2 = 2*k2*r2 + k1;
+    double krx_x = 2*dr2*x/squeeze;
+    double krx_y = 2*(dr2 + ax)*y/squeeze;
+    double kry_x = 2*(dr2 + ay)*x;
+    double kry_y = 2*dr2*y;
+    *xdxu = (krx - x*krx_x)/(krx*krx);
+    *xdyu = -x*krx_y/(krx*krx);
+    *ydxu = -y*kry_x/(kry*kry);
+    *ydyu = (kry - y*kry_y)/(kry*kry);
+}
+
+// The LensDistortion parameters, which define the source position of each output pixel.
+// This is also the key of the LensDistortion grid cache.
+struct LensDistortionParams
+{
+    DistortionModelEnum model;
+    DirectionEnum direction;
+    double par;
+    double k1;
+    double k2;
+    double cx;
+    double cy;
+    double squeeze;
+    double ax;
+    double ay;
+    OfxRectI srcBounds; // the distortion is relative to the source image bounds, which also depend on the render scale
+
+    bool operator==(const LensDistortionParams &o) const
+    {
+        return (model == o.model && direction == o.direction && par == o.par && k1 == o.k1 && k2 == o.k2 && cx == o.cx && cy == o.cy &&
+                squeeze == o.squeeze && ax == o.ax && ay == o.ay &&
+                srcBounds.x1 == o.srcBounds.x1 && srcBounds.y1 == o.srcBounds.y1 &&
+                srcBounds.x2 == o.srcBounds.x2 && srcBounds.y2 == o.srcBounds.y2);
+    }
+};
+
+// compute the distortion model at position (px,py) (in pixel coordinates, the center of pixel (x,y) being (x+0.5,y+0.5)), and its Jacobian
+static inline void
+lensDistortionModel(const LensDistortionParams &p,
+                    double px, double py,
+                    double *sx, double *sy,
+                    double *sxx, double *sxy, double *syx, double *syy)
+{
+    const OfxRectI &b = p.srcBounds;
+    double fx = (b.x2 - b.x1)/2.;
+    double fy = (b.y2 - b.y1)/2.;
+    double f = std::max(fx, fy); // TODO: distortion scaling param for LensDistortion?
+    double mx = (b.x2 + b.x1)/2.;
+    double my = (b.y2 + b.y1)/2.;
+    switch (p.model) {
+        case eDistortionModelNuke: {
+            double xu = p.par * (px - mx)/f;
+            double yu = (py - my)/f;
+            double xd, yd, xdxu, xdyu, ydxu, ydyu;
+            distort_nuke(xu, yu,
+                         p.k1, p.k2, p.cx, p.cy, p.squeeze, p.ax, p.ay,
+                         &xd, &yd,
+                         &xdxu, &xdyu, &ydxu, &ydyu);
+            *sx = (xd / p.par) * f + mx;
+            *sy = yd * f + my;
+            // chain rule: dxu/dx = par/f, dyu/dy = 1/f, dsx/dxd = f/par, dsy/dyd = f
+            *sxx = xdxu;
+            *sxy = xdyu / p.par;
+            *syx = ydxu * p.par;
+            *syy = ydyu;
+        }
+            break;
+    }
+}
+
+// solve the distortion model for the position (*sx,*sy) that maps to (px,py), using Newton iterations.
+// (*sx,*sy) contains the initial guess.
+// Returns false if there is no solution (the model folds over itself, or the iterations did not converge).
+static inline bool
+lensDistortionModelInverse(const LensDistortionParams &p,
+                           double px, double py,
+                           double *sx, double *sy,
+                           double *sxx, double *sxy, double *syx, double *syy)
+{
+    double x = *sx;
+    double y = *sy;
+    for (int i = 0; i < kLensDistortionInverseMaxIterations; ++i) {
+        double dx, dy, dxx, dxy, dyx, dyy;
+        lensDistortionModel(p, x, y, &dx, &dy, &dxx, &dxy, &dyx, &dyy);
+        double det = dxx*dyy - dxy*dyx;
+        // stay on the part of the model that does not fold over (this also rejects NaNs)
+        if (!(det > 0.)) {
+            return false;
+        }
+        double ex = dx - px;
+        double ey = dy - py;
+        double stepx = (dyy*ex - dxy*ey)/det;
+        double stepy = (dxx*ey - dyx*ex)/det;
+        x -= stepx;
+        y -= stepy;
+        if (std::abs(stepx) + std::abs(stepy) < kLensDistortionInverseTolerance) {
+            *sx = x;
+            *sy = y;
+            // the Jacobian of the inverse is the inverse of the Jacobian
+            *sxx = dyy/det;
+            *sxy = -dxy/det;
+            *syx = -dyx/det;
+            *syy = dxx/det;
+            return true;
+        }
+    }
+    return false;
 }
 
+// compute the source position of output pixel (x,y), and its Jacobian, without a grid
+static inline void
+lensDistortionPixel(const LensDistortionParams &p,
+                    int x, int y,
+                    double *sx, double *sy,
+                    double *sxx, double *sxy, double *syx, double *syy)
+{
+    switch (p.direction) {
+        case eDirectionUndistort:
+            lensDistortionModel(p, x + 0.5, y + 0.5, sx, sy, sxx, sxy, syx, syy);
+            break;
+        case eDirectionDistort:
+            *sx = x + 0.5;
+            *sy = y + 0.5;
+            if (!lensDistortionModelInverse(p, x + 0.5, y + 0.5, sx, sy, sxx, sxy, syx, syy)) {
+                // no source: black
+                *sx = *sy = std::numeric_limits<double>::infinity();
+                *sxx = *syy = 1.;
+                *sxy = *syx = 0.;
+            }
+            break;
+    }
+}
+
+// The source position and its Jacobian over a window of the source bounds, for a given set of LensDistortion parameters.
+// Rendering is then a simple lookup, as in STMap.
+// In the Undistort direction, the model is evaluated at each pixel.
+// In the Distort direction, the inverse model is solved on a coarser grid, which is interpolated bilinearly,
+// and the maximum round-trip error of this interpolation is measured when the grid is built.
+// The nodes are aligned on the source bounds, so that grids built over different windows give the same values.
+class LensDistortionGrid
+{
+public:
+    LensDistortionGrid(const LensDistortionParams &params, const OfxRectI &window)
+    : _params(params)
+    , _window()
+    , _step(params.direction == eDirectionDistort ? kLensDistortionInverseGridStep : 1)
+    , _x1(0)
+    , _y1(0)
+    , _width(0)
+    , _height(0)
+    , _data()
+    , _rowError()
+    , _maxError(0.)
+    {
+        const OfxRectI &b = params.srcBounds;
+        if (!MergeImages2D::rectIntersection(window, b, &_window)) {
+            _window.x1 = _window.y1 = _window.x2 = _window.y2 = 0;
+            return;
+        }
+        if (_step == 1) {
+            _x1 = _window.x1;
+            _y1 = _window.y1;
+            _width = _window.x2 - _window.x1;
+            _height = _window.y2 - _window.y1;
+        } else {
+            // the nodes around the window, so that its last pixel is between two nodes
+            int i1 = (_window.x1 - b.x1)/_step;
+            int j1 = (_window.y1 - b.y1)/_step;
+            _x1 = b.x1 + i1 * _step;
+            _y1 = b.y1 + j1 * _step;
+            _width = (_window.x2 - 1 - b.x1)/_step + 2 - i1;
+            _height = (_window.y2 - 1 - b.y1)/_step + 2 - j1;
+        }
+    }
+
+    const LensDistortionParams& params() const { return _params; }
+
+    /// true if the grid covers window
+    bool contains(const OfxRectI &window) const
+    {
+        return (_window.x1 <= window.x1 && window.x2 <= _window.x2 && _window.y1 <= window.y1 && window.y2 <= _window.y2);
+    }
+
+    /// the grid is not built above kLensDistortionGridMaxNodes nodes
+    bool isTooLarge() const { return (size_t)_width * _height > (size_t)kLensDistortionGridMaxNodes; }
+
+    /// compute the grid (multi-threaded)
+    void build()
+    {
+        _data.resize((size_t)_width * _height * 6);
+        {
+            Builder builder(*this, false);
+            builder.multiThread();
+        }
+        if (_step > 1) {
+            _rowError.assign(_height, 0.);
+            Builder builder(*this, true);
+            builder.multiThread();
+            _maxError = 0.;
+            for (int j = 0; j < _height; ++j) {
+                _maxError = std::max(_maxError, _rowError[j]);
+            }
+        }
+    }
+
+    /// maximum distance (in pixels) between an output pixel position and the distortion model applied to
+    /// its interpolated source position, measured at the center of each grid cell of the window (0 if the grid is not interpolated)
+    double maxError() const { return _maxError; }
+
+    /// get the source position and Jacobian of pixel (x,y).
+    /// Returns false if the pixel is outside of the grid.
+    bool getSourcePosition(int x, int y,
+                           double *sx, double *sy,
+                           double *sxx, double *sxy, double *syx, double *syy) const
+    {
+        x -= _x1;
+        y -= _y1;
+        if (x < 0 || y < 0) {
+            return false;
+        }
+        if (_step == 1) {
+            if (_width <= x || _height <= y) {
+                return false;
+            }
+            const float *gridPix = &_data[((size_t)y * _width + x) * 6];
+            *sx = gridPix[0];
+            *sy = gridPix[1];
+            *sxx = gridPix[2];
+            *sxy = gridPix[3];
+            *syx = gridPix[4];
+            *syy = gridPix[5];
+
+            return true;
+        }
+        int i = x / _step;
+        int j = y / _step;
+        if (_width <= i + 1 || _height <= j + 1) {
+            return false;
+        }
+        const float *p00 = &_data[((size_t)j * _width + i) * 6];
+        const float *p10 = p00 + 6;
+        const float *p01 = p00 + (size_t)_width * 6;
+        const float *p11 = p01 + 6;
+        if (p00[0] != p00[0] || p10[0] != p10[0] || p01[0] != p01[0] || p11[0] != p11[0]) {
+            // a node has no source: black
+            *sx = *sy = std::numeric_limits<double>::infinity();
+            *sxx = *syy = 1.;
+            *sxy = *syx = 0.;
+
+            return true;
+        }
+        double tx = (x - i * _step) / (double)_step;
+        double ty = (y - j * _step) / (double)_step;
+        double w00 = (1. - tx) * (1. - ty);
+        double w10 = tx * (1. - ty);
+        double w01 = (1. - tx) * ty;
+        double w11 = tx * ty;
+        double v[6];
+        for (int c = 0; c < 6; ++c) {
+            v[c] = w00 * p00[c] + w10 * p10[c] + w01 * p01[c] + w11 * p11[c];
+        }
+        *sx = v[0];
+        *sy = v[1];
+        *sxx = v[2];
+        *sxy = v[3];
+        *syx = v[4];
+        *syy = v[5];
+
+        return true;
+    }
+
+private:
+    class Builder : public OFX::MultiThread::Processor
+    {
+    public:
+        Builder(LensDistortionGrid &grid, bool measureError) : _grid(grid), _measureError(measureError) {}
+
+        virtual void multiThreadFunction(unsigned int threadId, unsigned int nThreads)
+        {
+            // each thread processes a band of rows
+            int y1 = (int)(((long long)_grid._height * threadId) / nThreads);
+            int y2 = (int)(((long long)_grid._height * (threadId + 1)) / nThreads);
+            if (_measureError) {
+                _grid.measureErrorRows(y1, y2);
+            } else {
+                _grid.buildRows(y1, y2);
+            }
+        }
+
+    private:
+        LensDistortionGrid &_grid;
+        bool _measureError;
+    };
+
+    // compute node rows [y1,y2) of the grid (relative to the grid origin)
+    void buildRows(int y1, int y2)
+    {
+        for (int j = y1; j < y2; ++j) {
+            float *gridPix = &_data[(size_t)j * _width * 6];
+            int y = _y1 + j * _step;
+            // the inverse model is solved starting from the solution at the previous node
+            double sx = _x1 + 0.5;
+            double sy = y + 0.5;
+            bool prevValid = false;
+            for (int i = 0; i < _width; ++i, gridPix += 6) {
+                int x = _x1 + i * _step;
+                double sxx, sxy, syx, syy;
+                bool valid = true;
+                if (_step == 1) {
+                    lensDistortionModel(_params, x + 0.5, y + 0.5, &sx, &sy, &sxx, &sxy, &syx, &syy);
+                } else {
+                    if (!prevValid) {
+                        sx = x + 0.5;
+                        sy = y + 0.5;
+                    }
+                    valid = lensDistortionModelInverse(_params, x + 0.5, y + 0.5, &sx, &sy, &sxx, &sxy, &syx, &syy);
+                    if (!valid && prevValid) {
+                        // retry from the pixel position
+                        sx = x + 0.5;
+                        sy = y + 0.5;
+                        valid = lensDistortionModelInverse(_params, x + 0.5, y + 0.5, &sx, &sy, &sxx, &sxy, &syx, &syy);
+                    }
+                    prevValid = valid;
+                }
+                if (valid) {
+                    gridPix[0] = (float)sx;
+                    gridPix[1] = (float)sy;
+                    gridPix[2] = (float)sxx;
+                    gridPix[3] = (float)sxy;
+                    gridPix[4] = (float)syx;
+                    gridPix[5] = (float)syy;
+                } else {
+                    std::fill(gridPix, gridPix + 6, std::numeric_limits<float>::quiet_NaN());
+                }
+            }
+        }
+    }
+
+    // measure the round-trip error at the center of the cells of node rows [y1,y2)
+    void measureErrorRows(int y1, int y2)
+    {
+        const OfxRectI &w = _window;
+        for (int j = y1; j < y2 && j + 1 < _height; ++j) {
+            int y = std::min(_y1 + j * _step + _step/2, w.y2 - 1);
+            double rowError = 0.;
+            for (int i = 0; i + 1 < _width; ++i) {
+                int x = std::min(_x1 + i * _step + _step/2, w.x2 - 1);
+                double sx, sy, sxx, sxy, syx, syy;
+                if (!getSourcePosition(x, y, &sx, &sy, &sxx, &sxy, &syx, &syy) || sx == std::numeric_limits<double>::infinity()) {
+                    continue;
+                }
+                double dx, dy;
+                lensDistortionModel(_params, sx, sy, &dx, &dy, &sxx, &sxy, &syx, &syy);
+                double e = std::sqrt((dx - (x + 0.5)) * (dx - (x + 0.5)) + (dy - (y + 0.5)) * (dy - (y + 0.5)));
+                rowError = std::max(rowError, e);
+            }
+            _rowError[j] = rowError;
+        }
+    }
+
+    LensDistortionParams _params;
+    OfxRectI _window; // the pixels covered by the grid
+    int _step; // distance in pixels between grid nodes
+    int _x1; // position of the first node
+    int _y1;
+    int _width; // number of nodes
+    int _height;
+    std::vector<float> _data; // sx, sy, sxx, sxy, syx, syy for each node (NaN if there is no source)
+    std::vector<double> _rowError; // round-trip error for each row of cells
+    double _maxError;
+};
+
+// A small cache of LensDistortion grids, shared by the renders of an instance.
+// Since the LensDistortion parameters are usually constant over a shot, the grid is computed only once
+// (or once per rendered window, if the host renders tiles).
+class LensDistortionGridCache
+{
+public:
+    /// RAII access to a grid of the cache: the grid is not freed while a Handle holds it
+    class Handle
+    {
+    public:
+        Handle(LensDistortionGridCache &cache, const LensDistortionParams &params, const OfxRectI &window)
+        : _cache(cache)
+        , _grid(0)
+        {
+            _grid = _cache.acquire(params, window);
+        }
+
+        ~Handle()
+        {
+            _cache.release(_grid);
+        }
+
+        /// the grid, or NULL if it is too large or could not be allocated
+        const LensDistortionGrid* get() const { return _grid; }
+
+    private:
+        Handle(const Handle&); // not implemented
+        Handle& operator=(const Handle&); // not implemented
+
+        LensDistortionGridCache &_cache;
+        LensDistortionGrid *_grid;
+    };
+
+    LensDistortionGridCache()
+    : _entries()
+    , _mutex()
+    {
+    }
+
+    ~LensDistortionGridCache()
+    {
+        for (std::list<Entry>::iterator it = _entries.begin(); it != _entries.end(); ++it) {
+            assert(it->useCount == 0);
+            delete it->grid;
+        }
+    }
+
+    /// free all grids that are not currently used (e.g. when the host calls purgeCaches)
+    void purge()
+    {
+        OFX::MultiThread::AutoMutex lock(_mutex);
+        trimUnlocked(0);
+    }
+
+private:
+    struct Entry
+    {
+        LensDistortionGrid *grid;
+        int useCount;
+    };
+
+    LensDistortionGridCache(const LensDistortionGridCache&); // not implemented
+    LensDistortionGridCache& operator=(const LensDistortionGridCache&); // not implemented
+
+    LensDistortionGrid* acquire(const LensDistortionParams &params, const OfxRectI &window)
+    {
+        OFX::MultiThread::AutoMutex lock(_mutex);
+        for (std::list<Entry>::iterator it = _entries.begin(); it != _entries.end(); ++it) {
+            if (it->grid->params() == params && it->grid->contains(window)) {
+                _entries.splice(_entries.begin(), _entries, it);
+                ++_entries.front().useCount;
+                return _entries.front().grid;
+            }
+        }
+        // the grid is built while holding the lock, so that concurrent renders do not build the same grid
+        std::auto_ptr<LensDistortionGrid> grid(new LensDistortionGrid(params, window));
+        if (grid->isTooLarge()) {
+            // render without a grid
+            return 0;
+        }
+        try {
+            grid->build();
+        } catch (const std::bad_alloc&) {
+            // render without a grid
+            return 0;
+        }
+        Entry e;
+        e.grid = grid.release();
+        e.useCount = 1;
+        _entries.push_front(e);
+        trimUnlocked(kLensDistortionGridCacheSize);
+
+        return e.grid;
+    }
+
+    void release(LensDistortionGrid *grid)
+    {
+        if (!grid) {
+            return;
+        }
+        OFX::MultiThread::AutoMutex lock(_mutex);
+        for (std::list<Entry>::iterator it = _entries.begin(); it != _entries.end(); ++it) {
+            if (it->grid == grid) {
+                assert(it->useCount > 0);
+                --it->useCount;
+                break;
+            }
+        }
+        trimUnlocked(kLensDistortionGridCacheSize);
+    }
+
+    // free the least recently used grids that are not in use, until at most maxEntries remain (must be called with _mutex locked)
+    void trimUnlocked(size_t maxEntries)
+    {
+        std::list<Entry>::iterator it = _entries.end();
+        while (_entries.size() > maxEntries && it != _entries.begin()) {
+            --it;
+            if (it->useCount == 0) {
+                delete it->grid;
+                it = _entries.erase(it);
+            }
+        }
+    }
+
+    std::list<Entry> _entries; // most recently used first
+    OFX::MultiThread::Mutex _mutex;
+};
+
 #if 0
 // see https://github.com/Itseez/opencv/blob/master/modules/imgproc/src/undistort.cpp
 static inline void
@@ -543,6 +1082,42 @@ private:
         }
     }
 
+    // fetch the U and V channels of row y of the UV image, for x in [x1,x2), into uRow and vRow (0 outside of the UV image).
+    // Each UV pixel is read once, and constant channels (uImg or vImg is NULL) are not fetched.
+    void
+    fetchUVRow(const OFX::Image *uImg, int uComp,
+               const OFX::Image *vImg, int vComp,
+               int y, int x1, int x2,
+               float *uRow, float *vRow)
+    {
+        const int n = x2 - x1;
+        if (uImg) {
+            std::fill(uRow, uRow + n, 0.f);
+        }
+        if (vImg) {
+            std::fill(vRow, vRow + n, 0.f);
+        }
+        const OfxRectI &uvBounds = _uvImg->getBounds();
+        if (y < uvBounds.y1 || uvBounds.y2 <= y) {
+            return;
+        }
+        const int bx1 = std::max(x1, uvBounds.x1);
+        const int bx2 = std::min(x2, uvBounds.x2);
+        if (bx2 <= bx1) {
+            return;
+        }
+        const PIX *uvPix = (const PIX *) _uvImg->getPixelAddress(bx1, y);
+        assert(uvPix);
+        for (int x = bx1; x < bx2; ++x, uvPix += nComponents) {
+            if (uImg) {
+                uRow[x - x1] = uvPix[uComp];
+            }
+            if (vImg) {
+                vRow[x - x1] = uvPix[vComp];
+            }
+        }
+    }
+
     static inline double wrap(double x, WrapEnum wrap)
     {
         switch(wrap) {
@@ -568,18 +1143,47 @@ private:
         compFromChannel(_uChannel, &uImg, &uComp);
         compFromChannel(_vChannel, &vImg, &vComp);
         int srcx1 = 0, srcx2 = 1, srcy1 = 0, srcy2 = 0;
-        double f = 0, par = 1.;
-        if ((plugin == eDistortionPluginSTMap || plugin == eDistortionPluginLensDistortion) && _srcImg) {
+        if (plugin == eDistortionPluginSTMap && _srcImg) {
             const OfxRectI& srcBounds = _srcImg->getBounds();
             srcx1 = srcBounds.x1;
             srcx2 = srcBounds.x2;
             srcy1 = srcBounds.y1;
             srcy2 = srcBounds.y2;
-            if (plugin == eDistortionPluginLensDistortion) {
-                double fx = (srcBounds.x2-srcBounds.x1)/2.;
-                double fy = (srcBounds.y2-srcBounds.y1)/2.;
-                f = std::max(fx, fy); // TODO: distortion scaling param for LensDistortion?
+        }
+        // pixels outside of the LensDistortion grid (or all pixels, if there is no grid) are computed directly
+        LensDistortionParams lensParams;
+        if (plugin == eDistortionPluginLensDistortion) {
+            lensParams.model = _distortionModel;
+            lensParams.direction = _direction;
+            lensParams.par = _par;
+            lensParams.k1 = _k1;
+            lensParams.k2 = _k2;
+            lensParams.cx = _cx;
+            lensParams.cy = _cy;
+            lensParams.squeeze = _squeeze;
+            lensParams.ax = _ax;
+            lensParams.ay = _ay;
+            lensParams.srcBounds = _lensSrcBounds;
+        }
+        // rolling window of the U and V channels on rows y-1, y and y+1, for x in [procWindow.x1-1,procWindow.x2+1),
+        // so that each UV pixel is read once. Constant channels (0 or 1) do not touch the UV image.
+        const bool fetchUV = (plugin == eDistortionPluginSTMap || plugin == eDistortionPluginIDistort) && (uImg || vImg);
+        const int uvx1 = procWindow.x1 - 1;
+        const int uvx2 = procWindow.x2 + 1;
+        const int uvRowSize = uvx2 - uvx1;
+        std::vector<float> uvRows(fetchUV ? 6 * uvRowSize : 0);
+        float *uRows[3] = {0, 0, 0}; // rows y-1, y, y+1
+        float *vRows[3] = {0, 0, 0};
+        OfxRectI uvBounds = {0, 0, 0, 0};
+        if (fetchUV) {
+            uvBounds = _uvImg->getBounds();
+            for (int i = 0; i < 3; ++i) {
+                uRows[i] = &uvRows[2 * i * uvRowSize];
+                vRows[i] = uRows[i] + uvRowSize;
             }
+            // the rows are shifted at the beginning of each line
+            fetchUVRow(uImg, uComp, vImg, vComp, procWindow.y1 - 1, uvx1, uvx2, uRows[1], vRows[1]);
+            fetchUVRow(uImg, uComp, vImg, vComp, procWindow.y1, uvx1, uvx2, uRows[2], vRows[2]);
         }
         float tmpPix[4];
         for (int y = procWindow.y1; y < procWindow.y2; y++) {
@@ -589,40 +1193,54 @@ private:
 
             PIX *dstPix = (PIX *) _dstImg->getPixelAddress(procWindow.x1, y);
 
+            bool uvRowInside = false; // row y is inside the UV image
+            bool uvRowGradient = false; // rows y-1 and y+1 are inside the UV image
+            if (fetchUV) {
+                float *uPrev = uRows[0];
+                float *vPrev = vRows[0];
+                uRows[0] = uRows[1];
+                vRows[0] = vRows[1];
+                uRows[1] = uRows[2];
+                vRows[1] = vRows[2];
+                uRows[2] = uPrev;
+                vRows[2] = vPrev;
+                fetchUVRow(uImg, uComp, vImg, vComp, y + 1, uvx1, uvx2, uRows[2], vRows[2]);
+                uvRowInside = (uvBounds.y1 <= y && y < uvBounds.y2);
+                uvRowGradient = (uvBounds.y1 <= y - 1 && y + 1 < uvBounds.y2);
+            }
+
             for (int x = procWindow.x1; x < procWindow.x2; x++) {
                 double sx, sy, sxx, sxy, syx, syy; // the source pixel coordinates and their derivatives
 
                 switch (plugin) {
                     case eDistortionPluginSTMap:
                     case eDistortionPluginIDistort: {
-                        const PIX *uvPix = (const PIX *)  (_uvImg ? _uvImg->getPixelAddress(x, y) : 0);
-                        const PIX *uvPix_xn = (const PIX *)  (_uvImg ? _uvImg->getPixelAddress(x+1, y) : 0);
-                        const PIX *uvPix_xp = (const PIX *)  (_uvImg ? _uvImg->getPixelAddress(x-1, y) : 0);
-                        const PIX *uvPix_yn = (const PIX *)  (_uvImg ? _uvImg->getPixelAddress(x, y+1) : 0);
-                        const PIX *uvPix_yp = (const PIX *)  (_uvImg ? _uvImg->getPixelAddress(x, y-1) : 0);
+                        const int i = x - uvx1; // index in the UV rows
+                        const bool uvInside = uvRowInside && uvBounds.x1 <= x && x < uvBounds.x2;
+                        const bool uvGradientX = uvBounds.x1 <= x - 1 && x + 1 < uvBounds.x2;
                         double u, v, ux, uy, vx, vy;
                         // compute gradients before wrapping
                         if (!uImg) {
                             u = uComp;
                             ux = uy = 0.;
-                        } else if (!uvPix) {
+                        } else if (!uvInside) {
                             u = PIX();
                             ux = uy = 0.;
                         } else {
-                            u = uvPix[uComp];
-                            ux = (uvPix_xn && uvPix_xp) ? ((uvPix_xn[uComp] - uvPix_xp[uComp]) / 2.) : 0.;
-                            uy = (uvPix_yn && uvPix_yp) ? ((uvPix_yn[uComp] - uvPix_yp[uComp]) / 2.) : 0.;
+                            u = uRows[1][i];
+                            ux = uvGradientX ? ((uRows[1][i+1] - uRows[1][i-1]) / 2.) : 0.;
+                            uy = uvRowGradient ? ((uRows[2][i] - uRows[0][i]) / 2.) : 0.;
                         }
                         if (!vImg) {
                             v = vComp;
                             vx = vy = 0.;
-                        } else if (!uvPix) {
+                        } else if (!uvInside) {
                             v = PIX();
                             vx = vy = 0.;
                         } else {
-                            v = uvPix[vComp];
-                            vx = (uvPix_xn && uvPix_xp) ? ((uvPix_xn[vComp] - uvPix_xp[vComp]) / 2.) : 0.;
-                            vy = (uvPix_yn && uvPix_yp) ? ((uvPix_yn[vComp] - uvPix_yp[vComp]) / 2.) : 0.;
+                            v = vRows[1][i];
+                            vx = uvGradientX ? ((vRows[1][i+1] - vRows[1][i-1]) / 2.) : 0.;
+                            vy = uvRowGradient ? ((vRows[2][i] - vRows[0][i]) / 2.) : 0.;
                         }
                         u = (u - _uOffset) * _uScale;
                         ux *= _uScale;
@@ -664,25 +1282,9 @@ private:
                     }
                         break;
                     case eDistortionPluginLensDistortion: {
-                        switch (_distortionModel) {
-                            case eDistortionModelNuke: {
-                                double xu = _par * (x + 0.5 - (srcx2+srcx1)/2.)/f;
-                                double yu = (y + 0.5 - (srcy2+srcy1)/2.)/f;
-                                distort_nuke(xu, yu,
-                                             _k1, _k2, _cx/par, _cy, _squeeze, _ax, _ay,
-                                             &sx, &sy);
-                                sx /= _par;
-                            }
-                                break;
+                        if (!_lensDistortionGrid || !_lensDistortionGrid->getSourcePosition(x, y, &sx, &sy, &sxx, &sxy, &syx, &syy)) {
+                            lensDistortionPixel(lensParams, x, y, &sx, &sy, &sxx, &sxy, &syx, &syy);
                         }
-                        sx *= f;
-                        sx += (srcx2+srcx1)/2.;
-                        sy *= f;
-                        sy += (srcy2+srcy1)/2.;
-                        sxx = 1; // TODO: Jacobian
-                        sxy = 0;
-                        syx = 0;
-                        syy = 1;
                     }
                         break;
                 }
@@ -782,12 +1384,15 @@ public:
     , _center(0)
     , _squeeze(0)
     , _asymmetric(0)
+    , _direction(0)
+    , _distortError(0)
     , _filter(0)
     , _clamp(0)
     , _blackOutside(0)
     , _mix(0)
     , _maskInvert(0)
     , _plugin(plugin)
+    , _lensDistortionGridCache()
     {
         _dstClip = fetchClip(kOfxImageEffectOutputClipName);
         assert(_dstClip && (_dstClip->getPixelComponents() == ePixelComponentRGB || _dstClip->getPixelComponents() == ePixelComponentRGBA || _dstClip->getPixelComponents() == ePixelComponentAlpha));
@@ -826,7 +1431,9 @@ public:
             _center = fetchDouble2DParam(kParamCenter);
             _squeeze = fetchDoubleParam(kParamSqueeze);
             _asymmetric = fetchDouble2DParam(kParamAsymmetric);
-            assert(_k1 && _k2 && _k3 && _p1 && _p2 && _center && _squeeze && _asymmetric);
+            _direction = fetchChoiceParam(kParamDirection);
+            _distortError = fetchDoubleParam(kParamDistortError);
+            assert(_k1 && _k2 && _k3 && _p1 && _p2 && _center && _squeeze && _asymmetric && _direction && _distortError);
         }
         _filter = fetchChoiceParam(kParamFilterType);
         _clamp = fetchBooleanParam(kParamFilterClamp);
@@ -837,6 +1444,10 @@ public:
         assert(_mix && _maskInvert);
 
         updateVisibility();
+        // the error is not saved with the project
+        if (_plugin == eDistortionPluginLensDistortion) {
+            updateDistortError(timeLineGetTime());
+        }
     }
 
 private:
@@ -860,16 +1471,55 @@ private:
 
     virtual bool isIdentity(const IsIdentityArguments &args, Clip * &identityClip, double &identityTime) OVERRIDE FINAL;
 
+    /** @brief free the LensDistortion grids that are not in use */
+    virtual void purgeCaches(void) OVERRIDE FINAL
+    {
+        _lensDistortionGridCache.purge();
+    }
+
     /** @brief called when a param has just had its value changed */
     void changedParam(const InstanceChangedArgs &args, const std::string &paramName)
     {
         if (_plugin == eDistortionPluginLensDistortion) {
-            if (paramName == kParamDistortionModel && args.reason == eChangeUserEdit) {
+            if ((paramName == kParamDistortionModel || paramName == kParamDirection) && args.reason == eChangeUserEdit) {
                 updateVisibility();
             }
+            if (paramName == kParamDistortionModel || paramName == kParamDirection ||
+                paramName == kParamK1 || paramName == kParamK2 || paramName == kParamCenter ||
+                paramName == kParamSqueeze || paramName == kParamAsymmetric) {
+                updateDistortError(args.time);
+            }
         }
     }
 
+    /** @brief called when a clip has just been changed in some way (a rewire maybe) */
+    void changedClip(const InstanceChangedArgs &args, const std::string &clipName)
+    {
+        // the grid depends on the source bounds and pixel aspect ratio
+        if (_plugin == eDistortionPluginLensDistortion && clipName == kOfxImageEffectSimpleSourceClipName) {
+            updateDistortError(args.time);
+        }
+    }
+
+    /** @brief get the LensDistortion parameters at the given time (except the source bounds) */
+    void getLensDistortionParams(double time, LensDistortionParams *params);
+
+    /** @brief get the source bounds of the LensDistortion parameters, from the source RoD (which is the RoI of the source).
+        The render and updateDistortError must use the same bounds, so that they share the grid. */
+    void getLensDistortionSrcBounds(double time, const OfxPointD &renderScale, LensDistortionParams *params)
+    {
+        MergeImages2D::toPixelEnclosing(_srcClip->getRegionOfDefinition(time), renderScale, params->par, &params->srcBounds);
+    }
+
+    /** @brief true if a parameter of the distortion model is animated */
+    bool lensDistortionParamsAnimated() const
+    {
+        return (_k1->getNumKeys() > 0 || _k2->getNumKeys() > 0 || _center->getNumKeys() > 0 ||
+                _squeeze->getNumKeys() > 0 || _asymmetric->getNumKeys() > 0);
+    }
+
+    void updateDistortError(double time);
+
     void updateVisibility()
     {
         if (_plugin == eDistortionPluginLensDistortion) {
@@ -888,6 +1538,9 @@ private:
                     _asymmetric->setIsSecret(false);
                     break;
             }
+            int direction_i;
+            _direction->getValue(direction_i);
+            _distortError->setIsSecret((DirectionEnum)direction_i != eDirectionDistort);
         }
     }
 private:
@@ -915,12 +1568,15 @@ private:
     OFX::Double2DParam* _center;
     OFX::DoubleParam* _squeeze;
     OFX::Double2DParam* _asymmetric;
+    OFX::ChoiceParam* _direction;
+    OFX::DoubleParam* _distortError;
     OFX::ChoiceParam* _filter;
     OFX::BooleanParam* _clamp;
     OFX::BooleanParam* _blackOutside;
     OFX::DoubleParam* _mix;
     OFX::BooleanParam* _maskInvert;
     DistortionPluginEnum _plugin;
+    LensDistortionGridCache _lensDistortionGridCache;
 };
 
 
@@ -1069,25 +1725,32 @@ DistortionPlugin::setupAndProcess(DistortionProcessorBase &processor, const OFX:
         vScale *= args.renderScale.y;
     }
     DistortionModelEnum distortionModel = eDistortionModelNuke;
+    DirectionEnum direction = eDirectionUndistort;
     double par = 1., k1 = 0., k2 = 0., k3 = 0., p1 = 0., p2 = 0., cx = 0., cy = 0., squeeze = 1., ax = 0., ay = 0.;
+    // the grid is held until the end of the render
+    std::auto_ptr<LensDistortionGridCache::Handle> lensDistortionGrid;
     if (_plugin == eDistortionPluginLensDistortion) {
-        int distortionModel_i;
-        _distortionModel->getValue(distortionModel_i);
-        distortionModel = (DistortionModelEnum)distortionModel_i;
-        switch (distortionModel) {
-            case eDistortionModelNuke:
-                par = _srcClip->getPixelAspectRatio();
-                _k1->getValueAtTime(time, k1);
-                _k2->getValueAtTime(time, k2);
-                //_k3->getValueAtTime(time, k3);
-                //_p1->getValueAtTime(time, p1);
-                //_p2->getValueAtTime(time, p2);
-                _center->getValueAtTime(time, cx, cy);
-                _squeeze->getValueAtTime(time, squeeze);
-                _asymmetric->getValueAtTime(time, ax, ay);
-                break;
+        LensDistortionParams lensParams;
+        getLensDistortionParams(time, &lensParams);
+        distortionModel = lensParams.model;
+        direction = lensParams.direction;
+        par = lensParams.par;
+        k1 = lensParams.k1;
+        k2 = lensParams.k2;
+        cx = lensParams.cx;
+        cy = lensParams.cy;
+        squeeze = lensParams.squeeze;
+        ax = lensParams.ax;
+        ay = lensParams.ay;
+        if (src.get()) {
+            getLensDistortionSrcBounds(time, args.renderScale, &lensParams);
+            // In the Undistort direction, a grid that is rebuilt at each frame costs more than computing
+            // the pixels directly. In the Distort direction, it solves the inverse model on 1/64 of the pixels.
+            if (lensParams.direction == eDirectionDistort || !lensDistortionParamsAnimated()) {
+                lensDistortionGrid.reset(new LensDistortionGridCache::Handle(_lensDistortionGridCache, lensParams, args.renderWindow));
+            }
+            processor.setLensDistortion(lensParams.srcBounds, lensDistortionGrid.get() ? lensDistortionGrid->get() : 0);
         }
-
     }
     processor.setValues(processR, processG, processB, processA,
                         transformIsIdentity, srcTransformInverse,
@@ -1095,13 +1758,64 @@ DistortionPlugin::setupAndProcess(DistortionProcessorBase &processor, const OFX:
                         uOffset, vOffset,
                         uScale, vScale,
                         uWrap, vWrap,
-                        distortionModel, par, k1, k2, k3, p1, p2, cx, cy, squeeze, ax, ay,
+                        distortionModel, direction, par, k1, k2, k3, p1, p2, cx, cy, squeeze, ax, ay,
                         blackOutside, mix);
 
     // Call the base class process member, this will call the derived templated process code
     processor.process();
 }
 
+void
+DistortionPlugin::getLensDistortionParams(double time, LensDistortionParams *params)
+{
+    int distortionModel_i;
+    _distortionModel->getValue(distortionModel_i);
+    params->model = (DistortionModelEnum)distortionModel_i;
+    int direction_i;
+    _direction->getValue(direction_i);
+    params->direction = (DirectionEnum)direction_i;
+    params->par = 1.;
+    params->k1 = params->k2 = 0.;
+    params->cx = params->cy = 0.;
+    params->squeeze = 1.;
+    params->ax = params->ay = 0.;
+    params->srcBounds.x1 = params->srcBounds.y1 = params->srcBounds.x2 = params->srcBounds.y2 = 0;
+    switch (params->model) {
+        case eDistortionModelNuke:
+            params->par = _srcClip->getPixelAspectRatio();
+            _k1->getValueAtTime(time, params->k1);
+            _k2->getValueAtTime(time, params->k2);
+            //_k3->getValueAtTime(time, k3);
+            //_p1->getValueAtTime(time, p1);
+            //_p2->getValueAtTime(time, p2);
+            _center->getValueAtTime(time, params->cx, params->cy);
+            _squeeze->getValueAtTime(time, params->squeeze);
+            _asymmetric->getValueAtTime(time, params->ax, params->ay);
+            break;
+    }
+}
+
+// compute the inverse distortion grid at full resolution, and show its round-trip error.
+// The grid stays in the cache for the next full-resolution render.
+void
+DistortionPlugin::updateDistortError(double time)
+{
+    int direction_i;
+    _direction->getValue(direction_i);
+    if ((DirectionEnum)direction_i != eDirectionDistort || !_srcClip || !_srcClip->isConnected()) {
+        return;
+    }
+    LensDistortionParams lensParams;
+    getLensDistortionParams(time, &lensParams);
+    OfxPointD renderScale;
+    renderScale.x = renderScale.y = 1.;
+    getLensDistortionSrcBounds(time, renderScale, &lensParams);
+    LensDistortionGridCache::Handle grid(_lensDistortionGridCache, lensParams, lensParams.srcBounds);
+    if (grid.get()) {
+        _distortError->setValue(grid.get()->maxError());
+    }
+}
+
 template <class PIX, int nComponents, int maxValue, DistortionPluginEnum plugin>
 void
 DistortionPlugin::renderInternalForBitDepth(const OFX::RenderArguments &args)
@@ -1635,6 +2349,19 @@ void DistortionPluginFactory<plugin>::describeInContext(OFX::ImageEffectDescript
             }
 
         }
+        {
+            ChoiceParamDescriptor *param = desc.defineChoiceParam(kParamDirection);
+            param->setLabel(kParamDirectionLabel);
+            param->setHint(kParamDirectionHint);
+            assert(param->getNOptions() == eDirectionUndistort);
+            param->appendOption(kParamDirectionOptionUndistort, kParamDirectionOptionUndistortHint);
+            assert(param->getNOptions() == eDirectionDistort);
+            param->appendOption(kParamDirectionOptionDistort, kParamDirectionOptionDistortHint);
+            param->setDefault((int)eDirectionUndistort);
+            if (page) {
+                page->addChild(*param);
+            }
+        }
         {
             DoubleParamDescriptor *param = desc.defineDoubleParam(kParamK1);
             param->setLabel(kParamK1Label);
@@ -1711,6 +2438,20 @@ void DistortionPluginFactory<plugin>::describeInContext(OFX::ImageEffectDescript
                 page->addChild(*param);
             }
         }
+        {
+            DoubleParamDescriptor *param = desc.defineDoubleParam(kParamDistortError);
+            param->setLabel(kParamDistortErrorLabel);
+            param->setHint(kParamDistortErrorHint);
+            param->setDisplayRange(0., 0.1);
+            param->setDigits(6);
+            param->setEnabled(false);
+            param->setAnimates(false);
+            param->setEvaluateOnChange(false);
+            param->setIsPersistant(false);
+            if (page) {
+                page->addChild(*param);
+            }
+        }
 
 
     }
@@ -79,10 +79,14 @@
 // - show progress
 
 #include "FrameBlend.h"
+#include "FrameBlendIncremental.h"
+#include "FrameBlendSelection.h"
 
 #include <cmath> // for floor
 #include <climits> // for INT_MAX
 #include <cassert>
+#include <new> // for std::bad_alloc
+#include <vector>
 
 #include "ofxsImageEffect.h"
 #include "ofxsMultiThread.h"
@@ -143,6 +147,10 @@
 #define kParamOperationOptionSumHint "Output is the sum/addition of selected frames."
 #define kParamOperationOptionProduct "Product"
 #define kParamOperationOptionProductHint "Output is the product/multiplication of selected frames."
+#define kParamOperationOptionMedian "Median"
+#define kParamOperationOptionMedianHint "Output is the median of selected frames (exact for 8-bit and 16-bit images; for float images, the result may be interpolated between values that are within 1/256 of the range of the values at the pixel). Can be used, combined with a foreground matte, to produce a clean background plate."
+#define kParamOperationOptionPercentile "Percentile"
+#define kParamOperationOptionPercentileHint "Output is the given percentile of selected frames (exact for 8-bit and 16-bit images; for float images, the result may be interpolated between values that are within 1/256 of the range of the values at the pixel)."
 #define kParamOperationDefault eOperationAverage
 enum OperationEnum {
     eOperationAverage,
@@ -150,8 +158,18 @@ enum OperationEnum {
     eOperationMax,
     eOperationSum,
     eOperationProduct,
+    eOperationMedian,
+    eOperationPercentile,
 };
 
+#define kParamPercentileName  "percentile"
+#define kParamPercentileLabel "Percentile"
+#define kParamPercentileHint  "Percentile of the values at each pixel used by the Percentile operation: 0 gives the minimum, 50 the median and 100 the maximum. The output is the value of rank round(percentile/100*(count-1)) in the sorted values, so that it is always one of the input values for 8-bit and 16-bit images."
+
+
+#define kParamIncrementalName  "incremental"
+#define kParamIncrementalLabel "Incremental"
+#define kParamIncrementalHint  "When frames are rendered in order, compute each output frame from the result of the previous one, by removing the frames that left the range and adding the frames that entered it, instead of blending all frames again. Only used by the Average, Sum, Min and Max operations. If the frames are not rendered in order, or if the range moves by more than its length, all frames are blended. The plugin does not know when the input frames change, so this should be unchecked while editing the nodes upstream."
 
 #define kParamOutputCountName  "outputCount"
 #define kParamOutputCountLabel "Output Count to Alpha"
@@ -160,9 +178,67 @@ enum OperationEnum {
 #define kClipFgMName "FgM"
 
 #define kFrameChunk 4 // how many frames to process simultaneously
+#define kFrameBlendIncrementalMaxValues (32*1024*1024) // maximum number of values kept by the Min and Max incremental mode
+#define kFrameBlendSelectionMaxMemory (256*1024*1024) // Median and Percentile process the render window by bands of rows above this size
 
 using namespace OFX;
 
+// The result of the previous render, kept by the plugin instance for the incremental mode.
+// Average and Sum keep the sum of each pixel component. Min and Max keep, for each pixel
+// component, a monotonic deque of the (frame, value) pairs that can still become the
+// minimum or maximum, stored in a ring buffer of n values.
+struct FrameBlendState
+{
+    bool valid;
+    // what the state was computed for
+    OfxRectI renderWindow;
+    OfxPointD renderScale;
+    OFX::FieldEnum field;
+    OFX::BitDepthEnum bitDepth;
+    int nComponents;
+    OperationEnum operation;
+    bool fgM;
+    int interval;
+    int n; // number of frames in the range
+    int firstFrame; // first frame of the range
+    // Average and Sum
+    std::vector<double> sum;
+    // number of values taken into account, for all operations
+    std::vector<unsigned short> count;
+    // Min and Max
+    std::vector<float> dequeValue;
+    std::vector<int> dequeFrame;
+    std::vector<unsigned short> dequeHead;
+    std::vector<unsigned short> dequeSize;
+
+    FrameBlendState()
+    : valid(false)
+    , renderWindow()
+    , renderScale()
+    , field(OFX::eFieldNone)
+    , bitDepth(OFX::eBitDepthNone)
+    , nComponents(0)
+    , operation(eOperationAverage)
+    , fgM(false)
+    , interval(1)
+    , n(0)
+    , firstFrame(0)
+    {
+    }
+
+    /// free the memory
+    void clear()
+    {
+        valid = false;
+        std::vector<double>().swap(sum);
+        std::vector<unsigned short>().swap(count);
+        std::vector<float>().swap(dequeValue);
+        std::vector<int>().swap(dequeFrame);
+        std::vector<unsigned short>().swap(dequeHead);
+        std::vector<unsigned short>().swap(dequeSize);
+    }
+};
+
 class FrameBlendProcessorBase : public OFX::PixelProcessor
 {
 protected:
@@ -171,6 +247,14 @@ protected:
     std::vector<const OFX::Image*> _fgMImgs;
     float *_accumulatorData;
     unsigned short *_countData;
+    FrameBlendState *_state;
+    std::vector<int> _srcFrames;
+    std::vector<const OFX::Image*> _leavingSrcImgs;
+    std::vector<const OFX::Image*> _leavingFgMImgs;
+    FrameBlendSelection *_selectionData;
+    int _selectionPass;
+    bool _selectionFirstChunk;
+    double _percentile;
     const OFX::Image *_maskImg;
     bool _processR;
     bool _processG;
@@ -191,6 +275,14 @@ public:
     , _fgMImgs(0)
     , _accumulatorData(0)
     , _countData(0)
+    , _state(0)
+    , _srcFrames()
+    , _leavingSrcImgs()
+    , _leavingFgMImgs()
+    , _selectionData(0)
+    , _selectionPass(0)
+    , _selectionFirstChunk(false)
+    , _percentile(50.)
     , _maskImg(0)
     , _processR(true)
     , _processG(true)
@@ -208,6 +300,25 @@ public:
     void setFgMImgs(const std::vector<const OFX::Image*> &v) {_fgMImgs = v;}
     void setAccumulators(float *accumulatorData, unsigned short *countData)
     {_accumulatorData = accumulatorData; _countData = countData;}
+    // incremental mode: srcFrames are the frames of the source images, leaving images are removed from the state
+    void setState(FrameBlendState *state,
+                  const std::vector<int> &srcFrames,
+                  const std::vector<const OFX::Image*> &leavingSrcImgs,
+                  const std::vector<const OFX::Image*> &leavingFgMImgs)
+    {
+        _state = state;
+        _srcFrames = srcFrames;
+        _leavingSrcImgs = leavingSrcImgs;
+        _leavingFgMImgs = leavingFgMImgs;
+    }
+    // Median and Percentile: firstChunk is true for the first chunk of frames of each pass
+    void setSelection(FrameBlendSelection *selectionData, int pass, bool firstChunk, double percentile)
+    {
+        _selectionData = selectionData;
+        _selectionPass = pass;
+        _selectionFirstChunk = firstChunk;
+        _percentile = percentile;
+    }
 
     void setMaskImg(const OFX::Image *v, bool maskInvert) { _maskImg = v; _maskInvert = maskInvert; }
 
@@ -343,6 +454,10 @@ private:
                 case eOperationProduct:
                     initVal = 1.;
                     break;
+                case eOperationMedian:
+                case eOperationPercentile:
+                    initVal = 0.;
+                    break;
             }
         }
 
@@ -362,39 +477,50 @@ private:
                 const PIX *srcPix = (const PIX *)  (_srcImg ? _srcImg->getPixelAddress(x, y) : 0);
                 size_t renderPix = ((_renderWindow.x2 - _renderWindow.x1) * (y - _renderWindow.y1) +
                                     (x - _renderWindow.x1));
-                int count = _countData ? _countData[renderPix] : 0;
-                if (_accumulatorData) {
-                    std::copy(&_accumulatorData[renderPix * nComponents], &_accumulatorData[renderPix * nComponents + nComponents], tmpPix);
+                int count;
+                if (_state) {
+                    count = updateState(x, y, renderPix, initVal, tmpPix);
+                } else if (_selectionData) {
+                    count = updateSelection(x, y, renderPix, tmpPix);
                 } else {
-                    std::fill(tmpPix, tmpPix + nComponents, initVal);
-                }
-                // accumulate
-                for (unsigned i = 0; i < _srcImgs.size(); ++i) {
-                    const PIX *fgMPix = (const PIX *)  (_fgMImgs[i] ? _fgMImgs[i]->getPixelAddress(x, y) : 0);
-                    if (!fgMPix || *fgMPix <= 0) {
-                        const PIX *srcPixi = (const PIX *)  (_srcImgs[i] ? _srcImgs[i]->getPixelAddress(x, y) : 0);
-                        if (srcPixi) {
-                            for (int c = 0; c < nComponents; ++c) {
-                                switch (operation) {
-                                    case eOperationAverage:
-                                        tmpPix[c] += srcPixi[c];
-                                        break;
-                                    case eOperationMin:
-                                        tmpPix[c] = std::min(tmpPix[c], (float)srcPixi[c]);
-                                        break;
-                                    case eOperationMax:
-                                        tmpPix[c] = std::max(tmpPix[c], (float)srcPixi[c]);
-                                        break;
-                                    case eOperationSum:
-                                        tmpPix[c] += srcPixi[c];
-                                        break;
-                                    case eOperationProduct:
-                                        tmpPix[c] *= srcPixi[c];
-                                        break;
+                    count = _countData ? _countData[renderPix] : 0;
+                    if (_accumulatorData) {
+                        std::copy(&_accumulatorData[renderPix * nComponents], &_accumulatorData[renderPix * nComponents + nComponents], tmpPix);
+                    } else {
+                        std::fill(tmpPix, tmpPix + nComponents, initVal);
+                    }
+                    // accumulate
+                    for (unsigned i = 0; i < _srcImgs.size(); ++i) {
+                        const PIX *fgMPix = (const PIX *)  (_fgMImgs[i] ? _fgMImgs[i]->getPixelAddress(x, y) : 0);
+                        if (!fgMPix || *fgMPix <= 0) {
+                            const PIX *srcPixi = (const PIX *)  (_srcImgs[i] ? _srcImgs[i]->getPixelAddress(x, y) : 0);
+                            if (srcPixi) {
+                                for (int c = 0; c < nComponents; ++c) {
+                                    switch (operation) {
+                                        case eOperationAverage:
+                                            tmpPix[c] += srcPixi[c];
+                                            break;
+                                        case eOperationMin:
+                                            tmpPix[c] = std::min(tmpPix[c], (float)srcPixi[c]);
+                                            break;
+                                        case eOperationMax:
+                                            tmpPix[c] = std::max(tmpPix[c], (float)srcPixi[c]);
+                                            break;
+                                        case eOperationSum:
+                                            tmpPix[c] += srcPixi[c];
+                                            break;
+                                        case eOperationProduct:
+                                            tmpPix[c] *= srcPixi[c];
+                                            break;
+                                        case eOperationMedian:
+                                        case eOperationPercentile:
+                                            // see updateSelection()
+                                            break;
+                                    }
                                 }
                             }
+                            ++count;
                         }
-                        ++count;
                     }
                 }
                 if (!_lastPass) {
@@ -457,6 +583,119 @@ private:
             }
         }
     }
+
+    // Incremental mode: remove the leaving frames from the state at pixel (x,y), add the source frames,
+    // and on the last pass get the result in tmpPix. Returns the number of values taken into account.
+    int updateState(int x, int y, size_t renderPix, float initVal, float *tmpPix)
+    {
+        assert(operation == eOperationAverage || operation == eOperationSum || operation == eOperationMin || operation == eOperationMax);
+        assert(_leavingSrcImgs.size() == _leavingFgMImgs.size() && _srcImgs.size() == _srcFrames.size());
+        FrameBlendState &state = *_state;
+        const bool sum = (operation == eOperationAverage || operation == eOperationSum);
+        const int n = state.n;
+        int count = state.count[renderPix];
+
+        for (unsigned i = 0; i < _leavingFgMImgs.size(); ++i) {
+            const PIX *fgMPix = (const PIX *)  (_leavingFgMImgs[i] ? _leavingFgMImgs[i]->getPixelAddress(x, y) : 0);
+            if (!fgMPix || *fgMPix <= 0) {
+                if (sum) {
+                    const PIX *srcPixi = (const PIX *)  (_leavingSrcImgs[i] ? _leavingSrcImgs[i]->getPixelAddress(x, y) : 0);
+                    if (srcPixi) {
+                        for (int c = 0; c < nComponents; ++c) {
+                            state.sum[renderPix * nComponents + c] -= srcPixi[c];
+                        }
+                    }
+                }
+                --count;
+            }
+        }
+        if (!sum) {
+            // remove the values of the frames that left the range
+            for (int c = 0; c < nComponents; ++c) {
+                size_t d = renderPix * nComponents + c;
+                FrameBlendIncremental::dequeRemoveBefore(&state.dequeFrame[d * n], n, state.firstFrame,
+                                                         state.dequeHead[d], state.dequeSize[d]);
+            }
+        }
+        for (unsigned i = 0; i < _srcImgs.size(); ++i) {
+            const PIX *fgMPix = (const PIX *)  (_fgMImgs[i] ? _fgMImgs[i]->getPixelAddress(x, y) : 0);
+            if (!fgMPix || *fgMPix <= 0) {
+                const PIX *srcPixi = (const PIX *)  (_srcImgs[i] ? _srcImgs[i]->getPixelAddress(x, y) : 0);
+                if (srcPixi) {
+                    for (int c = 0; c < nComponents; ++c) {
+                        size_t d = renderPix * nComponents + c;
+                        if (sum) {
+                            state.sum[d] += srcPixi[c];
+                        } else {
+                            // frames are added in increasing order
+                            FrameBlendIncremental::dequeAdd<operation == eOperationMin>(&state.dequeValue[d * n], &state.dequeFrame[d * n], n,
+                                                                                        state.dequeHead[d], state.dequeSize[d],
+                                                                                        srcPixi[c], _srcFrames[i]);
+                        }
+                    }
+                }
+                ++count;
+            }
+        }
+        state.count[renderPix] = count;
+
+        if (_lastPass) {
+            for (int c = 0; c < nComponents; ++c) {
+                size_t d = renderPix * nComponents + c;
+                if (sum) {
+                    tmpPix[c] = (float)state.sum[d];
+                } else {
+                    tmpPix[c] = FrameBlendIncremental::dequeResult(&state.dequeValue[d * n], state.dequeHead[d], state.dequeSize[d], initVal);
+                }
+            }
+        }
+
+        return count;
+    }
+
+    // Median and Percentile: update the selection at pixel (x,y) with the source frames, and on
+    // the last pass get the result in tmpPix. Returns the number of values taken into account.
+    int updateSelection(int x, int y, size_t renderPix, float *tmpPix)
+    {
+        assert(operation == eOperationMedian || operation == eOperationPercentile);
+        FrameBlendSelection *selection = &_selectionData[renderPix * nComponents];
+        int count = _countData ? _countData[renderPix] : 0;
+
+        const double percentile = (operation == eOperationMedian) ? 50. : _percentile;
+        if (_selectionFirstChunk) {
+            for (int c = 0; c < nComponents; ++c) {
+                if (_selectionPass == 0) {
+                    FrameBlendSelector<PIX, maxValue>::init(selection[c]);
+                } else {
+                    FrameBlendSelector<PIX, maxValue>::selectBucket(selection[c], percentile);
+                }
+            }
+        }
+        for (unsigned i = 0; i < _srcImgs.size(); ++i) {
+            const PIX *fgMPix = (const PIX *)  (_fgMImgs[i] ? _fgMImgs[i]->getPixelAddress(x, y) : 0);
+            if (!fgMPix || *fgMPix <= 0) {
+                const PIX *srcPixi = (const PIX *)  (_srcImgs[i] ? _srcImgs[i]->getPixelAddress(x, y) : 0);
+                if (srcPixi) {
+                    for (int c = 0; c < nComponents; ++c) {
+                        FrameBlendSelector<PIX, maxValue>::add(selection[c], srcPixi[c]);
+                    }
+                }
+                if (_selectionPass == 0) {
+                    ++count;
+                }
+            }
+        }
+        if (_lastPass) {
+            for (int c = 0; c < nComponents; ++c) {
+                if (maxValue != 1) {
+                    FrameBlendSelector<PIX, maxValue>::selectBucket(selection[c], percentile);
+                }
+                tmpPix[c] = FrameBlendSelector<PIX, maxValue>::value(selection[c]);
+            }
+        }
+
+        return count;
+    }
 };
 
 
@@ -481,9 +720,13 @@ public:
     , _inputRange(0)
     , _frameInterval(0)
     , _operation(0)
+    , _percentile(0)
+    , _incremental(0)
     , _outputCount(0)
     , _mix(0)
     , _maskInvert(0)
+    , _stateMutex()
+    , _state()
     {
         _dstClip = fetchClip(kOfxImageEffectOutputClipName);
         assert(_dstClip && (_dstClip->getPixelComponents() == ePixelComponentRGB || _dstClip->getPixelComponents() == ePixelComponentRGBA));
@@ -503,8 +746,13 @@ public:
         _inputRange = fetchPushButtonParam(kParamInputRangeName);
         _frameInterval = fetchIntParam(kParamFrameIntervalName);
         _operation = fetchChoiceParam(kParamOperation);
+        _percentile = fetchDoubleParam(kParamPercentileName);
+        _incremental = fetchBooleanParam(kParamIncrementalName);
         _outputCount = fetchBooleanParam(kParamOutputCountName);
-        assert(_frameRange && _absolute && _inputRange && _operation && _outputCount);
+        assert(_frameRange && _absolute && _inputRange && _operation && _percentile && _incremental && _outputCount);
+        int operation_i;
+        _operation->getValue(operation_i);
+        _percentile->setEnabled((OperationEnum)operation_i == eOperationPercentile);
         _mix = fetchDoubleParam(kParamMix);
         _maskInvert = fetchBooleanParam(kParamMaskInvert);
         assert(_mix && _maskInvert);
@@ -525,8 +773,20 @@ private:
     /** @brief called when a param has just had its value changed */
     virtual void changedParam(const InstanceChangedArgs &args, const std::string &paramName) OVERRIDE FINAL;
 
+    /** @brief called when a clip has just been changed in some way (a rewire maybe) */
+    virtual void changedClip(const InstanceChangedArgs &args, const std::string &clipName) OVERRIDE FINAL;
+
+    /** @brief free the result of the previous render, kept for the incremental mode */
+    virtual void purgeCaches(void) OVERRIDE FINAL;
+
 private:
 
+    const OFX::Image* fetchSourceImage(OFX::Clip *clip, int frame, const OFX::RenderArguments &args, OFX::BitDepthEnum dstBitDepth, OFX::PixelComponentEnum dstComponents);
+
+    const OFX::Image* fetchMatteImage(OFX::Clip *clip, int frame, const OFX::RenderArguments &args);
+
+    void clearState();
+
     template<int nComponents>
     void renderForComponents(const OFX::RenderArguments &args);
 
@@ -550,9 +810,13 @@ private:
     PushButtonParam* _inputRange;
     IntParam* _frameInterval;
     ChoiceParam* _operation;
+    DoubleParam* _percentile;
+    BooleanParam* _incremental;
     BooleanParam* _outputCount;
     OFX::DoubleParam* _mix;
     OFX::BooleanParam* _maskInvert;
+    OFX::MultiThread::Mutex _stateMutex;
+    FrameBlendState _state; // result of the previous render, protected by _stateMutex
 };
 
 
@@ -582,6 +846,64 @@ struct OptionalImagesHolder_RAII
         }
     }
 };
+
+// Lock a mutex if it is not already locked, and unlock it on destruction.
+struct StateLock_RAII
+{
+    OFX::MultiThread::Mutex &mutex;
+    bool locked;
+
+    StateLock_RAII(OFX::MultiThread::Mutex &m, bool tryLock)
+    : mutex(m)
+    , locked(tryLock ? m.tryLock() : false)
+    {
+    }
+
+    ~StateLock_RAII()
+    {
+        if (locked) {
+            mutex.unlock();
+        }
+    }
+};
+}
+
+// fetch a source image and check its properties
+const OFX::Image*
+FrameBlendPlugin::fetchSourceImage(OFX::Clip *clip, int frame, const OFX::RenderArguments &args, OFX::BitDepthEnum dstBitDepth, OFX::PixelComponentEnum dstComponents)
+{
+    std::auto_ptr<const OFX::Image> src(clip ? clip->fetchImage(frame) : 0);
+    if (src.get()) {
+        if (src->getRenderScale().x != args.renderScale.x ||
+            src->getRenderScale().y != args.renderScale.y ||
+            (src->getField() != OFX::eFieldNone /* for DaVinci Resolve */ && src->getField() != args.fieldToRender)) {
+            setPersistentMessage(OFX::Message::eMessageError, "", "OFX Host gave image with wrong scale or field properties");
+            OFX::throwSuiteStatusException(kOfxStatFailed);
+        }
+        OFX::BitDepthEnum    srcBitDepth      = src->getPixelDepth();
+        OFX::PixelComponentEnum srcComponents = src->getPixelComponents();
+        if (srcBitDepth != dstBitDepth || srcComponents != dstComponents) {
+            OFX::throwSuiteStatusException(kOfxStatErrImageFormat);
+        }
+    }
+    return src.release();
+}
+
+// fetch a foreground matte and check its properties
+const OFX::Image*
+FrameBlendPlugin::fetchMatteImage(OFX::Clip *clip, int frame, const OFX::RenderArguments &args)
+{
+    assert(clip && clip->isConnected());
+    std::auto_ptr<const OFX::Image> mask(clip->fetchImage(frame));
+    if (mask.get()) {
+        if (mask->getRenderScale().x != args.renderScale.x ||
+            mask->getRenderScale().y != args.renderScale.y ||
+            (mask->getField() != OFX::eFieldNone /* for DaVinci Resolve */ && mask->getField() != args.fieldToRender)) {
+            setPersistentMessage(OFX::Message::eMessageError, "", "OFX Host gave image with wrong scale or field properties");
+            OFX::throwSuiteStatusException(kOfxStatFailed);
+        }
+    }
+    return mask.release();
 }
 
 /* set up and run a processor */
@@ -685,106 +1007,229 @@ FrameBlendPlugin::setupAndProcess(FrameBlendProcessorBase &processor, const OFX:
 
     const OfxRectI& renderWindow = args.renderWindow;
     size_t nPixels = (renderWindow.y2 - renderWindow.y1) * (renderWindow.x2 - renderWindow.x1);
+    int dstNComponents = _dstClip->getPixelComponentCount();
     OperationEnum operation = processor.getOperation();
-
-    // Main processing loop.
-    // We process the frame range by chunks, to avoid using too much memory.
-    int imin;
-    int imax = 0;
-    while (imax < n) {
-        imin = imax;
-        imax = std::min(imin + kFrameChunk, n);
-        bool lastPass = (imax == n);
-
-        if (!lastPass) {
-            // Initialize accumulator image (always use float)
-            if (!accumulatorData) {
-                int dstNComponents = _dstClip->getPixelComponentCount();
-                accumulator.reset(new OFX::ImageMemory(nPixels * dstNComponents * sizeof(float), this));
-                accumulatorData = (float*)accumulator->lock();
-                switch (operation) {
-                    case eOperationAverage:
-                    case eOperationSum:
-                        std::fill(accumulatorData, accumulatorData + nPixels * dstNComponents, 0.);
-                        break;
-                    case eOperationMin:
-                        std::fill(accumulatorData, accumulatorData + nPixels * dstNComponents, std::numeric_limits<float>::infinity());
-                        break;
-                    case eOperationMax:
-                        std::fill(accumulatorData, accumulatorData + nPixels * dstNComponents, -std::numeric_limits<float>::infinity());
-                        break;
-                    case eOperationProduct:
-                        std::fill(accumulatorData, accumulatorData + nPixels * dstNComponents, 1.);
-                        break;
+    const bool fgMConnected = _fgMClip && _fgMClip->isConnected();
+
+    // the frames to accumulate, and in incremental mode the frames to remove from the previous result
+    std::vector<int> frames;
+    std::vector<int> leavingFrames;
+
+    // Incremental mode: the state is only used by one render at a time, other renders blend all frames.
+    bool incremental = false;
+    _incremental->getValueAtTime(time, incremental);
+    incremental = (incremental &&
+                   (operation == eOperationAverage || operation == eOperationSum ||
+                    ((operation == eOperationMin || operation == eOperationMax) &&
+                     nPixels * dstNComponents * n <= (size_t)kFrameBlendIncrementalMaxValues)) &&
+                   n <= USHRT_MAX);
+    StateLock_RAII stateLock(_stateMutex, incremental);
+    FrameBlendState *state = stateLock.locked ? &_state : NULL;
+    if (state) {
+        const bool sum = (operation == eOperationAverage || operation == eOperationSum);
+        if (!(state->valid &&
+              state->renderWindow.x1 == renderWindow.x1 && state->renderWindow.x2 == renderWindow.x2 &&
+              state->renderWindow.y1 == renderWindow.y1 && state->renderWindow.y2 == renderWindow.y2 &&
+              state->renderScale.x == args.renderScale.x && state->renderScale.y == args.renderScale.y &&
+              state->field == args.fieldToRender &&
+              state->bitDepth == dstBitDepth &&
+              state->nComponents == dstNComponents &&
+              state->operation == operation &&
+              state->fgM == fgMConnected &&
+              state->interval == interval &&
+              state->n == n &&
+              // sums do not depend on the order of the frames, so the range may also move backward
+              FrameBlendIncremental::moveRange(state->firstFrame, min, n, interval, sum, &frames, &leavingFrames))) {
+            // blend all frames
+            try {
+                state->valid = false;
+                state->count.assign(nPixels, 0);
+                if (sum) {
+                    state->sum.assign(nPixels * dstNComponents, 0.);
+                } else {
+                    state->dequeValue.resize(nPixels * dstNComponents * n);
+                    state->dequeFrame.resize(nPixels * dstNComponents * n);
+                    state->dequeHead.assign(nPixels * dstNComponents, 0);
+                    state->dequeSize.assign(nPixels * dstNComponents, 0);
                 }
-
+            } catch (const std::bad_alloc&) {
+                state->clear();
+                state = NULL;
             }
-            // Initialize count image if operator is average or outputCount is true and output has alpha (use short)
-            if (!countData && (operation == eOperationAverage || outputCount)) {
-                count.reset(new OFX::ImageMemory(nPixels * sizeof(unsigned short), this));
-                countData = (unsigned short*)count->lock();
-                std::fill(countData, countData + nPixels, 0);
+            if (state) {
+                for (int i = 0; i < n; ++i) {
+                    frames.push_back(min + i*interval);
+                }
+                state->renderWindow = renderWindow;
+                state->renderScale = args.renderScale;
+                state->field = args.fieldToRender;
+                state->bitDepth = dstBitDepth;
+                state->nComponents = dstNComponents;
+                state->operation = operation;
+                state->fgM = fgMConnected;
+                state->interval = interval;
+                state->n = n;
             }
         }
-
-        // fetch the source images
-        OptionalImagesHolder_RAII srcImgs;
+        if (state) {
+            // the state is only valid once the render is complete
+            state->valid = false;
+            state->firstFrame = min;
+        }
+    }
+    if (!state) {
         for (int i = 0; i < n; ++i) {
-            if (abort()) {
-                throwSuiteStatusException(kOfxStatFailed);
-                return;
-            }
-            const OFX::Image* src = _srcClip ? _srcClip->fetchImage(min + i*interval) : 0;
-            if (src) {
-                if (src->getRenderScale().x != args.renderScale.x ||
-                    src->getRenderScale().y != args.renderScale.y ||
-                    (src->getField() != OFX::eFieldNone /* for DaVinci Resolve */ && src->getField() != args.fieldToRender)) {
-                    setPersistentMessage(OFX::Message::eMessageError, "", "OFX Host gave image with wrong scale or field properties");
-                    OFX::throwSuiteStatusException(kOfxStatFailed);
+            frames.push_back(min + i*interval);
+        }
+    }
+    int nFrames = (int)frames.size();
+
+    // Median and Percentile process all frames several times, using a selection structure per pixel component.
+    // The render window is then processed by bands of rows, so that the selection structures fit in kFrameBlendSelectionMaxMemory.
+    const bool selection = (operation == eOperationMedian || operation == eOperationPercentile);
+    int nSelectionPasses = 1;
+    if (selection) {
+        switch (dstBitDepth) {
+            case OFX::eBitDepthUByte:
+                nSelectionPasses = FrameBlendSelector<unsigned char, 255>::passes();
+                break;
+            case OFX::eBitDepthUShort:
+                nSelectionPasses = FrameBlendSelector<unsigned short, 65535>::passes();
+                break;
+            default:
+                nSelectionPasses = FrameBlendSelector<float, 1>::passes();
+                break;
+        }
+    }
+    int bandHeight = std::max(1, renderWindow.y2 - renderWindow.y1);
+    std::auto_ptr<OFX::ImageMemory> selectionMemory;
+    FrameBlendSelection *selectionData = NULL;
+    double percentile = 50.;
+    if (selection) {
+        if (n > kFrameBlendSelectionMaxValues) {
+            setPersistentMessage(OFX::Message::eMessageError, "", "Median and Percentile are limited to 65535 frames");
+            OFX::throwSuiteStatusException(kOfxStatFailed);
+        }
+        const size_t rowBytes = std::max(1, renderWindow.x2 - renderWindow.x1) * dstNComponents * sizeof(FrameBlendSelection);
+        bandHeight = std::max(1, std::min(bandHeight, (int)(kFrameBlendSelectionMaxMemory / rowBytes)));
+        selectionMemory.reset(new OFX::ImageMemory(rowBytes * bandHeight, this));
+        selectionData = (FrameBlendSelection*)selectionMemory->lock();
+        _percentile->getValueAtTime(time, percentile);
+    }
+    const int nBands = std::max(1, (renderWindow.y2 - renderWindow.y1 + bandHeight - 1) / bandHeight);
+
+    // Main processing loop.
+    // We process the frame range by chunks, to avoid using too much memory.
+    // Each band of rows goes through all the selection passes before the next one.
+    for (int pass = 0; pass < nBands * nSelectionPasses; ++pass) {
+        const int selectionPass = pass % nSelectionPasses;
+        OfxRectI bandWindow = renderWindow;
+        bandWindow.y1 = renderWindow.y1 + (pass / nSelectionPasses) * bandHeight;
+        bandWindow.y2 = std::min(bandWindow.y1 + bandHeight, renderWindow.y2);
+        if (selection && selectionPass == 0 && countData) {
+            // the counts of the previous band
+            std::fill(countData, countData + nPixels, 0);
+        }
+        int imin;
+        int imax = 0;
+        do {
+            imin = imax;
+            imax = std::min(imin + kFrameChunk, nFrames);
+            bool lastPass = (imax == nFrames) && (selectionPass == nSelectionPasses - 1);
+
+            if (!lastPass && !state) {
+                // Initialize accumulator image (always use float)
+                if (!accumulatorData && !selection) {
+                    accumulator.reset(new OFX::ImageMemory(nPixels * dstNComponents * sizeof(float), this));
+                    accumulatorData = (float*)accumulator->lock();
+                    switch (operation) {
+                        case eOperationAverage:
+                        case eOperationSum:
+                            std::fill(accumulatorData, accumulatorData + nPixels * dstNComponents, 0.);
+                            break;
+                        case eOperationMin:
+                            std::fill(accumulatorData, accumulatorData + nPixels * dstNComponents, std::numeric_limits<float>::infinity());
+                            break;
+                        case eOperationMax:
+                            std::fill(accumulatorData, accumulatorData + nPixels * dstNComponents, -std::numeric_limits<float>::infinity());
+                            break;
+                        case eOperationProduct:
+                            std::fill(accumulatorData, accumulatorData + nPixels * dstNComponents, 1.);
+                            break;
+                        case eOperationMedian:
+                        case eOperationPercentile:
+                            assert(false);
+                            break;
+                    }
+
                 }
-                OFX::BitDepthEnum    srcBitDepth      = src->getPixelDepth();
-                OFX::PixelComponentEnum srcComponents = src->getPixelComponents();
-                if (srcBitDepth != dstBitDepth || srcComponents != dstComponents) {
-                    OFX::throwSuiteStatusException(kOfxStatErrImageFormat);
+                // Initialize count image if operator is average or outputCount is true and output has alpha (use short)
+                if (!countData && (operation == eOperationAverage || outputCount)) {
+                    count.reset(new OFX::ImageMemory(nPixels * sizeof(unsigned short), this));
+                    countData = (unsigned short*)count->lock();
+                    std::fill(countData, countData + nPixels, 0);
                 }
             }
-            srcImgs.images.push_back(src);
-        }
-        // fetch the foreground mattes
-        OptionalImagesHolder_RAII fgMImgs;
-        for (int i = 0; i < n; ++i) {
-            if (abort()) {
-                throwSuiteStatusException(kOfxStatFailed);
-                return;
+
+            // fetch the source images
+            OptionalImagesHolder_RAII srcImgs;
+            for (int i = imin; i < imax; ++i) {
+                if (abort()) {
+                    throwSuiteStatusException(kOfxStatFailed);
+                    return;
+                }
+                srcImgs.images.push_back(fetchSourceImage(_srcClip, frames[i], args, dstBitDepth, dstComponents));
             }
-            const OFX::Image* mask = (_fgMClip && _fgMClip->isConnected()) ? _fgMClip->fetchImage(min + i*interval) : 0;
-            if (mask) {
-                assert(_fgMClip->isConnected());
-                if (mask->getRenderScale().x != args.renderScale.x ||
-                    mask->getRenderScale().y != args.renderScale.y ||
-                    (mask->getField() != OFX::eFieldNone /* for DaVinci Resolve */ && mask->getField() != args.fieldToRender)) {
-                    setPersistentMessage(OFX::Message::eMessageError, "", "OFX Host gave image with wrong scale or field properties");
-                    OFX::throwSuiteStatusException(kOfxStatFailed);
+            // fetch the foreground mattes
+            OptionalImagesHolder_RAII fgMImgs;
+            for (int i = imin; i < imax; ++i) {
+                if (abort()) {
+                    throwSuiteStatusException(kOfxStatFailed);
+                    return;
+                }
+                fgMImgs.images.push_back(fgMConnected ? fetchMatteImage(_fgMClip, frames[i], args) : 0);
+            }
+            // in incremental mode, the frames leaving the range are removed during the first pass
+            OptionalImagesHolder_RAII leavingSrcImgs;
+            OptionalImagesHolder_RAII leavingFgMImgs;
+            if (state && imin == 0) {
+                for (unsigned i = 0; i < leavingFrames.size(); ++i) {
+                    if (abort()) {
+                        throwSuiteStatusException(kOfxStatFailed);
+                        return;
+                    }
+                    // Min and Max only need the foreground matte, to update the count
+                    leavingSrcImgs.images.push_back((operation == eOperationAverage || operation == eOperationSum) ?
+                                                    fetchSourceImage(_srcClip, leavingFrames[i], args, dstBitDepth, dstComponents) : 0);
+                    leavingFgMImgs.images.push_back(fgMConnected ? fetchMatteImage(_fgMClip, leavingFrames[i], args) : 0);
                 }
             }
-            fgMImgs.images.push_back(mask);
-        }
 
-        // set the images
-        if (lastPass) {
-            processor.setDstImg(dst.get());
-        }
-        processor.setSrcImgs(lastPass ? src.get() : 0, srcImgs.images);
-        processor.setFgMImgs(fgMImgs.images);
-        // set the render window
-        processor.setRenderWindow(renderWindow);
-        processor.setAccumulators(accumulatorData, countData);
-
-        processor.setValues(processR, processG, processB, processA,
-                            lastPass, outputCount, mix);
+            // set the images
+            if (lastPass) {
+                processor.setDstImg(dst.get());
+            }
+            processor.setSrcImgs(lastPass ? src.get() : 0, srcImgs.images);
+            processor.setFgMImgs(fgMImgs.images);
+            // set the render window
+            processor.setRenderWindow(bandWindow);
+            processor.setAccumulators(accumulatorData, countData);
+            processor.setState(state,
+                               std::vector<int>(frames.begin() + imin, frames.begin() + imax),
+                               leavingSrcImgs.images,
+                               leavingFgMImgs.images);
+            processor.setSelection(selectionData, selectionPass, imin == 0, percentile);
+
+            processor.setValues(processR, processG, processB, processA,
+                                lastPass, outputCount, mix);
         
-        // Call the base class process member, this will call the derived templated process code
-        processor.process();
+            // Call the base class process member, this will call the derived templated process code
+            processor.process();
+        } while (imax < nFrames);
+    }
+
+    if (state && !abort()) {
+        state->valid = true;
     }
 }
 
@@ -863,6 +1308,16 @@ FrameBlendPlugin::renderForBitDepth(const OFX::RenderArguments &args)
             setupAndProcess(fred, args);
             break;
         }
+        case eOperationMedian: {
+            FrameBlendProcessor<PIX, nComponents, maxValue, eOperationMedian> fred(*this);
+            setupAndProcess(fred, args);
+            break;
+        }
+        case eOperationPercentile: {
+            FrameBlendProcessor<PIX, nComponents, maxValue, eOperationPercentile> fred(*this);
+            setupAndProcess(fred, args);
+            break;
+        }
     }
 }
 
@@ -989,6 +1444,38 @@ FrameBlendPlugin::changedParam(const InstanceChangedArgs &args, const std::strin
         _frameRange->setValue((int)range.min, (int)range.max);
         _absolute->setValue(true);
     }
+    if (paramName == kParamOperation) {
+        int operation_i;
+        _operation->getValueAtTime(args.time, operation_i);
+        _percentile->setEnabled((OperationEnum)operation_i == eOperationPercentile);
+    }
+    if (paramName == kParamIncrementalName) {
+        bool incremental;
+        _incremental->getValueAtTime(args.time, incremental);
+        if (!incremental) {
+            clearState();
+        }
+    }
+}
+
+void
+FrameBlendPlugin::changedClip(const InstanceChangedArgs &/*args*/, const std::string &/*clipName*/)
+{
+    // the input images may be different
+    clearState();
+}
+
+void
+FrameBlendPlugin::purgeCaches(void)
+{
+    clearState();
+}
+
+void
+FrameBlendPlugin::clearState()
+{
+    OFX::MultiThread::AutoMutex lock(_stateMutex);
+    _state.clear();
 }
 
 
@@ -1165,12 +1652,40 @@ void FrameBlendPluginFactory::describeInContext(OFX::ImageEffectDescriptor &desc
         param->appendOption(kParamOperationOptionSum, kParamOperationOptionSumHint);
         assert(param->getNOptions() == (int)eOperationProduct);
         param->appendOption(kParamOperationOptionProduct, kParamOperationOptionProductHint);
+        assert(param->getNOptions() == (int)eOperationMedian);
+        param->appendOption(kParamOperationOptionMedian, kParamOperationOptionMedianHint);
+        assert(param->getNOptions() == (int)eOperationPercentile);
+        param->appendOption(kParamOperationOptionPercentile, kParamOperationOptionPercentileHint);
         param->setDefault((int)kParamOperationDefault);
         if (page) {
             page->addChild(*param);
         }
     }
 
+    {
+        DoubleParamDescriptor *param = desc.defineDoubleParam(kParamPercentileName);
+        param->setLabel(kParamPercentileLabel);
+        param->setHint(kParamPercentileHint);
+        param->setRange(0., 100.);
+        param->setDisplayRange(0., 100.);
+        param->setDefault(50.);
+        param->setAnimates(true); // can animate
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+
+    {
+        BooleanParamDescriptor *param = desc.defineBooleanParam(kParamIncrementalName);
+        param->setLabel(kParamIncrementalLabel);
+        param->setHint(kParamIncrementalHint);
+        param->setDefault(false);
+        param->setAnimates(false);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+
     {
         BooleanParamDescriptor *param = desc.defineBooleanParam(kParamOutputCountName);
         param->setLabel(kParamOutputCountLabel);
@@ -0,0 +1,139 @@
+/*
+ OFX FrameBlend plugin: sliding range of frames, for the incremental mode.
+
+ Copyright (C) 2014 INRIA
+
+ Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+
+ Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+
+ Redistributions in binary form must reproduce the above copyright notice, this
+ list of conditions and the following disclaimer in the documentation and/or
+ other materials provided with the distribution.
+
+ Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ INRIA
+ Domaine de Voluceau
+ Rocquencourt - B.P. 105
+ 78153 Le Chesnay Cedex - France
+ */
+
+#ifndef Misc_FrameBlendIncremental_h
+#define Misc_FrameBlendIncremental_h
+
+#include <cassert>
+#include <vector>
+
+namespace FrameBlendIncremental {
+
+/// The frames to add to and to remove from the result of a range of n frames (one every interval frames)
+/// starting at prevFirstFrame, to get the result of the range starting at firstFrame.
+/// If the range moved forward, the frames are added in increasing order. If backward is true, the range
+/// may also move backward (for sums, which do not depend on the order of the frames).
+/// Returns false if all frames must be blended again.
+inline bool
+moveRange(int prevFirstFrame,
+          int firstFrame,
+          int n,
+          int interval,
+          bool backward,
+          std::vector<int>* frames,
+          std::vector<int>* leavingFrames)
+{
+    if ((firstFrame - prevFirstFrame) % interval != 0) {
+        return false;
+    }
+    // number of intervals the range moved by
+    const int shift = (firstFrame - prevFirstFrame) / interval;
+    if (0 <= shift && shift < n) {
+        for (int i = 0; i < shift; ++i) {
+            leavingFrames->push_back(prevFirstFrame + i * interval);
+            frames->push_back(firstFrame + (n - shift + i) * interval);
+        }
+
+        return true;
+    }
+    if (backward && -n < shift && shift < 0) {
+        for (int i = 0; i < -shift; ++i) {
+            leavingFrames->push_back(firstFrame + (n + i) * interval);
+            frames->push_back(firstFrame + i * interval);
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
+// Min and Max keep, for each pixel component, a monotonic deque of the (frame, value) pairs that can
+// still become the minimum or maximum, stored in a ring buffer of n values (value and frame),
+// starting at head. The values increase (Min) or decrease (Max) from the front to the back.
+
+/// remove the values of the frames before firstFrame
+inline void
+dequeRemoveBefore(const int *frame,
+                  int n,
+                  int firstFrame,
+                  unsigned short &head,
+                  unsigned short &size)
+{
+    while (size > 0 && frame[head] < firstFrame) {
+        head = (head + 1) % n;
+        --size;
+    }
+}
+
+/// add the value of frame f, which comes after the frames of the values in the deque
+template <bool isMin>
+void
+dequeAdd(float *value,
+         int *frame,
+         int n,
+         unsigned short head,
+         unsigned short &size,
+         float v,
+         int f)
+{
+    // the values that can not become the minimum (or maximum) any more are removed from the back
+    while (size > 0) {
+        float back = value[(head + size - 1) % n];
+        if (isMin ? (back < v) : (v < back)) {
+            break;
+        }
+        --size;
+    }
+    assert(size < n);
+    int slot = (head + size) % n;
+    value[slot] = v;
+    frame[slot] = f;
+    ++size;
+}
+
+/// the minimum (or maximum), or initVal if the deque is empty
+inline float
+dequeResult(const float *value,
+            unsigned short head,
+            unsigned short size,
+            float initVal)
+{
+    return size > 0 ? value[head] : initVal;
+}
+} // namespace FrameBlendIncremental
+
+#endif // Misc_FrameBlendIncremental_h
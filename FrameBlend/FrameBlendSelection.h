@@ -0,0 +1,260 @@
+/*
+ OFX FrameBlend plugin: per-pixel selection of the value of a given rank, for Median and Percentile.
+
+ Copyright (C) 2014 INRIA
+
+ Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+
+ Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+
+ Redistributions in binary form must reproduce the above copyright notice, this
+ list of conditions and the following disclaimer in the documentation and/or
+ other materials provided with the distribution.
+
+ Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ INRIA
+ Domaine de Voluceau
+ Rocquencourt - B.P. 105
+ 78153 Le Chesnay Cedex - France
+ */
+
+#ifndef Misc_FrameBlendSelection_h
+#define Misc_FrameBlendSelection_h
+
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+#include <limits>
+
+#define kFrameBlendSelectionBits 4 // log2 of the number of histogram buckets used by each pass of Median and Percentile
+#define kFrameBlendSelectionFloatPasses 2 // number of refinement passes of Median and Percentile for float images
+#define kFrameBlendSelectionMaxValues 65535 // maximum number of values at each pixel (the counts are unsigned short)
+
+// Median and Percentile select the value of a given rank by narrowing down the interval that
+// contains it, using a small histogram per pixel component. Each pass over all frames selects one of
+// the 1 << kFrameBlendSelectionBits buckets, so that the memory does not depend on the number of frames.
+// For integer images, each pass selects kFrameBlendSelectionBits bits of the value, and the result is exact.
+// For float images, the first pass computes the range of the values, each refinement pass divides
+// the selected interval into equal buckets, and the last pass computes the range of the values in
+// the selected interval, of width range/256. The result is exact unless other distinct values
+// remain in that interval: it is then interpolated between them, according to its rank.
+struct FrameBlendSelection
+{
+    unsigned int prefix; // the buckets that were selected, kFrameBlendSelectionBits bits each
+    unsigned short rank; // rank of the selected value in the selected interval (number of values during the float range pass)
+    unsigned short count; // number of values in the selected interval
+    unsigned char shift; // integer images: number of bits of the value that are not selected yet
+    unsigned char level; // float images: number of buckets that were selected
+    float lo, hi; // float images: range of the values
+    union {
+        unsigned short histogram[1 << kFrameBlendSelectionBits];
+        float range[2]; // float images: min and max values in the selected interval, during the last pass
+    };
+};
+
+#define kFrameBlendSelectionRangePass 0xfe // shift value during the float range pass
+#define kFrameBlendSelectionEmpty 0xff // shift value when there are no values
+
+// the rank of the given percentile (in [0,100]) among n values
+inline int
+frameBlendPercentileRank(double percentile, int n)
+{
+    double p = std::max(0., std::min(percentile, 100.));
+    return std::max(0, std::min((int)std::floor(p / 100. * (n - 1) + 0.5), n - 1));
+}
+
+// The selection at one pixel component of an image of type PIX with the given maxValue (1 for float images).
+// init() is called before the first pass, add() for each value, selectBucket() at the end of each pass
+// except the last one for float images, and value() gives the result after the last pass.
+template <class PIX, int maxValue>
+class FrameBlendSelector
+{
+public:
+    /// number of passes over the values
+    static int passes()
+    {
+        switch (maxValue) {
+            case 255:
+                return 8 / kFrameBlendSelectionBits;
+            case 65535:
+                return 16 / kFrameBlendSelectionBits;
+            default:
+                return 2 + kFrameBlendSelectionFloatPasses;
+        }
+    }
+
+    static void init(FrameBlendSelection &s)
+    {
+        s.prefix = 0;
+        s.rank = 0;
+        s.count = 0;
+        s.level = 0;
+        if (maxValue == 1) {
+            s.shift = kFrameBlendSelectionRangePass;
+            s.lo = std::numeric_limits<float>::infinity();
+            s.hi = -std::numeric_limits<float>::infinity();
+        } else {
+            s.shift = (maxValue == 255) ? 8 : 16;
+            std::fill(s.histogram, s.histogram + (1 << kFrameBlendSelectionBits), 0);
+        }
+    }
+
+    /// take a value into account (NaN values are ignored)
+    static void add(FrameBlendSelection &s, PIX v)
+    {
+        if (s.shift == kFrameBlendSelectionEmpty) {
+            return;
+        }
+        if (maxValue != 1) {
+            const unsigned int key = (unsigned int)v;
+            if (s.shift > 0 && (key >> s.shift) == s.prefix) {
+                const int step = std::min((int)s.shift, kFrameBlendSelectionBits);
+                ++s.histogram[(key >> (s.shift - step)) & ((1u << step) - 1)];
+            }
+        } else if (v != v) {
+            // NaN has no rank
+            return;
+        } else if (s.shift == kFrameBlendSelectionRangePass) {
+            // the range of the finite values
+            if (std::abs((float)v) <= std::numeric_limits<float>::max()) {
+                s.lo = std::min(s.lo, (float)v);
+                s.hi = std::max(s.hi, (float)v);
+            }
+            ++s.rank;
+        } else {
+            const int b = floatBucket(s, v);
+            if (b < 0) {
+                return;
+            }
+            if (s.level < kFrameBlendSelectionFloatPasses) {
+                ++s.histogram[b];
+            } else {
+                s.range[0] = std::min(s.range[0], (float)v);
+                s.range[1] = std::max(s.range[1], (float)v);
+            }
+        }
+    }
+
+    /// end of a pass: select the histogram bucket that contains the value of the given percentile
+    static void selectBucket(FrameBlendSelection &s, double percentile)
+    {
+        if (s.shift == kFrameBlendSelectionEmpty) {
+            return;
+        }
+        const int nBuckets = 1 << kFrameBlendSelectionBits;
+        if (maxValue == 1 && s.shift == kFrameBlendSelectionRangePass) {
+            // end of the float range pass
+            if (s.rank == 0) {
+                s.shift = kFrameBlendSelectionEmpty;
+                return;
+            }
+            s.count = s.rank;
+            s.rank = frameBlendPercentileRank(percentile, s.count);
+            s.shift = 0;
+            std::fill(s.histogram, s.histogram + nBuckets, 0);
+
+            return;
+        }
+        if (maxValue != 1 && s.shift == ((maxValue == 255) ? 8 : 16)) {
+            // end of the first integer pass: all values were counted
+            int n = 0;
+            for (int b = 0; b < nBuckets; ++b) {
+                n += s.histogram[b];
+            }
+            if (n == 0) {
+                s.shift = kFrameBlendSelectionEmpty;
+                return;
+            }
+            s.count = n;
+            s.rank = frameBlendPercentileRank(percentile, n);
+        }
+        int b = 0;
+        int cumulated = 0;
+        while (b < nBuckets - 1 && cumulated + s.histogram[b] <= s.rank) {
+            cumulated += s.histogram[b];
+            ++b;
+        }
+        s.rank -= cumulated;
+        s.count = s.histogram[b];
+        s.prefix = (s.prefix << kFrameBlendSelectionBits) | b;
+        if (maxValue != 1) {
+            s.shift -= kFrameBlendSelectionBits;
+            std::fill(s.histogram, s.histogram + nBuckets, 0);
+        } else if (++s.level < kFrameBlendSelectionFloatPasses) {
+            std::fill(s.histogram, s.histogram + nBuckets, 0);
+        } else {
+            // the last pass computes the range of the values in the selected interval
+            s.range[0] = std::numeric_limits<float>::infinity();
+            s.range[1] = -std::numeric_limits<float>::infinity();
+        }
+    }
+
+    /// the selected value (0 if there are no values): exact for integer images, and for float images
+    /// unless other distinct values are within 1/256 of the range of the values
+    static float value(const FrameBlendSelection &s)
+    {
+        if (s.shift == kFrameBlendSelectionEmpty) {
+            return 0.;
+        }
+        if (maxValue != 1) {
+            assert(s.shift == 0);
+            return (float)s.prefix;
+        }
+        assert(s.level == kFrameBlendSelectionFloatPasses && s.count > 0);
+        const float lo = s.range[0];
+        const float hi = s.range[1];
+        if (s.rank == 0 || lo == hi) {
+            return lo;
+        }
+        if (s.rank == s.count - 1) {
+            return hi;
+        }
+        float v = lo + (hi - lo) * s.rank / (s.count - 1);
+
+        return (v == v) ? v : lo;
+    }
+
+private:
+    // the bucket of a float value at the current level of the selection, or -1 if it is not in the selected interval.
+    // The interval is recomputed from the range at each pass, so that a value always falls in the same buckets.
+    static int floatBucket(const FrameBlendSelection &s, float v)
+    {
+        const int nBuckets = 1 << kFrameBlendSelectionBits;
+        float lo = s.lo;
+        float hi = s.hi;
+        for (int l = 0; ; ++l) {
+            // infinite values go to the first or last bucket
+            float t = (v - lo) / (hi - lo);
+            int b = (t > 0) ? ((t < 1) ? (int)(t * nBuckets) : (nBuckets - 1)) : 0;
+            if (l == s.level) {
+                return b;
+            }
+            if (b != (int)((s.prefix >> (kFrameBlendSelectionBits * (s.level - 1 - l))) & (nBuckets - 1))) {
+                return -1;
+            }
+            float w = (hi - lo) / nBuckets;
+            if (b < nBuckets - 1) {
+                hi = lo + (b + 1) * w;
+            }
+            lo = lo + b * w;
+        }
+    }
+};
+
+#endif // Misc_FrameBlendSelection_h
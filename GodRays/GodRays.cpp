@@ -73,9 +73,12 @@
 #include "GodRays.h"
 #include "ofxsTransform3x3.h"
 #include "ofxsTransformInteract.h"
+#include "ofxsMerging.h"
 
 #include <cmath>
+#include <algorithm>
 #include <iostream>
+#include <vector>
 #ifdef _WINDOWS
 #include <windows.h>
 #endif
@@ -119,10 +122,30 @@
 #define kParamMaxLabel "Max"
 #define kParamMaxHint "Output the brightest value at each pixel rather than the average."
 
+#define kParamAlgorithm "algorithm"
+#define kParamAlgorithmLabel "Algorithm"
+#define kParamAlgorithmHint "Algorithm used to accumulate the intermediate images."
+#define kParamAlgorithmOptionExact "Exact"
+#define kParamAlgorithmOptionExactHint "Each output pixel is the combination of 2^steps samples of the source image."
+#define kParamAlgorithmOptionFast "Fast"
+#define kParamAlgorithmOptionFastHint "The same accumulation is computed in steps passes by recursive doubling: each pass combines the previous result with itself, transformed by the next power of two of the elementary transform. The cost does not depend much on the number of steps, but the result is softer (each pass resamples the previous one bilinearly), and it is approximate if the transforms do not compose exactly (see Fast Error). Useful for long rays in previews."
+
+enum AlgorithmEnum {
+    eAlgorithmExact = 0,
+    eAlgorithmFast,
+};
+
+#define kParamFastError "fastError"
+#define kParamFastErrorLabel "Fast Error"
+#define kParamFastErrorHint "Estimated maximum position error, in pixels at full resolution, of the samples of the Fast algorithm, compared to the Exact algorithm (measured at the corners of the source image). This is a position error only: it does not include the softening due to the repeated bilinear resampling, and the weights of the samples are only exact if Gamma is 1. Updated when the parameters or the source change."
+
 #ifndef USE_STEPS
 #define kTransform3x3MotionBlurCount 1000 // number of transforms used in the motion
 #endif
 
+#define kGodRaysOutsideMargin 4. // samples farther than this (times the filter footprint) from the source image are black
+#define kGodRaysFastMargin 2 // margin in pixels added to the regions computed by the intermediate passes of the Fast algorithm
+
 using namespace OFX;
 
 class GodRaysProcessorBase
@@ -176,8 +199,95 @@ public:
 #endif
         _max = max;
     }
+
+    /// render using the Fast (recursive doubling) algorithm, or the exact one if it cannot be used
+    virtual void processFast() = 0;
 };
 
+// transform the corners of the bounds by H and return the bounding box, or false if a corner goes to infinity
+static bool
+godRaysTransformBounds(const OFX::Matrix3x3 &H, const OfxRectI &bounds, OfxRectI *bbox)
+{
+    double x1 = 0., x2 = 0., y1 = 0., y2 = 0.;
+    for (int i = 0; i < 4; ++i) {
+        OFX::Point3D p;
+        p.x = (i & 1) ? bounds.x2 : bounds.x1;
+        p.y = (i & 2) ? bounds.y2 : bounds.y1;
+        p.z = 1.;
+        p = H * p;
+        if (p.z <= 0.) {
+            return false;
+        }
+        double x = p.x / p.z;
+        double y = p.y / p.z;
+        if (i == 0) {
+            x1 = x2 = x;
+            y1 = y2 = y;
+        } else {
+            x1 = std::min(x1, x);
+            x2 = std::max(x2, x);
+            y1 = std::min(y1, y);
+            y2 = std::max(y2, y);
+        }
+    }
+    // clamp before converting to int
+    const double big = 1e8;
+    bbox->x1 = (int)std::floor(std::max(-big, x1));
+    bbox->x2 = (int)std::ceil(std::min(big, x2));
+    bbox->y1 = (int)std::floor(std::max(-big, y1));
+    bbox->y2 = (int)std::ceil(std::min(big, y2));
+    return true;
+}
+
+// Fast algorithm: the transform used by pass k is D_k = T_0^-1 * T_(2^k), so that sample t is
+// computed with T_0 * D_k0 * D_k1 * ... for the bits k0 < k1 < ... of t.
+// Return the maximum distance between the positions given by this product and by T_t at the corners of bounds,
+// or -1 if the Fast algorithm cannot be used with these transforms.
+static double
+godRaysFastError(const OFX::Matrix3x3 *invtransform, size_t invtransformsize, const OfxRectI &bounds)
+{
+    int passes = 0;
+    while (((size_t)1 << passes) < invtransformsize) {
+        ++passes;
+    }
+    if (invtransformsize < 2 || ((size_t)1 << passes) != invtransformsize) {
+        return -1.;
+    }
+    double det = ofxsMatDeterminant(invtransform[0]);
+    if (det == 0.) {
+        return -1.;
+    }
+    const OFX::Matrix3x3 T0inv = ofxsMatInverse(invtransform[0], det);
+    std::vector<OFX::Matrix3x3> D(passes);
+    for (int k = 0; k < passes; ++k) {
+        D[k] = T0inv * invtransform[(size_t)1 << k];
+    }
+    double err = 0.;
+    for (size_t t = 1; t < invtransformsize; ++t) {
+        OFX::Matrix3x3 C = invtransform[0];
+        for (int k = 0; k < passes; ++k) {
+            if (t & ((size_t)1 << k)) {
+                C = C * D[k];
+            }
+        }
+        for (int i = 0; i < 4; ++i) {
+            OFX::Point3D p;
+            p.x = (i & 1) ? bounds.x2 : bounds.x1;
+            p.y = (i & 2) ? bounds.y2 : bounds.y1;
+            p.z = 1.;
+            OFX::Point3D pc = C * p;
+            OFX::Point3D pt = invtransform[t] * p;
+            if (pc.z == 0. || pt.z == 0.) {
+                continue;
+            }
+            double dx = pc.x / pc.z - pt.x / pt.z;
+            double dy = pc.y / pc.z - pt.y / pt.z;
+            err = std::max(err, std::sqrt(dx * dx + dy * dy));
+        }
+    }
+    return err;
+}
+
 // The "filter" and "clamp" template parameters allow filter-specific optimization
 // by the compiler, using the same generic code for all filters.
 template <class PIX, int nComponents, int maxValue, FilterEnum filter, bool clamp>
@@ -263,7 +373,11 @@ private:
         if (_motionblur == 0.) { // no motion blur
             return multiThreadProcessImagesNoBlur(procWindow);
         } else { // motion blur
+#ifdef USE_STEPS
+            return multiThreadProcessImagesSteps(procWindow);
+#else
             return multiThreadProcessImagesMotionBlur(procWindow);
+#endif
         }
     } // multiThreadProcessImages
 
@@ -316,6 +430,375 @@ private:
         }
     }
 
+    // Fast algorithm: R_0 = color_0 * src(T_0 x), then at each pass R_k+1(x) = R_k(x) + w_k * R_k(D_k x)
+    // (or the max of both), where D_k = T_0^-1 * T_(2^k) and w_k = color_(2^k) / color_0.
+    // If the transforms form a one-parameter group (e.g. a scale and rotation around the center) and the colors
+    // decrease geometrically (gamma = 1), R_passes is the sum of all samples, computed in log2(N) passes.
+    // Each R_k is stored in a float buffer, which covers the region needed by the next passes.
+    virtual void processFast() OVERRIDE FINAL
+    {
+        if (!_srcImg || !_dstImg || !setupFast()) {
+            process();
+            return;
+        }
+        const int passes = (int)_fastTransforms.size();
+        for (int pass = 0; pass <= passes + 1; ++pass) {
+            if (_effect.abort()) {
+                break;
+            }
+            FastPass fastPass(*this, pass);
+            fastPass.multiThread();
+        }
+        for (int i = 0; i < 2; ++i) {
+            std::vector<float>().swap(_fastBuffer[i]);
+        }
+    }
+
+    bool setupFast()
+    {
+        const int n = (int)_invtransformsize;
+        if (_renderWindow.x2 <= _renderWindow.x1 || _renderWindow.y2 <= _renderWindow.y1) {
+            return false;
+        }
+        // check that the transforms can be composed
+        if (godRaysFastError(_invtransform, _invtransformsize, _renderWindow) < 0.) {
+            return false;
+        }
+        int passes = 0;
+        while ((1 << passes) < n) {
+            ++passes;
+        }
+        const OFX::Matrix3x3 T0inv = ofxsMatInverse(_invtransform[0], ofxsMatDeterminant(_invtransform[0]));
+        _fastTransforms.resize(passes);
+        _fastWeights.resize(passes);
+        for (int k = 0; k < passes; ++k) {
+            _fastTransforms[k] = T0inv * _invtransform[1 << k];
+            for (int c = 0; c < nComponents; ++c) {
+                _fastWeights[k][c] = (_color[0][c] != 0.f) ? (_color[1 << k][c] / _color[0][c]) : 0.f;
+            }
+        }
+        // regions: pass k+1 reads R_k at D_k x for x in the region of R_k+1.
+        // The regions are limited to the render window and the source image, outside of which R_k is
+        // considered black (if blackOutside is checked) or extended from its edges.
+        const OfxRectI &srcBounds = _srcImg->getBounds();
+        OfxRectI limit;
+        limit.x1 = std::min(_renderWindow.x1, srcBounds.x1) - kGodRaysFastMargin;
+        limit.x2 = std::max(_renderWindow.x2, srcBounds.x2) + kGodRaysFastMargin;
+        limit.y1 = std::min(_renderWindow.y1, srcBounds.y1) - kGodRaysFastMargin;
+        limit.y2 = std::max(_renderWindow.y2, srcBounds.y2) + kGodRaysFastMargin;
+        _fastRects.resize(passes + 1);
+        _fastRects[passes] = _renderWindow;
+        for (int k = passes - 1; k >= 0; --k) {
+            OfxRectI r = _fastRects[k + 1];
+            OfxRectI bbox;
+            if (!godRaysTransformBounds(_fastTransforms[k], _fastRects[k + 1], &bbox)) {
+                bbox = limit;
+            }
+            r.x1 = std::max(limit.x1, std::min(r.x1, bbox.x1 - kGodRaysFastMargin));
+            r.x2 = std::min(limit.x2, std::max(r.x2, bbox.x2 + kGodRaysFastMargin));
+            r.y1 = std::max(limit.y1, std::min(r.y1, bbox.y1 - kGodRaysFastMargin));
+            r.y2 = std::min(limit.y2, std::max(r.y2, bbox.y2 + kGodRaysFastMargin));
+            _fastRects[k] = r;
+        }
+        // R_k is in _fastBuffer[k % 2]
+        for (int i = 0; i < 2; ++i) {
+            size_t size = 0;
+            for (int k = i; k <= passes; k += 2) {
+                size = std::max(size, (size_t)(_fastRects[k].x2 - _fastRects[k].x1) * (_fastRects[k].y2 - _fastRects[k].y1) * nComponents);
+            }
+            _fastBuffer[i].resize(size);
+        }
+        return true;
+    }
+
+    // one pass of the Fast algorithm: 0 computes R_0, k+1 computes R_k+1, and passes+1 writes the output
+    class FastPass : public OFX::MultiThread::Processor
+    {
+    public:
+        FastPass(GodRaysProcessor &processor, int pass) : _processor(processor), _pass(pass) {}
+
+        virtual void multiThreadFunction(unsigned int threadId, unsigned int nThreads)
+        {
+            const int passes = (int)_processor._fastTransforms.size();
+            const OfxRectI &rect = _processor._fastRects[std::min(_pass, passes)];
+            const int h = rect.y2 - rect.y1;
+            int y1 = rect.y1 + (int)(((long long)h * threadId) / nThreads);
+            int y2 = rect.y1 + (int)(((long long)h * (threadId + 1)) / nThreads);
+            _processor.fastPassRows(_pass, y1, y2);
+        }
+
+    private:
+        GodRaysProcessor &_processor;
+        int _pass;
+    };
+    friend class FastPass;
+
+    void fastPassRows(int pass, int y1, int y2)
+    {
+        const int passes = (int)_fastTransforms.size();
+        float tmpPix[nComponents];
+        if (pass == 0) {
+            // R_0 = color_0 * src(T_0 x)
+            const OfxRectI &rect = _fastRects[0];
+            const OFX::Matrix3x3& H = _invtransform[0];
+            for (int y = y1; y < y2; ++y) {
+                if ( _effect.abort() ) {
+                    break;
+                }
+                float *bufPix = &_fastBuffer[0][((size_t)(y - rect.y1) * (rect.x2 - rect.x1)) * nComponents];
+                OFX::Point3D transformed;
+                transformed.x = H.a * (rect.x1 + 0.5) + H.b * (y + 0.5) + H.c;
+                transformed.y = H.d * (rect.x1 + 0.5) + H.e * (y + 0.5) + H.f;
+                transformed.z = H.g * (rect.x1 + 0.5) + H.h * (y + 0.5) + H.i;
+                for (int x = rect.x1; x < rect.x2; ++x, bufPix += nComponents) {
+                    if (transformed.z == 0.) {
+                        std::fill(tmpPix, tmpPix + nComponents, 0.f);
+                    } else {
+                        double fx = transformed.x / transformed.z;
+                        double fy = transformed.y / transformed.z;
+                        if (filter == eFilterImpulse) {
+                            ofxsFilterInterpolate2D<PIX,nComponents,filter,clamp>(fx, fy, _srcImg, _blackOutside, tmpPix);
+                        } else {
+                            double Jxx = (H.a*transformed.z - transformed.x*H.g)/(transformed.z*transformed.z);
+                            double Jxy = (H.b*transformed.z - transformed.x*H.h)/(transformed.z*transformed.z);
+                            double Jyx = (H.d*transformed.z - transformed.y*H.g)/(transformed.z*transformed.z);
+                            double Jyy = (H.e*transformed.z - transformed.y*H.h)/(transformed.z*transformed.z);
+                            ofxsFilterInterpolate2DSuper<PIX,nComponents,filter,clamp>(fx, fy, Jxx, Jxy, Jyx, Jyy, _srcImg, _blackOutside, tmpPix);
+                        }
+                    }
+                    for (int c = 0; c < nComponents; ++c) {
+                        bufPix[c] = tmpPix[c] * _color[0][c];
+                    }
+                    transformed.x += H.a;
+                    transformed.y += H.d;
+                    transformed.z += H.g;
+                }
+            }
+        } else if (pass <= passes) {
+            // R_k+1(x) = R_k(x) + w_k * R_k(D_k x)
+            const int k = pass - 1;
+            const OfxRectI &srcRect = _fastRects[k];
+            const OfxRectI &rect = _fastRects[k + 1];
+            const float *srcBuf = &_fastBuffer[k % 2][0];
+            const OFX::Matrix3x3& H = _fastTransforms[k];
+            for (int y = y1; y < y2; ++y) {
+                if ( _effect.abort() ) {
+                    break;
+                }
+                float *bufPix = &_fastBuffer[(k + 1) % 2][((size_t)(y - rect.y1) * (rect.x2 - rect.x1)) * nComponents];
+                const float *srcPix = &srcBuf[((size_t)(y - srcRect.y1) * (srcRect.x2 - srcRect.x1) + (rect.x1 - srcRect.x1)) * nComponents];
+                OFX::Point3D transformed;
+                transformed.x = H.a * (rect.x1 + 0.5) + H.b * (y + 0.5) + H.c;
+                transformed.y = H.d * (rect.x1 + 0.5) + H.e * (y + 0.5) + H.f;
+                transformed.z = H.g * (rect.x1 + 0.5) + H.h * (y + 0.5) + H.i;
+                for (int x = rect.x1; x < rect.x2; ++x, bufPix += nComponents, srcPix += nComponents) {
+                    if (transformed.z == 0.) {
+                        std::fill(tmpPix, tmpPix + nComponents, 0.f);
+                    } else {
+                        fastSample(srcBuf, srcRect, transformed.x / transformed.z, transformed.y / transformed.z, tmpPix);
+                    }
+                    for (int c = 0; c < nComponents; ++c) {
+                        float v = _fastWeights[k][c] * tmpPix[c];
+                        bufPix[c] = _max ? std::max(srcPix[c], v) : (srcPix[c] + v);
+                    }
+                    transformed.x += H.a;
+                    transformed.y += H.d;
+                    transformed.z += H.g;
+                }
+            }
+        } else {
+            // output: the mean (or max) of all samples
+            const OfxRectI &rect = _fastRects[passes];
+            const float n = (float)_invtransformsize;
+            for (int y = y1; y < y2; ++y) {
+                if ( _effect.abort() ) {
+                    break;
+                }
+                const float *bufPix = &_fastBuffer[passes % 2][((size_t)(y - rect.y1) * (rect.x2 - rect.x1)) * nComponents];
+                PIX *dstPix = (PIX *) _dstImg->getPixelAddress(rect.x1, y);
+                for (int x = rect.x1; x < rect.x2; ++x, bufPix += nComponents, dstPix += nComponents) {
+                    for (int c = 0; c < nComponents; ++c) {
+                        tmpPix[c] = _max ? bufPix[c] : (bufPix[c] / n);
+                    }
+                    ofxsMaskMix<PIX, nComponents, maxValue, true>(tmpPix, x, y, _srcImg, _domask, _maskImg, (float)_mix, _maskInvert, dstPix);
+                }
+            }
+        }
+    }
+
+    // bilinear interpolation of an intermediate buffer at (fx,fy) (canonical pixel coordinates)
+    void fastSample(const float *buf, const OfxRectI &rect, double fx, double fy, float *pix) const
+    {
+        const int w = rect.x2 - rect.x1;
+        const int h = rect.y2 - rect.y1;
+        double px = fx - 0.5 - rect.x1;
+        double py = fy - 0.5 - rect.y1;
+        if (_blackOutside) {
+            if (!(px > -1. && px < w && py > -1. && py < h)) { // also catches NaNs
+                std::fill(pix, pix + nComponents, 0.f);
+                return;
+            }
+        } else {
+            // extend the edges (this also avoids overflows when converting to int)
+            px = std::max(0., std::min(px, w - 1.));
+            py = std::max(0., std::min(py, h - 1.));
+        }
+        const int ix = (int)std::floor(px);
+        const int iy = (int)std::floor(py);
+        const float ax = (float)(px - ix);
+        const float ay = (float)(py - iy);
+        const float weights[4] = { (1.f - ax) * (1.f - ay), ax * (1.f - ay), (1.f - ax) * ay, ax * ay };
+        std::fill(pix, pix + nComponents, 0.f);
+        for (int i = 0; i < 4; ++i) {
+            int jx = ix + (i & 1);
+            int jy = iy + (i >> 1);
+            if (jx < 0 || w <= jx || jy < 0 || h <= jy) {
+                if (_blackOutside) {
+                    continue;
+                }
+                jx = std::max(0, std::min(jx, w - 1));
+                jy = std::max(0, std::min(jy, h - 1));
+            }
+            const float *p = &buf[((size_t)jy * w + jx) * nComponents];
+            for (int c = 0; c < nComponents; ++c) {
+                pix[c] += weights[i] * p[c];
+            }
+        }
+    }
+
+#ifdef USE_STEPS
+    // Compute the range [*x1,*x2) of the row y of procWindow where the sample of the affine transform H may be non-black,
+    // i.e. where the transformed pixel center is near the source image.
+    // This is only valid if blackOutside is checked: otherwise, the source image edges extend to infinity.
+    void getSampleRowRange(const OFX::Matrix3x3 &H, const OfxRectI &procWindow, int y, int *x1, int *x2) const
+    {
+        *x1 = procWindow.x1;
+        *x2 = procWindow.x2;
+        // the transformed point moves by (H.a,H.d)/H.i at each step along the row
+        const double dx = H.a / H.i;
+        const double dy = H.d / H.i;
+        // the filter footprint is proportional to the Jacobian, which is constant for an affine transform
+        const double margin = kGodRaysOutsideMargin * (1. + std::max(std::abs(dx) + std::abs(H.b / H.i),
+                                                                     std::abs(dy) + std::abs(H.e / H.i)));
+        const OfxRectI &srcBounds = _srcImg->getBounds();
+        // transformed center of the first pixel of the row
+        const double fx0 = (H.a * (procWindow.x1 + 0.5) + H.b * (y + 0.5) + H.c) / H.i;
+        const double fy0 = (H.d * (procWindow.x1 + 0.5) + H.e * (y + 0.5) + H.f) / H.i;
+        clipRowRange(fx0, dx, srcBounds.x1 - margin, srcBounds.x2 + margin, procWindow.x1, x1, x2);
+        clipRowRange(fy0, dy, srcBounds.y1 - margin, srcBounds.y2 + margin, procWindow.x1, x1, x2);
+    }
+
+    // restrict [*x1,*x2) to the x for which lo <= f0 + (x - xOrigin) * df <= hi
+    static void clipRowRange(double f0, double df, double lo, double hi, int xOrigin, int *x1, int *x2)
+    {
+        if (df == 0.) {
+            if (f0 < lo || hi < f0) {
+                *x2 = *x1;
+            }
+            return;
+        }
+        double t1 = (lo - f0) / df;
+        double t2 = (hi - f0) / df;
+        if (t2 < t1) {
+            std::swap(t1, t2);
+        }
+        // clamp before converting to int, the range may be huge
+        t1 = std::max(t1, (double)(*x1 - xOrigin));
+        t2 = std::min(t2, (double)(*x2 - 1 - xOrigin));
+        if (t2 < t1) {
+            *x2 = *x1;
+            return;
+        }
+        *x1 = xOrigin + (int)std::ceil(t1);
+        *x2 = std::max(*x1, xOrigin + (int)std::floor(t2) + 1);
+    }
+
+    // Along a row, the transformed pixel center moves linearly in homogeneous coordinates, so the transforms are
+    // applied one after the other to the whole row, stepping the transformed point incrementally.
+    // If blackOutside is checked, samples outside of the source image are black and are skipped, using one range
+    // test per row and transform. The result is the same as computing all samples.
+    void multiThreadProcessImagesSteps(const OfxRectI &procWindow)
+    {
+        float tmpPix[nComponents];
+        const int width = procWindow.x2 - procWindow.x1;
+        if (width <= 0) {
+            return;
+        }
+        std::vector<double> accRow(width * nComponents);
+        std::vector<float> maxRow(width * nComponents);
+        const int n = (int)_invtransformsize;
+        for (int y = procWindow.y1; y < procWindow.y2; ++y) {
+            if ( _effect.abort() ) {
+                break;
+            }
+
+            std::fill(accRow.begin(), accRow.end(), 0.);
+            std::fill(maxRow.begin(), maxRow.end(), 0.f);
+            for (int t = 0; _srcImg && t < n; ++t) {
+                const OFX::Matrix3x3& H = _invtransform[t];
+                const bool affine = (H.g == 0. && H.h == 0.);
+                if (affine && H.i == 0.) {
+                    // the back-transformed points are at infinity
+                    continue;
+                }
+                int x1 = procWindow.x1;
+                int x2 = procWindow.x2;
+                if (affine && _blackOutside) {
+                    getSampleRowRange(H, procWindow, y, &x1, &x2);
+                    if (x2 <= x1) {
+                        continue;
+                    }
+                }
+                // the coordinates of the center of the pixel in canonical coordinates
+                // see http://openfx.sourceforge.net/Documentation/1.3/ofxProgrammingReference.html#CanonicalCoordinates
+                OFX::Point3D transformed;
+                transformed.x = H.a * (x1 + 0.5) + H.b * (y + 0.5) + H.c;
+                transformed.y = H.d * (x1 + 0.5) + H.e * (y + 0.5) + H.f;
+                transformed.z = H.g * (x1 + 0.5) + H.h * (y + 0.5) + H.i;
+                double *accPix = &accRow[(x1 - procWindow.x1) * nComponents];
+                float *maxPix = &maxRow[(x1 - procWindow.x1) * nComponents];
+                for (int x = x1; x < x2; ++x, accPix += nComponents, maxPix += nComponents) {
+                    if (transformed.z != 0.) {
+                        double fx = transformed.x / transformed.z;
+                        double fy = transformed.y / transformed.z;
+                        if (filter == eFilterImpulse) {
+                            ofxsFilterInterpolate2D<PIX,nComponents,filter,clamp>(fx, fy, _srcImg, _blackOutside, tmpPix);
+                        } else {
+                            double Jxx = (H.a*transformed.z - transformed.x*H.g)/(transformed.z*transformed.z);
+                            double Jxy = (H.b*transformed.z - transformed.x*H.h)/(transformed.z*transformed.z);
+                            double Jyx = (H.d*transformed.z - transformed.y*H.g)/(transformed.z*transformed.z);
+                            double Jyy = (H.e*transformed.z - transformed.y*H.h)/(transformed.z*transformed.z);
+                            ofxsFilterInterpolate2DSuper<PIX,nComponents,filter,clamp>(fx, fy, Jxx, Jxy, Jyx, Jyy, _srcImg, _blackOutside, tmpPix);
+                        }
+                        for (int c = 0; c < nComponents; ++c) {
+                            // multiply by color
+                            tmpPix[c] *= _color[t][c];
+                            if (_max) {
+                                maxPix[c] = std::max(maxPix[c], tmpPix[c]);
+                            }
+                            accPix[c] += tmpPix[c];
+                        }
+                    }
+                    // next pixel
+                    transformed.x += H.a;
+                    transformed.y += H.d;
+                    transformed.z += H.g;
+                }
+            }
+
+            PIX *dstPix = (PIX *) _dstImg->getPixelAddress(procWindow.x1, y);
+            const double *accPix = &accRow[0];
+            const float *maxPix = &maxRow[0];
+            for (int x = procWindow.x1; x < procWindow.x2; ++x, dstPix += nComponents, accPix += nComponents, maxPix += nComponents) {
+                for (int c = 0; c < nComponents; ++c) {
+                    tmpPix[c] = _max ? maxPix[c] : (float)(n ? accPix[c] / n : 0.);
+                }
+                ofxsMaskMix<PIX, nComponents, maxValue, true>(tmpPix, x, y, _srcImg, _domask, _maskImg, (float)_mix, _maskInvert, dstPix);
+            }
+        }
+    }
+#endif
+
     void multiThreadProcessImagesMotionBlur(const OfxRectI &procWindow)
     {
         float tmpPix[nComponents];
@@ -505,6 +988,11 @@ private:
     };
 
     std::vector<Pix > _color;
+    // Fast algorithm data
+    std::vector<OFX::Matrix3x3> _fastTransforms; // D_k
+    std::vector<Pix > _fastWeights; // w_k
+    std::vector<OfxRectI> _fastRects; // region of R_k
+    std::vector<float> _fastBuffer[2]; // R_k is in _fastBuffer[k % 2]
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -531,6 +1019,8 @@ public:
     , _steps(0)
 #endif
     , _max(0)
+    , _algorithm(0)
+    , _fastError(0)
     {
         // NON-GENERIC
         _translate = fetchDouble2DParam(kParamTransformTranslate);
@@ -552,8 +1042,13 @@ public:
         assert(_steps);
 #endif
         _max = fetchBooleanParam(kParamMax);
+        _algorithm = fetchChoiceParam(kParamAlgorithm);
+        _fastError = fetchDoubleParam(kParamFastError);
 
-        assert(_fromColor && _toColor && _gamma && _max);
+        assert(_fromColor && _toColor && _gamma && _max && _algorithm && _fastError);
+        updateVisibility();
+        // the error is not saved with the project
+        updateFastError(timeLineGetTime());
     }
 
 private:
@@ -563,6 +1058,10 @@ private:
 
     void resetCenter(double time);
 
+    void updateVisibility();
+
+    void updateFastError(double time);
+
     virtual void changedParam(const OFX::InstanceChangedArgs &args, const std::string &paramName) OVERRIDE FINAL;
 
     /** @brief called when a clip has just been changed in some way (a rewire maybe) */
@@ -596,6 +1095,8 @@ private:
     RGBAParam* _gamma;
     IntParam* _steps;
     BooleanParam* _max;
+    ChoiceParam* _algorithm;
+    DoubleParam* _fastError;
 };
 
 // overridden is identity
@@ -755,9 +1256,51 @@ GodRaysPlugin::resetCenter(double time)
     endEditBlock();
 }
 
+void
+GodRaysPlugin::updateVisibility()
+{
+    int algorithm_i;
+    _algorithm->getValue(algorithm_i);
+    _fastError->setIsSecret((AlgorithmEnum)algorithm_i != eAlgorithmFast);
+}
+
+// compute the error of the Fast algorithm at full resolution
+void
+GodRaysPlugin::updateFastError(double time)
+{
+    int algorithm_i;
+    _algorithm->getValue(algorithm_i);
+    if ((AlgorithmEnum)algorithm_i != eAlgorithmFast || !_srcClip || !_srcClip->isConnected()) {
+        return;
+    }
+    OfxPointD renderScale;
+    renderScale.x = renderScale.y = 1.;
+    const double pixelAspectRatio = _srcClip->getPixelAspectRatio();
+    OfxRectI srcBounds;
+    MergeImages2D::toPixelEnclosing(_srcClip->getRegionOfDefinition(time), renderScale, pixelAspectRatio, &srcBounds);
+    bool invert;
+    _invert->getValueAtTime(time, invert);
+    int steps;
+    _steps->getValueAtTime(time, steps);
+    std::vector<OFX::Matrix3x3> invtransform((size_t)1 << std::max(0, steps));
+    size_t invtransformsize = getInverseTransformsBlur(time, renderScale, false, pixelAspectRatio, invert, &invtransform.front(), invtransform.size());
+    double err = godRaysFastError(&invtransform.front(), invtransformsize, srcBounds);
+    _fastError->setValue(std::max(0., err));
+}
+
 void
 GodRaysPlugin::changedParam(const OFX::InstanceChangedArgs &args, const std::string &paramName)
 {
+    if (paramName == kParamFastError) {
+        return;
+    }
+    if (paramName == kParamAlgorithm && args.reason == OFX::eChangeUserEdit) {
+        updateVisibility();
+    }
+    if (paramName != kParamTransformResetCenter && paramName != kParamTransformInteractive) {
+        // any other parameter may change the transforms
+        updateFastError(args.time);
+    }
     if (paramName == kParamTransformResetCenter) {
         resetCenter(args.time);
     } else if (paramName == kParamTransformTranslate ||
@@ -780,6 +1323,10 @@ GodRaysPlugin::changedClip(const InstanceChangedArgs &args, const std::string &c
     if (clipName == kOfxImageEffectSimpleSourceClipName && _srcClip && args.reason == OFX::eChangeUserEdit) {
         resetCenter(args.time);
     }
+    // the error depends on the source bounds and pixel aspect ratio
+    if (clipName == kOfxImageEffectSimpleSourceClipName) {
+        updateFastError(args.time);
+    }
 }
 
 
@@ -941,8 +1488,15 @@ GodRaysPlugin::setupAndProcess(GodRaysProcessorBase &processor,
 #endif
                         max);
 
+    int algorithm_i;
+    _algorithm->getValueAtTime(time, algorithm_i);
+
     // Call the base class process member, this will call the derived templated process code
-    processor.process();
+    if ((AlgorithmEnum)algorithm_i == eAlgorithmFast) {
+        processor.processFast();
+    } else {
+        processor.process();
+    }
 } // setupAndProcess
 
 template <class PIX, int nComponents, int maxValue>
@@ -1318,6 +1872,36 @@ void GodRaysPluginFactory::describeInContext(OFX::ImageEffectDescriptor &desc, O
         }
     }
 
+    // algorithm
+    {
+        ChoiceParamDescriptor* param = desc.defineChoiceParam(kParamAlgorithm);
+        param->setLabel(kParamAlgorithmLabel);
+        param->setHint(kParamAlgorithmHint);
+        assert(param->getNOptions() == eAlgorithmExact);
+        param->appendOption(kParamAlgorithmOptionExact, kParamAlgorithmOptionExactHint);
+        assert(param->getNOptions() == eAlgorithmFast);
+        param->appendOption(kParamAlgorithmOptionFast, kParamAlgorithmOptionFastHint);
+        param->setDefault((int)eAlgorithmExact);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+
+    // fastError
+    {
+        DoubleParamDescriptor* param = desc.defineDoubleParam(kParamFastError);
+        param->setLabel(kParamFastErrorLabel);
+        param->setHint(kParamFastErrorHint);
+        param->setDisplayRange(0., 10.);
+        param->setEnabled(false);
+        param->setAnimates(false);
+        param->setEvaluateOnChange(false);
+        param->setIsPersistant(false);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+
     ofxsMaskMixDescribeParams(desc, page);
 }
 
@@ -81,6 +81,7 @@
 #include "ofxsMaskMix.h"
 #include "ofxsMerging.h"
 #include "ofxsMacros.h"
+#include "ColorKernels.h"
 
 #define kPluginName "GradeOFX"
 #define kPluginGrouping "Color"
@@ -97,8 +98,9 @@
 // History:
 // version 1.0: initial version
 // version 2.0: use kNatronOfxParamProcess* parameters
+// version 2.1: add the precision parameter
 #define kPluginVersionMajor 2 // Incrementing this number means that you have broken backwards compatibility of the plug-in.
-#define kPluginVersionMinor 0 // Increment this when you have fixed a bug or made it faster.
+#define kPluginVersionMinor 1 // Increment this when you have fixed a bug or made it faster.
 
 #define kSupportsTiles 1
 #define kSupportsMultiResolution 1
@@ -145,267 +147,17 @@
 
 using namespace OFX;
 
-namespace {
-    struct RGBAValues {
-        double r,g,b,a;
-        RGBAValues(double v) : r(v), g(v), b(v), a(v) {}
-        RGBAValues() : r(0), g(0), b(0), a(0) {}
-    };
-}
-
-class GradeProcessorBase : public OFX::ImageProcessor
-{
-protected:
-    const OFX::Image *_srcImg;
-    const OFX::Image *_maskImg;
-    bool _premult;
-    int _premultChannel;
-    bool   _doMasking;
-    double _mix;
-    bool _maskInvert;
-    bool _processR, _processG, _processB, _processA;
-
-public:
-    
-    GradeProcessorBase(OFX::ImageEffect &instance)
-    : OFX::ImageProcessor(instance)
-    , _srcImg(0)
-    , _maskImg(0)
-    , _premult(false)
-    , _premultChannel(3)
-    , _doMasking(false)
-    , _mix(1.)
-    , _maskInvert(false)
-    , _processR(false)
-    , _processG(false)
-    , _processB(false)
-    , _processA(false)
-    , _clampBlack(true)
-    , _clampWhite(true)
-    {
-    }
-    
-    void setSrcImg(const OFX::Image *v) {_srcImg = v;}
-    
-    void setMaskImg(const OFX::Image *v, bool maskInvert) { _maskImg = v; _maskInvert = maskInvert; }
-    
-    void doMasking(bool v) {_doMasking = v;}
-    
-    void setValues(const RGBAValues& blackPoint,
-                   const RGBAValues& whitePoint,
-                   const RGBAValues& black,
-                   const RGBAValues& white,
-                   const RGBAValues& multiply,
-                   const RGBAValues& offset,
-                   const RGBAValues& gamma,
-                   bool clampBlack,
-                   bool clampWhite,
-                   bool premult,
-                   int premultChannel,
-                   double mix,
-                   bool processR,
-                   bool processG,
-                   bool processB,
-                   bool processA)
-    {
-        _blackPoint = blackPoint;
-        _whitePoint = whitePoint;
-        _black = black;
-        _white = white;
-        _multiply = multiply;
-        _offset = offset;
-        _gamma = gamma;
-        _clampBlack = clampBlack;
-        _clampWhite = clampWhite;
-        _premult = premult;
-        _premultChannel = premultChannel;
-        _mix = mix;
-        _processR = processR;
-        _processG = processG;
-        _processB = processB;
-        _processA = processA;
-    }
-
-    void grade(double* v, double wp, double bp, double white, double black, double mutiply, double offset, double gamma)
-    {
-        double A = mutiply * (white - black) / (wp - bp);
-        double B = offset + black - A * bp;
-        *v = std::pow((A * *v) + B, 1. / gamma);
-    }
-    
-    template<bool processR, bool processG, bool processB, bool processA>
-    void grade(double *r, double *g, double *b,double *a)
-    {
-        if (processR) {
-            grade(r, _whitePoint.r, _blackPoint.r, _white.r, _black.r, _multiply.r, _offset.r, _gamma.r);
-        }
-        if (processG) {
-            grade(g, _whitePoint.g, _blackPoint.g, _white.g, _black.g, _multiply.g, _offset.g, _gamma.g);
-        }
-        if (processB) {
-            grade(b, _whitePoint.b, _blackPoint.b, _white.b, _black.b, _multiply.b, _offset.b, _gamma.b);
-        }
-        if (processA) {
-            grade(a, _whitePoint.a, _blackPoint.a, _white.a, _black.a, _multiply.a, _offset.a, _gamma.a);
-        }
-        if (_clampBlack) {
-            if (processR) {
-                *r = std::max(0.,*r);
-            }
-            if (processG) {
-                *g = std::max(0.,*g);
-            }
-            if (processB) {
-                *b = std::max(0.,*b);
-            }
-            if (processA) {
-                *a = std::max(0.,*a);
-            }
-        }
-        if (_clampWhite) {
-            if (processR) {
-                *r = std::min(1.,*r);
-            }
-            if (processG) {
-                *g = std::min(1.,*g);
-            }
-            if (processB) {
-                *b = std::min(1.,*b);
-            }
-            if (processA) {
-                *a = std::min(1.,*a);
-            }
-        }
-    }
-
-private:
-    RGBAValues _blackPoint;
-    RGBAValues _whitePoint;
-    RGBAValues _black;
-    RGBAValues _white;
-    RGBAValues _multiply;
-    RGBAValues _offset;
-    RGBAValues _gamma;
-    bool _clampBlack;
-    bool _clampWhite;
-};
-
-
+typedef PixelKernelProcessorBase<GradeKernel> GradeProcessorBase;
 
 template <class PIX, int nComponents, int maxValue>
-class GradeProcessor : public GradeProcessorBase
+class GradeProcessor : public PixelKernelProcessor<GradeKernel, PIX, nComponents, maxValue>
 {
 public:
     GradeProcessor(OFX::ImageEffect &instance)
-    : GradeProcessorBase(instance)
+    : PixelKernelProcessor<GradeKernel, PIX, nComponents, maxValue>(instance)
     {
-    }
-    
-    void multiThreadProcessImages(OfxRectI procWindow)
-    {
-        const bool r = _processR && (nComponents != 1);
-        const bool g = _processG && (nComponents >= 2);
-        const bool b = _processB && (nComponents >= 3);
-        const bool a = _processA && (nComponents == 1 || nComponents == 4);
-        if (r) {
-            if (g) {
-                if (b) {
-                    if (a) {
-                        return process<true ,true ,true ,true >(procWindow); // RGBA
-                    } else {
-                        return process<true ,true ,true ,false>(procWindow); // RGBa
-                    }
-                } else {
-                    if (a) {
-                        return process<true ,true ,false,true >(procWindow); // RGbA
-                    } else {
-                        return process<true ,true ,false,false>(procWindow); // RGba
-                    }
-                }
-            } else {
-                if (b) {
-                    if (a) {
-                        return process<true ,false,true ,true >(procWindow); // RgBA
-                    } else {
-                        return process<true ,false,true ,false>(procWindow); // RgBa
-                    }
-                } else {
-                    if (a) {
-                        return process<true ,false,false,true >(procWindow); // RgbA
-                    } else {
-                        return process<true ,false,false,false>(procWindow); // Rgba
-                    }
-                }
-            }
-        } else {
-            if (g) {
-                if (b) {
-                    if (a) {
-                        return process<false,true ,true ,true >(procWindow); // rGBA
-                    } else {
-                        return process<false,true ,true ,false>(procWindow); // rGBa
-                    }
-                } else {
-                    if (a) {
-                        return process<false,true ,false,true >(procWindow); // rGbA
-                    } else {
-                        return process<false,true ,false,false>(procWindow); // rGba
-                    }
-                }
-            } else {
-                if (b) {
-                    if (a) {
-                        return process<false,false,true ,true >(procWindow); // rgBA
-                    } else {
-                        return process<false,false,true ,false>(procWindow); // rgBa
-                    }
-                } else {
-                    if (a) {
-                        return process<false,false,false,true >(procWindow); // rgbA
-                    } else {
-                        return process<false,false,false,false>(procWindow); // rgba
-                    }
-                }
-            }
-        }
-    }
-
-
-private:
-    
-    template<bool processR, bool processG, bool processB, bool processA>
-    void process(OfxRectI procWindow)
-    {
-        assert((!processR && !processG && !processB) || (nComponents == 3 || nComponents == 4));
-        assert(!processA || (nComponents == 1 || nComponents == 4));
-        assert(nComponents == 3 || nComponents == 4);
-        assert(_dstImg);
-        float unpPix[4];
-        float tmpPix[4];
-        for (int y = procWindow.y1; y < procWindow.y2; y++) {
-            if (_effect.abort()) {
-                break;
-            }
-
-            PIX *dstPix = (PIX *) _dstImg->getPixelAddress(procWindow.x1, y);
-
-            for (int x = procWindow.x1; x < procWindow.x2; x++) {
-                const PIX *srcPix = (const PIX *)  (_srcImg ? _srcImg->getPixelAddress(x, y) : 0);
-                ofxsUnPremult<PIX, nComponents, maxValue>(srcPix, unpPix, _premult, _premultChannel);
-                double t_r = unpPix[0];
-                double t_g = unpPix[1];
-                double t_b = unpPix[2];
-                double t_a = unpPix[3];
-                grade<processR,processG,processB,processA>(&t_r,&t_g,&t_b,&t_a);
-                tmpPix[0] = (float)t_r;
-                tmpPix[1] = (float)t_g;
-                tmpPix[2] = (float)t_b;
-                tmpPix[3] = (float)t_a;
-                ofxsPremultMaskMixPix<PIX, nComponents, maxValue, true>(tmpPix, _premult, _premultChannel, x, y, srcPix, _doMasking, _maskImg, (float)_mix, _maskInvert, dstPix);
-                // increment the dst pixel
-                dstPix += nComponents;
-            }
-        }
+        // the unprocessed channels go through premult, mask and mix like the processed ones
+        this->setCopyUnprocessed(false);
     }
 };
 
@@ -434,6 +186,7 @@ public:
     , _gamma(0)
     , _clampBlack(0)
     , _clampWhite(0)
+    , _precision(0)
     , _premult(0)
     , _premultChannel(0)
     , _mix(0)
@@ -455,6 +208,8 @@ public:
         _clampBlack = fetchBooleanParam(kParamClampBlack);
         _clampWhite = fetchBooleanParam(kParamClampWhite);
         assert(_blackPoint && _whitePoint && _black && _white && _multiply && _offset && _gamma && _clampBlack && _clampWhite);
+        _precision = fetchChoiceParam(kParamPrecision);
+        assert(_precision);
         _premult = fetchBooleanParam(kParamPremult);
         _premultChannel = fetchChoiceParam(kParamPremultChannel);
         assert(_premult && _premultChannel);
@@ -499,6 +254,7 @@ private:
     OFX::RGBAParam* _gamma;
     OFX::BooleanParam* _clampBlack;
     OFX::BooleanParam* _clampWhite;
+    OFX::ChoiceParam* _precision;
     OFX::BooleanParam* _premult;
     OFX::ChoiceParam* _premultChannel;
     OFX::DoubleParam* _mix;
@@ -593,9 +349,21 @@ GradePlugin::setupAndProcess(GradeProcessorBase &processor, const OFX::RenderArg
     _processB->getValue(processB);
     _processA->getValue(processA);
 
-    processor.setValues(blackPoint, whitePoint, black, white, multiply, offset, gamma,
-                        clampBlack, clampWhite, premult, premultChannel, mix,
-                        processR, processG, processB, processA);
+    processor.setValues(processR, processG, processB, processA,
+                        premult, premultChannel, mix);
+    int precision;
+    _precision->getValueAtTime(args.time, precision);
+    GradeKernel kernel(blackPoint, whitePoint, black, white, multiply, offset, gamma,
+                       clampBlack, clampWhite);
+    kernel.setFastPow(precision == ePrecisionFast);
+    // for large 8-bit and 16-bit images, compute the grade of each level once
+    std::vector<float> levelsLUT;
+    const int levelsMaxValue = levelsLUTMaxValue(dstBitDepth, premult, args.renderWindow);
+    if (levelsMaxValue) {
+        buildLevelsLUT(kernel, levelsMaxValue, &levelsLUT);
+        kernel.setLevelsLUT(&levelsLUT[0], levelsMaxValue);
+    }
+    processor.setKernel(kernel);
     processor.process();
 }
 
@@ -892,6 +660,8 @@ GradePluginFactory::describeInContext(OFX::ImageEffectDescriptor &desc, OFX::Con
         }
     }
     
+    describePrecisionParam(desc, page);
+
     ofxsPremultDescribeParams(desc, page);
     ofxsMaskMixDescribeParams(desc, page);
 }
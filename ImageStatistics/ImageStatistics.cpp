@@ -74,6 +74,9 @@
 #include <cmath>
 #include <climits>
 #include <algorithm>
+#include <limits>
+#include <string>
+#include <vector>
 
 #include "ofxsProcessing.H"
 #include "ofxsRectangleInteract.h"
@@ -143,6 +146,22 @@ using std::isnan;
 #define kParamAutoUpdateLabel "Auto Update"
 #define kParamAutoUpdateHint "Automatically update values when input or rectangle changes if an analysis was performed at current frame. If not checked, values are only updated if the plugin parameters change. "
 
+#define kParamRestrictToFrameRange "restrictToFrameRange"
+#define kParamRestrictToFrameRangeLabel "Restrict to Frame Range"
+#define kParamRestrictToFrameRangeHint "Restrict sequence analysis to a range of frames. If not checked, the whole input frame range is analyzed."
+
+#define kParamFrameRange "frameRange"
+#define kParamFrameRangeLabel "Frame Range"
+#define kParamFrameRangeHint "Range of frames analyzed by Analyze Sequence. It is intersected with the input frame range."
+
+#define kParamInputRange "inputRange"
+#define kParamInputRangeLabel "Input Range"
+#define kParamInputRangeHint "Set the frame range to the input range."
+
+#define kParamFrameStep "frameStep"
+#define kParamFrameStepLabel "Frame Step"
+#define kParamFrameStepHint "Analyze Sequence only analyzes one frame every Frame Step frames, starting at the first frame of the range."
+
 #define kParamGroupRGBA "RGBA"
 
 #define kParamStatMin "statMin"
@@ -257,670 +276,321 @@ namespace {
     };
 }
 
-class ImageStatisticsProcessorBase : public OFX::ImageProcessor
+// Accumulator for the min, max, mean and central moments of order 2 to 4 of a set of values.
+// Accumulators computed on disjoint sets of values can be merged in a numerically stable way, see:
+// T. F. Chan, G. H. Golub, R. J. LeVeque, "Updating Formulae and a Pairwise Algorithm for Computing Sample Variances", 1979
+// P. Pebay, "Formulas for Robust, One-Pass Parallel Computation of Covariances and Arbitrary-Order Statistical Moments", 2008
+struct Moments
 {
-protected:
-    OFX::MultiThread::Mutex _mutex; //< this is used so we can multi-thread the analysis and protect the shared results
-    unsigned long _count;
-
-public:
-    ImageStatisticsProcessorBase(OFX::ImageEffect &instance)
-    : OFX::ImageProcessor(instance)
-    , _mutex()
-    , _count(0)
+    double n;
+    double min;
+    double max;
+    double mean;
+    double m2; //!< sum of (x-mean)^2
+    double m3; //!< sum of (x-mean)^3
+    double m4; //!< sum of (x-mean)^4
+
+    Moments()
+    : n(0.)
+    , min(+std::numeric_limits<double>::infinity())
+    , max(-std::numeric_limits<double>::infinity())
+    , mean(0.)
+    , m2(0.)
+    , m3(0.)
+    , m4(0.)
     {
     }
 
-    virtual ~ImageStatisticsProcessorBase()
+    // compute the moments of count values (two passes over the values, which should be in cache)
+    void set(const double *values, int count)
     {
-    }
-
-    virtual void setPrevResults(const Results &results) = 0;
-
-    virtual void getResults(Results *results) = 0;
-
-protected:
-
-    template<class PIX, int nComponents, int maxValue>
-    void toRGBA(const PIX *p, RGBAValues* rgba)
-    {
-        if (nComponents == 4) {
-            rgba->r = p[0]/(double)maxValue;
-            rgba->g = p[1]/(double)maxValue;
-            rgba->b = p[2]/(double)maxValue;
-            rgba->a = p[3]/(double)maxValue;
-        } else if (nComponents == 3) {
-            rgba->r = p[0]/(double)maxValue;
-            rgba->g = p[1]/(double)maxValue;
-            rgba->b = p[2]/(double)maxValue;
-            rgba->a = 0;
-        } else if (nComponents == 2) {
-            rgba->r = p[0]/(double)maxValue;
-            rgba->g = p[1]/(double)maxValue;
-            rgba->b = 0;
-            rgba->a = 0;
-        } else if (nComponents == 1) {
-            rgba->r = 0;
-            rgba->g = 0;
-            rgba->b = 0;
-            rgba->a = p[0]/(double)maxValue;
-        } else {
-            rgba->r = 0;
-            rgba->g = 0;
-            rgba->b = 0;
-            rgba->a = 0;
+        n = count;
+        if (count <= 0) {
+            *this = Moments();
+            return;
         }
-    }
-
-    template<class PIX, int nComponents, int maxValue>
-    void
-    pixToHSVL(const PIX *p, float hsvl[4])
-    {
-        if (nComponents == 4 || nComponents == 3) {
-            float r, g, b;
-            r = p[0]/(float)maxValue;
-            g = p[1]/(float)maxValue;
-            b = p[2]/(float)maxValue;
-            OFX::Color::rgb_to_hsv(r, g, b, &hsvl[0], &hsvl[1], &hsvl[2]);
-            float min = std::min(std::min(r, g), b);
-            float max = std::max(std::max(r, g), b);
-            hsvl[3] = (min + max)/2;
-        } else {
-            hsvl[0] = hsvl[1] = hsvl[2] = hsvl[3] = 0.f;
+        double sum = 0.;
+        min = max = values[0];
+        for (int i = 0; i < count; ++i) {
+            const double v = values[i];
+            min = std::min(min, v);
+            max = std::max(max, v);
+            sum += v;
+        }
+        mean = sum / count;
+        m2 = m3 = m4 = 0.;
+        for (int i = 0; i < count; ++i) {
+            const double d = values[i] - mean;
+            const double d2 = d * d;
+            m2 += d2;
+            m3 += d2 * d;
+            m4 += d2 * d2;
         }
     }
 
-    template<class PIX, int nComponents, int maxValue>
-    void toComponents(const RGBAValues& rgba, PIX *p)
+    void merge(const Moments &b)
     {
-        if (nComponents == 4) {
-            p[0] = rgba.r * maxValue + ((maxValue != 1) ? 0.5 : 0);
-            p[1] = rgba.g * maxValue + ((maxValue != 1) ? 0.5 : 0);
-            p[2] = rgba.b * maxValue + ((maxValue != 1) ? 0.5 : 0);
-            p[3] = rgba.a * maxValue + ((maxValue != 1) ? 0.5 : 0);
-        } else if (nComponents == 3) {
-            p[0] = rgba.r * maxValue + ((maxValue != 1) ? 0.5 : 0);
-            p[1] = rgba.g * maxValue + ((maxValue != 1) ? 0.5 : 0);
-            p[2] = rgba.b * maxValue + ((maxValue != 1) ? 0.5 : 0);
-        } else if (nComponents == 2) {
-            p[0] = rgba.r * maxValue + ((maxValue != 1) ? 0.5 : 0);
-            p[1] = rgba.g * maxValue + ((maxValue != 1) ? 0.5 : 0);
-        } else if (nComponents == 1) {
-            p[0] = rgba.a * maxValue + ((maxValue != 1) ? 0.5 : 0);
+        if (b.n == 0.) {
+            return;
+        }
+        if (n == 0.) {
+            *this = b;
+            return;
         }
+        const double na = n;
+        const double nb = b.n;
+        const double nab = na + nb;
+        const double delta = b.mean - mean;
+        const double delta2 = delta * delta;
+        const double d_n = delta / nab;
+        const double d_n2 = d_n * d_n;
+        m4 += b.m4 + delta2 * d_n2 * na * nb * (na * na - na * nb + nb * nb) / nab
+              + 6. * d_n2 * (na * na * b.m2 + nb * nb * m2)
+              + 4. * d_n * (na * b.m3 - nb * m3);
+        m3 += b.m3 + delta * d_n2 * na * nb * (na - nb)
+              + 3. * d_n * (na * b.m2 - nb * m2);
+        m2 += b.m2 + delta * d_n * na * nb;
+        mean += nb * d_n;
+        n = nab;
+        min = std::min(min, b.min);
+        max = std::max(max, b.max);
     }
 };
 
+#define nComponentsHSVL 4
 
-template <class PIX, int nComponents, int maxValue>
-class ImageMinMaxMeanProcessor : public ImageStatisticsProcessorBase
+// the partial results computed by one thread
+struct MomentsRGBAHSVL
 {
-private:
-    double _min[nComponents];
-    double _max[nComponents];
-    double _sum[nComponents];
-public:
-    ImageMinMaxMeanProcessor(OFX::ImageEffect &instance)
-    : ImageStatisticsProcessorBase(instance)
-    {
-        std::fill(_min, _min+nComponents, +std::numeric_limits<double>::infinity());
-        std::fill(_max, _max+nComponents, -std::numeric_limits<double>::infinity());
-        std::fill(_sum, _sum+nComponents, 0.);
-    }
+    Moments rgba[4];
+    Moments hsvl[nComponentsHSVL];
 
-    ~ImageMinMaxMeanProcessor()
+    void merge(const MomentsRGBAHSVL& b)
     {
-    }
-
-    void setPrevResults(const Results &/*results*/) OVERRIDE FINAL {}
-
-    void getResults(Results *results) OVERRIDE FINAL
-    {
-        if (_count > 0) {
-            toRGBA<double, nComponents, 1>(_min, &results->min);
-            toRGBA<double, nComponents, 1>(_max, &results->max);
-            double mean[nComponents];
-            for (int c = 0; c < nComponents; ++c) {
-                mean[c] = _sum[c]/_count;
-            }
-            toRGBA<double, nComponents, 1>(mean, &results->mean);
+        for (int c = 0; c < 4; ++c) {
+            rgba[c].merge(b.rgba[c]);
         }
-    }
-
-private:
-
-    void addResults(double min[nComponents], double max[nComponents], double sum[nComponents], unsigned long count) {
-        _mutex.lock();
-        for (int c = 0; c < nComponents; ++c) {
-            _min[c] = std::min(_min[c], min[c]);
-            _max[c] = std::max(_max[c], max[c]);
-            _sum[c] += sum[c];
-        }
-        _count += count;
-        _mutex.unlock();
-    }
-
-
-    void multiThreadProcessImages(OfxRectI procWindow)
-    {
-        double min[nComponents], max[nComponents], sum[nComponents];
-        std::fill(min, min+nComponents, +std::numeric_limits<double>::infinity());
-        std::fill(max, max+nComponents, -std::numeric_limits<double>::infinity());
-        std::fill(sum, sum + nComponents, 0.);
-        unsigned long count = 0;
-        assert(_dstImg->getBounds().x1 <= procWindow.x1 && procWindow.y2 <= _dstImg->getBounds().y2 &&
-               _dstImg->getBounds().y1 <= procWindow.y1 && procWindow.y2 <= _dstImg->getBounds().y2);
-        for (int y = procWindow.y1; y < procWindow.y2; ++y) {
-            if (_effect.abort()) {
-                break;
-            }
-
-            PIX *dstPix = (PIX *) _dstImg->getPixelAddress(procWindow.x1, y);
-
-            double sumLine[nComponents]; // partial sum to avoid underflows
-            std::fill(sumLine, sumLine + nComponents, 0.);
-
-            for (int x = procWindow.x1; x < procWindow.x2; ++x) {
-                for (int c = 0; c < nComponents; ++c) {
-                    double v = *dstPix;
-                    min[c] = std::min(min[c], v);
-                    max[c] = std::max(max[c], v);
-                    sumLine[c] += v;
-                    ++dstPix;
-                }
-            }
-            for (int c = 0; c < nComponents; ++c) {
-                sum[c] += sumLine[c];
-            }
-            count += procWindow.x2 - procWindow.x1;
+        for (int c = 0; c < nComponentsHSVL; ++c) {
+            hsvl[c].merge(b.hsvl[c]);
         }
-
-        addResults(min, max, sum, count);
     }
 };
 
-
-
-
-template <class PIX, int nComponents, int maxValue>
-class ImageSDevProcessor : public ImageStatisticsProcessorBase
+class ImageStatisticsProcessorBase : public OFX::ImageProcessor
 {
-private:
-    double _mean[nComponents];
-    double _sum_p2[nComponents];
-public:
-    ImageSDevProcessor(OFX::ImageEffect &instance)
-    : ImageStatisticsProcessorBase(instance)
-    {
-        std::fill(_mean, _mean+nComponents, 0.);
-        std::fill(_sum_p2, _sum_p2+nComponents, 0.);
-    }
+protected:
+    OFX::MultiThread::Mutex _mutex; //< only used if the host uses more threads than expected
+    bool _doRGBA;
+    bool _doHSVL;
+    bool _checkAbort; //< if false, abort() is left to the caller
+    std::vector<MomentsRGBAHSVL> _partials; //< one per thread, merged after processing, so that no lock is needed
+    MomentsRGBAHSVL _extra; //< partial results from threads beyond _partials.size()
 
-    ~ImageSDevProcessor()
+public:
+    ImageStatisticsProcessorBase(OFX::ImageEffect &instance, bool doRGBA, bool doHSVL, bool checkAbort)
+    : OFX::ImageProcessor(instance)
+    , _mutex()
+    , _doRGBA(doRGBA)
+    , _doHSVL(doHSVL)
+    , _checkAbort(checkAbort)
+    , _partials(std::max(1u, OFX::MultiThread::getNumCPUs()))
+    , _extra()
     {
     }
 
-    void setPrevResults(const Results &results) OVERRIDE FINAL
+    virtual ~ImageStatisticsProcessorBase()
     {
-        toComponents<double, nComponents, 1>(results.mean, _mean);
     }
 
-    void getResults(Results *results) OVERRIDE FINAL
+    void getResults(Results *resultsRGBA, Results *resultsHSVL)
     {
-        if (_count > 1) {
-            double sdev[nComponents];
-            for (int c = 0; c < nComponents; ++c) {
-                // sdev^2 is an unbiased estimator for the population variance
-                sdev[c] = std::sqrt(std::max(0., _sum_p2[c]/(_count-1)));
-            }
-            toRGBA<double, nComponents, 1>(sdev, &results->sdev);
+        MomentsRGBAHSVL m = _extra;
+        for (size_t i = 0; i < _partials.size(); ++i) {
+            m.merge(_partials[i]);
         }
-    }
-
-private:
-
-    void addResults(double sum_p2[nComponents], unsigned long count) {
-        _mutex.lock();
-        for (int c = 0; c < nComponents; ++c) {
-            _sum_p2[c] += sum_p2[c];
+        if (_doRGBA) {
+            momentsToResults(m.rgba, resultsRGBA);
         }
-        _count += count;
-        _mutex.unlock();
-    }
-
-
-    void multiThreadProcessImages(OfxRectI procWindow)
-    {
-        double sum_p2[nComponents];
-        std::fill(sum_p2, sum_p2 + nComponents, 0.);
-        unsigned long count = 0;
-        assert(_dstImg->getBounds().x1 <= procWindow.x1 && procWindow.y2 <= _dstImg->getBounds().y2 &&
-               _dstImg->getBounds().y1 <= procWindow.y1 && procWindow.y2 <= _dstImg->getBounds().y2);
-        for (int y = procWindow.y1; y < procWindow.y2; ++y) {
-            if (_effect.abort()) {
-                break;
-            }
-
-            PIX *dstPix = (PIX *) _dstImg->getPixelAddress(procWindow.x1, y);
-
-            double sumLine_p2[nComponents]; // partial sum to avoid underflows
-            std::fill(sumLine_p2, sumLine_p2 + nComponents, 0.);
-
-            for (int x = procWindow.x1; x < procWindow.x2; ++x) {
-                for (int c = 0; c < nComponents; ++c) {
-                    double v = (*dstPix - _mean[c]);
-                    sumLine_p2[c] += v * v;
-                    ++dstPix;
-                }
-            }
-            for (int c = 0; c < nComponents; ++c) {
-                sum_p2[c] += sumLine_p2[c];
-            }
-            count += procWindow.x2 - procWindow.x1;
+        if (_doHSVL) {
+            momentsToResults(m.hsvl, resultsHSVL);
         }
-
-        addResults(sum_p2, count);
     }
-};
 
-
-
-
-template <class PIX, int nComponents, int maxValue>
-class ImageSkewnessKurtosisProcessor : public ImageStatisticsProcessorBase
-{
 private:
-    double _mean[nComponents];
-    double _sdev[nComponents];
-    double _sum_p3[nComponents];
-    double _sum_p4[nComponents];
-public:
-    ImageSkewnessKurtosisProcessor(OFX::ImageEffect &instance)
-    : ImageStatisticsProcessorBase(instance)
-    {
-        std::fill(_mean, _mean+nComponents, 0.);
-        std::fill(_sdev, _sdev+nComponents, 0.);
-        std::fill(_sum_p3, _sum_p3+nComponents, 0.);
-        std::fill(_sum_p4, _sum_p4+nComponents, 0.);
-    }
-
-    ~ImageSkewnessKurtosisProcessor()
-    {
-    }
-
-    void setPrevResults(const Results &results) OVERRIDE FINAL
+    static void toRGBA(const double v[4], RGBAValues* rgba)
     {
-        toComponents<double, nComponents, 1>(results.mean, _mean);
-        toComponents<double, nComponents, 1>(results.sdev, _sdev);
+        rgba->r = v[0];
+        rgba->g = v[1];
+        rgba->b = v[2];
+        rgba->a = v[3];
     }
 
-    void getResults(Results *results) OVERRIDE FINAL
+    static void momentsToResults(const Moments m[4], Results *results)
     {
-        if (_count > 2) {
-            double skewness[nComponents];
-            // factor for the adjusted Fisher-Pearson standardized moment coefficient G_1
-            double skewfac = ((double)_count*_count) / ((double)(_count-1)*(_count-2));
-            assert(!isnan(skewfac));
-            for (int c = 0; c < nComponents; ++c) {
-                skewness[c] = skewfac * _sum_p3[c] / _count;
-            }
-            toRGBA<double, nComponents, 1>(skewness, &results->skewness);
-            assert(!isnan(results->skewness.r) && !isnan(results->skewness.g) && !isnan(results->skewness.b) && !isnan(results->skewness.a));
-        }
-        if (_count > 3) {
-            double kurtosis[nComponents];
-            double kurtfac = ((double)(_count+1)*_count) / ((double)(_count-1)*(_count-2)*(_count-3));
-            double kurtshift = -3 * ((double)(_count-1)*(_count-1)) / ((double)(_count-2)*(_count-3));
-            assert(!isnan(kurtfac) && !isnan(kurtshift));
-            for (int c = 0; c < nComponents; ++c) {
-                kurtosis[c] = kurtfac * _sum_p4[c] + kurtshift;
-            }
-            toRGBA<double, nComponents, 1>(kurtosis, &results->kurtosis);
-            assert(!isnan(results->kurtosis.r) && !isnan(results->kurtosis.g) && !isnan(results->kurtosis.b) && !isnan(results->kurtosis.a));
+        // missing components (e.g. RGB in an Alpha image) have no values, and their statistics are zero
+        double count = 0.;
+        for (int c = 0; c < 4; ++c) {
+            count = std::max(count, m[c].n);
         }
-    }
-
-private:
-
-    void addResults(double sum_p3[nComponents], double sum_p4[nComponents], unsigned long count) {
-        _mutex.lock();
-        for (int c = 0; c < nComponents; ++c) {
-            _sum_p3[c] += sum_p3[c];
-            _sum_p4[c] += sum_p4[c];
+        if (count <= 0) {
+            return;
         }
-        _count += count;
-        _mutex.unlock();
-    }
-
-
-    void multiThreadProcessImages(OfxRectI procWindow)
-    {
-        double sum_p3[nComponents];
-        double sum_p4[nComponents];
-        std::fill(sum_p3, sum_p3 + nComponents, 0.);
-        std::fill(sum_p4, sum_p4 + nComponents, 0.);
-        unsigned long count = 0;
-        assert(_dstImg->getBounds().x1 <= procWindow.x1 && procWindow.y2 <= _dstImg->getBounds().y2 &&
-               _dstImg->getBounds().y1 <= procWindow.y1 && procWindow.y2 <= _dstImg->getBounds().y2);
-        for (int y = procWindow.y1; y < procWindow.y2; ++y) {
-            if (_effect.abort()) {
-                break;
+        double min[4], max[4], mean[4], sdev[4], skewness[4], kurtosis[4];
+        // factor for the adjusted Fisher-Pearson standardized moment coefficient G_1
+        const double skewfac = (count > 2) ? (count * count) / ((count - 1) * (count - 2)) : 0.;
+        const double kurtfac = (count > 3) ? ((count + 1) * count) / ((count - 1) * (count - 2) * (count - 3)) : 0.;
+        const double kurtshift = (count > 3) ? -3 * ((count - 1) * (count - 1)) / ((count - 2) * (count - 3)) : 0.;
+        assert(!isnan(skewfac) && !isnan(kurtfac) && !isnan(kurtshift));
+        for (int c = 0; c < 4; ++c) {
+            if (m[c].n == 0.) {
+                min[c] = max[c] = mean[c] = sdev[c] = skewness[c] = kurtosis[c] = 0.;
+                continue;
             }
-
-            PIX *dstPix = (PIX *) _dstImg->getPixelAddress(procWindow.x1, y);
-
-            double sumLine_p3[nComponents]; // partial sum to avoid underflows
-            double sumLine_p4[nComponents]; // partial sum to avoid underflows
-            std::fill(sumLine_p3, sumLine_p3 + nComponents, 0.);
-            std::fill(sumLine_p4, sumLine_p4 + nComponents, 0.);
-
-            for (int x = procWindow.x1; x < procWindow.x2; ++x) {
-                for (int c = 0; c < nComponents; ++c) {
-                    if (_sdev[c] > 0.) {
-                        double v = (*dstPix - _mean[c])/_sdev[c];
-                        double v2 = v * v;
-                        sumLine_p3[c] += v2 * v;
-                        sumLine_p4[c] += v2 * v2;
-                    }
-                    ++dstPix;
-                }
-            }
-            for (int c = 0; c < nComponents; ++c) {
-                sum_p3[c] += sumLine_p3[c];
-                sum_p4[c] += sumLine_p4[c];
+            assert(m[c].n == count);
+            min[c] = m[c].min;
+            max[c] = m[c].max;
+            mean[c] = m[c].mean;
+            // sdev^2 is an unbiased estimator for the population variance
+            sdev[c] = (count > 1) ? std::sqrt(std::max(0., m[c].m2 / (count - 1))) : 0.;
+            double sum_p3 = 0.;
+            double sum_p4 = 0.;
+            if (sdev[c] > 0.) {
+                const double sdev2 = sdev[c] * sdev[c];
+                sum_p3 = m[c].m3 / (sdev2 * sdev[c]);
+                sum_p4 = m[c].m4 / (sdev2 * sdev2);
             }
-            count += procWindow.x2 - procWindow.x1;
+            skewness[c] = skewfac * sum_p3 / count;
+            kurtosis[c] = kurtfac * sum_p4 + kurtshift;
         }
-        
-        addResults(sum_p3, sum_p4, count);
-    }
-};
-
-#define nComponentsHSVL 4
-
-template <class PIX, int nComponents, int maxValue>
-class ImageHSVLMinMaxMeanProcessor : public ImageStatisticsProcessorBase
-{
-private:
-    double _min[nComponentsHSVL];
-    double _max[nComponentsHSVL];
-    double _sum[nComponentsHSVL];
-public:
-    ImageHSVLMinMaxMeanProcessor(OFX::ImageEffect &instance)
-    : ImageStatisticsProcessorBase(instance)
-    {
-        std::fill(_min, _min+nComponentsHSVL, +std::numeric_limits<double>::infinity());
-        std::fill(_max, _max+nComponentsHSVL, -std::numeric_limits<double>::infinity());
-        std::fill(_sum, _sum+nComponentsHSVL, 0.);
-    }
-
-    ~ImageHSVLMinMaxMeanProcessor()
-    {
-    }
-
-    void setPrevResults(const Results &/*results*/) OVERRIDE FINAL {}
-
-    void getResults(Results *results) OVERRIDE FINAL
-    {
-        if (_count > 0) {
-            toRGBA<double, nComponentsHSVL, 1>(_min, &results->min);
-            toRGBA<double, nComponentsHSVL, 1>(_max, &results->max);
-            double mean[nComponentsHSVL];
-            for (int c = 0; c < nComponentsHSVL; ++c) {
-                mean[c] = _sum[c]/_count;
-            }
-            toRGBA<double, nComponentsHSVL, 1>(mean, &results->mean);
+        toRGBA(min, &results->min);
+        toRGBA(max, &results->max);
+        toRGBA(mean, &results->mean);
+        if (count > 1) {
+            toRGBA(sdev, &results->sdev);
         }
-    }
-
-private:
-
-    void addResults(double min[nComponentsHSVL], double max[nComponentsHSVL], double sum[nComponentsHSVL], unsigned long count) {
-        _mutex.lock();
-        for (int c = 0; c < nComponentsHSVL; ++c) {
-            _min[c] = std::min(_min[c], min[c]);
-            _max[c] = std::max(_max[c], max[c]);
-            _sum[c] += sum[c];
+        if (count > 2) {
+            toRGBA(skewness, &results->skewness);
+            assert(!isnan(results->skewness.r) && !isnan(results->skewness.g) && !isnan(results->skewness.b) && !isnan(results->skewness.a));
         }
-        _count += count;
-        _mutex.unlock();
-    }
-
-
-    void multiThreadProcessImages(OfxRectI procWindow)
-    {
-        double min[nComponentsHSVL], max[nComponentsHSVL], sum[nComponentsHSVL];
-        std::fill(min, min+nComponentsHSVL, +std::numeric_limits<double>::infinity());
-        std::fill(max, max+nComponentsHSVL, -std::numeric_limits<double>::infinity());
-        std::fill(sum, sum + nComponentsHSVL, 0.);
-        unsigned long count = 0;
-        assert(_dstImg->getBounds().x1 <= procWindow.x1 && procWindow.y2 <= _dstImg->getBounds().y2 &&
-               _dstImg->getBounds().y1 <= procWindow.y1 && procWindow.y2 <= _dstImg->getBounds().y2);
-        for (int y = procWindow.y1; y < procWindow.y2; ++y) {
-            if (_effect.abort()) {
-                break;
-            }
-
-            PIX *dstPix = (PIX *) _dstImg->getPixelAddress(procWindow.x1, y);
-
-            double sumLine[nComponentsHSVL]; // partial sum to avoid underflows
-            std::fill(sumLine, sumLine + nComponentsHSVL, 0.);
-
-            for (int x = procWindow.x1; x < procWindow.x2; ++x) {
-                float hsvl[nComponentsHSVL];
-                pixToHSVL<PIX, nComponents, maxValue>(dstPix, hsvl);
-                for (int c = 0; c < nComponentsHSVL; ++c) {
-                    double v = hsvl[c];
-                    min[c] = std::min(min[c], v);
-                    max[c] = std::max(max[c], v);
-                    sumLine[c] += v;
-                }
-                dstPix += nComponents;
-            }
-            for (int c = 0; c < nComponentsHSVL; ++c) {
-                sum[c] += sumLine[c];
-            }
-            count += procWindow.x2 - procWindow.x1;
+        if (count > 3) {
+            toRGBA(kurtosis, &results->kurtosis);
+            assert(!isnan(results->kurtosis.r) && !isnan(results->kurtosis.g) && !isnan(results->kurtosis.b) && !isnan(results->kurtosis.a));
         }
-
-        addResults(min, max, sum, count);
     }
-};
 
+    virtual void processWindow(const OfxRectI& procWindow, MomentsRGBAHSVL* partial) = 0;
 
-
-
-template <class PIX, int nComponents, int maxValue>
-class ImageHSVLSDevProcessor : public ImageStatisticsProcessorBase
-{
-private:
-    double _mean[nComponentsHSVL];
-    double _sum_p2[nComponentsHSVL];
-public:
-    ImageHSVLSDevProcessor(OFX::ImageEffect &instance)
-    : ImageStatisticsProcessorBase(instance)
-    {
-        std::fill(_mean, _mean+nComponentsHSVL, 0.);
-        std::fill(_sum_p2, _sum_p2+nComponentsHSVL, 0.);
-    }
-
-    ~ImageHSVLSDevProcessor()
-    {
-    }
-
-    void setPrevResults(const Results &results) OVERRIDE FINAL
+    // overridden from OFX::ImageProcessor, so that each thread accumulates into its own partial results
+    virtual void multiThreadFunction(unsigned int threadId, unsigned int nThreads) OVERRIDE FINAL
     {
-        toComponents<double, nComponentsHSVL, 1>(results.mean, _mean);
-    }
-
-    void getResults(Results *results) OVERRIDE FINAL
-    {
-        if (_count > 1) {
-            double sdev[nComponentsHSVL];
-            for (int c = 0; c < nComponentsHSVL; ++c) {
-                // sdev^2 is an unbiased estimator for the population variance
-                sdev[c] = std::sqrt(std::max(0., _sum_p2[c]/(_count-1)));
-            }
-            toRGBA<double, nComponentsHSVL, 1>(sdev, &results->sdev);
-        }
-    }
-
-private:
-
-    void addResults(double sum_p2[nComponentsHSVL], unsigned long count) {
-        _mutex.lock();
-        for (int c = 0; c < nComponentsHSVL; ++c) {
-            _sum_p2[c] += sum_p2[c];
+        // slice the y range into the number of threads, like OFX::ImageProcessor does
+        const int dy = _renderWindow.y2 - _renderWindow.y1;
+        OfxRectI win = _renderWindow;
+        win.y1 = _renderWindow.y1 + (int)(((long long)dy * threadId) / nThreads);
+        win.y2 = _renderWindow.y1 + (int)(((long long)dy * (threadId + 1)) / nThreads);
+        if (threadId < _partials.size()) {
+            processWindow(win, &_partials[threadId]);
+        } else {
+            MomentsRGBAHSVL partial;
+            processWindow(win, &partial);
+            OFX::MultiThread::AutoMutex lock(_mutex);
+            _extra.merge(partial);
         }
-        _count += count;
-        _mutex.unlock();
     }
 
-
-    void multiThreadProcessImages(OfxRectI procWindow)
+    virtual void multiThreadProcessImages(OfxRectI procWindow) OVERRIDE FINAL
     {
-        double sum_p2[nComponentsHSVL];
-        std::fill(sum_p2, sum_p2 + nComponentsHSVL, 0.);
-        unsigned long count = 0;
-        assert(_dstImg->getBounds().x1 <= procWindow.x1 && procWindow.y2 <= _dstImg->getBounds().y2 &&
-               _dstImg->getBounds().y1 <= procWindow.y1 && procWindow.y2 <= _dstImg->getBounds().y2);
-        for (int y = procWindow.y1; y < procWindow.y2; ++y) {
-            if (_effect.abort()) {
-                break;
-            }
-
-            PIX *dstPix = (PIX *) _dstImg->getPixelAddress(procWindow.x1, y);
-
-            double sumLine_p2[nComponentsHSVL]; // partial sum to avoid underflows
-            std::fill(sumLine_p2, sumLine_p2 + nComponentsHSVL, 0.);
-
-            for (int x = procWindow.x1; x < procWindow.x2; ++x) {
-                float hsvl[nComponentsHSVL];
-                pixToHSVL<PIX, nComponents, maxValue>(dstPix, hsvl);
-                for (int c = 0; c < nComponentsHSVL; ++c) {
-                    double v = (hsvl[c] - _mean[c]);
-                    sumLine_p2[c] += v * v;
-                }
-                dstPix += nComponents;
-            }
-            for (int c = 0; c < nComponentsHSVL; ++c) {
-                sum_p2[c] += sumLine_p2[c];
-            }
-            count += procWindow.x2 - procWindow.x1;
-        }
-
-        addResults(sum_p2, count);
+        // not called, since multiThreadFunction is overridden
+        OFX::MultiThread::AutoMutex lock(_mutex);
+        processWindow(procWindow, &_extra);
     }
 };
 
-
-
-
+// Computes min/max/mean/sdev/skewness/kurtosis on RGBA and/or HSVL in a single pass over the image.
+// Each row is converted to double values and its moments are computed while it is in cache,
+// then merged into the partial results of the thread.
 template <class PIX, int nComponents, int maxValue>
-class ImageHSVLSkewnessKurtosisProcessor : public ImageStatisticsProcessorBase
+class ImageStatisticsProcessor : public ImageStatisticsProcessorBase
 {
-private:
-    double _mean[nComponentsHSVL];
-    double _sdev[nComponentsHSVL];
-    double _sum_p3[nComponentsHSVL];
-    double _sum_p4[nComponentsHSVL];
 public:
-    ImageHSVLSkewnessKurtosisProcessor(OFX::ImageEffect &instance)
-    : ImageStatisticsProcessorBase(instance)
+    ImageStatisticsProcessor(OFX::ImageEffect &instance, bool doRGBA, bool doHSVL, bool checkAbort)
+    : ImageStatisticsProcessorBase(instance, doRGBA, doHSVL, checkAbort)
     {
-        std::fill(_mean, _mean+nComponentsHSVL, 0.);
-        std::fill(_sdev, _sdev+nComponentsHSVL, 0.);
-        std::fill(_sum_p3, _sum_p3+nComponentsHSVL, 0.);
-        std::fill(_sum_p4, _sum_p4+nComponentsHSVL, 0.);
     }
 
-    ~ImageHSVLSkewnessKurtosisProcessor()
+    ~ImageStatisticsProcessor()
     {
     }
 
-    void setPrevResults(const Results &results) OVERRIDE FINAL
-    {
-        toComponents<double, nComponentsHSVL, 1>(results.mean, _mean);
-        toComponents<double, nComponentsHSVL, 1>(results.sdev, _sdev);
-    }
-
-    void getResults(Results *results) OVERRIDE FINAL
-    {
-        if (_count > 2) {
-            double skewness[nComponentsHSVL];
-            // factor for the adjusted Fisher-Pearson standardized moment coefficient G_1
-            double skewfac = ((double)_count*_count) / ((double)(_count-1)*(_count-2));
-            for (int c = 0; c < nComponentsHSVL; ++c) {
-                skewness[c] = skewfac * _sum_p3[c] / _count;
-            }
-            toRGBA<double, nComponentsHSVL, 1>(skewness, &results->skewness);
-        }
-        if (_count > 3) {
-            double kurtosis[nComponentsHSVL];
-            double kurtfac = ((double)(_count+1)*_count) / ((double)(_count-1)*(_count-2)*(_count-3));
-            double kurtshift = -3 * ((double)(_count-1)*(_count-1)) / ((double)(_count-2)*(_count-3));
-            for (int c = 0; c < nComponentsHSVL; ++c) {
-                kurtosis[c] = kurtfac * _sum_p4[c] + kurtshift;
-            }
-            toRGBA<double, nComponentsHSVL, 1>(kurtosis, &results->kurtosis);
-        }
-    }
-
 private:
 
-    void addResults(double sum_p3[nComponentsHSVL], double sum_p4[nComponentsHSVL], unsigned long count) {
-        _mutex.lock();
-        for (int c = 0; c < nComponentsHSVL; ++c) {
-            _sum_p3[c] += sum_p3[c];
-            _sum_p4[c] += sum_p4[c];
+    template<class SRCPIX, int srcMaxValue>
+    static void
+    pixToHSVL(const SRCPIX *p, float hsvl[4])
+    {
+        if (nComponents == 4 || nComponents == 3) {
+            float r, g, b;
+            r = p[0]/(float)srcMaxValue;
+            g = p[1]/(float)srcMaxValue;
+            b = p[2]/(float)srcMaxValue;
+            OFX::Color::rgb_to_hsv(r, g, b, &hsvl[0], &hsvl[1], &hsvl[2]);
+            float min = std::min(std::min(r, g), b);
+            float max = std::max(std::max(r, g), b);
+            hsvl[3] = (min + max)/2;
+        } else {
+            hsvl[0] = hsvl[1] = hsvl[2] = hsvl[3] = 0.f;
         }
-        _count += count;
-        _mutex.unlock();
     }
 
-
-    void multiThreadProcessImages(OfxRectI procWindow)
+    void processWindow(const OfxRectI& procWindow, MomentsRGBAHSVL* partial) OVERRIDE FINAL
     {
-        double sum_p3[nComponentsHSVL];
-        double sum_p4[nComponentsHSVL];
-        std::fill(sum_p3, sum_p3 + nComponentsHSVL, 0.);
-        std::fill(sum_p4, sum_p4 + nComponentsHSVL, 0.);
-        unsigned long count = 0;
         assert(_dstImg->getBounds().x1 <= procWindow.x1 && procWindow.y2 <= _dstImg->getBounds().y2 &&
                _dstImg->getBounds().y1 <= procWindow.y1 && procWindow.y2 <= _dstImg->getBounds().y2);
+        const int width = procWindow.x2 - procWindow.x1;
+        if (width <= 0) {
+            return;
+        }
+        // statistics on the components are computed on the raw pixel values, as before.
+        // rgbaChannel[c] is the RGBA channel of component c
+        const int rgbaChannel[4] = { (nComponents == 1) ? 3 : 0, 1, 2, 3 };
+        std::vector<double> rgbaValues(_doRGBA ? (size_t)width * nComponents : 0);
+        std::vector<double> hsvlValues(_doHSVL ? (size_t)width * nComponentsHSVL : 0);
         for (int y = procWindow.y1; y < procWindow.y2; ++y) {
-            if (_effect.abort()) {
+            if (_checkAbort && _effect.abort()) {
                 break;
             }
 
-            PIX *dstPix = (PIX *) _dstImg->getPixelAddress(procWindow.x1, y);
-
-            double sumLine_p3[nComponentsHSVL]; // partial sum to avoid underflows
-            double sumLine_p4[nComponentsHSVL]; // partial sum to avoid underflows
-            std::fill(sumLine_p3, sumLine_p3 + nComponentsHSVL, 0.);
-            std::fill(sumLine_p4, sumLine_p4 + nComponentsHSVL, 0.);
+            const PIX *dstPix = (const PIX *) _dstImg->getPixelAddress(procWindow.x1, y);
 
-            for (int x = procWindow.x1; x < procWindow.x2; ++x) {
-                float hsvl[nComponentsHSVL];
-                pixToHSVL<PIX, nComponents, maxValue>(dstPix, hsvl);
-                for (int c = 0; c < nComponentsHSVL; ++c) {
-                    if (_sdev[c] > 0.) {
-                        double v = (hsvl[c] - _mean[c])/_sdev[c];
-                        double v2 = v * v;
-                        sumLine_p3[c] += v2 * v;
-                        sumLine_p4[c] += v2 * v2;
+            for (int x = 0; x < width; ++x, dstPix += nComponents) {
+                if (_doRGBA) {
+                    for (int c = 0; c < nComponents; ++c) {
+                        rgbaValues[(size_t)c * width + x] = dstPix[c];
+                    }
+                }
+                if (_doHSVL) {
+                    float hsvl[nComponentsHSVL];
+                    pixToHSVL<PIX, maxValue>(dstPix, hsvl);
+                    for (int c = 0; c < nComponentsHSVL; ++c) {
+                        hsvlValues[(size_t)c * width + x] = hsvl[c];
                     }
                 }
-                dstPix += nComponents;
             }
-            for (int c = 0; c < nComponentsHSVL; ++c) {
-                sum_p3[c] += sumLine_p3[c];
-                sum_p4[c] += sumLine_p4[c];
+
+            Moments line;
+            if (_doRGBA) {
+                for (int c = 0; c < nComponents; ++c) {
+                    line.set(&rgbaValues[(size_t)c * width], width);
+                    partial->rgba[rgbaChannel[c]].merge(line);
+                }
+            }
+            if (_doHSVL) {
+                for (int c = 0; c < nComponentsHSVL; ++c) {
+                    line.set(&hsvlValues[(size_t)c * width], width);
+                    partial->hsvl[c].merge(line);
+                }
             }
-            count += procWindow.x2 - procWindow.x1;
         }
-        
-        addResults(sum_p3, sum_p4, count);
     }
 };
 
@@ -938,6 +608,10 @@ public:
     , _size(0)
     , _interactive(0)
     , _restrictToRectangle(0)
+    , _autoUpdate(0)
+    , _restrictToFrameRange(0)
+    , _frameRange(0)
+    , _frameStep(0)
     {
         _dstClip = fetchClip(kOfxImageEffectOutputClipName);
         assert(_dstClip && (_dstClip->getPixelComponents() == ePixelComponentAlpha || _dstClip->getPixelComponents() == ePixelComponentRGB || _dstClip->getPixelComponents() == ePixelComponentRGBA));
@@ -950,6 +624,10 @@ public:
         _restrictToRectangle = fetchBooleanParam(kParamRestrictToRectangle);
         _autoUpdate = fetchBooleanParam(kParamAutoUpdate);
         assert(_btmLeft && _size && _interactive && _restrictToRectangle && _autoUpdate);
+        _restrictToFrameRange = fetchBooleanParam(kParamRestrictToFrameRange);
+        _frameRange = fetchInt2DParam(kParamFrameRange);
+        _frameStep = fetchIntParam(kParamFrameStep);
+        assert(_restrictToFrameRange && _frameRange && _frameStep);
         _statMin = fetchRGBAParam(kParamStatMin);
         _statMax = fetchRGBAParam(kParamStatMax);
         _statMean = fetchRGBAParam(kParamStatMean);
@@ -982,9 +660,21 @@ public:
         _autoUpdate->getValue(doUpdate);
         _interactive->setEnabled(restrictToRectangle && doUpdate);
         _interactive->setIsSecret(!restrictToRectangle || !doUpdate);
+        bool restrictToFrameRange;
+        _restrictToFrameRange->getValue(restrictToFrameRange);
+        _frameRange->setEnabled(restrictToFrameRange);
     }
 
 private:
+    // results of the analysis of one frame of the sequence
+    struct FrameResults
+    {
+        int time;
+        bool valid; //!< false if there was no image or the analysis window was empty
+        Results rgba;
+        Results hsvl;
+    };
+
     /* override is identity */
     virtual bool isIdentity(const OFX::IsIdentityArguments &args, OFX::Clip * &identityClip, double &identityTime) OVERRIDE FINAL;
 
@@ -999,37 +689,46 @@ private:
     virtual void changedParam(const OFX::InstanceChangedArgs &args, const std::string &paramName) OVERRIDE FINAL;
 
     /* set up and run a processor */
-    void setupAndProcess(ImageStatisticsProcessorBase &processor, const OFX::Image* srcImg, double time, const OfxRectI &analysisWindow, const Results &prevResults, Results *results);
+    void setupAndProcess(ImageStatisticsProcessorBase &processor, const OFX::Image* srcImg, const OfxRectI &analysisWindow, Results *resultsRGBA, Results *resultsHSVL);
 
     // compute computation window in srcImg
     bool computeWindow(const OFX::Image* srcImg, double time, OfxRectI *analysisWindow);
 
-    // update image statistics
-    void update(const OFX::Image* srcImg, double time, const OfxRectI& analysisWindow);
-    void updateHSVL(const OFX::Image* srcImg, double time, const OfxRectI& analysisWindow);
+    // update image statistics on RGBA and/or HSVL (in a single pass over the image)
+    void update(const OFX::Image* srcImg, double time, const OfxRectI& analysisWindow, bool doRGBA, bool doHSVL);
+
+    // analyze all frames from the sequence (or from the frame range), and set keyframes
+    void analyzeSequence(const OfxPointD& renderScale, bool doRGBA, bool doHSVL);
+
+    // analyze one frame of the sequence
+    void analyzeFrame(const OfxPointD& renderScale, bool doRGBA, bool doHSVL, FrameResults *frame);
 
-    template <template<class PIX, int nComponents, int maxValue> class Processor, class PIX, int nComponents, int maxValue>
-    void updateSubComponentsDepth(const OFX::Image* srcImg, double time, const OfxRectI &analysisWindow, const Results& prevResults, Results* results)
+    // set the values of the statistics parameters at time (must be called within an edit block)
+    void setValuesRGBA(double time, const Results& results);
+    void setValuesHSVL(double time, const Results& results);
+
+    template <class PIX, int nComponents, int maxValue>
+    void updateSubComponentsDepth(const OFX::Image* srcImg, const OfxRectI &analysisWindow, bool doRGBA, bool doHSVL, bool checkAbort, Results* resultsRGBA, Results* resultsHSVL)
     {
-        Processor<PIX, nComponents, maxValue> fred(*this);
-        setupAndProcess(fred, srcImg, time, analysisWindow, prevResults, results);
+        ImageStatisticsProcessor<PIX, nComponents, maxValue> fred(*this, doRGBA, doHSVL, checkAbort);
+        setupAndProcess(fred, srcImg, analysisWindow, resultsRGBA, resultsHSVL);
     }
 
-    template <template<class PIX, int nComponents, int maxValue> class Processor, int nComponents>
-    void updateSubComponents(const OFX::Image* srcImg, double time, const OfxRectI &analysisWindow, const Results& prevResults, Results* results)
+    template <int nComponents>
+    void updateSubComponents(const OFX::Image* srcImg, const OfxRectI &analysisWindow, bool doRGBA, bool doHSVL, bool checkAbort, Results* resultsRGBA, Results* resultsHSVL)
     {
         OFX::BitDepthEnum srcBitDepth = srcImg->getPixelDepth();
         switch (srcBitDepth) {
             case OFX::eBitDepthUByte: {
-                updateSubComponentsDepth<Processor, unsigned char, nComponents, 255>(srcImg, time, analysisWindow, prevResults, results);
+                updateSubComponentsDepth<unsigned char, nComponents, 255>(srcImg, analysisWindow, doRGBA, doHSVL, checkAbort, resultsRGBA, resultsHSVL);
                 break;
             }
             case OFX::eBitDepthUShort: {
-                updateSubComponentsDepth<Processor, unsigned short, nComponents, 65535>(srcImg, time, analysisWindow, prevResults, results);
+                updateSubComponentsDepth<unsigned short, nComponents, 65535>(srcImg, analysisWindow, doRGBA, doHSVL, checkAbort, resultsRGBA, resultsHSVL);
                 break;
             }
             case OFX::eBitDepthFloat: {
-                updateSubComponentsDepth<Processor, float, nComponents, 1>(srcImg, time, analysisWindow, prevResults, results);
+                updateSubComponentsDepth<float, nComponents, 1>(srcImg, analysisWindow, doRGBA, doHSVL, checkAbort, resultsRGBA, resultsHSVL);
                 break;
             }
             default:
@@ -1037,17 +736,16 @@ private:
         }
     }
 
-    template <template<class PIX, int nComponents, int maxValue> class Processor>
-    void updateSub(const OFX::Image* srcImg, double time, const OfxRectI &analysisWindow, const Results& prevResults, Results* results)
+    void updateSub(const OFX::Image* srcImg, const OfxRectI &analysisWindow, bool doRGBA, bool doHSVL, bool checkAbort, Results* resultsRGBA, Results* resultsHSVL)
     {
         OFX::PixelComponentEnum srcComponents  = srcImg->getPixelComponents();
         assert(srcComponents == OFX::ePixelComponentAlpha ||srcComponents == OFX::ePixelComponentRGB || srcComponents == OFX::ePixelComponentRGBA);
         if (srcComponents == OFX::ePixelComponentAlpha) {
-            updateSubComponents<Processor, 1>(srcImg, time, analysisWindow, prevResults, results);
+            updateSubComponents<1>(srcImg, analysisWindow, doRGBA, doHSVL, checkAbort, resultsRGBA, resultsHSVL);
         } else if (srcComponents == OFX::ePixelComponentRGBA) {
-            updateSubComponents<Processor, 4>(srcImg, time, analysisWindow, prevResults, results);
+            updateSubComponents<4>(srcImg, analysisWindow, doRGBA, doHSVL, checkAbort, resultsRGBA, resultsHSVL);
         } else if (srcComponents == OFX::ePixelComponentRGB) {
-            updateSubComponents<Processor, 3>(srcImg, time, analysisWindow, prevResults, results);
+            updateSubComponents<3>(srcImg, analysisWindow, doRGBA, doHSVL, checkAbort, resultsRGBA, resultsHSVL);
         } else {
             // coverity[dead_error_line]
             OFX::throwSuiteStatusException(kOfxStatErrUnsupported);
@@ -1065,6 +763,9 @@ private:
     BooleanParam* _interactive;
     BooleanParam* _restrictToRectangle;
     BooleanParam* _autoUpdate;
+    BooleanParam* _restrictToFrameRange;
+    Int2DParam* _frameRange;
+    IntParam* _frameStep;
     RGBAParam* _statMin;
     RGBAParam* _statMax;
     RGBAParam* _statMean;
@@ -1138,13 +839,10 @@ ImageStatisticsPlugin::render(const OFX::RenderArguments &args)
             OfxRectI analysisWindow;
             bool intersect = computeWindow(src.get(), args.time, &analysisWindow);
             if (intersect) {
-                if (k != -1) {
-                    update(src.get(), args.time, analysisWindow);
-                }
+                bool doRGBA = (k != -1);
                 k = _statHSVLMean->getKeyIndex(args.time, eKeySearchNear);
-                if (k != -1) {
-                    updateHSVL(src.get(), args.time, analysisWindow);
-                }
+                bool doHSVL = (k != -1);
+                update(src.get(), args.time, analysisWindow, doRGBA, doHSVL);
             }
         }
     }
@@ -1241,6 +939,15 @@ ImageStatisticsPlugin::changedParam(const OFX::InstanceChangedArgs &args,
         paramName == kParamRectangleInteractSize) {
         _autoUpdate->getValue(doUpdate);
     }
+    if (paramName == kParamRestrictToFrameRange) {
+        bool restrictToFrameRange;
+        _restrictToFrameRange->getValue(restrictToFrameRange);
+        _frameRange->setEnabled(restrictToFrameRange);
+    }
+    if (paramName == kParamInputRange && _srcClip && _srcClip->isConnected()) {
+        OfxRangeD range = _srcClip->getFrameRange();
+        _frameRange->setValue((int)std::ceil(range.min), (int)std::floor(range.max));
+    }
     if (paramName == kParamAnalyzeFrame) {
         doAnalyzeRGBA = true;
     }
@@ -1305,54 +1012,26 @@ ImageStatisticsPlugin::changedParam(const OFX::InstanceChangedArgs &args,
             bool intersect = computeWindow(src.get(), args.time, &analysisWindow);
             if (intersect) {
                 getPropertySet().propSetInt(kOfxImageEffectPropInAnalysis, 1, false);
-                if (doAnalyzeRGBA) {
-                    update(src.get(), args.time, analysisWindow);
-                }
-                if (doAnalyzeHSVL) {
-                    updateHSVL(src.get(), args.time, analysisWindow);
-                }
+                update(src.get(), args.time, analysisWindow, doAnalyzeRGBA, doAnalyzeHSVL);
                 getPropertySet().propSetInt(kOfxImageEffectPropInAnalysis, 0, false);
             }
         }
     }
     if ((doAnalyzeSequenceRGBA || doAnalyzeSequenceHSVL) && _srcClip && _srcClip->isConnected()) {
         getPropertySet().propSetInt(kOfxImageEffectPropInAnalysis, 1, false);
-        progressStart("Analyzing sequence...");
-        OfxRangeD range = _srcClip->getFrameRange();
-        //timeLineGetBounds(range.min, range.max); // wrong: we want the input frame range only
-        int tmin = (int)std::ceil(range.min);
-        int tmax = (int)std::floor(range.max);
-        for (int t = tmin; t <= tmax; ++t) {
-            std::auto_ptr<OFX::Image> src((_srcClip && _srcClip->isConnected()) ?
-                                          _srcClip->fetchImage(t) : 0);
-            if (src.get()) {
-                if (src->getRenderScale().x != args.renderScale.x ||
-                    src->getRenderScale().y != args.renderScale.y) {
-                    setPersistentMessage(OFX::Message::eMessageError, "", "OFX Host gave image with wrong scale or field properties");
-                    OFX::throwSuiteStatusException(kOfxStatFailed);
-                }
-                bool intersect = computeWindow(src.get(), t, &analysisWindow);
-                if (intersect) {
-                    if (doAnalyzeSequenceRGBA) {
-                        update(src.get(), t, analysisWindow);
-                    }
-                    if (doAnalyzeSequenceHSVL) {
-                        updateHSVL(src.get(), t, analysisWindow);
-                    }
-                }
-            }
-            if (tmax != tmin) {
-                progressUpdate((t-tmin)/(double)(tmax-tmin));
-            }
+        try {
+            analyzeSequence(args.renderScale, doAnalyzeSequenceRGBA, doAnalyzeSequenceHSVL);
+        } catch (...) {
+            getPropertySet().propSetInt(kOfxImageEffectPropInAnalysis, 0, false);
+            throw;
         }
-        progressEnd();
         getPropertySet().propSetInt(kOfxImageEffectPropInAnalysis, 0, false);
     }
 }
 
 /* set up and run a processor */
 void
-ImageStatisticsPlugin::setupAndProcess(ImageStatisticsProcessorBase &processor, const OFX::Image* srcImg, double /*time*/, const OfxRectI &analysisWindow, const Results &prevResults, Results *results)
+ImageStatisticsPlugin::setupAndProcess(ImageStatisticsProcessorBase &processor, const OFX::Image* srcImg, const OfxRectI &analysisWindow, Results *resultsRGBA, Results *resultsHSVL)
 {
 
     // set the images
@@ -1361,14 +1040,10 @@ ImageStatisticsPlugin::setupAndProcess(ImageStatisticsProcessorBase &processor,
     // set the render window
     processor.setRenderWindow(analysisWindow);
 
-    processor.setPrevResults(prevResults);
-
     // Call the base class process member, this will call the derived templated process code
     processor.process();
 
-    if (!abort()) {
-        processor.getResults(results);
-    }
+    processor.getResults(resultsRGBA, resultsHSVL);
 }
 
 bool
@@ -1408,56 +1083,138 @@ ImageStatisticsPlugin::computeWindow(const OFX::Image* srcImg, double time, OfxR
 }
 // update image statistics
 void
-ImageStatisticsPlugin::update(const OFX::Image* srcImg, double time, const OfxRectI &analysisWindow)
+ImageStatisticsPlugin::update(const OFX::Image* srcImg, double time, const OfxRectI &analysisWindow, bool doRGBA, bool doHSVL)
 {
     // TODO: CHECK if checkDoubleAnalysis param is true and analysisWindow is the same as btmLeft/sizeAnalysis
-    Results results;
-    if (!abort()) {
-        updateSub<ImageMinMaxMeanProcessor>(srcImg, time, analysisWindow, results, &results);
-    }
-    if (!abort()) {
-        updateSub<ImageSDevProcessor>(srcImg, time, analysisWindow, results, &results);
+    if (!doRGBA && !doHSVL) {
+        return;
     }
+    Results results;
+    Results resultsHSVL;
     if (!abort()) {
-        updateSub<ImageSkewnessKurtosisProcessor>(srcImg, time, analysisWindow, results, &results);
+        updateSub(srcImg, analysisWindow, doRGBA, doHSVL, true, &results, &resultsHSVL);
     }
     if (abort()) {
         return;
     }
-    beginEditBlock("updateStatisticsRGBA");
+    if (doRGBA) {
+        beginEditBlock("updateStatisticsRGBA");
+        setValuesRGBA(time, results);
+        endEditBlock();
+    }
+    if (doHSVL) {
+        beginEditBlock("updateStatisticsHSVL");
+        setValuesHSVL(time, resultsHSVL);
+        endEditBlock();
+    }
+}
+
+void
+ImageStatisticsPlugin::setValuesRGBA(double time, const Results& results)
+{
     _statMin->setValueAtTime(time, results.min.r, results.min.g, results.min.b, results.min.a);
     _statMax->setValueAtTime(time, results.max.r, results.max.g, results.max.b, results.max.a);
     _statMean->setValueAtTime(time, results.mean.r, results.mean.g, results.mean.b, results.mean.a);
     _statSDev->setValueAtTime(time, results.sdev.r, results.sdev.g, results.sdev.b, results.sdev.a);
     _statSkewness->setValueAtTime(time, results.skewness.r, results.skewness.g, results.skewness.b, results.skewness.a);
-   // printf("skewness = %g %g %g %g\n", results.skewness.r, results.skewness.g, results.skewness.b, results.skewness.a);
+    // printf("skewness = %g %g %g %g\n", results.skewness.r, results.skewness.g, results.skewness.b, results.skewness.a);
     _statKurtosis->setValueAtTime(time, results.kurtosis.r, results.kurtosis.g, results.kurtosis.b, results.kurtosis.a);
-    endEditBlock();
 }
 
 void
-ImageStatisticsPlugin::updateHSVL(const OFX::Image* srcImg, double time, const OfxRectI &analysisWindow)
+ImageStatisticsPlugin::setValuesHSVL(double time, const Results& results)
 {
-    Results results;
-    if (!abort()) {
-        updateSub<ImageHSVLMinMaxMeanProcessor>(srcImg, time, analysisWindow, results, &results);
-    }
-    if (!abort()) {
-        updateSub<ImageHSVLSDevProcessor>(srcImg, time, analysisWindow, results, &results);
-    }
-    if (!abort()) {
-        updateSub<ImageHSVLSkewnessKurtosisProcessor>(srcImg, time, analysisWindow, results, &results);
-    }
-    if (abort()) {
-        return;
-    }
-    beginEditBlock("updateStatisticsHSVL");
     _statHSVLMin->setValueAtTime(time, results.min.r, results.min.g, results.min.b, results.min.a);
     _statHSVLMax->setValueAtTime(time, results.max.r, results.max.g, results.max.b, results.max.a);
     _statHSVLMean->setValueAtTime(time, results.mean.r, results.mean.g, results.mean.b, results.mean.a);
     _statHSVLSDev->setValueAtTime(time, results.sdev.r, results.sdev.g, results.sdev.b, results.sdev.a);
     _statHSVLSkewness->setValueAtTime(time, results.skewness.r, results.skewness.g, results.skewness.b, results.skewness.a);
     _statHSVLKurtosis->setValueAtTime(time, results.kurtosis.r, results.kurtosis.g, results.kurtosis.b, results.kurtosis.a);
+}
+
+// analyze one frame. frame->valid is left false if there is nothing to analyze.
+// The reduction is multithreaded, and abort() is only checked by the caller, between frames.
+void
+ImageStatisticsPlugin::analyzeFrame(const OfxPointD& renderScale, bool doRGBA, bool doHSVL, FrameResults *frame)
+{
+    std::auto_ptr<const OFX::Image> src(_srcClip->fetchImage(frame->time));
+    if (!src.get()) {
+        return;
+    }
+    if (src->getRenderScale().x != renderScale.x ||
+        src->getRenderScale().y != renderScale.y) {
+        setPersistentMessage(OFX::Message::eMessageError, "", "OFX Host gave image with wrong scale or field properties");
+        OFX::throwSuiteStatusException(kOfxStatFailed);
+    }
+    OfxRectI analysisWindow;
+    bool intersect = computeWindow(src.get(), frame->time, &analysisWindow);
+    if (!intersect) {
+        return;
+    }
+    updateSub(src.get(), analysisWindow, doRGBA, doHSVL, false, &frame->rgba, &frame->hsvl);
+    frame->valid = true;
+}
+
+void
+ImageStatisticsPlugin::analyzeSequence(const OfxPointD& renderScale, bool doRGBA, bool doHSVL)
+{
+    OfxRangeD range = _srcClip->getFrameRange();
+    //timeLineGetBounds(range.min, range.max); // wrong: we want the input frame range only
+    int tmin = (int)std::ceil(range.min);
+    int tmax = (int)std::floor(range.max);
+    bool restrictToFrameRange;
+    _restrictToFrameRange->getValue(restrictToFrameRange);
+    if (restrictToFrameRange) {
+        int first, last;
+        _frameRange->getValue(first, last);
+        tmin = std::max(tmin, std::min(first, last));
+        tmax = std::min(tmax, std::max(first, last));
+    }
+    int step;
+    _frameStep->getValue(step);
+    step = std::max(1, step);
+    if (tmax < tmin) {
+        return;
+    }
+
+    std::vector<FrameResults> frames((tmax - tmin) / step + 1);
+    for (size_t i = 0; i < frames.size(); ++i) {
+        frames[i].time = tmin + (int)i * step;
+        frames[i].valid = false;
+    }
+
+    // Images are fetched on this thread, since the clip and parameter suites may not be used from
+    // other threads outside of a render. Each frame is then reduced on all CPUs.
+    progressStart("Analyzing sequence...");
+    try {
+        for (size_t i = 0; i < frames.size() && !abort(); ++i) {
+            analyzeFrame(renderScale, doRGBA, doHSVL, &frames[i]);
+            if (abort()) {
+                // the reduction of this frame may be incomplete
+                frames[i].valid = false;
+                break;
+            }
+            progressUpdate((i + 1) / (double)frames.size());
+        }
+    } catch (...) {
+        progressEnd();
+        throw;
+    }
+    progressEnd();
+
+    // set all keyframes at once. If the analysis was interrupted, the frames that were analyzed are kept.
+    beginEditBlock("analyzeSequence");
+    for (size_t i = 0; i < frames.size(); ++i) {
+        if (!frames[i].valid) {
+            continue;
+        }
+        if (doRGBA) {
+            setValuesRGBA(frames[i].time, frames[i].rgba);
+        }
+        if (doHSVL) {
+            setValuesHSVL(frames[i].time, frames[i].hsvl);
+        }
+    }
     endEditBlock();
 }
 
@@ -1659,6 +1416,59 @@ void ImageStatisticsPluginFactory::describeInContext(OFX::ImageEffectDescriptor
         }
     }
 
+    // restrictToFrameRange
+    {
+        BooleanParamDescriptor *param = desc.defineBooleanParam(kParamRestrictToFrameRange);
+        param->setLabel(kParamRestrictToFrameRangeLabel);
+        param->setHint(kParamRestrictToFrameRangeHint);
+        param->setDefault(false);
+        param->setAnimates(false);
+        param->setEvaluateOnChange(false);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+
+    // frameRange
+    {
+        Int2DParamDescriptor *param = desc.defineInt2DParam(kParamFrameRange);
+        param->setLabel(kParamFrameRangeLabel);
+        param->setHint(kParamFrameRangeHint);
+        param->setDimensionLabels("min", "max");
+        param->setDefault(1, 1);
+        param->setAnimates(false);
+        param->setEvaluateOnChange(false);
+        param->setLayoutHint(eLayoutHintNoNewLine);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+
+    // inputRange
+    {
+        PushButtonParamDescriptor *param = desc.definePushButtonParam(kParamInputRange);
+        param->setLabel(kParamInputRangeLabel);
+        param->setHint(kParamInputRangeHint);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+
+    // frameStep
+    {
+        IntParamDescriptor *param = desc.defineIntParam(kParamFrameStep);
+        param->setLabel(kParamFrameStepLabel);
+        param->setHint(kParamFrameStepHint);
+        param->setDefault(1);
+        param->setRange(1, INT_MAX);
+        param->setDisplayRange(1, 10);
+        param->setAnimates(false);
+        param->setEvaluateOnChange(false);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+
     {
         GroupParamDescriptor* group = desc.defineGroupParam(kParamGroupRGBA);
         group->setLabel(kParamGroupRGBA);
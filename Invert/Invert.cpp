@@ -85,6 +85,7 @@
 #include "ofxsMaskMix.h"
 #include "ofxsMerging.h"
 #include "ofxsMacros.h"
+#include "ColorKernels.h"
 
 
 #define kPluginName "InvertOFX"
@@ -112,178 +113,23 @@
 using namespace OFX;
 
 // Base class for the RGBA and the Alpha processor
-class InvertBase : public OFX::ImageProcessor
-{
-protected:
-    const OFX::Image *_srcImg;
-    const OFX::Image *_maskImg;
-    bool   _doMasking;
-    bool _processR;
-    bool _processG;
-    bool _processB;
-    bool _processA;
-    bool _premult;
-    int _premultChannel;
-    double _mix;
-    bool _maskInvert;
-
-public:
-    /** @brief no arg ctor */
-    InvertBase(OFX::ImageEffect &instance)
-    : OFX::ImageProcessor(instance)
-    , _srcImg(0)
-    , _maskImg(0)
-    , _doMasking(false)
-    , _processR(true)
-    , _processG(true)
-    , _processB(true)
-    , _processA(false)
-    , _premult(false)
-    , _premultChannel(3)
-    , _mix(1.)
-    , _maskInvert(false)
-    {
-    }
-
-    /** @brief set the src image */
-    void setSrcImg(const OFX::Image *v) {_srcImg = v;}
-
-    void setMaskImg(const OFX::Image *v, bool maskInvert) { _maskImg = v; _maskInvert = maskInvert; }
-
-    void doMasking(bool v) {_doMasking = v;}
-
-    void setValues(bool processR,
-                   bool processG,
-                   bool processB,
-                   bool processA,
-                   bool premult,
-                   int premultChannel,
-                   double mix)
-    {
-        _processR = processR;
-        _processG = processG;
-        _processB = processB;
-        _processA = processA;
-        _premult = premult;
-        _premultChannel = premultChannel;
-        _mix = mix;
-    }
-};
+typedef PixelKernelProcessorBase<InvertKernel> InvertBase;
 
 // template to do the RGBA processing
 template <class PIX, int nComponents, int maxValue>
-class ImageInverter : public InvertBase
+class ImageInverter : public PixelKernelProcessor<InvertKernel, PIX, nComponents, maxValue>
 {
   public:
     // ctor
     ImageInverter(OFX::ImageEffect &instance)
-            : InvertBase(instance)
+            : PixelKernelProcessor<InvertKernel, PIX, nComponents, maxValue>(instance)
     {
-    }
-
-  private:
-    // and do some processing
-    void multiThreadProcessImages(OfxRectI procWindow)
-    {
-        const bool r = _processR && (nComponents != 1);
-        const bool g = _processG && (nComponents >= 2);
-        const bool b = _processB && (nComponents >= 3);
-        const bool a = _processA && (nComponents == 1 || nComponents == 4);
-        if (r) {
-            if (g) {
-                if (b) {
-                    if (a) {
-                        return process<true ,true ,true ,true >(procWindow); // RGBA
-                    } else {
-                        return process<true ,true ,true ,false>(procWindow); // RGBa
-                    }
-                } else {
-                    if (a) {
-                        return process<true ,true ,false,true >(procWindow); // RGbA
-                    } else {
-                        return process<true ,true ,false,false>(procWindow); // RGba
-                    }
-                }
-            } else {
-                if (b) {
-                    if (a) {
-                        return process<true ,false,true ,true >(procWindow); // RgBA
-                    } else {
-                        return process<true ,false,true ,false>(procWindow); // RgBa
-                    }
-                } else {
-                    if (a) {
-                        return process<true ,false,false,true >(procWindow); // RgbA
-                    } else {
-                        return process<true ,false,false,false>(procWindow); // Rgba
-                    }
-                }
-            }
-        } else {
-            if (g) {
-                if (b) {
-                    if (a) {
-                        return process<false,true ,true ,true >(procWindow); // rGBA
-                    } else {
-                        return process<false,true ,true ,false>(procWindow); // rGBa
-                    }
-                } else {
-                    if (a) {
-                        return process<false,true ,false,true >(procWindow); // rGbA
-                    } else {
-                        return process<false,true ,false,false>(procWindow); // rGba
-                    }
-                }
-            } else {
-                if (b) {
-                    if (a) {
-                        return process<false,false,true ,true >(procWindow); // rgBA
-                    } else {
-                        return process<false,false,true ,false>(procWindow); // rgBa
-                    }
-                } else {
-                    if (a) {
-                        return process<false,false,false,true >(procWindow); // rgbA
-                    } else {
-                        return process<false,false,false,false>(procWindow); // rgba
-                    }
-                }
-            }
-        }
-    }
-
-  private:
-    template<bool processR, bool processG, bool processB, bool processA>
-    void process(const OfxRectI& procWindow)
-    {
-        float unpPix[4];
-        float tmpPix[4];
-        for (int y = procWindow.y1; y < procWindow.y2; y++) {
-            if (_effect.abort()) {
-                break;
-            }
-
-            PIX *dstPix = (PIX *) _dstImg->getPixelAddress(procWindow.x1, y);
-
-            for (int x = procWindow.x1; x < procWindow.x2; x++) {
-
-                const PIX *srcPix = (const PIX *)  (_srcImg ? _srcImg->getPixelAddress(x, y) : 0);
-
-                // do we have a source image to scale up
-                ofxsUnPremult<PIX, nComponents, maxValue>(srcPix, unpPix, _premult, _premultChannel);
-                tmpPix[0] = processR ? (1.f - unpPix[0]) : unpPix[0];
-                tmpPix[1] = processG ? (1.f - unpPix[1]) : unpPix[1];
-                tmpPix[2] = processB ? (1.f - unpPix[2]) : unpPix[2];
-                tmpPix[3] = processA ? (1.f - unpPix[3]) : unpPix[3];
-                ofxsPremultMaskMixPix<PIX, nComponents, maxValue, true>(tmpPix, _premult, _premultChannel, x, y, srcPix, _doMasking, _maskImg, (float)_mix, _maskInvert, dstPix);
-
-                // increment the dst pixel
-                dstPix += nComponents;
-            }
-        }
+        // the unprocessed channels are premultiplied by the (possibly inverted) alpha
+        this->setCopyUnprocessed(false);
     }
 };
 
+
 ////////////////////////////////////////////////////////////////////////////////
 /** @brief The plugin that does our work */
 class InvertPlugin : public OFX::ImageEffect
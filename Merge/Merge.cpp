@@ -73,6 +73,8 @@
 #include "Merge.h"
 
 #include <cmath>
+#include <vector>
+#include <algorithm>
 #ifdef _WINDOWS
 #include <windows.h>
 #endif
@@ -82,6 +84,7 @@
 #include "ofxsMaskMix.h"
 
 #include "ofxNatron.h"
+#include "MergeRowKernels.h"
 #include "ofxsMacros.h"
 
 #define kPluginName "MergeOFX"
@@ -188,125 +191,265 @@ public:
     MergeProcessor(OFX::ImageEffect &instance)
     : MergeProcessorBase(instance)
     {
+        // vectorized kernels are only used for RGBA, where no alpha has to be made up
+        _rowFunction[0] = (nComponents == 4) ? MergeRowKernels::getRowFunction<f>(false) : 0;
+        _rowFunction[1] = (nComponents == 4) ? MergeRowKernels::getRowFunction<f>(true) : 0;
     }
     
 private:
+    // Each row is cut into segments where the set of inputs that have a pixel is constant.
+    // The valid x-span of each input is resolved once per row, and each segment walks raw row pointers,
+    // so that getPixelAddress is not called per pixel.
     void multiThreadProcessImages(OfxRectI procWindow)
     {
-        float tmpPix[4];
+        assert(_optionalAImages.size() == 0 || _optionalAImages.size() == (kMaximumAInputs - 1));
+        // input 0 is A, input 1 is B, inputs 2... are the optional A inputs
+        const size_t nInputs = 2 + _optionalAImages.size();
+        std::vector<const OFX::Image*> images(nInputs);
+        images[0] = _srcImgA;
+        images[1] = _srcImgB;
+        for (size_t i = 0; i < _optionalAImages.size(); ++i) {
+            images[2 + i] = _optionalAImages[i];
+        }
+        std::vector<int> spanX1(nInputs);
+        std::vector<int> spanX2(nInputs);
+        std::vector<const PIX*> spanPix(nInputs); // address of pixel (spanX1,y)
+        std::vector<const PIX*> segmentPix(nInputs); // address of the first pixel of the segment, or NULL if outside of the input
+        std::vector<int> cuts;
+        cuts.reserve(2 * nInputs + 2);
         float tmpA[4];
         float tmpB[4];
 
         for (int c = 0; c < 4; ++c) {
             tmpA[c] = tmpB[c] = 0.;
         }
+
+        // normalized RGBA rows for the vectorized kernel: A, B and result
+        MergeRowKernels::MergeRowFunction rowFunction = _rowFunction[_alphaMasking ? 1 : 0];
+        std::vector<float> rowBuffers;
+        if (rowFunction) {
+            rowBuffers.resize(3 * 4 * (procWindow.x2 - procWindow.x1));
+        }
+
         for (int y = procWindow.y1; y < procWindow.y2; ++y) {
             if (_effect.abort()) {
                 break;
             }
 
+            // resolve the span of each input on this row
+            cuts.clear();
+            cuts.push_back(procWindow.x1);
+            cuts.push_back(procWindow.x2);
+            for (size_t i = 0; i < nInputs; ++i) {
+                spanX1[i] = spanX2[i] = procWindow.x1;
+                spanPix[i] = 0;
+                if (!images[i]) {
+                    continue;
+                }
+                const OfxRectI& bounds = images[i]->getBounds();
+                if (y < bounds.y1 || bounds.y2 <= y) {
+                    continue;
+                }
+                const int x1 = std::max(procWindow.x1, bounds.x1);
+                const int x2 = std::min(procWindow.x2, bounds.x2);
+                if (x1 >= x2) {
+                    continue;
+                }
+                spanX1[i] = x1;
+                spanX2[i] = x2;
+                spanPix[i] = (const PIX *) images[i]->getPixelAddress(x1, y);
+                assert(spanPix[i]);
+                cuts.push_back(x1);
+                cuts.push_back(x2);
+            }
+            std::sort(cuts.begin(), cuts.end());
+            cuts.erase(std::unique(cuts.begin(), cuts.end()), cuts.end());
+
             PIX *dstPix = (PIX *) _dstImg->getPixelAddress(procWindow.x1, y);
 
-            for (int x = procWindow.x1; x < procWindow.x2; ++x) {
-                
-                const PIX *srcPixA = (const PIX *)  (_srcImgA ? _srcImgA->getPixelAddress(x, y) : 0);
-                const PIX *srcPixB = (const PIX *)  (_srcImgB ? _srcImgB->getPixelAddress(x, y) : 0);
-                
-                assert(_optionalAImages.size() == 0 || _optionalAImages.size() == (kMaximumAInputs - 1));
-                
-                
-                if (srcPixA || srcPixB) {
-
-                    for (int c = 0; c < nComponents; ++c) {
-#                     ifdef DEBUG
-                        // check for NaN
-                        assert(!srcPixA || srcPixA[c] == srcPixA[c]);
-                        assert(!srcPixB || srcPixB[c] == srcPixB[c]);
-#                     endif
-                        // all images are supposed to be black and transparent outside o
-                        tmpA[c] = srcPixA ? ((float)srcPixA[c] / maxValue) : 0.f;
-                        tmpB[c] = srcPixB ? ((float)srcPixB[c] / maxValue) : 0.f;
-#                     ifdef DEBUG
-                        // check for NaN
-                        assert(tmpA[c] == tmpA[c]);
-                        assert(tmpB[c] == tmpB[c]);
-#                     endif
-                    }
-                    if (nComponents != 4) {
-                        // set alpha (1 inside, 0 outside)
-                        tmpA[3] = srcPixA ? 1. : 0.;
-                        tmpB[3] = srcPixB ? 1. : 0.;
+            for (size_t k = 0; k + 1 < cuts.size(); ++k) {
+                const int x1 = cuts[k];
+                const int x2 = cuts[k + 1];
+                for (size_t i = 0; i < nInputs; ++i) {
+                    segmentPix[i] = (spanPix[i] && spanX1[i] <= x1 && x2 <= spanX2[i]) ? (spanPix[i] + (x1 - spanX1[i]) * nComponents) : 0;
+                }
+                if (rowFunction && (segmentPix[0] || segmentPix[1])) {
+                    processSegmentRows(rowFunction, x1, x2, y, segmentPix, &rowBuffers[0], dstPix);
+                } else if (segmentPix[0]) {
+                    if (segmentPix[1]) {
+                        processSegment<true, true>(x1, x2, y, segmentPix, tmpA, tmpB, dstPix);
+                    } else {
+                        processSegment<true, false>(x1, x2, y, segmentPix, tmpA, tmpB, dstPix);
                     }
-                    // work in float: clamping is done when mixing
-                    mergePixel<f, float, 4, 1>(_alphaMasking, tmpA, tmpB, tmpPix);
-    
-                    
                 } else {
-                    // everything is black and transparent
-                    for (int c = 0; c < 4; ++c) {
-                        tmpPix[c] = 0;
+                    if (segmentPix[1]) {
+                        processSegment<false, true>(x1, x2, y, segmentPix, tmpA, tmpB, dstPix);
+                    } else {
+                        processSegment<false, false>(x1, x2, y, segmentPix, tmpA, tmpB, dstPix);
                     }
                 }
+                dstPix += (x2 - x1) * nComponents;
+            }
+        }
+    }
 
-#             ifdef DEBUG
-                // check for NaN
-                for (int c = 0; c < 4; ++c) {
-                    assert(tmpPix[c] == tmpPix[c]);
+    // process pixels [x1,x2) of row y, where the presence of each input is constant.
+    // hasA and hasB tell if A and B have pixels on this segment, so that the interior loop has no test on them.
+    template<bool hasA, bool hasB>
+    void processSegment(int x1, int x2, int y, const std::vector<const PIX*>& segmentPix, float tmpA[4], float tmpB[4], PIX *dstPix)
+    {
+        float tmpPix[4];
+        const PIX *srcPixA = hasA ? segmentPix[0] : 0;
+        const PIX *srcPixB = hasB ? segmentPix[1] : 0;
+        // the optional A inputs that have pixels on this segment
+        const PIX *optionalPix[kMaximumAInputs];
+        int nOptional = 0;
+        for (size_t i = 2; i < segmentPix.size(); ++i) {
+            if (segmentPix[i]) {
+                optionalPix[nOptional++] = segmentPix[i];
+            }
+        }
+
+        for (int x = x1; x < x2; ++x) {
+            if (hasA || hasB) {
+                for (int c = 0; c < nComponents; ++c) {
+#                 ifdef DEBUG
+                    // check for NaN
+                    assert(!hasA || srcPixA[c] == srcPixA[c]);
+                    assert(!hasB || srcPixB[c] == srcPixB[c]);
+#                 endif
+                    // all images are supposed to be black and transparent outside o
+                    tmpA[c] = hasA ? ((float)srcPixA[c] / maxValue) : 0.f;
+                    tmpB[c] = hasB ? ((float)srcPixB[c] / maxValue) : 0.f;
                 }
-#             endif
-
-                for (unsigned int i = 0; i < _optionalAImages.size(); ++i) {
-                    srcPixA = (const PIX *)  (_optionalAImages[i] ? _optionalAImages[i]->getPixelAddress(x, y) : 0);
-                    
-                    if (srcPixA) {
-                        
-                        for (int c = 0; c < nComponents; ++c) {
-#                     ifdef DEBUG
-                            // check for NaN
-                            assert(srcPixA[c] == srcPixA[c]);
-#                     endif
-                            // all images are supposed to be black and transparent outside o
-                            tmpA[c] = (float)srcPixA[c] / maxValue;
-#                         ifdef DEBUG
-                            // check for NaN
-                            assert(tmpA[c] == tmpA[c]);
-#                         endif
-                        }
-                        if (nComponents != 4) {
-                            // set alpha (1 inside, 0 outside)
-                            assert(srcPixA);
-                            tmpA[3] = 1.;
-                        }
-                        for (int c = 0; c < 4; ++c) {
-                            tmpB[c] = tmpPix[c];
-                        }
-
-                        // work in float: clamping is done when mixing
-                        mergePixel<f, float, nComponents, 1>(_alphaMasking, tmpA, tmpB, tmpPix);
-
-#                     ifdef DEBUG
-                        // check for NaN
-                        for (int c = 0; c < 4; ++c) {
-                            assert(tmpPix[c] == tmpPix[c]);
-                        }
-#                     endif
-                    }
+                if (nComponents != 4) {
+                    // set alpha (1 inside, 0 outside)
+                    tmpA[3] = hasA ? 1. : 0.;
+                    tmpB[3] = hasB ? 1. : 0.;
+                }
+                // work in float: clamping is done when mixing
+                mergePixel<f, float, 4, 1>(_alphaMasking, tmpA, tmpB, tmpPix);
+            } else {
+                // everything is black and transparent
+                for (int c = 0; c < 4; ++c) {
+                    tmpPix[c] = 0;
                 }
-                
-                // tmpPix has 4 components, but we only need the first nComponents
+            }
 
-                // denormalize
+            for (int i = 0; i < nOptional; ++i) {
+                const PIX *optPix = optionalPix[i];
                 for (int c = 0; c < nComponents; ++c) {
-                    tmpPix[c] *= maxValue;
+#                 ifdef DEBUG
+                    // check for NaN
+                    assert(optPix[c] == optPix[c]);
+#                 endif
+                    tmpA[c] = (float)optPix[c] / maxValue;
                 }
-                
-                ofxsMaskMixPix<PIX, nComponents, maxValue, true>(tmpPix, x, y, srcPixB, _doMasking, _maskImg, (float)_mix, _maskInvert, dstPix);
-                
-                dstPix += nComponents;
+                if (nComponents != 4) {
+                    // set alpha (1 inside)
+                    tmpA[3] = 1.;
+                }
+                for (int c = 0; c < 4; ++c) {
+                    tmpB[c] = tmpPix[c];
+                }
+
+                // work in float: clamping is done when mixing
+                mergePixel<f, float, nComponents, 1>(_alphaMasking, tmpA, tmpB, tmpPix);
+                optionalPix[i] += nComponents;
+            }
+
+#         ifdef DEBUG
+            // check for NaN
+            for (int c = 0; c < 4; ++c) {
+                assert(tmpPix[c] == tmpPix[c]);
+            }
+#         endif
+
+            // tmpPix has 4 components, but we only need the first nComponents
+
+            // denormalize
+            for (int c = 0; c < nComponents; ++c) {
+                tmpPix[c] *= maxValue;
+            }
+
+            ofxsMaskMixPix<PIX, nComponents, maxValue, true>(tmpPix, x, y, srcPixB, _doMasking, _maskImg, (float)_mix, _maskInvert, dstPix);
+
+            dstPix += nComponents;
+            if (hasA) {
+                srcPixA += nComponents;
+            }
+            if (hasB) {
+                srcPixB += nComponents;
             }
         }
     }
-    
+
+    // same as processSegment, for RGBA images with A or B present, using a vectorized row kernel:
+    // the segment is normalized into float rows, merged row by row, and then masked and mixed.
+    // rowBuffers holds three RGBA rows of the processing window width.
+    void processSegmentRows(MergeRowKernels::MergeRowFunction rowFunction, int x1, int x2, int y, const std::vector<const PIX*>& segmentPix, float *rowBuffers, PIX *dstPix)
+    {
+        assert(nComponents == 4 && (segmentPix[0] || segmentPix[1]));
+        const int n = x2 - x1;
+        float *rowA = rowBuffers;
+        float *rowB = rowA + 4 * n;
+        float *rowPix = rowB + 4 * n;
+
+        normalizeRow(segmentPix[0], n, rowA);
+        normalizeRow(segmentPix[1], n, rowB);
+        rowFunction(rowA, rowB, n, rowPix);
+
+        // the optional A inputs are merged over the result, in place
+        for (size_t i = 2; i < segmentPix.size(); ++i) {
+            if (segmentPix[i]) {
+                normalizeRow(segmentPix[i], n, rowA);
+                rowFunction(rowA, rowPix, n, rowPix);
+            }
+        }
+
+        const PIX *srcPixB = segmentPix[1];
+        float *tmpPix = rowPix;
+        for (int x = x1; x < x2; ++x) {
+#         ifdef DEBUG
+            // check for NaN
+            for (int c = 0; c < 4; ++c) {
+                assert(tmpPix[c] == tmpPix[c]);
+            }
+#         endif
+            // denormalize
+            for (int c = 0; c < nComponents; ++c) {
+                tmpPix[c] *= maxValue;
+            }
+
+            ofxsMaskMixPix<PIX, nComponents, maxValue, true>(tmpPix, x, y, srcPixB, _doMasking, _maskImg, (float)_mix, _maskInvert, dstPix);
+
+            tmpPix += 4;
+            dstPix += nComponents;
+            if (srcPixB) {
+                srcPixB += nComponents;
+            }
+        }
+    }
+
+    // convert n RGBA pixels to normalized floats, or fill with black and transparent if there is no input
+    static void normalizeRow(const PIX *srcPix, int n, float *row)
+    {
+        if (!srcPix) {
+            std::fill(row, row + 4 * n, 0.f);
+            return;
+        }
+        for (int i = 0; i < 4 * n; ++i) {
+#         ifdef DEBUG
+            // check for NaN
+            assert(srcPix[i] == srcPix[i]);
+#         endif
+            row[i] = (float)srcPix[i] / maxValue;
+        }
+    }
+
+private:
+    // vectorized RGBA row kernels, without and with alpha masking (NULL if the scalar path must be used)
+    MergeRowKernels::MergeRowFunction _rowFunction[2];
 };
 
 
@@ -0,0 +1,152 @@
+/*
+ OFX Merge plugin: vectorized row kernels.
+
+ Copyright (C) 2014 INRIA
+
+ Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+
+ Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+
+ Redistributions in binary form must reproduce the above copyright notice, this
+ list of conditions and the following disclaimer in the documentation and/or
+ other materials provided with the distribution.
+
+ Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ INRIA
+ Domaine de Voluceau
+ Rocquencourt - B.P. 105
+ 78153 Le Chesnay Cedex - France
+ */
+
+#ifndef Misc_MergeRowKernels_h
+#define Misc_MergeRowKernels_h
+
+#include "ofxsMerging.h"
+
+// SSE2 is part of the x86-64 baseline, and is enabled on 32-bit x86 by -msse2 or /arch:SSE2
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define kMergeRowKernelsSSE2 1
+#include <emmintrin.h>
+#include <xmmintrin.h> // _MM_TRANSPOSE4_PS
+#else
+#define kMergeRowKernelsSSE2 0
+#endif
+
+// number of RGBA pixels processed per iteration of the vectorized loop
+#define kMergeRowKernelsPixels 4
+
+namespace MergeRowKernels {
+
+/// Merge n RGBA float pixels of A over n RGBA float pixels of B into dst.
+/// dst may be the same buffer as A or B.
+typedef void (*MergeRowFunction)(const float *A, const float *B, int n, float *dst);
+
+#if kMergeRowKernelsSSE2
+// The operator formulas, applied to four values at once.
+// The order of the operations is the same as in the scalar functors of ofxsMerging.h,
+// and there is no fused multiply-add, so that each component is rounded the same way.
+template <MergeImages2D::MergingFunctionEnum f>
+struct MergeOpSSE2
+{
+    static const bool supported = false;
+    static inline __m128 apply(__m128 A, __m128 /*B*/, __m128 /*a*/, __m128 /*b*/, __m128 /*one*/) { return A; }
+};
+
+#define MERGE_OP_SSE2(e, expr) \
+template <> \
+struct MergeOpSSE2<MergeImages2D::e> \
+{ \
+    static const bool supported = true; \
+    static inline __m128 apply(__m128 A, __m128 B, __m128 a, __m128 b, __m128 one) { (void)B; (void)a; (void)b; (void)one; return expr; } \
+};
+
+MERGE_OP_SSE2(eMergeOver,     _mm_add_ps(A, _mm_mul_ps(B, _mm_sub_ps(one, a))))
+MERGE_OP_SSE2(eMergeUnder,    _mm_add_ps(_mm_mul_ps(A, _mm_sub_ps(one, b)), B))
+MERGE_OP_SSE2(eMergePlus,     _mm_add_ps(A, B))
+MERGE_OP_SSE2(eMergeMultiply, _mm_mul_ps(A, B))
+MERGE_OP_SSE2(eMergeScreen,   _mm_sub_ps(_mm_add_ps(A, B), _mm_mul_ps(A, B)))
+MERGE_OP_SSE2(eMergeIn,       _mm_mul_ps(A, b))
+MERGE_OP_SSE2(eMergeOut,      _mm_mul_ps(A, _mm_sub_ps(one, b)))
+MERGE_OP_SSE2(eMergeATop,     _mm_add_ps(_mm_mul_ps(A, b), _mm_mul_ps(B, _mm_sub_ps(one, a))))
+// std::max(A,B) returns A unless A < B, which is what maxps(B,A) does (also for NaN and signed zeroes)
+MERGE_OP_SSE2(eMergeLighten,  _mm_max_ps(B, A))
+// std::min(A,B) returns A unless B < A, which is what minps(B,A) does
+MERGE_OP_SSE2(eMergeDarken,   _mm_min_ps(B, A))
+
+#undef MERGE_OP_SSE2
+
+template <MergeImages2D::MergingFunctionEnum f, bool alphaMasking>
+void
+mergeRowSSE2(const float *A, const float *B, int n, float *dst)
+{
+    const __m128 one = _mm_set1_ps(1.f);
+    int x = 0;
+    // four pixels per iteration: the pixels are transposed so that each vector holds one component
+    // of the four pixels, and a and b are the alpha vectors of A and B
+    for (; x + kMergeRowKernelsPixels <= n; x += kMergeRowKernelsPixels, A += 4 * kMergeRowKernelsPixels, B += 4 * kMergeRowKernelsPixels, dst += 4 * kMergeRowKernelsPixels) {
+        __m128 Ar = _mm_loadu_ps(A);
+        __m128 Ag = _mm_loadu_ps(A + 4);
+        __m128 Ab = _mm_loadu_ps(A + 8);
+        __m128 a = _mm_loadu_ps(A + 12);
+        _MM_TRANSPOSE4_PS(Ar, Ag, Ab, a);
+        __m128 Br = _mm_loadu_ps(B);
+        __m128 Bg = _mm_loadu_ps(B + 4);
+        __m128 Bb = _mm_loadu_ps(B + 8);
+        __m128 b = _mm_loadu_ps(B + 12);
+        _MM_TRANSPOSE4_PS(Br, Bg, Bb, b);
+        __m128 r = MergeOpSSE2<f>::apply(Ar, Br, a, b, one);
+        __m128 g = MergeOpSSE2<f>::apply(Ag, Bg, a, b, one);
+        __m128 bl = MergeOpSSE2<f>::apply(Ab, Bb, a, b, one);
+        // with alpha masking, output alpha is a + b - a*b
+        __m128 alpha = alphaMasking ? _mm_sub_ps(_mm_add_ps(a, b), _mm_mul_ps(a, b)) : MergeOpSSE2<f>::apply(a, b, a, b, one);
+        _MM_TRANSPOSE4_PS(r, g, bl, alpha);
+        _mm_storeu_ps(dst, r);
+        _mm_storeu_ps(dst + 4, g);
+        _mm_storeu_ps(dst + 8, bl);
+        _mm_storeu_ps(dst + 12, alpha);
+    }
+    for (; x < n; ++x, A += 4, B += 4, dst += 4) {
+        MergeImages2D::mergePixel<f, float, 4, 1>(alphaMasking, A, B, dst);
+    }
+}
+#endif // kMergeRowKernelsSSE2
+
+/// Return the fastest row kernel for operator f that is available on this CPU,
+/// or NULL if the scalar path must be used.
+/// The kernels give exactly the same results as the scalar mergePixel (see tests/MergeRowKernelsTest.cpp).
+template <MergeImages2D::MergingFunctionEnum f>
+MergeRowFunction
+getRowFunction(bool alphaMasking)
+{
+#if kMergeRowKernelsSSE2
+    if (MergeOpSSE2<f>::supported) {
+        // alpha masking only applies to some operators (see isMaskable)
+        if (alphaMasking && MergeImages2D::isMaskable(f)) {
+            return &mergeRowSSE2<f, true>;
+        }
+        return &mergeRowSSE2<f, false>;
+    }
+#endif
+    (void)alphaMasking;
+    return 0;
+}
+
+} // namespace MergeRowKernels
+
+#endif // Misc_MergeRowKernels_h
@@ -0,0 +1,1078 @@
+/*
+ OFX color plugins: color correction kernels.
+
+ Copyright (C) 2014 INRIA
+
+ Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+
+ Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+
+ Redistributions in binary form must reproduce the above copyright notice, this
+ list of conditions and the following disclaimer in the documentation and/or
+ other materials provided with the distribution.
+
+ Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ INRIA
+ Domaine de Voluceau
+ Rocquencourt - B.P. 105
+ 78153 Le Chesnay Cedex - France
+ */
+
+/*
+ The color functions of Gamma, Grade, Saturation, ColorMatrix and ColorCorrect, as kernels for
+ PixelKernelProcessor. They are shared with ColorStack, which chains them in a single pass.
+
+ Besides process(), each kernel has an apply() function, which works in place on a double
+ precision pixel.
+
+ The gamma functions use either std::pow or fastPow (see FastPow.h), depending on the "precision"
+ parameter. Gamma and Grade process each channel independently, so for 8-bit and 16-bit images
+ they can also use a lookup table of their results on all the levels of the image.
+ */
+
+#ifndef Misc_ColorKernels_h
+#define Misc_ColorKernels_h
+
+#include <cmath>
+#include <cassert>
+#include <algorithm>
+#include <vector>
+
+#include "ofxsImageEffect.h"
+#include "PixelKernelProcessor.h"
+#include "FastPow.h"
+
+#define LUT_MAX_PRECISION 100
+
+#define kParamPrecision "precision"
+#define kParamPrecisionLabel "Precision"
+#define kParamPrecisionHint "How the gamma functions are computed. " \
+    "For 8-bit and 16-bit images that are not premultiplied, a table of the results on all the levels is computed first when the image is large enough."
+#define kParamPrecisionOptionExact "Exact"
+#define kParamPrecisionOptionExactHint "Use std::pow, for reference results. This is the default."
+#define kParamPrecisionOptionFast "Fast"
+#define kParamPrecisionOptionFastHint "Use a polynomial approximation of pow. The relative error is below 2e-7 + 1.5e-7 * |log2(value) / gamma|, " \
+    "e.g. 7.4e-7 for values in [1/4, 4] with gamma in [0.2, 5], 1.5e-6 when |log2(value) / gamma| <= 10 and 2.7e-6 when it is <= 20."
+
+// Rec.709 luminance:
+//Y = 0.2126 R + 0.7152 G + 0.0722 B
+static const double s_rLum = 0.2126;
+static const double s_gLum = 0.7152;
+static const double s_bLum = 0.0722;
+
+struct RGBAValues {
+    double r,g,b,a;
+    RGBAValues(double v) : r(v), g(v), b(v), a(v) {}
+    RGBAValues() : r(0), g(0), b(0), a(0) {}
+};
+
+enum LuminanceMathEnum {
+    eLuminanceMathRec709,
+    eLuminanceMathCcir601,
+    eLuminanceMathAverage,
+    eLuminanceMathMaximum,
+};
+
+enum PrecisionEnum {
+    ePrecisionExact,
+    ePrecisionFast,
+};
+
+inline void
+describePrecisionParam(OFX::ImageEffectDescriptor &desc, OFX::PageParamDescriptor *page)
+{
+    OFX::ChoiceParamDescriptor* param = desc.defineChoiceParam(kParamPrecision);
+    param->setLabel(kParamPrecisionLabel);
+    param->setHint(kParamPrecisionHint);
+    assert(param->getNOptions() == ePrecisionExact);
+    param->appendOption(kParamPrecisionOptionExact, kParamPrecisionOptionExactHint);
+    assert(param->getNOptions() == ePrecisionFast);
+    param->appendOption(kParamPrecisionOptionFast, kParamPrecisionOptionFastHint);
+    param->setDefault(ePrecisionExact);
+    param->setAnimates(false);
+    if (page) {
+        page->addChild(*param);
+    }
+}
+
+/// The max value of the levels table to use for this render, or 0 if it should not be used.
+/// The table is only valid if the unpremultiplied values are levels of the image, and it
+/// is only worth computing if there are more pixels to render than levels.
+inline int
+levelsLUTMaxValue(OFX::BitDepthEnum bitDepth, bool premult, const OfxRectI &renderWindow)
+{
+    int maxValue;
+    switch (bitDepth) {
+        case OFX::eBitDepthUByte:
+            maxValue = 255;
+            break;
+        case OFX::eBitDepthUShort:
+            maxValue = 65535;
+            break;
+        default:
+            return 0;
+    }
+    if (premult) {
+        return 0;
+    }
+    const double nPixels = (double)(renderWindow.x2 - renderWindow.x1) * (renderWindow.y2 - renderWindow.y1);
+    if (nPixels <= maxValue + 1) {
+        return 0;
+    }
+    return maxValue;
+}
+
+/// Compute the levels table of a kernel that processes each channel independently:
+/// the RGBA result of the kernel for each level 0..maxValue, divided by maxValue as in ofxsUnPremult.
+template <class Kernel>
+void
+buildLevelsLUT(const Kernel &kernel, int maxValue, std::vector<float> *lut)
+{
+    lut->resize((maxValue + 1) * 4);
+    for (int i = 0; i <= maxValue; ++i) {
+        const float v = i / (float)maxValue;
+        const float unpPix[4] = { v, v, v, v };
+        kernel.template process<true, true, true, true>(unpPix, &(*lut)[i * 4]);
+    }
+}
+
+/// The result of the kernel, from its levels table.
+template<bool processR, bool processG, bool processB, bool processA>
+void
+processFromLevelsLUT(const float *lut, int maxValue, const float *unpPix, float *tmpPix)
+{
+    const bool processed[4] = { processR, processG, processB, processA };
+    for (int c = 0; c < 4; ++c) {
+        if (processed[c]) {
+            const int i = std::max(0, std::min((int)(unpPix[c] * maxValue + 0.5f), maxValue));
+            tmpPix[c] = lut[i * 4 + c];
+        } else {
+            tmpPix[c] = unpPix[c];
+        }
+    }
+}
+
+// add a constant to the selected channels
+struct AddKernel : public PixelKernel<AddKernel>
+{
+    AddKernel()
+    : _value()
+    {
+    }
+
+    AddKernel(const RGBAValues& value)
+    : _value(value)
+    {
+    }
+
+    template<bool processR, bool processG, bool processB, bool processA>
+    void process(const float *unpPix, float *tmpPix) const
+    {
+        for (int c = 0; c < 4; ++c) {
+            if (processR && c == 0) {
+                tmpPix[0] = unpPix[0] + (float)_value.r;
+            } else if (processG && c == 1) {
+                tmpPix[1] = unpPix[1] + (float)_value.g;
+            } else if (processB && c == 2) {
+                tmpPix[2] = unpPix[2] + (float)_value.b;
+            } else if (processA && c == 3) {
+                tmpPix[3] = unpPix[3] + (float)_value.a;
+            } else {
+                tmpPix[c] = unpPix[c];
+            }
+        }
+    }
+
+#if kPixelKernelSSE2
+    template<bool processR, bool processG, bool processB, bool processA>
+    void processRow(const float *srcPix, float *dstPix, int n) const
+    {
+        const __m128 mask = pixelKernelChannelMaskSSE2<processR, processG, processB, processA>();
+        const __m128 value = _mm_set_ps((float)_value.a, (float)_value.b, (float)_value.g, (float)_value.r);
+        for (int x = 0; x < n; ++x, srcPix += 4, dstPix += 4) {
+            const __m128 v = _mm_loadu_ps(srcPix);
+            _mm_storeu_ps(dstPix, pixelKernelSelectSSE2(mask, _mm_add_ps(v, value), v));
+        }
+    }
+#endif
+
+private:
+    RGBAValues _value;
+};
+
+// multiply the selected channels by a constant
+struct MultiplyKernel : public PixelKernel<MultiplyKernel>
+{
+    MultiplyKernel()
+    : _value()
+    {
+    }
+
+    MultiplyKernel(const RGBAValues& value)
+    : _value(value)
+    {
+    }
+
+    template<bool processR, bool processG, bool processB, bool processA>
+    void process(const float *unpPix, float *tmpPix) const
+    {
+        for (int c = 0; c < 4; ++c) {
+            if (processR && c == 0) {
+                tmpPix[0] = unpPix[0] * (float)_value.r;
+            } else if (processG && c == 1) {
+                tmpPix[1] = unpPix[1] * (float)_value.g;
+            } else if (processB && c == 2) {
+                tmpPix[2] = unpPix[2] * (float)_value.b;
+            } else if (processA && c == 3) {
+                tmpPix[3] = unpPix[3] * (float)_value.a;
+            } else {
+                tmpPix[c] = unpPix[c];
+            }
+        }
+    }
+
+#if kPixelKernelSSE2
+    template<bool processR, bool processG, bool processB, bool processA>
+    void processRow(const float *srcPix, float *dstPix, int n) const
+    {
+        const __m128 mask = pixelKernelChannelMaskSSE2<processR, processG, processB, processA>();
+        const __m128 value = _mm_set_ps((float)_value.a, (float)_value.b, (float)_value.g, (float)_value.r);
+        for (int x = 0; x < n; ++x, srcPix += 4, dstPix += 4) {
+            const __m128 v = _mm_loadu_ps(srcPix);
+            _mm_storeu_ps(dstPix, pixelKernelSelectSSE2(mask, _mm_mul_ps(v, value), v));
+        }
+    }
+#endif
+
+private:
+    RGBAValues _value;
+};
+
+// invert the selected channels
+struct InvertKernel : public PixelKernel<InvertKernel>
+{
+    template<bool processR, bool processG, bool processB, bool processA>
+    void process(const float *unpPix, float *tmpPix) const
+    {
+        tmpPix[0] = processR ? (1.f - unpPix[0]) : unpPix[0];
+        tmpPix[1] = processG ? (1.f - unpPix[1]) : unpPix[1];
+        tmpPix[2] = processB ? (1.f - unpPix[2]) : unpPix[2];
+        tmpPix[3] = processA ? (1.f - unpPix[3]) : unpPix[3];
+    }
+
+#if kPixelKernelSSE2
+    template<bool processR, bool processG, bool processB, bool processA>
+    void processRow(const float *srcPix, float *dstPix, int n) const
+    {
+        const __m128 mask = pixelKernelChannelMaskSSE2<processR, processG, processB, processA>();
+        const __m128 one = _mm_set1_ps(1.f);
+        for (int x = 0; x < n; ++x, srcPix += 4, dstPix += 4) {
+            const __m128 v = _mm_loadu_ps(srcPix);
+            _mm_storeu_ps(dstPix, pixelKernelSelectSSE2(mask, _mm_sub_ps(one, v), v));
+        }
+    }
+#endif
+};
+
+// gamma function applied to the selected channels
+struct GammaKernel : public PixelKernel<GammaKernel>
+{
+    GammaKernel()
+    : _value()
+    , _fastPow(false)
+    , _levelsLUT(0)
+    , _levelsMaxValue(0)
+    {
+    }
+
+    GammaKernel(const RGBAValues& value)
+    : _value()
+    , _fastPow(false)
+    , _levelsLUT(0)
+    , _levelsMaxValue(0)
+    {
+        _value.r = 1./std::max(1e-8, value.r);
+        _value.g = 1./std::max(1e-8, value.g);
+        _value.b = 1./std::max(1e-8, value.b);
+        _value.a = 1./std::max(1e-8, value.a);
+    }
+
+    void setFastPow(bool fastPow) { _fastPow = fastPow; }
+
+    /// lut is the table given by buildLevelsLUT, it must be valid while the kernel is used.
+    void setLevelsLUT(const float *lut, int maxValue) { _levelsLUT = lut; _levelsMaxValue = maxValue; }
+
+    template<bool processR, bool processG, bool processB, bool processA>
+    void process(const float *unpPix, float *tmpPix) const
+    {
+        if (_levelsLUT) {
+            processFromLevelsLUT<processR, processG, processB, processA>(_levelsLUT, _levelsMaxValue, unpPix, tmpPix);
+            return;
+        }
+        for (int c = 0; c < 4; ++c) {
+            if (!(unpPix[c] > 0.)) {
+                // gamma function is not defined for negative values (NaN is also left unchanged, as in apply())
+                tmpPix[c] = unpPix[c];
+            } else if (processR && c == 0) {
+                tmpPix[0] = power(unpPix[0], (float)_value.r);
+            } else if (processG && c == 1) {
+                tmpPix[1] = power(unpPix[1], (float)_value.g);
+            } else if (processB && c == 2) {
+                tmpPix[2] = power(unpPix[2], (float)_value.b);
+            } else if (processA && c == 3) {
+                tmpPix[3] = power(unpPix[3], (float)_value.a);
+            } else {
+                tmpPix[c] = unpPix[c];
+            }
+        }
+    }
+
+#if kPixelKernelSSE2
+    template<bool processR, bool processG, bool processB, bool processA>
+    void processRow(const float *srcPix, float *dstPix, int n) const
+    {
+        if (!_fastPow || _levelsLUT) {
+            PixelKernel<GammaKernel>::processRow<processR, processG, processB, processA>(srcPix, dstPix, n);
+            return;
+        }
+        const __m128 mask = pixelKernelChannelMaskSSE2<processR, processG, processB, processA>();
+        const __m128 value = _mm_set_ps((float)_value.a, (float)_value.b, (float)_value.g, (float)_value.r);
+        const __m128 zero = _mm_setzero_ps();
+        // channels with a gamma of 1 are left unchanged, like in power()
+        const __m128 channels = _mm_andnot_ps(_mm_cmpeq_ps(value, _mm_set1_ps(1.f)), mask);
+        for (int x = 0; x < n; ++x, srcPix += 4, dstPix += 4) {
+            const __m128 v = _mm_loadu_ps(srcPix);
+            // gamma function is not defined for negative values
+            const __m128 m = _mm_and_ps(channels, _mm_cmpgt_ps(v, zero));
+            _mm_storeu_ps(dstPix, pixelKernelSelectSSE2(m, fastPowSSE2(v, value), v));
+        }
+    }
+#endif
+
+    template<bool processR, bool processG, bool processB, bool processA>
+    void apply(double *r, double *g, double *b, double *a) const
+    {
+        // gamma function is not defined for negative values
+        if (processR && *r > 0.) {
+            *r = power(*r, _value.r);
+        }
+        if (processG && *g > 0.) {
+            *g = power(*g, _value.g);
+        }
+        if (processB && *b > 0.) {
+            *b = power(*b, _value.b);
+        }
+        if (processA && *a > 0.) {
+            *a = power(*a, _value.a);
+        }
+    }
+
+private:
+    float power(float x, float y) const
+    {
+        if (y == 1.f) {
+            return x;
+        }
+        return _fastPow ? fastPow(x, y) : std::pow(x, y);
+    }
+
+    double power(double x, double y) const
+    {
+        if (y == 1.) {
+            return x;
+        }
+        return _fastPow ? (double)fastPow((float)x, (float)y) : std::pow(x, y);
+    }
+
+    RGBAValues _value;
+    bool _fastPow;
+    const float *_levelsLUT;
+    int _levelsMaxValue;
+};
+
+// grade the selected channels
+struct GradeKernel : public PixelKernel<GradeKernel>
+{
+    GradeKernel()
+    : _clampBlack(true)
+    , _clampWhite(true)
+    , _fastPow(false)
+    , _levelsLUT(0)
+    , _levelsMaxValue(0)
+    {
+    }
+
+    GradeKernel(const RGBAValues& blackPoint,
+                const RGBAValues& whitePoint,
+                const RGBAValues& black,
+                const RGBAValues& white,
+                const RGBAValues& multiply,
+                const RGBAValues& offset,
+                const RGBAValues& gamma,
+                bool clampBlack,
+                bool clampWhite)
+    : _blackPoint(blackPoint)
+    , _whitePoint(whitePoint)
+    , _black(black)
+    , _white(white)
+    , _multiply(multiply)
+    , _offset(offset)
+    , _gamma(gamma)
+    , _clampBlack(clampBlack)
+    , _clampWhite(clampWhite)
+    , _fastPow(false)
+    , _levelsLUT(0)
+    , _levelsMaxValue(0)
+    {
+    }
+
+    void setFastPow(bool fastPow) { _fastPow = fastPow; }
+
+    /// lut is the table given by buildLevelsLUT, it must be valid while the kernel is used.
+    void setLevelsLUT(const float *lut, int maxValue) { _levelsLUT = lut; _levelsMaxValue = maxValue; }
+
+    template<bool processR, bool processG, bool processB, bool processA>
+    void process(const float *unpPix, float *tmpPix) const
+    {
+        if (_levelsLUT) {
+            processFromLevelsLUT<processR, processG, processB, processA>(_levelsLUT, _levelsMaxValue, unpPix, tmpPix);
+            return;
+        }
+        double t_r = unpPix[0];
+        double t_g = unpPix[1];
+        double t_b = unpPix[2];
+        double t_a = unpPix[3];
+        apply<processR,processG,processB,processA>(&t_r,&t_g,&t_b,&t_a);
+        tmpPix[0] = (float)t_r;
+        tmpPix[1] = (float)t_g;
+        tmpPix[2] = (float)t_b;
+        tmpPix[3] = (float)t_a;
+    }
+
+    template<bool processR, bool processG, bool processB, bool processA>
+    void apply(double *r, double *g, double *b, double *a) const
+    {
+        if (processR) {
+            grade(r, _whitePoint.r, _blackPoint.r, _white.r, _black.r, _multiply.r, _offset.r, _gamma.r);
+        }
+        if (processG) {
+            grade(g, _whitePoint.g, _blackPoint.g, _white.g, _black.g, _multiply.g, _offset.g, _gamma.g);
+        }
+        if (processB) {
+            grade(b, _whitePoint.b, _blackPoint.b, _white.b, _black.b, _multiply.b, _offset.b, _gamma.b);
+        }
+        if (processA) {
+            grade(a, _whitePoint.a, _blackPoint.a, _white.a, _black.a, _multiply.a, _offset.a, _gamma.a);
+        }
+        if (_clampBlack) {
+            if (processR) {
+                *r = std::max(0.,*r);
+            }
+            if (processG) {
+                *g = std::max(0.,*g);
+            }
+            if (processB) {
+                *b = std::max(0.,*b);
+            }
+            if (processA) {
+                *a = std::max(0.,*a);
+            }
+        }
+        if (_clampWhite) {
+            if (processR) {
+                *r = std::min(1.,*r);
+            }
+            if (processG) {
+                *g = std::min(1.,*g);
+            }
+            if (processB) {
+                *b = std::min(1.,*b);
+            }
+            if (processA) {
+                *a = std::min(1.,*a);
+            }
+        }
+    }
+
+private:
+    void grade(double* v, double wp, double bp, double white, double black, double mutiply, double offset, double gamma) const
+    {
+        double A = mutiply * (white - black) / (wp - bp);
+        double B = offset + black - A * bp;
+        double x = (A * *v) + B;
+        if (_fastPow && gamma != 1. && x > 0.) {
+            *v = fastPow((float)x, (float)(1. / gamma));
+        } else {
+            *v = std::pow(x, 1. / gamma);
+        }
+    }
+
+    RGBAValues _blackPoint;
+    RGBAValues _whitePoint;
+    RGBAValues _black;
+    RGBAValues _white;
+    RGBAValues _multiply;
+    RGBAValues _offset;
+    RGBAValues _gamma;
+    bool _clampBlack;
+    bool _clampWhite;
+    bool _fastPow;
+    const float *_levelsLUT;
+    int _levelsMaxValue;
+};
+
+// desaturate the selected channels
+struct SaturationKernel : public PixelKernel<SaturationKernel>
+{
+    SaturationKernel()
+    : _saturation(0.)
+    , _luminanceMath(eLuminanceMathRec709)
+    , _clampBlack(true)
+    , _clampWhite(true)
+    {
+    }
+
+    SaturationKernel(double saturation,
+                     LuminanceMathEnum luminanceMath,
+                     bool clampBlack,
+                     bool clampWhite)
+    : _saturation(saturation)
+    , _luminanceMath(luminanceMath)
+    , _clampBlack(clampBlack)
+    , _clampWhite(clampWhite)
+    {
+    }
+
+    template<bool processR, bool processG, bool processB, bool processA>
+    void process(const float *unpPix, float *tmpPix) const
+    {
+        double t_r = unpPix[0];
+        double t_g = unpPix[1];
+        double t_b = unpPix[2];
+        double t_a = unpPix[3];
+        apply<processR,processG,processB,processA>(&t_r,&t_g,&t_b,&t_a);
+        tmpPix[0] = (float)t_r;
+        tmpPix[1] = (float)t_g;
+        tmpPix[2] = (float)t_b;
+        tmpPix[3] = (float)t_a;
+    }
+
+    template<bool processR, bool processG, bool processB, bool processA>
+    void apply(double *r, double *g, double *b, double *a) const
+    {
+        double l;
+        switch (_luminanceMath) {
+            case eLuminanceMathRec709:
+                l = 0.2126 * *r + 0.7152 * *g + 0.0722 * *b;
+                break;
+            case eLuminanceMathCcir601:
+                l = 0.299 * *r + 0.587 * *g + 0.114 * *b;
+                break;
+            case eLuminanceMathAverage:
+                l = (*r + *g + *b) / 3;
+                break;
+            case eLuminanceMathMaximum:
+                l = std::max(std::max(*r, *g), *b);
+                break;
+        }
+        if (processR) {
+            *r = (1. - _saturation) * l + _saturation * *r;
+        }
+        if (processG) {
+            *g = (1. - _saturation) * l + _saturation * *g;
+        }
+        if (processB) {
+            *b = (1. - _saturation) * l + _saturation * *b;
+        }
+        if (processA) {
+            // nothing to do
+        }
+        if (_clampBlack) {
+            if (processR) {
+                *r = std::max(0.,*r);
+            }
+            if (processG) {
+                *g = std::max(0.,*g);
+            }
+            if (processB) {
+                *b = std::max(0.,*b);
+            }
+            if (processA) {
+                *a = std::max(0.,*a);
+            }
+        }
+        if (_clampWhite) {
+            if (processR) {
+                *r = std::min(1.,*r);
+            }
+            if (processG) {
+                *g = std::min(1.,*g);
+            }
+            if (processB) {
+                *b = std::min(1.,*b);
+            }
+            if (processA) {
+                *a = std::min(1.,*a);
+            }
+        }
+    }
+
+private:
+
+    double _saturation;
+    LuminanceMathEnum _luminanceMath;
+    bool _clampBlack;
+    bool _clampWhite;
+};
+
+// apply the color matrix to the selected channels
+struct ColorMatrixKernel : public PixelKernel<ColorMatrixKernel>
+{
+    ColorMatrixKernel()
+    : _clampBlack(true)
+    , _clampWhite(true)
+    {
+    }
+
+    ColorMatrixKernel(const RGBAValues& outputRed,
+                      const RGBAValues& outputGreen,
+                      const RGBAValues& outputBlue,
+                      const RGBAValues& outputAlpha,
+                      bool clampBlack,
+                      bool clampWhite)
+    : _clampBlack(clampBlack)
+    , _clampWhite(clampWhite)
+    {
+        _matrix[0] = outputRed;
+        _matrix[1] = outputGreen;
+        _matrix[2] = outputBlue;
+        _matrix[3] = outputAlpha;
+    }
+
+    template<bool processR, bool processG, bool processB, bool processA>
+    void process(const float *unpPix, float *tmpPix) const
+    {
+        for (int c = 0; c < 4; ++c) { // tmpPix has 4 components
+            if ((processR && c == 0) ||
+                (processG && c == 1) ||
+                (processB && c == 2) ||
+                (processA && c == 3)) {
+                tmpPix[c] = (float)apply(c, unpPix[0], unpPix[1], unpPix[2], unpPix[3]);
+            } else {
+                tmpPix[c] = unpPix[c];
+            }
+        }
+    }
+
+    template<bool processR, bool processG, bool processB, bool processA>
+    void apply(double *r, double *g, double *b, double *a) const
+    {
+        const double inR = *r;
+        const double inG = *g;
+        const double inB = *b;
+        const double inA = *a;
+        if (processR) {
+            *r = apply(0, inR, inG, inB, inA);
+        }
+        if (processG) {
+            *g = apply(1, inR, inG, inB, inA);
+        }
+        if (processB) {
+            *b = apply(2, inR, inG, inB, inA);
+        }
+        if (processA) {
+            *a = apply(3, inR, inG, inB, inA);
+        }
+    }
+
+private:
+    double apply(int c, double inR, double inG, double inB, double inA) const
+    {
+        double comp = _matrix[c].r * inR + _matrix[c].g * inG + _matrix[c].b * inB + _matrix[c].a * inA;
+        if (_clampBlack && comp < 0.) {
+            comp = 0.;
+        } else  if (_clampWhite && comp > 1.) {
+            comp = 1.;
+        }
+        return comp;
+    }
+
+    RGBAValues _matrix[4];
+    bool _clampBlack;
+    bool _clampWhite;
+};
+
+struct ColorControlValues {
+    double r;
+    double g;
+    double b;
+    double a;
+
+    ColorControlValues() : r(0.), g(0.), b(0.),a(0.) {}
+
+    void getValueFrom(double time, OFX::RGBAParam* p)
+    {
+        p->getValueAtTime(time, r, g, b, a);
+    }
+};
+
+struct ColorControlGroup {
+    ColorControlValues saturation;
+    ColorControlValues contrast;
+    ColorControlValues gamma;
+    ColorControlValues gain;
+    ColorControlValues offset;
+};
+
+// the parameters of a ColorControlGroup
+struct ColorControlParamGroup {
+    ColorControlParamGroup()
+    : saturation(0)
+    , contrast(0)
+    , gamma(0)
+    , gain(0)
+    , offset(0) {}
+
+    OFX::RGBAParam* saturation;
+    OFX::RGBAParam* contrast;
+    OFX::RGBAParam* gamma;
+    OFX::RGBAParam* gain;
+    OFX::RGBAParam* offset;
+};
+
+inline bool
+groupIsIdentity(const ColorControlGroup& group)
+{
+    return (group.saturation.r == 1. &&
+            group.saturation.g == 1. &&
+            group.saturation.b == 1. &&
+            group.saturation.a == 1. &&
+            group.contrast.r == 1. &&
+            group.contrast.g == 1. &&
+            group.contrast.b == 1. &&
+            group.contrast.a == 1. &&
+            group.gamma.r == 1. &&
+            group.gamma.g == 1. &&
+            group.gamma.b == 1. &&
+            group.gamma.a == 1. &&
+            group.gain.r == 1. &&
+            group.gain.g == 1. &&
+            group.gain.b == 1. &&
+            group.gain.a == 1. &&
+            group.offset.r == 0. &&
+            group.offset.g == 0. &&
+            group.offset.b == 0. &&
+            group.offset.a == 0.);
+}
+
+template<bool processR, bool processG, bool processB, bool processA>
+struct RGBAPixel {
+    double r, g, b,a;
+    bool useFastPow;
+
+    RGBAPixel(double r_, double g_, double b_,double a_, bool useFastPow_ = false)
+    : r(r_)
+    , g(g_)
+    , b(b_)
+    , a(a_)
+    , useFastPow(useFastPow_)
+    {
+    }
+
+    void applySMH(const ColorControlGroup& sValues,
+                  double s_scale,
+                  const ColorControlGroup& mValues,
+                  double m_scale,
+                  const ColorControlGroup& hValues,
+                  double h_scale,
+                  const ColorControlGroup& masterValues)
+    {
+        RGBAPixel s = *this;
+        RGBAPixel m = *this;
+        RGBAPixel h = *this;
+        s.applyGroup(sValues);
+        m.applyGroup(mValues);
+        h.applyGroup(hValues);
+        
+        if (processR) {
+            r = s.r * s_scale + m.r * m_scale + h.r * h_scale;
+        }
+        if (processG) {
+            g = s.g * s_scale + m.g * m_scale + h.g * h_scale;
+        }
+        if (processB) {
+            b = s.b * s_scale + m.b * m_scale + h.b * h_scale;
+        }
+        if (processA) {
+            a = s.a * s_scale + m.a * m_scale + h.a * h_scale;
+        }
+        applyGroup(masterValues);
+    }
+
+private:
+    void applySaturation(const ColorControlValues &c)
+    {
+        double tmp_r ,tmp_g,tmp_b ;
+        if (processR) {
+            tmp_r = r *((1.f - c.r) * s_rLum + c.r) + g *((1.f-c.r) * s_gLum) + b *((1.f-c.r) * s_bLum);
+        }
+        if (processG) {
+            tmp_g = g *((1.f - c.g) * s_gLum + c.g) + r *((1.f-c.g) * s_rLum) + b *((1.f-c.g) * s_bLum);
+        }
+        if (processB) {
+            tmp_b = b *((1.f - c.b) * s_bLum + c.b) + g *((1.f-c.b) * s_gLum) + r *((1.f-c.b) * s_rLum);
+        }
+        if (processR) {
+            r = tmp_r;
+        }
+        if (processG) {
+            g = tmp_g;
+        }
+        if (processB) {
+            b = tmp_b;
+        }
+    }
+
+    void applyContrast(const ColorControlValues &c)
+    {
+        if (processR) {
+            r = (r - 0.5f) * c.r  + 0.5f;
+        }
+        if (processG) {
+            g = (g - 0.5f) * c.g  + 0.5f;
+        }
+        if (processB) {
+            b = (b - 0.5f) * c.b  + 0.5f;
+        }
+        if (processA) {
+            a = (a - 0.5f) * c.a  + 0.5f;
+        }
+    }
+
+    void applyGain(const ColorControlValues &c)
+    {
+        if (processR) {
+            r = r * c.r;
+        }
+        if (processG) {
+            g = g * c.g;
+        }
+        if (processB) {
+            b = b * c.b;
+        }
+        if (processA) {
+            a = a * c.a;
+        }
+    }
+
+    void applyGamma(const ColorControlValues &c)
+    {
+        if (processR && r > 0) {
+            r = power(r ,c.r);
+        }
+        if (processG && g > 0) {
+            g = power(g ,c.g);
+        }
+        if (processB && b > 0) {
+            b = power(b ,c.b);
+        }
+        if (processA && a > 0) {
+            a = power(a ,c.a);
+        }
+    }
+
+    double power(double x, double gamma) const
+    {
+        if (!useFastPow) {
+            return std::pow(x ,1. / gamma);
+        } else if (gamma == 1.) {
+            return x;
+        }
+        return fastPow((float)x, (float)(1. / gamma));
+    }
+
+    void applyOffset(const ColorControlValues &c)
+    {
+        if (processR) {
+            r = r + c.r;
+        }
+        if (processG) {
+            g = g + c.g;
+        }
+        if (processB) {
+            b = b + c.b;
+        }
+        if (processA) {
+            a = a + c.a;
+        }
+    }
+
+    void applyGroup(const ColorControlGroup& group)
+    {
+        applySaturation(group.saturation);
+        applyContrast(group.contrast);
+        applyGamma(group.gamma);
+        applyGain(group.gain);
+        applyOffset(group.offset);
+    }
+
+};
+
+// color correction of the shadows, midtones and highlights
+struct ColorCorrectKernel : public PixelKernel<ColorCorrectKernel>
+{
+    ColorCorrectKernel()
+    : _clampBlack(true)
+    , _clampWhite(true)
+    , _fastPow(false)
+    {
+        std::fill(&_lookupTable[0][0], &_lookupTable[0][0] + 2 * (LUT_MAX_PRECISION + 1), 0.);
+    }
+
+    ColorCorrectKernel(const ColorControlGroup& master,
+                       const ColorControlGroup& shadow,
+                       const ColorControlGroup& midtone,
+                       const ColorControlGroup& hightlights,
+                       bool clampBlack,
+                       bool clampWhite)
+    : _masterValues(master)
+    , _shadowValues(shadow)
+    , _midtoneValues(midtone)
+    , _highlightsValues(hightlights)
+    , _clampBlack(clampBlack)
+    , _clampWhite(clampWhite)
+    , _fastPow(false)
+    {
+        std::fill(&_lookupTable[0][0], &_lookupTable[0][0] + 2 * (LUT_MAX_PRECISION + 1), 0.);
+    }
+
+    void setFastPow(bool fastPow) { _fastPow = fastPow; }
+
+    /// Build the LUT of the shadows and highlights tone ranges.
+    /// If the host does not support parametric parameters, lookupTable is NULL and the default curves are used.
+    void setLookupTable(OFX::ParametricParam *lookupTable, double time)
+    {
+        for (int curve = 0; curve < 2; ++curve) {
+            for (int position = 0; position <= LUT_MAX_PRECISION; ++position) {
+                // position to evaluate the param at
+                double parametricPos = double(position)/LUT_MAX_PRECISION;
+
+                // evaluate the parametric param
+                double value;
+                if (lookupTable) {
+                    value = lookupTable->getValue(curve, time, parametricPos);
+                } else if (curve == 0) {
+                    if (parametricPos < 0.09) {
+                        value = 1. - parametricPos/0.09;
+                    } else {
+                        value = 0.;
+                    }
+                } else {
+                    assert(curve == 1);
+                    if (parametricPos <= 0.5) {
+                        value = 0.;
+                    } else {
+                        value = (parametricPos - 0.5) / 0.5;
+                    }
+                }
+                // set that in the lut
+                _lookupTable[curve][position] = (float)std::max(0., std::min(value, 1.));
+            }
+        }
+    }
+
+    template<bool processR, bool processG, bool processB, bool processA>
+    void process(const float *unpPix, float *tmpPix) const
+    {
+        double t_r = unpPix[0];
+        double t_g = unpPix[1];
+        double t_b = unpPix[2];
+        double t_a = unpPix[3];
+        apply<processR,processG,processB,processA>(&t_r, &t_g, &t_b,&t_a);
+        tmpPix[0] = (float)t_r;
+        tmpPix[1] = (float)t_g;
+        tmpPix[2] = (float)t_b;
+        tmpPix[3] = (float)t_a;
+    }
+
+    template<bool processR, bool processG, bool processB, bool processA>
+    void apply(double *r, double *g, double *b, double *a) const
+    {
+        double luminance = *r * s_rLum + *g * s_gLum + *b * s_bLum;
+        double s_scale = interpolate(0, luminance);
+        double h_scale = interpolate(1, luminance);
+        double m_scale = 1.f - s_scale - h_scale;
+
+        RGBAPixel<processR,processG,processB,processA> p(*r, *g, *b, *a, _fastPow);
+        p.applySMH(_shadowValues, s_scale,
+                   _midtoneValues, m_scale,
+                   _highlightsValues, h_scale,
+                   _masterValues);
+        if (processR) {
+            *r = clamp(p.r);
+        }
+        if (processG) {
+            *g = clamp(p.g);
+        }
+        if (processB) {
+            *b = clamp(p.b);
+        }
+        if (processA) {
+            *a = clamp(p.a);
+        }
+    }
+
+private:
+    double clamp(double comp) const
+    {
+        if (_clampBlack && comp < 0.) {
+            comp = 0.;
+        } else  if (_clampWhite && comp > 1.0) {
+            comp = 1.0;
+        }
+        return comp;
+    }
+
+    double interpolate(int curve, double value) const
+    {
+        if (value < 0.) {
+            return _lookupTable[curve][0];
+        } else if (value >= 1.) {
+            return _lookupTable[curve][LUT_MAX_PRECISION];
+        } else {
+            double i_d = std::floor(value * LUT_MAX_PRECISION);
+            int i = (int)i_d;
+            assert(i < LUT_MAX_PRECISION);
+            double alpha = value * LUT_MAX_PRECISION - i_d;
+            assert(0. <= alpha && alpha < 1.);
+            return _lookupTable[curve][i] * (1.-alpha) + _lookupTable[curve][i+1] * alpha;
+        }
+    }
+
+    ColorControlGroup _masterValues;
+    ColorControlGroup _shadowValues;
+    ColorControlGroup _midtoneValues;
+    ColorControlGroup _highlightsValues;
+    bool _clampBlack;
+    bool _clampWhite;
+    bool _fastPow;
+    double _lookupTable[2][LUT_MAX_PRECISION + 1];
+};
+
+#endif // Misc_ColorKernels_h
@@ -0,0 +1,185 @@
+/*
+ OFX color plugins: fast pow function.
+
+ Copyright (C) 2014 INRIA
+
+ Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+
+ Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+
+ Redistributions in binary form must reproduce the above copyright notice, this
+ list of conditions and the following disclaimer in the documentation and/or
+ other materials provided with the distribution.
+
+ Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ INRIA
+ Domaine de Voluceau
+ Rocquencourt - B.P. 105
+ 78153 Le Chesnay Cedex - France
+ */
+
+/*
+ Fast float pow, for the gamma functions of the color plugins.
+
+ fastPow(x, y) computes exp2(y * log2(x)) for x > 0, with polynomial approximations of log2
+ and exp2. It has no branch and no table, so that loops over it can be vectorized, and
+ fastPowSSE2 does the same operations on four values, giving exactly the same results
+ (unless the compiler contracts the scalar version into fused multiply-adds).
+
+ Speed: the scalar version is not faster than a good std::pow (e.g. the powf of glibc), the
+ gain comes from fastPowSSE2, which computes four values in less time than std::pow takes for
+ one (see tests/FastPowBenchmark.cpp, "make -C tests bench").
+
+ Accuracy: the polynomials are accurate to about 1e-8, and the error mostly comes from the
+ rounding of log2(x) and of y * log2(x) to float, so it grows with |y * log2(x)|. The relative
+ error is below 2e-7 + 1.5e-7 * |y * log2(x)|: the measured maximum over all x is 7.5e-7 for
+ |y * log2(x)| <= 5, 1.5e-6 for <= 10, 2.7e-6 for <= 20, 5.7e-6 for <= 40 and 1.7e-5 up to 126.
+ For example, it is 7.4e-7 for x in [1/4, 4] and y in [0.2, 5]. Below 20, this is below the
+ precision of 16-bit images.
+
+ x is clamped to [FLT_MIN, +inf), so that zero and negative values give 2^(-126 * y) instead of
+ a NaN, and y * log2(x) is clamped to [-126, 127.99], so that the result is a normal float in
+ [2^-126, 2^127.99]: larger results give 2^127.99, unless x is +inf.
+ A NaN x is returned unchanged, and x = +inf gives the same result as std::pow (+inf for y > 0,
+ 1 for y = 0 and 0 for y < 0). y must not be NaN.
+ */
+
+#ifndef Misc_FastPow_h
+#define Misc_FastPow_h
+
+#include <cstring>
+#include <cfloat>
+
+#include "PixelKernelSSE2.h"
+
+// log2(m) = 2/ln(2) * atanh(t) with t = (m - 1) / (m + 1), for m in [sqrt(1/2), sqrt(2))
+#define kFastPowLog2C1 2.8853900817779268f
+#define kFastPowLog2C3 0.9617966939259756f
+#define kFastPowLog2C5 0.5770780163555854f
+#define kFastPowLog2C7 0.41219858311113244f
+#define kFastPowLog2C9 0.32059889797532523f
+
+// 2^f = exp(f * ln(2)), for f in [-0.5, 0.5]
+#define kFastPowExp2C1 0.6931471805599453f
+#define kFastPowExp2C2 0.2402265069591007f
+#define kFastPowExp2C3 0.05550410866482158f
+#define kFastPowExp2C4 0.009618129107628477f
+#define kFastPowExp2C5 0.0013333558146428443f
+#define kFastPowExp2C6 0.00015403530393381606f
+#define kFastPowExp2C7 1.525273380405984e-05f
+
+// 1.5 * 2^23: adding and subtracting it rounds to the nearest integer
+#define kFastPowRound 12582912.f
+
+inline float
+fastLog2(float x)
+{
+    // same comparisons as _mm_max_ps and _mm_min_ps, for the same results on NaN
+    x = x > FLT_MIN ? x : FLT_MIN;
+    int i;
+    std::memcpy(&i, &x, sizeof(i));
+    // split x into 2^e * m, with m in [sqrt(1/2), sqrt(2))
+    i -= 0x3f3504f3; // sqrt(1/2)
+    const int e = i >> 23;
+    i = (i & 0x007fffff) + 0x3f3504f3;
+    float m;
+    std::memcpy(&m, &i, sizeof(m));
+    const float t = (m - 1.f) / (m + 1.f);
+    const float t2 = t * t;
+    return (float)e + t * (kFastPowLog2C1 + t2 * (kFastPowLog2C3 + t2 * (kFastPowLog2C5 + t2 * (kFastPowLog2C7 + t2 * kFastPowLog2C9))));
+}
+
+inline float
+fastExp2(float x)
+{
+    x = x > -126.f ? x : -126.f;
+    x = x < 127.99f ? x : 127.99f;
+    // 2^x = 2^n * 2^f, with n = x rounded, but at most 127 so that 2^n is a normal float.
+    // f is in [-0.5, 0.5], or [0.5, 0.99] above 127.5, where the polynomial is less accurate (1.3e-6).
+    float n = (x + kFastPowRound) - kFastPowRound;
+    n = n < 127.f ? n : 127.f;
+    const float f = x - n;
+    const float p = 1.f + f * (kFastPowExp2C1 + f * (kFastPowExp2C2 + f * (kFastPowExp2C3 + f * (kFastPowExp2C4 + f * (kFastPowExp2C5 + f * (kFastPowExp2C6 + f * kFastPowExp2C7))))));
+    // 2^n, n is in [-126, 127]
+    const int i = ((int)n + 127) << 23;
+    float scale;
+    std::memcpy(&scale, &i, sizeof(scale));
+    return p * scale;
+}
+
+inline float
+fastPow(float x, float y)
+{
+    const float r = fastExp2(y * fastLog2(x));
+    // NaN and +inf, with the same comparisons as fastPowSSE2
+    const float special = (y > 0.f || x != x) ? x : (y == 0.f ? 1.f : 0.f);
+    return x <= FLT_MAX ? r : special;
+}
+
+#if kPixelKernelSSE2
+inline __m128
+fastLog2SSE2(__m128 x)
+{
+    const __m128i sqrtHalf = _mm_set1_epi32(0x3f3504f3);
+    x = _mm_max_ps(x, _mm_set1_ps(FLT_MIN));
+    const __m128i i = _mm_sub_epi32(_mm_castps_si128(x), sqrtHalf);
+    const __m128 e = _mm_cvtepi32_ps(_mm_srai_epi32(i, 23));
+    const __m128 m = _mm_castsi128_ps(_mm_add_epi32(_mm_and_si128(i, _mm_set1_epi32(0x007fffff)), sqrtHalf));
+    const __m128 one = _mm_set1_ps(1.f);
+    const __m128 t = _mm_div_ps(_mm_sub_ps(m, one), _mm_add_ps(m, one));
+    const __m128 t2 = _mm_mul_ps(t, t);
+    __m128 p = _mm_add_ps(_mm_set1_ps(kFastPowLog2C7), _mm_mul_ps(t2, _mm_set1_ps(kFastPowLog2C9)));
+    p = _mm_add_ps(_mm_set1_ps(kFastPowLog2C5), _mm_mul_ps(t2, p));
+    p = _mm_add_ps(_mm_set1_ps(kFastPowLog2C3), _mm_mul_ps(t2, p));
+    p = _mm_add_ps(_mm_set1_ps(kFastPowLog2C1), _mm_mul_ps(t2, p));
+    return _mm_add_ps(e, _mm_mul_ps(t, p));
+}
+
+inline __m128
+fastExp2SSE2(__m128 x)
+{
+    x = _mm_max_ps(x, _mm_set1_ps(-126.f));
+    x = _mm_min_ps(x, _mm_set1_ps(127.99f));
+    const __m128 round = _mm_set1_ps(kFastPowRound);
+    const __m128 n = _mm_min_ps(_mm_sub_ps(_mm_add_ps(x, round), round), _mm_set1_ps(127.f));
+    const __m128 f = _mm_sub_ps(x, n);
+    __m128 p = _mm_add_ps(_mm_set1_ps(kFastPowExp2C6), _mm_mul_ps(f, _mm_set1_ps(kFastPowExp2C7)));
+    p = _mm_add_ps(_mm_set1_ps(kFastPowExp2C5), _mm_mul_ps(f, p));
+    p = _mm_add_ps(_mm_set1_ps(kFastPowExp2C4), _mm_mul_ps(f, p));
+    p = _mm_add_ps(_mm_set1_ps(kFastPowExp2C3), _mm_mul_ps(f, p));
+    p = _mm_add_ps(_mm_set1_ps(kFastPowExp2C2), _mm_mul_ps(f, p));
+    p = _mm_add_ps(_mm_set1_ps(kFastPowExp2C1), _mm_mul_ps(f, p));
+    p = _mm_add_ps(_mm_set1_ps(1.f), _mm_mul_ps(f, p));
+    const __m128i i = _mm_slli_epi32(_mm_add_epi32(_mm_cvttps_epi32(n), _mm_set1_epi32(127)), 23);
+    return _mm_mul_ps(p, _mm_castsi128_ps(i));
+}
+
+inline __m128
+fastPowSSE2(__m128 x, __m128 y)
+{
+    const __m128 r = fastExp2SSE2(_mm_mul_ps(y, fastLog2SSE2(x)));
+    // NaN and +inf
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 keep = _mm_or_ps(_mm_cmpgt_ps(y, zero), _mm_cmpunord_ps(x, x));
+    const __m128 special = pixelKernelSelectSSE2(keep, x, _mm_and_ps(_mm_cmpeq_ps(y, zero), _mm_set1_ps(1.f)));
+    return pixelKernelSelectSSE2(_mm_cmple_ps(x, _mm_set1_ps(FLT_MAX)), r, special);
+}
+#endif
+
+#endif // Misc_FastPow_h
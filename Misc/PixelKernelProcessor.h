@@ -0,0 +1,354 @@
+/*
+ OFX color plugins: shared per-pixel processor.
+
+ Copyright (C) 2014 INRIA
+
+ Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+
+ Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+
+ Redistributions in binary form must reproduce the above copyright notice, this
+ list of conditions and the following disclaimer in the documentation and/or
+ other materials provided with the distribution.
+
+ Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ INRIA
+ Domaine de Voluceau
+ Rocquencourt - B.P. 105
+ 78153 Le Chesnay Cedex - France
+ */
+
+/*
+ The color plugins (Gamma, Multiply, Add, Invert, ColorMatrix, Saturation, Grade...) all
+ share the same processing loop: unpremultiply the source pixel, apply a color function
+ to the selected channels, premultiply, then apply the mask and mix.
+
+ A plugin only has to write the color function, as a kernel class:
+
+ struct MyKernel : public PixelKernel<MyKernel>
+ {
+     // unpPix and tmpPix are RGBA (for Alpha images, the value is in unpPix[3]).
+     // tmpPix must be set for all four components (copy the channels that are not processed).
+     template<bool processR, bool processG, bool processB, bool processA>
+     void process(const float *unpPix, float *tmpPix) const;
+ };
+
+ and use PixelKernelProcessor<MyKernel, PIX, nComponents, maxValue> as its processor.
+
+ When the image is RGBA float, and there is no premultiplication, no mask and mix is 1,
+ the kernel is applied directly to the source rows, without any conversion. A kernel may
+ also define a vectorized version of the row function, with the same signature as
+ PixelKernel::processRow. It must give exactly the same bits as process(), which is
+ checked by tests/PixelKernelTest.cpp.
+ */
+
+#ifndef Misc_PixelKernelProcessor_h
+#define Misc_PixelKernelProcessor_h
+
+#include <algorithm>
+
+#include "ofxsProcessing.H"
+#include "ofxsMaskMix.h"
+#include "ofxsMacros.h"
+#include "PixelKernelSSE2.h"
+
+/// Base class for the kernels, giving the default row function.
+template <class Kernel>
+struct PixelKernel
+{
+    /// Apply the kernel to n RGBA float pixels. dstPix may be the same buffer as srcPix.
+    template<bool processR, bool processG, bool processB, bool processA>
+    void processRow(const float *srcPix, float *dstPix, int n) const
+    {
+        const Kernel &kernel = static_cast<const Kernel &>(*this);
+        float tmpPix[4];
+        for (int x = 0; x < n; ++x, srcPix += 4, dstPix += 4) {
+            kernel.template process<processR, processG, processB, processA>(srcPix, tmpPix);
+            dstPix[0] = tmpPix[0];
+            dstPix[1] = tmpPix[1];
+            dstPix[2] = tmpPix[2];
+            dstPix[3] = tmpPix[3];
+        }
+    }
+};
+
+template <class Kernel>
+class PixelKernelProcessorBase : public OFX::ImageProcessor
+{
+protected:
+    const OFX::Image *_srcImg;
+    const OFX::Image *_maskImg;
+    Kernel _kernel;
+    bool _processR;
+    bool _processG;
+    bool _processB;
+    bool _processA;
+    bool _copyUnprocessed;
+    bool _premult;
+    int _premultChannel;
+    bool _doMasking;
+    double _mix;
+    bool _maskInvert;
+
+public:
+    PixelKernelProcessorBase(OFX::ImageEffect &instance)
+    : OFX::ImageProcessor(instance)
+    , _srcImg(0)
+    , _maskImg(0)
+    , _kernel()
+    , _processR(true)
+    , _processG(true)
+    , _processB(true)
+    , _processA(false)
+    , _copyUnprocessed(true)
+    , _premult(false)
+    , _premultChannel(3)
+    , _doMasking(false)
+    , _mix(1.)
+    , _maskInvert(false)
+    {
+    }
+
+    void setSrcImg(const OFX::Image *v) {_srcImg = v;}
+
+    void setMaskImg(const OFX::Image *v, bool maskInvert) { _maskImg = v; _maskInvert = maskInvert; }
+
+    void doMasking(bool v) {_doMasking = v;}
+
+    void setKernel(const Kernel &kernel) {_kernel = kernel;}
+
+    /// If true (the default), the channels that are not processed are copied from the source
+    /// after the premult/mask/mix step. If false, they go through premult/mask/mix like the others.
+    void setCopyUnprocessed(bool v) {_copyUnprocessed = v;}
+
+    void setValues(bool processR,
+                   bool processG,
+                   bool processB,
+                   bool processA,
+                   bool premult,
+                   int premultChannel,
+                   double mix)
+    {
+        _processR = processR;
+        _processG = processG;
+        _processB = processB;
+        _processA = processA;
+        _premult = premult;
+        _premultChannel = premultChannel;
+        _mix = mix;
+    }
+};
+
+
+template <class Kernel, class PIX, int nComponents, int maxValue>
+class PixelKernelProcessor : public PixelKernelProcessorBase<Kernel>
+{
+    typedef PixelKernelProcessorBase<Kernel> Base;
+
+public:
+    PixelKernelProcessor(OFX::ImageEffect &instance)
+    : PixelKernelProcessorBase<Kernel>(instance)
+    {
+    }
+
+private:
+    virtual void multiThreadProcessImages(OfxRectI procWindow) OVERRIDE FINAL
+    {
+        const bool r = Base::_processR && (nComponents != 1);
+        const bool g = Base::_processG && (nComponents >= 2);
+        const bool b = Base::_processB && (nComponents >= 3);
+        const bool a = Base::_processA && (nComponents == 1 || nComponents == 4);
+        if (r) {
+            if (g) {
+                if (b) {
+                    if (a) {
+                        return process<true ,true ,true ,true >(procWindow); // RGBA
+                    } else {
+                        return process<true ,true ,true ,false>(procWindow); // RGBa
+                    }
+                } else {
+                    if (a) {
+                        return process<true ,true ,false,true >(procWindow); // RGbA
+                    } else {
+                        return process<true ,true ,false,false>(procWindow); // RGba
+                    }
+                }
+            } else {
+                if (b) {
+                    if (a) {
+                        return process<true ,false,true ,true >(procWindow); // RgBA
+                    } else {
+                        return process<true ,false,true ,false>(procWindow); // RgBa
+                    }
+                } else {
+                    if (a) {
+                        return process<true ,false,false,true >(procWindow); // RgbA
+                    } else {
+                        return process<true ,false,false,false>(procWindow); // Rgba
+                    }
+                }
+            }
+        } else {
+            if (g) {
+                if (b) {
+                    if (a) {
+                        return process<false,true ,true ,true >(procWindow); // rGBA
+                    } else {
+                        return process<false,true ,true ,false>(procWindow); // rGBa
+                    }
+                } else {
+                    if (a) {
+                        return process<false,true ,false,true >(procWindow); // rGbA
+                    } else {
+                        return process<false,true ,false,false>(procWindow); // rGba
+                    }
+                }
+            } else {
+                if (b) {
+                    if (a) {
+                        return process<false,false,true ,true >(procWindow); // rgBA
+                    } else {
+                        return process<false,false,true ,false>(procWindow); // rgBa
+                    }
+                } else {
+                    if (a) {
+                        return process<false,false,false,true >(procWindow); // rgbA
+                    } else {
+                        return process<false,false,false,false>(procWindow); // rgba
+                    }
+                }
+            }
+        }
+    }
+
+    template<bool processR, bool processG, bool processB, bool processA>
+    void process(const OfxRectI& procWindow)
+    {
+        assert(nComponents == 1 || nComponents == 3 || nComponents == 4);
+        assert(Base::_dstImg);
+        // the source rows are only valid inside the source bounds
+        OfxRectI srcBounds = { procWindow.x2, procWindow.y2, procWindow.x2, procWindow.y2 };
+        if (Base::_srcImg) {
+            srcBounds = Base::_srcImg->getBounds();
+        }
+        const int srcX1 = std::max(procWindow.x1, std::min(srcBounds.x1, procWindow.x2));
+        const int srcX2 = std::max(srcX1, std::min(srcBounds.x2, procWindow.x2));
+        // RGBA float without premult, mask and mix: the kernel rows can be applied directly to the source
+        const bool directRows = (nComponents == 4 && maxValue == 1 &&
+                                 !Base::_premult && !Base::_doMasking && Base::_mix == 1.);
+        // the mask rows are read like the source rows, the mask being a single component image
+        const bool maskRows = Base::_doMasking && Base::_maskImg;
+        OfxRectI maskBounds = { 0, 0, 0, 0 };
+        if (maskRows) {
+            maskBounds = Base::_maskImg->getBounds();
+        }
+
+        for (int y = procWindow.y1; y < procWindow.y2; y++) {
+            if (Base::_effect.abort()) {
+                break;
+            }
+
+            PIX *dstPix = (PIX *) Base::_dstImg->getPixelAddress(procWindow.x1, y);
+            const PIX *maskRow = 0;
+            if (maskRows && maskBounds.x1 < maskBounds.x2 && maskBounds.y1 <= y && y < maskBounds.y2) {
+                maskRow = (const PIX *) Base::_maskImg->getPixelAddress(maskBounds.x1, y);
+            }
+            const PIX *srcRow = 0;
+            if (Base::_srcImg && srcX1 < srcX2 && srcBounds.y1 <= y && y < srcBounds.y2) {
+                srcRow = (const PIX *) Base::_srcImg->getPixelAddress(srcX1, y);
+            }
+            if (!srcRow) {
+                for (int x = procWindow.x1; x < procWindow.x2; x++, dstPix += nComponents) {
+                    processPixel<processR, processG, processB, processA>(x, y, 0, maskPixel(maskRow, maskBounds, x), dstPix);
+                }
+                continue;
+            }
+            int x = procWindow.x1;
+            for (; x < srcX1; x++, dstPix += nComponents) {
+                processPixel<processR, processG, processB, processA>(x, y, 0, maskPixel(maskRow, maskBounds, x), dstPix);
+            }
+            if (directRows) {
+                Base::_kernel.template processRow<processR, processG, processB, processA>((const float *)srcRow, (float *)dstPix, srcX2 - srcX1);
+                dstPix += (srcX2 - srcX1) * nComponents;
+                x = srcX2;
+            } else {
+                for (const PIX *srcPix = srcRow; x < srcX2; x++, srcPix += nComponents, dstPix += nComponents) {
+                    processPixel<processR, processG, processB, processA>(x, y, srcPix, maskPixel(maskRow, maskBounds, x), dstPix);
+                }
+            }
+            for (; x < procWindow.x2; x++, dstPix += nComponents) {
+                processPixel<processR, processG, processB, processA>(x, y, 0, maskPixel(maskRow, maskBounds, x), dstPix);
+            }
+        }
+    }
+
+    // the mask pixel at x, or NULL if it is outside of the mask row
+    static const PIX *maskPixel(const PIX *maskRow, const OfxRectI& maskBounds, int x)
+    {
+        return (maskRow && maskBounds.x1 <= x && x < maskBounds.x2) ? maskRow + (x - maskBounds.x1) : 0;
+    }
+
+    template<bool processR, bool processG, bool processB, bool processA>
+    void processPixel(int x, int y, const PIX *srcPix, const PIX *maskPix, PIX *dstPix)
+    {
+        float unpPix[4];
+        float tmpPix[4];
+        ofxsUnPremult<PIX, nComponents, maxValue>(srcPix, unpPix, Base::_premult, Base::_premultChannel);
+        Base::_kernel.template process<processR, processG, processB, processA>(unpPix, tmpPix);
+        if (Base::_doMasking && Base::_maskImg) {
+            // same mask scale as ofxsMaskMixPix, from the mask row instead of getPixelAddress
+            float maskScale;
+            if (maskPix == 0) {
+                maskScale = Base::_maskInvert ? 1.f : 0.f;
+            } else {
+                maskScale = *maskPix / float(maxValue);
+                if (Base::_maskInvert) {
+                    maskScale = 1.f - maskScale;
+                }
+            }
+            ofxsPremultMaskMixPix<PIX, nComponents, maxValue, true>(tmpPix, Base::_premult, Base::_premultChannel, x, y, srcPix, false, 0, maskScale * (float)Base::_mix, false, dstPix);
+        } else {
+            ofxsPremultMaskMixPix<PIX, nComponents, maxValue, true>(tmpPix, Base::_premult, Base::_premultChannel, x, y, srcPix, Base::_doMasking, Base::_maskImg, (float)Base::_mix, Base::_maskInvert, dstPix);
+        }
+        if (!Base::_copyUnprocessed) {
+            return;
+        }
+        // copy back original values from unprocessed channels
+        if (nComponents == 1) {
+            if (!processA) {
+                dstPix[0] = srcPix ? srcPix[0] : PIX();
+            }
+        } else if (nComponents == 3 || nComponents == 4) {
+            if (!processR) {
+                dstPix[0] = srcPix ? srcPix[0] : PIX();
+            }
+            if (!processG) {
+                dstPix[1] = srcPix ? srcPix[1] : PIX();
+            }
+            if (!processB) {
+                dstPix[2] = srcPix ? srcPix[2] : PIX();
+            }
+            if (!processA && nComponents == 4) {
+                dstPix[3] = srcPix ? srcPix[3] : PIX();
+            }
+        }
+    }
+};
+
+#endif // Misc_PixelKernelProcessor_h
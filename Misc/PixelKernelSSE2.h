@@ -0,0 +1,71 @@
+/*
+ OFX color plugins: SSE2 configuration.
+
+ Copyright (C) 2014 INRIA
+
+ Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+
+ Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+
+ Redistributions in binary form must reproduce the above copyright notice, this
+ list of conditions and the following disclaimer in the documentation and/or
+ other materials provided with the distribution.
+
+ Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ INRIA
+ Domaine de Voluceau
+ Rocquencourt - B.P. 105
+ 78153 Le Chesnay Cedex - France
+ */
+
+/*
+ kPixelKernelSSE2 is 1 if the SSE2 versions of the kernels can be compiled, with a few helpers
+ shared by those versions. This header does not depend on the OFX headers, so that FastPow.h
+ can be used without them.
+ */
+
+#ifndef Misc_PixelKernelSSE2_h
+#define Misc_PixelKernelSSE2_h
+
+// SSE2 is part of the x86-64 baseline, and is enabled on 32-bit x86 by -msse2 or /arch:SSE2
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define kPixelKernelSSE2 1
+#include <emmintrin.h>
+#else
+#define kPixelKernelSSE2 0
+#endif
+
+#if kPixelKernelSSE2
+/// The lanes of the processed channels are all ones, the others are zero.
+template<bool processR, bool processG, bool processB, bool processA>
+inline __m128
+pixelKernelChannelMaskSSE2()
+{
+    return _mm_castsi128_ps(_mm_set_epi32(processA ? -1 : 0, processB ? -1 : 0, processG ? -1 : 0, processR ? -1 : 0));
+}
+
+/// a where mask is set, b elsewhere.
+inline __m128
+pixelKernelSelectSSE2(__m128 mask, __m128 a, __m128 b)
+{
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+#endif
+
+#endif // Misc_PixelKernelSSE2_h
@@ -8,6 +8,7 @@
 #include "ClipTest.h"
 #include "ColorCorrect.h"
 #include "ColorMatrix.h"
+#include "ColorStack.h"
 #include "ColorTransform.h"
 #include "Constant.h"
 #include "CopyRectangle.h"
@@ -70,6 +71,7 @@ namespace OFX
             getClipTestPluginID(ids);
             getColorCorrectPluginID(ids);
             getColorMatrixPluginID(ids);
+            getColorStackPluginID(ids);
             getColorTransformPluginIDs(ids);
             getConstantPluginID(ids);
             getCopyRectanglePluginID(ids);
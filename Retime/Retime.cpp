@@ -79,10 +79,7 @@
 /*
  TODO: this plugin has to be improved a lot
  - propose a "timewarp" curve (as ParametricParam)
- - selection of the integration filter (box or nearest) and shutter time
  - handle fielded input correctly
- 
- - retiming based on optical flow computation will be done separately
  */
 
 #include "Retime.h"
@@ -90,6 +87,12 @@
 #include <cmath> // for floor
 #include <cfloat> // for FLT_MAX
 #include <cassert>
+#include <cstring> // for memcpy
+#include <algorithm>
+#include <vector>
+#include <list>
+#include <memory>
+#include <new> // for std::bad_alloc
 
 #include "ofxsImageEffect.h"
 #include "ofxsMultiThread.h"
@@ -97,6 +100,7 @@
 #include "ofxsProcessing.H"
 #include "ofxsImageBlender.H"
 #include "ofxsCopier.h"
+#include "ofxsMerging.h"
 #include "ofxsMacros.h"
 
 #define kPluginName "RetimeOFX"
@@ -135,18 +139,41 @@
 #define kParamFilterOptionNearestHint "Pick input image with nearest integer time."
 #define kParamFilterOptionLinear "Linear"
 #define kParamFilterOptionLinearHint "Blend the two nearest images with linear interpolation."
-// TODO:
+#define kParamFilterOptionMotion "Motion"
+#define kParamFilterOptionMotionHint "Estimate the motion between the two nearest images (optical flow), warp both images to the output time and blend them. This avoids the ghosting of the Linear filter on moving objects, but may produce artifacts where objects are occluded or the motion is too complex. The motion is only estimated once for all the output frames between the same two images."
 #define kParamFilterOptionBox "Box"
-#define kParamFilterOptionBoxHint "Weighted average of images over the shutter time (shutter time is defined in the output sequence)." // requires shutter parameter
+#define kParamFilterOptionBoxHint "Weighted average of images over the shutter time (shutter time is defined in the output sequence)."
 
 enum FilterEnum {
     eFilterNone,
     eFilterNearest,
     eFilterLinear,
-    //eFilterBox,
+    eFilterMotion,
+    eFilterBox,
 };
 #define kParamFilterDefault eFilterLinear
 
+#define kRetimeFlowMaxPixels (2048*1152) // the flow is computed at a lower resolution for larger images
+#define kRetimeFlowMinSize 16 // minimum width and height of the coarsest level of the flow pyramid
+#define kRetimeFlowMaxLevels 8 // maximum number of levels of the flow pyramid
+#define kRetimeFlowIterations 3 // number of flow refinement iterations at each level
+#define kRetimeFlowWindowRadius 2 // radius of the Lucas-Kanade window
+#define kRetimeFlowRegularization 1e-3 // keeps the flow from the coarser level where there is no texture
+#define kRetimeFlowMaxStep 1. // maximum flow update per iteration, in pixels of the current level
+#define kRetimeFlowCacheSize 2 // number of flow fields kept by each instance
+#define kRetimeBoxFrameChunk 4 // how many frames the Box filter processes simultaneously
+#define kRetimeFrameCacheSize 8 // number of source images kept by each instance for the Box filter
+
+#define kParamShutter "shutter"
+#define kParamShutterLabel "Shutter"
+#define kParamShutterHint "Shutter time of the Box filter, in output frames, centered on the output frame. All the input frames covered by the shutter time are averaged, and the input frames at both ends are weighted by the fraction of the frame that is covered. With a shutter of 1, each input frame contributes to only one output frame, or is shared by two consecutive output frames."
+#define kParamShutterDefault 1.
+
+#define kParamReuseFrames "reuseFrames"
+#define kParamReuseFramesLabel "Reuse Frames"
+#define kParamReuseFramesHint "Keep a copy of the input images used by the Box filter, so that the images shared by consecutive output frames (e.g. when retiming faster than realtime) are only fetched once. The plugin does not know when the input frames change, so this should be unchecked while editing the nodes upstream."
+#define kParamReuseFramesDefault false
+
 #define kPageTimeWarp "timeWarp"
 #define kPageTimeWarpLabel "Time Warp"
 
@@ -157,6 +184,924 @@ enum FilterEnum {
 namespace OFX {
     extern ImageEffectHostDescription gHostDescription;
 }
+
+// bilinear sample of a single-channel float image of size width*height at pixel position (x,y), clamped to the image
+static inline float
+retimeFlowSample(const float *img, int width, int height, double x, double y)
+{
+    x = std::max(0., std::min(x, width - 1.));
+    y = std::max(0., std::min(y, height - 1.));
+    int x0 = std::min((int)x, std::max(0, width - 2));
+    int y0 = std::min((int)y, std::max(0, height - 2));
+    int x1 = std::min(x0 + 1, width - 1);
+    int y1 = std::min(y0 + 1, height - 1);
+    float tx = (float)(x - x0);
+    float ty = (float)(y - y0);
+    float a = img[(size_t)y0 * width + x0] + tx * (img[(size_t)y0 * width + x1] - img[(size_t)y0 * width + x0]);
+    float b = img[(size_t)y1 * width + x0] + tx * (img[(size_t)y1 * width + x1] - img[(size_t)y1 * width + x0]);
+
+    return a + ty * (b - a);
+}
+
+// The optical flow between two images, for the Motion filter.
+// It is computed on the luminance by a dense pyramidal Lucas-Kanade method: from the coarsest level of
+// the pyramid, the flow from the coarser level is refined by a few iterations which solve, at each pixel,
+// the brightness constancy equation in the least-squares sense over a small window. The equation at each
+// pixel of the window is linearized around the current flow of that pixel, which keeps the iterations stable.
+// Both the forward flow (from the first image to the second) and the backward flow are computed.
+class RetimeFlow
+{
+public:
+    /// bounds are the pixel bounds of the images, and the hashes identify their luminance
+    RetimeFlow(const OfxRectI &bounds, unsigned int fromHash, unsigned int toHash)
+    : _bounds(bounds)
+    , _fromHash(fromHash)
+    , _toHash(toHash)
+    , _scale(1)
+    , _width(0)
+    , _height(0)
+    , _forward()
+    , _backward()
+    {
+    }
+
+    bool matches(const OfxRectI &bounds, unsigned int fromHash, unsigned int toHash) const
+    {
+        return (_bounds.x1 == bounds.x1 && _bounds.y1 == bounds.y1 && _bounds.x2 == bounds.x2 && _bounds.y2 == bounds.y2 &&
+                _fromHash == fromHash && _toHash == toHash);
+    }
+
+    /// compute the flow from the luminance of the two images over the bounds (multi-threaded)
+    void build(const std::vector<float> &fromLum, const std::vector<float> &toLum)
+    {
+        std::vector<Level> levels(1);
+        levels[0].width = _bounds.x2 - _bounds.x1;
+        levels[0].height = _bounds.y2 - _bounds.y1;
+        levels[0].from = fromLum;
+        levels[0].to = toLum;
+        while ((size_t)levels[0].width * levels[0].height > kRetimeFlowMaxPixels) {
+            Level l;
+            downsample(levels[0], l);
+            std::swap(levels[0], l);
+            _scale *= 2;
+        }
+        while ((int)levels.size() < kRetimeFlowMaxLevels &&
+               levels.back().width / 2 >= kRetimeFlowMinSize && levels.back().height / 2 >= kRetimeFlowMinSize) {
+            levels.push_back(Level());
+            downsample(levels[levels.size() - 2], levels.back());
+        }
+        _width = levels[0].width;
+        _height = levels[0].height;
+        solve(levels, false, _forward);
+        solve(levels, true, _backward);
+    }
+
+    /// the forward (from the first image to the second) or backward flow at pixel (x,y), in pixels
+    void getFlow(bool backward, int x, int y, double *u, double *v) const
+    {
+        const std::vector<float> &flow = backward ? _backward : _forward;
+        double fx = (x - _bounds.x1 + 0.5) / _scale - 0.5;
+        double fy = (y - _bounds.y1 + 0.5) / _scale - 0.5;
+        if (_scale == 1 && x >= _bounds.x1 && x < _bounds.x2 && y >= _bounds.y1 && y < _bounds.y2) {
+            const float *f = &flow[((size_t)(y - _bounds.y1) * _width + (x - _bounds.x1)) * 2];
+            *u = f[0];
+            *v = f[1];
+
+            return;
+        }
+        fx = std::max(0., std::min(fx, _width - 1.));
+        fy = std::max(0., std::min(fy, _height - 1.));
+        int x0 = std::min((int)fx, std::max(0, _width - 2));
+        int y0 = std::min((int)fy, std::max(0, _height - 2));
+        int x1 = std::min(x0 + 1, _width - 1);
+        int y1 = std::min(y0 + 1, _height - 1);
+        double tx = fx - x0;
+        double ty = fy - y0;
+        for (int c = 0; c < 2; ++c) {
+            double a = flow[((size_t)y0 * _width + x0) * 2 + c] * (1. - tx) + flow[((size_t)y0 * _width + x1) * 2 + c] * tx;
+            double b = flow[((size_t)y1 * _width + x0) * 2 + c] * (1. - tx) + flow[((size_t)y1 * _width + x1) * 2 + c] * tx;
+            (c == 0 ? *u : *v) = (a * (1. - ty) + b * ty) * _scale;
+        }
+    }
+
+private:
+    struct Level
+    {
+        int width;
+        int height;
+        std::vector<float> from;
+        std::vector<float> to;
+    };
+
+    // average 2x2 blocks
+    static void downsample(const Level &src, Level &dst)
+    {
+        dst.width = (src.width + 1) / 2;
+        dst.height = (src.height + 1) / 2;
+        dst.from.resize((size_t)dst.width * dst.height);
+        dst.to.resize((size_t)dst.width * dst.height);
+        for (int y = 0; y < dst.height; ++y) {
+            int sy0 = 2 * y;
+            int sy1 = std::min(2 * y + 1, src.height - 1);
+            for (int x = 0; x < dst.width; ++x) {
+                int sx0 = 2 * x;
+                int sx1 = std::min(2 * x + 1, src.width - 1);
+                size_t i00 = (size_t)sy0 * src.width + sx0;
+                size_t i10 = (size_t)sy0 * src.width + sx1;
+                size_t i01 = (size_t)sy1 * src.width + sx0;
+                size_t i11 = (size_t)sy1 * src.width + sx1;
+                dst.from[(size_t)y * dst.width + x] = 0.25f * (src.from[i00] + src.from[i10] + src.from[i01] + src.from[i11]);
+                dst.to[(size_t)y * dst.width + x] = 0.25f * (src.to[i00] + src.to[i10] + src.to[i01] + src.to[i11]);
+            }
+        }
+    }
+
+    // compute the flow of the pyramid, from I0 to I1 (from the second image to the first if backward is true)
+    static void solve(const std::vector<Level> &levels, bool backward, std::vector<float> &flow)
+    {
+        for (int l = (int)levels.size() - 1; l >= 0; --l) {
+            const Level &level = levels[l];
+            std::vector<float> levelFlow((size_t)level.width * level.height * 2, 0.f);
+            if (l < (int)levels.size() - 1) {
+                // upsample the flow of the coarser level
+                const Level &coarse = levels[l + 1];
+                for (int y = 0; y < level.height; ++y) {
+                    for (int x = 0; x < level.width; ++x) {
+                        double cx = (x + 0.5) / 2 - 0.5;
+                        double cy = (y + 0.5) / 2 - 0.5;
+                        for (int c = 0; c < 2; ++c) {
+                            levelFlow[((size_t)y * level.width + x) * 2 + c] = 2.f * sampleFlow(flow, coarse.width, coarse.height, c, cx, cy);
+                        }
+                    }
+                }
+            }
+            LevelSolver solver(backward ? level.to : level.from, backward ? level.from : level.to, level.width, level.height, levelFlow);
+            solver.solve();
+            flow.swap(levelFlow);
+        }
+    }
+
+    static float sampleFlow(const std::vector<float> &flow, int width, int height, int c, double x, double y)
+    {
+        x = std::max(0., std::min(x, width - 1.));
+        y = std::max(0., std::min(y, height - 1.));
+        int x0 = std::min((int)x, std::max(0, width - 2));
+        int y0 = std::min((int)y, std::max(0, height - 2));
+        int x1 = std::min(x0 + 1, width - 1);
+        int y1 = std::min(y0 + 1, height - 1);
+        float tx = (float)(x - x0);
+        float ty = (float)(y - y0);
+        float a = flow[((size_t)y0 * width + x0) * 2 + c] * (1.f - tx) + flow[((size_t)y0 * width + x1) * 2 + c] * tx;
+        float b = flow[((size_t)y1 * width + x0) * 2 + c] * (1.f - tx) + flow[((size_t)y1 * width + x1) * 2 + c] * tx;
+
+        return a * (1.f - ty) + b * ty;
+    }
+
+    // the Lucas-Kanade iterations at one level of the pyramid.
+    // Each step processes bands of rows in parallel: the window sums are computed by a horizontal
+    // pass on each row, followed by a vertical pass.
+    class LevelSolver
+    {
+    public:
+        LevelSolver(const std::vector<float> &I0, const std::vector<float> &I1, int width, int height, std::vector<float> &flow)
+        : _I0(I0)
+        , _I1(I1)
+        , _width(width)
+        , _height(height)
+        , _flow(flow)
+        , _gradient((size_t)width * height * 2)
+        , _rows((size_t)width * height * 3)
+        , _tensor((size_t)width * height * 3)
+        , _rhs((size_t)width * height * 2)
+        {
+        }
+
+        void solve()
+        {
+            run(eStepGradient);
+            run(eStepTensor);
+            for (int i = 0; i < kRetimeFlowIterations; ++i) {
+                run(eStepResidual);
+                run(eStepRightHandSide);
+                run(eStepUpdate);
+            }
+        }
+
+    private:
+        enum StepEnum
+        {
+            eStepGradient, // gradient of I0, and horizontal sums of its products
+            eStepTensor, // vertical sums of the gradient products
+            eStepResidual, // horizontal sums of the linearized equations, using the difference between I1 warped by the flow and I0
+            eStepRightHandSide, // vertical sums of the above
+            eStepUpdate, // solve for the new flow
+        };
+
+        class Worker : public OFX::MultiThread::Processor
+        {
+        public:
+            Worker(LevelSolver &solver, StepEnum step) : _solver(solver), _step(step) {}
+
+            virtual void multiThreadFunction(unsigned int threadId, unsigned int nThreads)
+            {
+                // each thread processes a band of rows
+                int y1 = (int)(((long long)_solver._height * threadId) / nThreads);
+                int y2 = (int)(((long long)_solver._height * (threadId + 1)) / nThreads);
+                _solver.processRows(_step, y1, y2);
+            }
+
+        private:
+            LevelSolver &_solver;
+            StepEnum _step;
+        };
+
+        void run(StepEnum step)
+        {
+            Worker worker(*this, step);
+            worker.multiThread();
+        }
+
+        void processRows(StepEnum step, int y1, int y2)
+        {
+            std::vector<float> products((size_t)_width * 3);
+            for (int y = y1; y < y2; ++y) {
+                switch (step) {
+                    case eStepGradient: {
+                        const float *row = &_I0[(size_t)y * _width];
+                        const float *rowUp = &_I0[(size_t)std::max(y - 1, 0) * _width];
+                        const float *rowDown = &_I0[(size_t)std::min(y + 1, _height - 1) * _width];
+                        float *g = &_gradient[(size_t)y * _width * 2];
+                        for (int x = 0; x < _width; ++x) {
+                            float gx = 0.5f * (row[std::min(x + 1, _width - 1)] - row[std::max(x - 1, 0)]);
+                            float gy = 0.5f * (rowDown[x] - rowUp[x]);
+                            g[x * 2] = gx;
+                            g[x * 2 + 1] = gy;
+                            products[x * 3] = gx * gx;
+                            products[x * 3 + 1] = gx * gy;
+                            products[x * 3 + 2] = gy * gy;
+                        }
+                        sumRow(products, 3, &_rows[(size_t)y * _width * 3]);
+                        break;
+                    }
+                    case eStepTensor:
+                        sumColumn(_rows, 3, y, &_tensor[(size_t)y * _width * 3]);
+                        break;
+                    case eStepResidual: {
+                        const float *row = &_I0[(size_t)y * _width];
+                        const float *g = &_gradient[(size_t)y * _width * 2];
+                        const float *f = &_flow[(size_t)y * _width * 2];
+                        for (int x = 0; x < _width; ++x) {
+                            // gx*u + gy*v - it = gx*u' + gy*v' at this pixel, where (u',v') is the new flow
+                            float gx = g[x * 2];
+                            float gy = g[x * 2 + 1];
+                            float it = retimeFlowSample(&_I1[0], _width, _height, x + f[x * 2], y + f[x * 2 + 1]) - row[x];
+                            float e = gx * f[x * 2] + gy * f[x * 2 + 1] - it;
+                            products[x * 2] = gx * e;
+                            products[x * 2 + 1] = gy * e;
+                        }
+                        sumRow(products, 2, &_rows[(size_t)y * _width * 2]);
+                        break;
+                    }
+                    case eStepRightHandSide:
+                        sumColumn(_rows, 2, y, &_rhs[(size_t)y * _width * 2]);
+                        break;
+                    case eStepUpdate: {
+                        const float *t = &_tensor[(size_t)y * _width * 3];
+                        const float *b = &_rhs[(size_t)y * _width * 2];
+                        float *f = &_flow[(size_t)y * _width * 2];
+                        for (int x = 0; x < _width; ++x) {
+                            // the regularization pulls the solution towards the current flow
+                            double a11 = t[x * 3] + kRetimeFlowRegularization;
+                            double a12 = t[x * 3 + 1];
+                            double a22 = t[x * 3 + 2] + kRetimeFlowRegularization;
+                            double b1 = b[x * 2] + kRetimeFlowRegularization * f[x * 2];
+                            double b2 = b[x * 2 + 1] + kRetimeFlowRegularization * f[x * 2 + 1];
+                            double det = a11 * a22 - a12 * a12;
+                            double du = (a22 * b1 - a12 * b2) / det - f[x * 2];
+                            double dv = (a11 * b2 - a12 * b1) / det - f[x * 2 + 1];
+                            f[x * 2] += (float)std::max(-kRetimeFlowMaxStep, std::min(du, kRetimeFlowMaxStep));
+                            f[x * 2 + 1] += (float)std::max(-kRetimeFlowMaxStep, std::min(dv, kRetimeFlowMaxStep));
+                        }
+                        break;
+                    }
+                }
+            }
+        }
+
+        // sum of the nComponents values over the window, along the row
+        void sumRow(const std::vector<float> &products, int nComponents, float *dst) const
+        {
+            const int r = kRetimeFlowWindowRadius;
+            for (int x = 0; x < _width; ++x) {
+                for (int c = 0; c < nComponents; ++c) {
+                    float sum = 0.f;
+                    for (int i = std::max(x - r, 0); i <= std::min(x + r, _width - 1); ++i) {
+                        sum += products[i * nComponents + c];
+                    }
+                    dst[x * nComponents + c] = sum;
+                }
+            }
+        }
+
+        // sum of the nComponents values of the row sums over the window, along the column
+        void sumColumn(const std::vector<float> &rows, int nComponents, int y, float *dst) const
+        {
+            const int r = kRetimeFlowWindowRadius;
+            std::fill(dst, dst + (size_t)_width * nComponents, 0.f);
+            for (int j = std::max(y - r, 0); j <= std::min(y + r, _height - 1); ++j) {
+                const float *row = &rows[(size_t)j * _width * nComponents];
+                for (int i = 0; i < _width * nComponents; ++i) {
+                    dst[i] += row[i];
+                }
+            }
+        }
+
+        const std::vector<float> &_I0;
+        const std::vector<float> &_I1;
+        int _width;
+        int _height;
+        std::vector<float> &_flow; // u, v for each pixel
+        std::vector<float> _gradient; // gx, gy of I0 for each pixel
+        std::vector<float> _rows; // horizontal window sums
+        std::vector<float> _tensor; // window sums of gx*gx, gx*gy, gy*gy
+        std::vector<float> _rhs; // window sums of gx*e, gy*e (see eStepResidual)
+    };
+
+    OfxRectI _bounds;
+    unsigned int _fromHash;
+    unsigned int _toHash;
+    int _scale; // size of a flow pixel, in image pixels
+    int _width; // size of the flow
+    int _height;
+    std::vector<float> _forward; // u, v for each pixel
+    std::vector<float> _backward;
+};
+
+// computes the luminance of img over bounds (0 outside of the image), normalized to [0,1]
+typedef void (*RetimeLuminanceFunction)(const OFX::Image *img, const OfxRectI &bounds, std::vector<float> &lum);
+
+// A small cache of flow fields, shared by the renders of an instance.
+// When slowing down a clip, several output frames are interpolated between the same two images, and the
+// flow is only computed once. The flow is identified by a hash of the pixels of the images, so that
+// it is recomputed if the input changes.
+class RetimeFlowCache
+{
+public:
+    /// RAII access to a flow of the cache: the flow is not freed while a Handle holds it
+    class Handle
+    {
+    public:
+        Handle(RetimeFlowCache &cache,
+               const OfxRectI &bounds,
+               const OFX::Image *fromImg,
+               unsigned int fromHash,
+               const OFX::Image *toImg,
+               unsigned int toHash,
+               RetimeLuminanceFunction luminance)
+        : _cache(cache)
+        , _flow(0)
+        {
+            _flow = _cache.acquire(bounds, fromImg, fromHash, toImg, toHash, luminance);
+        }
+
+        ~Handle()
+        {
+            _cache.release(_flow);
+        }
+
+        /// the flow, or NULL if it could not be allocated
+        const RetimeFlow* get() const { return _flow; }
+
+    private:
+        Handle(const Handle&); // not implemented
+        Handle& operator=(const Handle&); // not implemented
+
+        RetimeFlowCache &_cache;
+        RetimeFlow *_flow;
+    };
+
+    RetimeFlowCache()
+    : _entries()
+    , _mutex()
+    {
+    }
+
+    ~RetimeFlowCache()
+    {
+        for (std::list<Entry>::iterator it = _entries.begin(); it != _entries.end(); ++it) {
+            assert(it->useCount == 0);
+            delete it->flow;
+        }
+    }
+
+    /// free all flows that are not currently used (e.g. when the host calls purgeCaches)
+    void purge()
+    {
+        OFX::MultiThread::AutoMutex lock(_mutex);
+        trimUnlocked(0);
+    }
+
+private:
+    struct Entry
+    {
+        RetimeFlow *flow;
+        int useCount;
+    };
+
+    RetimeFlowCache(const RetimeFlowCache&); // not implemented
+    RetimeFlowCache& operator=(const RetimeFlowCache&); // not implemented
+
+    RetimeFlow* acquire(const OfxRectI &bounds,
+                        const OFX::Image *fromImg,
+                        unsigned int fromHash,
+                        const OFX::Image *toImg,
+                        unsigned int toHash,
+                        RetimeLuminanceFunction luminance)
+    {
+        OFX::MultiThread::AutoMutex lock(_mutex);
+        for (std::list<Entry>::iterator it = _entries.begin(); it != _entries.end(); ++it) {
+            if (it->flow->matches(bounds, fromHash, toHash)) {
+                _entries.splice(_entries.begin(), _entries, it);
+                ++_entries.front().useCount;
+                return _entries.front().flow;
+            }
+        }
+        // the flow is computed while holding the lock, so that concurrent renders (e.g. tiles) do not compute the same flow
+        std::auto_ptr<RetimeFlow> flow(new RetimeFlow(bounds, fromHash, toHash));
+        try {
+            std::vector<float> fromLum;
+            std::vector<float> toLum;
+            luminance(fromImg, bounds, fromLum);
+            luminance(toImg, bounds, toLum);
+            flow->build(fromLum, toLum);
+        } catch (const std::bad_alloc&) {
+            // render without a flow
+            return 0;
+        }
+        Entry e;
+        e.flow = flow.release();
+        e.useCount = 1;
+        _entries.push_front(e);
+        trimUnlocked(kRetimeFlowCacheSize);
+
+        return e.flow;
+    }
+
+    void release(RetimeFlow *flow)
+    {
+        if (!flow) {
+            return;
+        }
+        OFX::MultiThread::AutoMutex lock(_mutex);
+        for (std::list<Entry>::iterator it = _entries.begin(); it != _entries.end(); ++it) {
+            if (it->flow == flow) {
+                assert(it->useCount > 0);
+                --it->useCount;
+                break;
+            }
+        }
+        trimUnlocked(kRetimeFlowCacheSize);
+    }
+
+    // free the least recently used flows that are not in use, until at most maxEntries remain (must be called with _mutex locked)
+    void trimUnlocked(size_t maxEntries)
+    {
+        std::list<Entry>::iterator it = _entries.end();
+        while (_entries.size() > maxEntries && it != _entries.begin()) {
+            --it;
+            if (it->useCount == 0) {
+                delete it->flow;
+                it = _entries.erase(it);
+            }
+        }
+    }
+
+    std::list<Entry> _entries; // most recently used first
+    OFX::MultiThread::Mutex _mutex;
+};
+
+// the luminance of img over bounds (0 outside of the image), normalized to [0,1]
+template <class PIX, int nComponents, int maxValue>
+static void
+retimeLuminance(const OFX::Image *img, const OfxRectI &bounds, std::vector<float> &lum)
+{
+    const int width = bounds.x2 - bounds.x1;
+    lum.resize((size_t)width * (bounds.y2 - bounds.y1));
+    for (int y = bounds.y1; y < bounds.y2; ++y) {
+        float *dst = &lum[(size_t)(y - bounds.y1) * width];
+        for (int x = bounds.x1; x < bounds.x2; ++x, ++dst) {
+            const PIX *pix = (const PIX *)img->getPixelAddress(x, y);
+            float l = 0.f;
+            if (pix) {
+                if (nComponents >= 3) {
+                    l = 0.2126f * pix[0] + 0.7152f * pix[1] + 0.0722f * pix[2];
+                } else if (nComponents == 2) {
+                    l = 0.5f * (pix[0] + pix[1]);
+                } else {
+                    l = pix[0];
+                }
+                l /= maxValue;
+                if (!(std::abs(l) <= FLT_MAX)) {
+                    // NaN or infinity
+                    l = 0.f;
+                }
+            }
+            *dst = l;
+        }
+    }
+}
+
+// a hash of the pixels of img over bounds, which must be inside the image bounds
+template <class PIX, int nComponents>
+static unsigned int
+retimeImageHash(const OFX::Image *img, const OfxRectI &bounds)
+{
+    const size_t rowBytes = (size_t)(bounds.x2 - bounds.x1) * nComponents * sizeof(PIX);
+    unsigned int hash = 2166136261u; // FNV-1a, on 32-bit words
+    for (int y = bounds.y1; y < bounds.y2; ++y) {
+        const unsigned char *row = (const unsigned char *)img->getPixelAddress(bounds.x1, y);
+        assert(row);
+        size_t i = 0;
+        for (; i + 4 <= rowBytes; i += 4) {
+            unsigned int word;
+            std::memcpy(&word, row + i, sizeof(word));
+            hash = (hash ^ word) * 16777619u;
+        }
+        for (; i < rowBytes; ++i) {
+            hash = (hash ^ row[i]) * 16777619u;
+        }
+    }
+
+    return hash;
+}
+
+class RetimeMotionProcessorBase : public OFX::ImageProcessor
+{
+protected:
+    const OFX::Image *_fromImg;
+    const OFX::Image *_toImg;
+    const RetimeFlow *_flow;
+    double _blend;
+
+public:
+    RetimeMotionProcessorBase(OFX::ImageEffect &instance)
+    : OFX::ImageProcessor(instance)
+    , _fromImg(0)
+    , _toImg(0)
+    , _flow(0)
+    , _blend(0.)
+    {
+    }
+
+    void setValues(const OFX::Image *fromImg, const OFX::Image *toImg, const RetimeFlow *flow, double blend)
+    {
+        _fromImg = fromImg;
+        _toImg = toImg;
+        _flow = flow;
+        _blend = blend;
+    }
+};
+
+// warp both images to the intermediate time along the flow, and blend them
+template <class PIX, int nComponents, int maxValue>
+class RetimeMotionProcessor : public RetimeMotionProcessorBase
+{
+public:
+    RetimeMotionProcessor(OFX::ImageEffect &instance)
+    : RetimeMotionProcessorBase(instance)
+    {
+    }
+
+private:
+    // bilinear sample at pixel position (x,y), clamped to the image bounds
+    static void sample(const OFX::Image *img, double x, double y, float *tmpPix)
+    {
+        const OfxRectI &bounds = img->getBounds();
+        x = std::max((double)bounds.x1, std::min(x, bounds.x2 - 1.));
+        y = std::max((double)bounds.y1, std::min(y, bounds.y2 - 1.));
+        int x0 = (int)std::floor(x);
+        int y0 = (int)std::floor(y);
+        int x1 = std::min(x0 + 1, bounds.x2 - 1);
+        int y1 = std::min(y0 + 1, bounds.y2 - 1);
+        float tx = (float)(x - x0);
+        float ty = (float)(y - y0);
+        const PIX *p00 = (const PIX *)img->getPixelAddress(x0, y0);
+        const PIX *p10 = (const PIX *)img->getPixelAddress(x1, y0);
+        const PIX *p01 = (const PIX *)img->getPixelAddress(x0, y1);
+        const PIX *p11 = (const PIX *)img->getPixelAddress(x1, y1);
+        for (int c = 0; c < nComponents; ++c) {
+            float a = p00[c] + tx * (p10[c] - (float)p00[c]);
+            float b = p01[c] + tx * (p11[c] - (float)p01[c]);
+            tmpPix[c] = a + ty * (b - a);
+        }
+    }
+
+    void multiThreadProcessImages(OfxRectI procWindow) OVERRIDE FINAL
+    {
+        assert(_fromImg && _toImg && _flow);
+        float fromPix[nComponents];
+        float toPix[nComponents];
+        const float t = (float)_blend;
+        for (int y = procWindow.y1; y < procWindow.y2; ++y) {
+            if (_effect.abort()) {
+                break;
+            }
+
+            PIX *dstPix = (PIX *) _dstImg->getPixelAddress(procWindow.x1, y);
+
+            for (int x = procWindow.x1; x < procWindow.x2; ++x) {
+                // a point at (x,y) at the intermediate time comes from (x,y) - t*forward in the first image,
+                // and goes to (x,y) - (1-t)*backward in the second image
+                double fu, fv, bu, bv;
+                _flow->getFlow(false, x, y, &fu, &fv);
+                _flow->getFlow(true, x, y, &bu, &bv);
+                sample(_fromImg, x - _blend * fu, y - _blend * fv, fromPix);
+                sample(_toImg, x - (1. - _blend) * bu, y - (1. - _blend) * bv, toPix);
+                for (int c = 0; c < nComponents; ++c) {
+                    float v = fromPix[c] + t * (toPix[c] - fromPix[c]);
+                    if (maxValue == 1) {
+                        dstPix[c] = (PIX)v;
+                    } else {
+                        dstPix[c] = (PIX)std::max(0.f, std::min(v + 0.5f, (float)maxValue));
+                    }
+                }
+                dstPix += nComponents;
+            }
+        }
+    }
+};
+
+// A copy of a source image, kept by the RetimeFrameCache
+struct RetimeFrame
+{
+    double time;
+    OfxPointD renderScale;
+    OFX::FieldEnum field;
+    OFX::BitDepthEnum bitDepth;
+    OFX::PixelComponentEnum components;
+    OfxRectI bounds;
+    int pixelBytes;
+    std::vector<unsigned char> data;
+
+    const void* getPixelAddress(int x, int y) const
+    {
+        if (x < bounds.x1 || x >= bounds.x2 || y < bounds.y1 || y >= bounds.y2) {
+            return 0;
+        }
+        return &data[(((size_t)(y - bounds.y1) * (bounds.x2 - bounds.x1)) + (x - bounds.x1)) * pixelBytes];
+    }
+};
+
+// The source images used by the last renders of the Box filter, so that the images shared by consecutive
+// output frames are only fetched once. The plugin does not know when the input images change, so this is optional.
+class RetimeFrameCache
+{
+public:
+    RetimeFrameCache()
+    : _entries()
+    , _mutex()
+    {
+    }
+
+    ~RetimeFrameCache()
+    {
+        for (std::list<Entry>::iterator it = _entries.begin(); it != _entries.end(); ++it) {
+            assert(it->useCount == 0);
+            delete it->frame;
+        }
+    }
+
+    /// get a frame that covers the window, or NULL. The frame must be released.
+    const RetimeFrame* acquire(double time,
+                               const OfxPointD &renderScale,
+                               OFX::FieldEnum field,
+                               OFX::BitDepthEnum bitDepth,
+                               OFX::PixelComponentEnum components,
+                               const OfxRectI &window)
+    {
+        OFX::MultiThread::AutoMutex lock(_mutex);
+        for (std::list<Entry>::iterator it = _entries.begin(); it != _entries.end(); ++it) {
+            const RetimeFrame &f = *it->frame;
+            if (f.time == time && f.renderScale.x == renderScale.x && f.renderScale.y == renderScale.y &&
+                f.field == field && f.bitDepth == bitDepth && f.components == components &&
+                f.bounds.x1 <= window.x1 && window.x2 <= f.bounds.x2 && f.bounds.y1 <= window.y1 && window.y2 <= f.bounds.y2) {
+                _entries.splice(_entries.begin(), _entries, it);
+                ++_entries.front().useCount;
+                return _entries.front().frame;
+            }
+        }
+        return 0;
+    }
+
+    /// add a copy of img, or return NULL if it could not be allocated. The frame must be released.
+    const RetimeFrame* insert(double time,
+                              const OfxPointD &renderScale,
+                              OFX::FieldEnum field,
+                              const OFX::Image &img,
+                              int pixelBytes)
+    {
+        std::auto_ptr<RetimeFrame> frame(new RetimeFrame);
+        frame->time = time;
+        frame->renderScale = renderScale;
+        frame->field = field;
+        frame->bitDepth = img.getPixelDepth();
+        frame->components = img.getPixelComponents();
+        frame->bounds = img.getBounds();
+        frame->pixelBytes = pixelBytes;
+        const size_t rowBytes = (size_t)(frame->bounds.x2 - frame->bounds.x1) * pixelBytes;
+        try {
+            frame->data.resize(rowBytes * (frame->bounds.y2 - frame->bounds.y1));
+        } catch (const std::bad_alloc&) {
+            return 0;
+        }
+        for (int y = frame->bounds.y1; y < frame->bounds.y2; ++y) {
+            std::memcpy(&frame->data[(size_t)(y - frame->bounds.y1) * rowBytes], img.getPixelAddress(frame->bounds.x1, y), rowBytes);
+        }
+
+        OFX::MultiThread::AutoMutex lock(_mutex);
+        Entry e;
+        e.frame = frame.release();
+        e.useCount = 1;
+        _entries.push_front(e);
+        trimUnlocked(kRetimeFrameCacheSize);
+
+        return e.frame;
+    }
+
+    void release(const RetimeFrame *frame)
+    {
+        if (!frame) {
+            return;
+        }
+        OFX::MultiThread::AutoMutex lock(_mutex);
+        for (std::list<Entry>::iterator it = _entries.begin(); it != _entries.end(); ++it) {
+            if (it->frame == frame) {
+                assert(it->useCount > 0);
+                --it->useCount;
+                break;
+            }
+        }
+        trimUnlocked(kRetimeFrameCacheSize);
+    }
+
+    /// free all frames that are not currently used (e.g. when the host calls purgeCaches)
+    void purge()
+    {
+        OFX::MultiThread::AutoMutex lock(_mutex);
+        trimUnlocked(0);
+    }
+
+private:
+    struct Entry
+    {
+        RetimeFrame *frame;
+        int useCount;
+    };
+
+    RetimeFrameCache(const RetimeFrameCache&); // not implemented
+    RetimeFrameCache& operator=(const RetimeFrameCache&); // not implemented
+
+    // free the least recently used frames that are not in use, until at most maxEntries remain (must be called with _mutex locked)
+    void trimUnlocked(size_t maxEntries)
+    {
+        std::list<Entry>::iterator it = _entries.end();
+        while (_entries.size() > maxEntries && it != _entries.begin()) {
+            --it;
+            if (it->useCount == 0) {
+                delete it->frame;
+                it = _entries.erase(it);
+            }
+        }
+    }
+
+    std::list<Entry> _entries; // most recently used first
+    OFX::MultiThread::Mutex _mutex;
+};
+
+// A source of the Box filter: either an image or a copy from the frame cache
+struct RetimeBoxSource
+{
+    const OFX::Image *img;
+    const RetimeFrame *frame;
+    float weight;
+
+    const void* getPixelAddress(int x, int y) const
+    {
+        return img ? img->getPixelAddress(x, y) : frame->getPixelAddress(x, y);
+    }
+};
+
+// Since the sources cannot be held in a std::auto_ptr, use a RAII class to always free them, even in case of exceptions.
+struct RetimeBoxSourcesHolder_RAII
+{
+    RetimeFrameCache &cache;
+    std::vector<RetimeBoxSource> sources;
+
+    RetimeBoxSourcesHolder_RAII(RetimeFrameCache &c)
+    : cache(c)
+    , sources()
+    {
+    }
+
+    ~RetimeBoxSourcesHolder_RAII()
+    {
+        for (unsigned int i = 0; i < sources.size(); ++i) {
+            delete sources[i].img;
+            cache.release(sources[i].frame);
+        }
+    }
+};
+
+class RetimeBoxProcessorBase : public OFX::ImageProcessor
+{
+protected:
+    std::vector<RetimeBoxSource> _sources;
+    float *_accumulatorData; // the weighted sum of the previous chunks over the render window, or NULL
+    OfxRectI _renderWindow;
+    bool _firstChunk;
+    bool _lastChunk;
+
+public:
+    RetimeBoxProcessorBase(OFX::ImageEffect &instance)
+    : OFX::ImageProcessor(instance)
+    , _sources()
+    , _accumulatorData(0)
+    , _firstChunk(true)
+    , _lastChunk(true)
+    {
+        _renderWindow.x1 = _renderWindow.y1 = _renderWindow.x2 = _renderWindow.y2 = 0;
+    }
+
+    void setValues(const std::vector<RetimeBoxSource> &sources,
+                   float *accumulatorData,
+                   const OfxRectI &renderWindow,
+                   bool firstChunk,
+                   bool lastChunk)
+    {
+        _sources = sources;
+        _accumulatorData = accumulatorData;
+        _renderWindow = renderWindow;
+        _firstChunk = firstChunk;
+        _lastChunk = lastChunk;
+    }
+};
+
+// weighted sum of the source images, processed by chunks of frames
+template <class PIX, int nComponents, int maxValue>
+class RetimeBoxProcessor : public RetimeBoxProcessorBase
+{
+public:
+    RetimeBoxProcessor(OFX::ImageEffect &instance)
+    : RetimeBoxProcessorBase(instance)
+    {
+    }
+
+private:
+    void multiThreadProcessImages(OfxRectI procWindow) OVERRIDE FINAL
+    {
+        assert(_firstChunk || _accumulatorData);
+        assert(_lastChunk || _accumulatorData);
+        float tmpPix[nComponents];
+        for (int y = procWindow.y1; y < procWindow.y2; ++y) {
+            if (_effect.abort()) {
+                break;
+            }
+
+            PIX *dstPix = _lastChunk ? (PIX *) _dstImg->getPixelAddress(procWindow.x1, y) : 0;
+
+            for (int x = procWindow.x1; x < procWindow.x2; ++x) {
+                float *accPix = _accumulatorData ? &_accumulatorData[((size_t)(y - _renderWindow.y1) * (_renderWindow.x2 - _renderWindow.x1) + (x - _renderWindow.x1)) * nComponents] : 0;
+                if (_firstChunk) {
+                    std::fill(tmpPix, tmpPix + nComponents, 0.f);
+                } else {
+                    std::copy(accPix, accPix + nComponents, tmpPix);
+                }
+                for (unsigned i = 0; i < _sources.size(); ++i) {
+                    const PIX *srcPix = (const PIX *) _sources[i].getPixelAddress(x, y);
+                    if (srcPix) {
+                        const float w = _sources[i].weight;
+                        for (int c = 0; c < nComponents; ++c) {
+                            tmpPix[c] += w * srcPix[c];
+                        }
+                    }
+                }
+                if (!_lastChunk) {
+                    std::copy(tmpPix, tmpPix + nComponents, accPix);
+                } else if (dstPix) {
+                    for (int c = 0; c < nComponents; ++c) {
+                        if (maxValue == 1) {
+                            dstPix[c] = (PIX)tmpPix[c];
+                        } else {
+                            dstPix[c] = (PIX)std::max(0.f, std::min(tmpPix[c] + 0.5f, (float)maxValue));
+                        }
+                    }
+                    dstPix += nComponents;
+                }
+            }
+        }
+    }
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 /** @brief The plugin that does our work */
 class RetimePlugin : public OFX::ImageEffect
@@ -172,6 +1117,10 @@ protected:
     OFX::ParametricParam  *_warp;      /**< @brief only used in the filter or general context. */
     OFX::DoubleParam  *_duration;   /**< @brief how long the output should be as a proportion of input. General context only. */
     OFX::ChoiceParam  *_filter;   /**< @brief how images are interpolated (or not). */
+    OFX::DoubleParam  *_shutter;  /**< @brief shutter time of the Box filter. */
+    OFX::BooleanParam  *_reuseFrames; /**< @brief keep the images used by the Box filter. */
+    RetimeFlowCache _flowCache;   /**< @brief the flows computed by the Motion filter. */
+    RetimeFrameCache _frameCache; /**< @brief the images used by the Box filter. */
 
 public:
     /** @brief ctor */
@@ -185,6 +1134,10 @@ public:
     , _warp(0)
     , _duration(0)
     , _filter(0)
+    , _shutter(0)
+    , _reuseFrames(0)
+    , _flowCache()
+    , _frameCache()
     {
         _dstClip = fetchClip(kOfxImageEffectOutputClipName);
         _srcClip = fetchClip(kOfxImageEffectSimpleSourceClipName);
@@ -209,7 +1162,14 @@ public:
             }
         }
         _filter = fetchChoiceParam(kParamFilter);
-        assert(_filter);
+        _shutter = fetchDoubleParam(kParamShutter);
+        _reuseFrames = fetchBooleanParam(kParamReuseFrames);
+        assert(_filter && _shutter && _reuseFrames);
+
+        int filter_i;
+        _filter->getValue(filter_i);
+        _shutter->setEnabled((FilterEnum)filter_i == eFilterBox);
+        _reuseFrames->setEnabled((FilterEnum)filter_i == eFilterBox);
     }
 
     /* Override the render */
@@ -226,8 +1186,40 @@ public:
     /* override the time domain action, only for the general context */
     virtual bool getTimeDomain(OfxRangeD &range) OVERRIDE FINAL;
 
+    /** Override the get regions of interest action: the Motion filter needs the whole images */
+    virtual void getRegionsOfInterest(const OFX::RegionsOfInterestArguments &args, OFX::RegionOfInterestSetter &rois) OVERRIDE FINAL;
+
+    /** @brief free the flows kept for the Motion filter and the images kept for the Box filter */
+    virtual void purgeCaches(void) OVERRIDE FINAL
+    {
+        _flowCache.purge();
+        _frameCache.purge();
+    }
+
+    virtual void changedParam(const OFX::InstanceChangedArgs &args, const std::string &paramName) OVERRIDE FINAL;
+
+    virtual void changedClip(const OFX::InstanceChangedArgs &args, const std::string &clipName) OVERRIDE FINAL;
+
     /* set up and run a processor */
     void setupAndProcess(OFX::ImageBlenderBase &, const OFX::RenderArguments &args, double sourceTime, FilterEnum filter);
+
+    /* set up and run the processor of the Motion filter */
+    template <class PIX, int nComponents, int maxValue>
+    void setupAndProcessMotion(const OFX::RenderArguments &args, double sourceTime);
+
+    /* set up and run the processor of the Box filter */
+    template <class PIX, int nComponents, int maxValue>
+    void setupAndProcessBox(const OFX::RenderArguments &args);
+
+private:
+    /* the source time for the given output time */
+    double getSourceTime(double time);
+
+    /* the input frames averaged by the Box filter for the given output time, in increasing order, and their weights */
+    void getBoxFrames(double time, std::vector<double> *frameTimes, std::vector<float> *weights);
+
+    /* fetch a source image and check its properties */
+    OFX::Image* fetchSourceImage(double t, const OFX::RenderArguments &args, OFX::BitDepthEnum dstBitDepth, OFX::PixelComponentEnum dstComponents);
 };
 
 
@@ -252,6 +1244,76 @@ checkComponents(const OFX::Image &src,
     }
 }
 
+double
+RetimePlugin::getSourceTime(double time)
+{
+    double sourceTime;
+    if (getContext() == OFX::eContextRetimer) {
+        // the host is specifying it, so fetch it from the kOfxImageEffectRetimerParamName pseudo-param
+        sourceTime = _sourceTime->getValueAtTime(time);
+    } else {
+        bool reverse_input;
+        OfxRangeD srcRange = _srcClip->getFrameRange();
+        _reverse_input->getValueAtTime(time, reverse_input);
+        // we have our own param, which is a speed, so we integrate it to get the time we want
+        if (reverse_input) {
+            sourceTime = srcRange.max - _speed->integrate(srcRange.min, time);
+        } else {
+            sourceTime = srcRange.min + _speed->integrate(srcRange.min, time);
+        }
+        if (_warp) {
+            double r = srcRange.max - srcRange.min;
+            if (r != 0.) {
+                sourceTime = srcRange.min + r * _warp->getValue(0, time, (sourceTime-srcRange.min)/r);
+            }
+        }
+    }
+    return sourceTime;
+}
+
+void
+RetimePlugin::getBoxFrames(double time,
+                           std::vector<double> *frameTimes,
+                           std::vector<float> *weights)
+{
+    frameTimes->clear();
+    weights->clear();
+    double shutter;
+    _shutter->getValueAtTime(time, shutter);
+    // the source interval covered by the shutter (the source time may go backwards)
+    double lo = getSourceTime(time - shutter / 2);
+    double hi = getSourceTime(time + shutter / 2);
+    if (hi < lo) {
+        std::swap(lo, hi);
+    }
+    if (_srcClip && _srcClip->isConnected()) {
+        // only use frames from the source frame range
+        OfxRangeD srcRange = _srcClip->getFrameRange();
+        lo = std::max(srcRange.min, std::min(lo, srcRange.max));
+        hi = std::max(srcRange.min, std::min(hi, srcRange.max));
+    }
+    if (hi - lo <= 0.) {
+        // no shutter, the source time does not change, or the shutter is outside of the source range: pick the nearest frame
+        frameTimes->push_back(std::floor(lo + 0.5));
+        weights->push_back(1.f);
+
+        return;
+    }
+    // input frame f covers the interval [f-0.5,f+0.5], and its weight is the part of that interval covered by the shutter
+    for (double f = std::floor(lo + 0.5); f - 0.5 < hi; f += 1.) {
+        double w = (std::min(hi, f + 0.5) - std::max(lo, f - 0.5)) / (hi - lo);
+        if (w > 0.) {
+            frameTimes->push_back(f);
+            weights->push_back((float)w);
+        }
+    }
+    if (frameTimes->empty()) {
+        // may only happen because of rounding errors
+        frameTimes->push_back(std::floor((lo + hi) / 2 + 0.5));
+        weights->push_back(1.f);
+    }
+}
+
 static void framesNeeded(double sourceTime, OFX::FieldEnum fieldToRender, double *fromTimep, double *toTimep, double *blendp)
 {
     // figure the two images we are blending between
@@ -337,30 +1399,8 @@ RetimePlugin::setupAndProcess(OFX::ImageBlenderBase &processor,
     framesNeeded(sourceTime, args.fieldToRender, &fromTime, &toTime, &blend);
 
     // fetch the two source images
-    std::auto_ptr<OFX::Image> fromImg((_srcClip && _srcClip->isConnected()) ?
-                                      _srcClip->fetchImage(fromTime) : 0);
-    std::auto_ptr<OFX::Image> toImg((_srcClip && _srcClip->isConnected()) ?
-                                    _srcClip->fetchImage(toTime) : 0);
-
-    // make sure bit depths are sane
-    if (fromImg.get()) {
-        if (fromImg->getRenderScale().x != args.renderScale.x ||
-            fromImg->getRenderScale().y != args.renderScale.y ||
-            (fromImg->getField() != OFX::eFieldNone /* for DaVinci Resolve */ && fromImg->getField() != args.fieldToRender)) {
-            setPersistentMessage(OFX::Message::eMessageError, "", "OFX Host gave image with wrong scale or field properties");
-            OFX::throwSuiteStatusException(kOfxStatFailed);
-        }
-        checkComponents(*fromImg, dstBitDepth, dstComponents);
-    }
-    if (toImg.get()) {
-        if (toImg->getRenderScale().x != args.renderScale.x ||
-            toImg->getRenderScale().y != args.renderScale.y ||
-            (toImg->getField() != OFX::eFieldNone /* for DaVinci Resolve */ && toImg->getField() != args.fieldToRender)) {
-            setPersistentMessage(OFX::Message::eMessageError, "", "OFX Host gave image with wrong scale or field properties");
-            OFX::throwSuiteStatusException(kOfxStatFailed);
-        }
-        checkComponents(*toImg, dstBitDepth, dstComponents);
-    }
+    std::auto_ptr<OFX::Image> fromImg(fetchSourceImage(fromTime, args, dstBitDepth, dstComponents));
+    std::auto_ptr<OFX::Image> toImg(fetchSourceImage(toTime, args, dstBitDepth, dstComponents));
 
     // set the images
     processor.setDstImg(dst.get());
@@ -377,44 +1417,207 @@ RetimePlugin::setupAndProcess(OFX::ImageBlenderBase &processor,
     processor.process();
 }
 
+OFX::Image*
+RetimePlugin::fetchSourceImage(double t,
+                               const OFX::RenderArguments &args,
+                               OFX::BitDepthEnum dstBitDepth,
+                               OFX::PixelComponentEnum dstComponents)
+{
+    std::auto_ptr<OFX::Image> img((_srcClip && _srcClip->isConnected()) ?
+                                  _srcClip->fetchImage(t) : 0);
+
+    // make sure bit depths are sane
+    if (img.get()) {
+        if (img->getRenderScale().x != args.renderScale.x ||
+            img->getRenderScale().y != args.renderScale.y ||
+            (img->getField() != OFX::eFieldNone /* for DaVinci Resolve */ && img->getField() != args.fieldToRender)) {
+            setPersistentMessage(OFX::Message::eMessageError, "", "OFX Host gave image with wrong scale or field properties");
+            OFX::throwSuiteStatusException(kOfxStatFailed);
+        }
+        checkComponents(*img, dstBitDepth, dstComponents);
+    }
+    return img.release();
+}
+
+/* set up and run the processor of the Motion filter */
+template <class PIX, int nComponents, int maxValue>
 void
-RetimePlugin::getFramesNeeded(const OFX::FramesNeededArguments &args,
-                               OFX::FramesNeededSetter &frames)
+RetimePlugin::setupAndProcessMotion(const OFX::RenderArguments &args,
+                                    double sourceTime)
 {
     const double time = args.time;
-    double sourceTime;
-    if (getContext() == OFX::eContextRetimer) {
-        // the host is specifying it, so fetch it from the kOfxImageEffectRetimerParamName pseudo-param
-        sourceTime = _sourceTime->getValueAtTime(time);
-    } else {
-        bool reverse_input;
-        OfxRangeD srcRange = _srcClip->getFrameRange();
-        _reverse_input->getValueAtTime(time, reverse_input);
-        // we have our own param, which is a speed, so we integrate it to get the time we want
-        if (reverse_input) {
-            sourceTime = srcRange.max - _speed->integrate(srcRange.min, time);
-        } else {
-            sourceTime = srcRange.min + _speed->integrate(srcRange.min, time);
-        }
-        if (_warp) {
-            double r = srcRange.max - srcRange.min;
-            if (r != 0.) {
-                sourceTime = srcRange.min + r * _warp->getValue(0, time, (sourceTime-srcRange.min)/r);
+    // get a dst image
+    std::auto_ptr<OFX::Image>  dst(_dstClip->fetchImage(time));
+    if (!dst.get()) {
+        OFX::throwSuiteStatusException(kOfxStatFailed);
+    }
+    OFX::BitDepthEnum         dstBitDepth    = dst->getPixelDepth();
+    OFX::PixelComponentEnum   dstComponents  = dst->getPixelComponents();
+    if (dstBitDepth != _dstClip->getPixelDepth() ||
+        dstComponents != _dstClip->getPixelComponents()) {
+        setPersistentMessage(OFX::Message::eMessageError, "", "OFX Host gave image with wrong depth or components");
+        OFX::throwSuiteStatusException(kOfxStatFailed);
+    }
+    if (dst->getRenderScale().x != args.renderScale.x ||
+        dst->getRenderScale().y != args.renderScale.y ||
+        (dst->getField() != OFX::eFieldNone /* for DaVinci Resolve */ && dst->getField() != args.fieldToRender)) {
+        setPersistentMessage(OFX::Message::eMessageError, "", "OFX Host gave image with wrong scale or field properties");
+        OFX::throwSuiteStatusException(kOfxStatFailed);
+    }
+
+    // figure the two images we are blending between
+    double fromTime, toTime;
+    double blend;
+    framesNeeded(sourceTime, args.fieldToRender, &fromTime, &toTime, &blend);
+
+    // fetch the two source images
+    std::auto_ptr<OFX::Image> fromImg(fetchSourceImage(fromTime, args, dstBitDepth, dstComponents));
+    std::auto_ptr<OFX::Image> toImg(fetchSourceImage(toTime, args, dstBitDepth, dstComponents));
+
+    // the flow is computed on the part of the images that is available in both
+    OfxRectI bounds = {0, 0, 0, 0};
+    if (fromImg.get() && toImg.get()) {
+        OFX::MergeImages2D::rectIntersection(fromImg->getBounds(), toImg->getBounds(), &bounds);
+    }
+    std::auto_ptr<RetimeFlowCache::Handle> flow;
+    if (bounds.x1 < bounds.x2 && bounds.y1 < bounds.y2) {
+        flow.reset(new RetimeFlowCache::Handle(_flowCache, bounds,
+                                               fromImg.get(), retimeImageHash<PIX, nComponents>(fromImg.get(), bounds),
+                                               toImg.get(), retimeImageHash<PIX, nComponents>(toImg.get(), bounds),
+                                               &retimeLuminance<PIX, nComponents, maxValue>));
+    }
+    if (!flow.get() || !flow->get()) {
+        // no flow: blend linearly
+        OFX::ImageBlender<PIX, nComponents> processor(*this);
+        processor.setDstImg(dst.get());
+        processor.setFromImg(fromImg.get());
+        processor.setToImg(toImg.get());
+        processor.setRenderWindow(args.renderWindow);
+        processor.setBlend((float)blend);
+        processor.process();
+
+        return;
+    }
+
+    RetimeMotionProcessor<PIX, nComponents, maxValue> processor(*this);
+    processor.setDstImg(dst.get());
+    processor.setRenderWindow(args.renderWindow);
+    processor.setValues(fromImg.get(), toImg.get(), flow->get(), blend);
+
+    // Call the base class process member, this will call the derived templated process code
+    processor.process();
+}
+
+/* set up and run the processor of the Box filter */
+template <class PIX, int nComponents, int maxValue>
+void
+RetimePlugin::setupAndProcessBox(const OFX::RenderArguments &args)
+{
+    const double time = args.time;
+    // get a dst image
+    std::auto_ptr<OFX::Image>  dst(_dstClip->fetchImage(time));
+    if (!dst.get()) {
+        OFX::throwSuiteStatusException(kOfxStatFailed);
+    }
+    OFX::BitDepthEnum         dstBitDepth    = dst->getPixelDepth();
+    OFX::PixelComponentEnum   dstComponents  = dst->getPixelComponents();
+    if (dstBitDepth != _dstClip->getPixelDepth() ||
+        dstComponents != _dstClip->getPixelComponents()) {
+        setPersistentMessage(OFX::Message::eMessageError, "", "OFX Host gave image with wrong depth or components");
+        OFX::throwSuiteStatusException(kOfxStatFailed);
+    }
+    if (dst->getRenderScale().x != args.renderScale.x ||
+        dst->getRenderScale().y != args.renderScale.y ||
+        (dst->getField() != OFX::eFieldNone /* for DaVinci Resolve */ && dst->getField() != args.fieldToRender)) {
+        setPersistentMessage(OFX::Message::eMessageError, "", "OFX Host gave image with wrong scale or field properties");
+        OFX::throwSuiteStatusException(kOfxStatFailed);
+    }
+
+    std::vector<double> frameTimes;
+    std::vector<float> weights;
+    getBoxFrames(time, &frameTimes, &weights);
+    const int nFrames = (int)frameTimes.size();
+    bool reuseFrames;
+    _reuseFrames->getValueAtTime(time, reuseFrames);
+
+    const OfxRectI &renderWindow = args.renderWindow;
+    const size_t nPixels = (size_t)(renderWindow.x2 - renderWindow.x1) * (renderWindow.y2 - renderWindow.y1);
+
+    // the frames are processed by chunks, to avoid holding too many images at once
+    std::auto_ptr<OFX::ImageMemory> accumulator;
+    float *accumulatorData = NULL;
+    if (nFrames > kRetimeBoxFrameChunk) {
+        accumulator.reset(new OFX::ImageMemory(nPixels * nComponents * sizeof(float), this));
+        accumulatorData = (float*)accumulator->lock();
+    }
+
+    RetimeBoxProcessor<PIX, nComponents, maxValue> processor(*this);
+    for (int imin = 0; imin < nFrames; imin += kRetimeBoxFrameChunk) {
+        const int imax = std::min(imin + kRetimeBoxFrameChunk, nFrames);
+
+        // fetch the source images, or get them from the frame cache
+        RetimeBoxSourcesHolder_RAII srcs(_frameCache);
+        for (int i = imin; i < imax; ++i) {
+            if (abort()) {
+                OFX::throwSuiteStatusException(kOfxStatFailed);
+            }
+            RetimeBoxSource src;
+            src.img = 0;
+            src.frame = 0;
+            src.weight = weights[i];
+            if (reuseFrames) {
+                src.frame = _frameCache.acquire(frameTimes[i], args.renderScale, args.fieldToRender, dstBitDepth, dstComponents, renderWindow);
+            }
+            if (!src.frame) {
+                std::auto_ptr<OFX::Image> img(fetchSourceImage(frameTimes[i], args, dstBitDepth, dstComponents));
+                if (!img.get()) {
+                    // a missing image contributes black and transparent pixels
+                    continue;
+                }
+                if (reuseFrames) {
+                    src.frame = _frameCache.insert(frameTimes[i], args.renderScale, args.fieldToRender, *img, (int)(nComponents * sizeof(PIX)));
+                }
+                if (!src.frame) {
+                    src.img = img.release();
+                }
             }
+            srcs.sources.push_back(src);
         }
+
+        const bool lastChunk = (imax == nFrames);
+        processor.setDstImg(lastChunk ? dst.get() : 0);
+        processor.setRenderWindow(renderWindow);
+        processor.setValues(srcs.sources, accumulatorData, renderWindow, imin == 0, lastChunk);
+
+        // Call the base class process member, this will call the derived templated process code
+        processor.process();
     }
+}
+
+void
+RetimePlugin::getFramesNeeded(const OFX::FramesNeededArguments &args,
+                               OFX::FramesNeededSetter &frames)
+{
+    const double time = args.time;
+    double sourceTime = getSourceTime(time);
 
     int filter_i;
     _filter->getValueAtTime(time, filter_i);
     FilterEnum filter = (FilterEnum)filter_i;
 
     OfxRangeD range;
-    if (sourceTime == (int)sourceTime || filter == eFilterNone) {
+    if (filter == eFilterBox) {
+        std::vector<double> frameTimes;
+        std::vector<float> weights;
+        getBoxFrames(time, &frameTimes, &weights);
+        range.min = frameTimes.front();
+        range.max = frameTimes.back();
+    } else if (sourceTime == (int)sourceTime || filter == eFilterNone) {
         range.min = sourceTime;
         range.max = sourceTime;
     } else if (filter == eFilterNearest) {
         range.min = range.max = std::floor(sourceTime + 0.5);
-    } else if (filter == eFilterLinear) {
+    } else if (filter == eFilterLinear || filter == eFilterMotion) {
         // figure the two images we are blending between
         double fromTime, toTime;
         double blend;
@@ -432,31 +1635,22 @@ bool
 RetimePlugin::isIdentity(const OFX::IsIdentityArguments &args, OFX::Clip * &identityClip, double &identityTime)
 {
     const double time = args.time;
-    double sourceTime;
-    if (getContext() == OFX::eContextRetimer) {
-        // the host is specifying it, so fetch it from the kOfxImageEffectRetimerParamName pseudo-param
-        sourceTime = _sourceTime->getValueAtTime(time);
-    } else {
-        bool reverse_input;
-        OfxRangeD srcRange = _srcClip->getFrameRange();
-        _reverse_input->getValueAtTime(time, reverse_input);
-        // we have our own param, which is a speed, so we integrate it to get the time we want
-        if (reverse_input) {
-            sourceTime = srcRange.max - _speed->integrate(srcRange.min, time);
-        } else {
-            sourceTime = srcRange.min + _speed->integrate(srcRange.min, time);
-        }
-        if (_warp) {
-            double r = srcRange.max - srcRange.min;
-            if (r != 0.) {
-                sourceTime = srcRange.min + r * _warp->getValue(0, time, (sourceTime-srcRange.min)/r);
-            }
-        }
-    }
+    double sourceTime = getSourceTime(time);
     int filter_i;
     _filter->getValueAtTime(time, filter_i);
     FilterEnum filter = (FilterEnum)filter_i;
 
+    if (filter == eFilterBox) {
+        std::vector<double> frameTimes;
+        std::vector<float> weights;
+        getBoxFrames(time, &frameTimes, &weights);
+        if (frameTimes.size() == 1) {
+            identityClip = _srcClip;
+            identityTime = frameTimes[0];
+            return true;
+        }
+        return false;
+    }
     if (sourceTime == (int)sourceTime || filter == eFilterNone) {
         identityClip = _srcClip;
         identityTime = sourceTime;
@@ -471,6 +1665,51 @@ RetimePlugin::isIdentity(const OFX::IsIdentityArguments &args, OFX::Clip * &iden
     return false;
 }
 
+void
+RetimePlugin::changedParam(const OFX::InstanceChangedArgs &args,
+                           const std::string &paramName)
+{
+    if (paramName == kParamFilter) {
+        int filter_i;
+        _filter->getValueAtTime(args.time, filter_i);
+        _shutter->setEnabled((FilterEnum)filter_i == eFilterBox);
+        _reuseFrames->setEnabled((FilterEnum)filter_i == eFilterBox);
+    }
+    if (paramName == kParamReuseFrames) {
+        bool reuseFrames;
+        _reuseFrames->getValueAtTime(args.time, reuseFrames);
+        if (!reuseFrames) {
+            _frameCache.purge();
+        }
+    }
+}
+
+void
+RetimePlugin::changedClip(const OFX::InstanceChangedArgs &/*args*/,
+                          const std::string &/*clipName*/)
+{
+    // the input images may be different
+    _frameCache.purge();
+}
+
+void
+RetimePlugin::getRegionsOfInterest(const OFX::RegionsOfInterestArguments &args,
+                                   OFX::RegionOfInterestSetter &rois)
+{
+    int filter_i;
+    _filter->getValueAtTime(args.time, filter_i);
+    if ((FilterEnum)filter_i != eFilterMotion || !_srcClip || !_srcClip->isConnected()) {
+        // the default RoI is the render window
+        return;
+    }
+    // the flow is computed once on the whole images, and shared by all tiles
+    double fromTime, toTime;
+    double blend;
+    framesNeeded(getSourceTime(args.time), OFX::eFieldNone, &fromTime, &toTime, &blend);
+    OfxRectD roi = _srcClip->getRegionOfDefinition(fromTime);
+    OFX::MergeImages2D::rectBoundingBox(roi, _srcClip->getRegionOfDefinition(toTime), &roi);
+    rois.setRegionOfInterest(*_srcClip, roi);
+}
 
 /* override the time domain action, only for the general context */
 bool
@@ -506,6 +1745,38 @@ RetimePlugin::renderInternal(const OFX::RenderArguments &args,
                              FilterEnum filter,
                              OFX::BitDepthEnum dstBitDepth)
 {
+    if (filter == eFilterBox) {
+        switch (dstBitDepth) {
+            case OFX::eBitDepthUByte:
+                setupAndProcessBox<unsigned char, nComponents, 255>(args);
+                break;
+            case OFX::eBitDepthUShort:
+                setupAndProcessBox<unsigned short, nComponents, 65535>(args);
+                break;
+            case OFX::eBitDepthFloat:
+                setupAndProcessBox<float, nComponents, 1>(args);
+                break;
+            default:
+                OFX::throwSuiteStatusException(kOfxStatErrUnsupported);
+        }
+        return;
+    }
+    if (filter == eFilterMotion) {
+        switch (dstBitDepth) {
+            case OFX::eBitDepthUByte:
+                setupAndProcessMotion<unsigned char, nComponents, 255>(args, sourceTime);
+                break;
+            case OFX::eBitDepthUShort:
+                setupAndProcessMotion<unsigned short, nComponents, 65535>(args, sourceTime);
+                break;
+            case OFX::eBitDepthFloat:
+                setupAndProcessMotion<float, nComponents, 1>(args, sourceTime);
+                break;
+            default:
+                OFX::throwSuiteStatusException(kOfxStatErrUnsupported);
+        }
+        return;
+    }
     switch (dstBitDepth) {
         case OFX::eBitDepthUByte: {
             OFX::ImageBlender<unsigned char, nComponents> fred(*this);
@@ -540,34 +1811,13 @@ RetimePlugin::render(const OFX::RenderArguments &args)
     assert(kSupportsMultipleClipDepths || !_srcClip || _srcClip->getPixelDepth()       == _dstClip->getPixelDepth());
 
     // figure the frame we should be retiming from
-    double sourceTime;
-
-    if (getContext() == OFX::eContextRetimer) {
-        // the host is specifying it, so fetch it from the kOfxImageEffectRetimerParamName pseudo-param
-        sourceTime = _sourceTime->getValueAtTime(time);
-    } else {
-        bool reverse_input;
-        OfxRangeD srcRange = _srcClip->getFrameRange();
-        _reverse_input->getValueAtTime(time, reverse_input);
-        // we have our own param, which is a speed, so we integrate it to get the time we want
-        if (reverse_input) {
-            sourceTime = srcRange.max - _speed->integrate(srcRange.min, time);
-        } else {
-            sourceTime = srcRange.min + _speed->integrate(srcRange.min, time);
-        }
-        if (_warp) {
-            double r = srcRange.max - srcRange.min;
-            if (r != 0.) {
-                sourceTime = srcRange.min + r * _warp->getValue(0, time, (sourceTime-srcRange.min)/r);
-            }
-        }
-    }
+    double sourceTime = getSourceTime(time);
 
     int filter_i;
     _filter->getValueAtTime(time, filter_i);
     FilterEnum filter = (FilterEnum)filter_i;
 
-    if (sourceTime == (int)sourceTime || filter == eFilterNone || filter == eFilterNearest) {
+    if ((sourceTime == (int)sourceTime && filter != eFilterBox) || filter == eFilterNone || filter == eFilterNearest) {
         // should be caught by isIdentity!
         setPersistentMessage(OFX::Message::eMessageError, "", "OFX Host should not render");
         OFX::throwSuiteStatusException(kOfxStatFailed);
@@ -763,13 +2013,40 @@ void RetimePluginFactory::describeInContext(OFX::ImageEffectDescriptor &desc, Co
         param->appendOption(kParamFilterOptionNearest, kParamFilterOptionNearestHint);
         assert(param->getNOptions() == eFilterLinear);
         param->appendOption(kParamFilterOptionLinear, kParamFilterOptionLinearHint);
-        //assert(param->getNOptions() == eFilterBox);
-        //param->appendOption(kParamFilterOptionBox, kParamFilterOptionBoxHint);
+        assert(param->getNOptions() == eFilterMotion);
+        param->appendOption(kParamFilterOptionMotion, kParamFilterOptionMotionHint);
+        assert(param->getNOptions() == eFilterBox);
+        param->appendOption(kParamFilterOptionBox, kParamFilterOptionBoxHint);
         param->setDefault((int)kParamFilterDefault);
         if (page) {
             page->addChild(*param);
         }
     }
+
+    {
+        DoubleParamDescriptor *param = desc.defineDoubleParam(kParamShutter);
+        param->setLabel(kParamShutterLabel);
+        param->setHint(kParamShutterHint);
+        param->setDefault(kParamShutterDefault);
+        param->setRange(0., FLT_MAX);
+        param->setIncrement(0.1);
+        param->setDisplayRange(0., 2.);
+        param->setAnimates(true); // can animate
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+
+    {
+        BooleanParamDescriptor *param = desc.defineBooleanParam(kParamReuseFrames);
+        param->setLabel(kParamReuseFramesLabel);
+        param->setHint(kParamReuseFramesHint);
+        param->setDefault(kParamReuseFramesDefault);
+        param->setAnimates(false);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
 }
 
 /** @brief The create instance function, the plugin must return an object derived from the \ref OFX::ImageEffect class */
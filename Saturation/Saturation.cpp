@@ -81,6 +81,7 @@
 #include "ofxsMaskMix.h"
 #include "ofxsMerging.h"
 #include "ofxsMacros.h"
+#include "ColorKernels.h"
 #include "ofxNatron.h"
 
 #define kPluginName "SaturationOFX"
@@ -116,13 +117,6 @@
 #define kParamLuminanceMathOptionMaximum "Max"
 #define kParamLuminanceMathOptionMaximumHint "Use max or r, g, b."
 
-enum LuminanceMathEnum {
-    eLuminanceMathRec709,
-    eLuminanceMathCcir601,
-    eLuminanceMathAverage,
-    eLuminanceMathMaximum,
-};
-
 #define kParamClampBlack "clampBlack"
 #define kParamClampBlackLabel "Clamp Black"
 #define kParamClampBlackHint "All colors below 0 on output are set to 0."
@@ -133,254 +127,17 @@ enum LuminanceMathEnum {
 
 using namespace OFX;
 
-class SaturationProcessorBase : public OFX::ImageProcessor
-{
-protected:
-    const OFX::Image *_srcImg;
-    const OFX::Image *_maskImg;
-    bool _premult;
-    int _premultChannel;
-    bool   _doMasking;
-    double _mix;
-    bool _maskInvert;
-    bool _processR, _processG, _processB, _processA;
-
-public:
-    
-    SaturationProcessorBase(OFX::ImageEffect &instance)
-    : OFX::ImageProcessor(instance)
-    , _srcImg(0)
-    , _maskImg(0)
-    , _premult(false)
-    , _premultChannel(3)
-    , _doMasking(false)
-    , _mix(1.)
-    , _maskInvert(false)
-    , _processR(false)
-    , _processG(false)
-    , _processB(false)
-    , _processA(false)
-    , _saturation(0.)
-    , _luminanceMath(eLuminanceMathRec709)
-    , _clampBlack(true)
-    , _clampWhite(true)
-    {
-    }
-    
-    void setSrcImg(const OFX::Image *v) {_srcImg = v;}
-    
-    void setMaskImg(const OFX::Image *v, bool maskInvert) { _maskImg = v; _maskInvert = maskInvert; }
-    
-    void doMasking(bool v) {_doMasking = v;}
-    
-    void setValues(double saturation,
-                   LuminanceMathEnum luminanceMath,
-                   bool clampBlack,
-                   bool clampWhite,
-                   bool premult,
-                   int premultChannel,
-                   double mix,
-                   bool processR,
-                   bool processG,
-                   bool processB,
-                   bool processA)
-    {
-        _saturation = saturation;
-        _luminanceMath = luminanceMath;
-        _clampBlack = clampBlack;
-        _clampWhite = clampWhite;
-        _premult = premult;
-        _premultChannel = premultChannel;
-        _mix = mix;
-        _processR = processR;
-        _processG = processG;
-        _processB = processB;
-        _processA = processA;
-    }
-
-    template<bool processR, bool processG, bool processB, bool processA>
-    void grade(double *r, double *g, double *b, double *a)
-    {
-        double l;
-        switch (_luminanceMath) {
-            case eLuminanceMathRec709:
-                l = 0.2126 * *r + 0.7152 * *g + 0.0722 * *b;
-                break;
-            case eLuminanceMathCcir601:
-                l = 0.299 * *r + 0.587 * *g + 0.114 * *b;
-                break;
-            case eLuminanceMathAverage:
-                l = (*r + *g + *b) / 3;
-                break;
-            case eLuminanceMathMaximum:
-                l = std::max(std::max(*r, *g), *b);
-                break;
-        }
-        if (processR) {
-            *r = (1. - _saturation) * l + _saturation * *r;
-        }
-        if (processG) {
-            *g = (1. - _saturation) * l + _saturation * *g;
-        }
-        if (processB) {
-            *b = (1. - _saturation) * l + _saturation * *b;
-        }
-        if (processA) {
-            // nothing to do
-        }
-        if (_clampBlack) {
-            if (processR) {
-                *r = std::max(0.,*r);
-            }
-            if (processG) {
-                *g = std::max(0.,*g);
-            }
-            if (processB) {
-                *b = std::max(0.,*b);
-            }
-            if (processA) {
-                *a = std::max(0.,*a);
-            }
-        }
-        if (_clampWhite) {
-            if (processR) {
-                *r = std::min(1.,*r);
-            }
-            if (processG) {
-                *g = std::min(1.,*g);
-            }
-            if (processB) {
-                *b = std::min(1.,*b);
-            }
-            if (processA) {
-                *a = std::min(1.,*a);
-            }
-        }
-    }
-
-private:
-    double _saturation;
-    LuminanceMathEnum _luminanceMath;
-    bool _clampBlack;
-    bool _clampWhite;
-};
-
-
+typedef PixelKernelProcessorBase<SaturationKernel> SaturationProcessorBase;
 
 template <class PIX, int nComponents, int maxValue>
-class SaturationProcessor : public SaturationProcessorBase
+class SaturationProcessor : public PixelKernelProcessor<SaturationKernel, PIX, nComponents, maxValue>
 {
 public:
     SaturationProcessor(OFX::ImageEffect &instance)
-    : SaturationProcessorBase(instance)
-    {
-    }
-    
-    void multiThreadProcessImages(OfxRectI procWindow)
+    : PixelKernelProcessor<SaturationKernel, PIX, nComponents, maxValue>(instance)
     {
-        const bool r = _processR && (nComponents != 1);
-        const bool g = _processG && (nComponents >= 2);
-        const bool b = _processB && (nComponents >= 3);
-        const bool a = _processA && (nComponents == 1 || nComponents == 4);
-        if (r) {
-            if (g) {
-                if (b) {
-                    if (a) {
-                        return process<true ,true ,true ,true >(procWindow); // RGBA
-                    } else {
-                        return process<true ,true ,true ,false>(procWindow); // RGBa
-                    }
-                } else {
-                    if (a) {
-                        return process<true ,true ,false,true >(procWindow); // RGbA
-                    } else {
-                        return process<true ,true ,false,false>(procWindow); // RGba
-                    }
-                }
-            } else {
-                if (b) {
-                    if (a) {
-                        return process<true ,false,true ,true >(procWindow); // RgBA
-                    } else {
-                        return process<true ,false,true ,false>(procWindow); // RgBa
-                    }
-                } else {
-                    if (a) {
-                        return process<true ,false,false,true >(procWindow); // RgbA
-                    } else {
-                        return process<true ,false,false,false>(procWindow); // Rgba
-                    }
-                }
-            }
-        } else {
-            if (g) {
-                if (b) {
-                    if (a) {
-                        return process<false,true ,true ,true >(procWindow); // rGBA
-                    } else {
-                        return process<false,true ,true ,false>(procWindow); // rGBa
-                    }
-                } else {
-                    if (a) {
-                        return process<false,true ,false,true >(procWindow); // rGbA
-                    } else {
-                        return process<false,true ,false,false>(procWindow); // rGba
-                    }
-                }
-            } else {
-                if (b) {
-                    if (a) {
-                        return process<false,false,true ,true >(procWindow); // rgBA
-                    } else {
-                        return process<false,false,true ,false>(procWindow); // rgBa
-                    }
-                } else {
-                    if (a) {
-                        return process<false,false,false,true >(procWindow); // rgbA
-                    } else {
-                        return process<false,false,false,false>(procWindow); // rgba
-                    }
-                }
-            }
-        }
-    }
-    
-
-private:
-    
-    template<bool processR, bool processG, bool processB, bool processA>
-    void process(OfxRectI procWindow)
-    {
-        assert((!processR && !processG && !processB) || (nComponents == 3 || nComponents == 4));
-        assert(!processA || (nComponents == 1 || nComponents == 4));
-        assert(nComponents == 3 || nComponents == 4);
-        assert(_dstImg);
-        float unpPix[4];
-        float tmpPix[4];
-        for (int y = procWindow.y1; y < procWindow.y2; y++) {
-            if (_effect.abort()) {
-                break;
-            }
-
-            PIX *dstPix = (PIX *) _dstImg->getPixelAddress(procWindow.x1, y);
-
-            for (int x = procWindow.x1; x < procWindow.x2; x++) {
-                const PIX *srcPix = (const PIX *)  (_srcImg ? _srcImg->getPixelAddress(x, y) : 0);
-                ofxsUnPremult<PIX, nComponents, maxValue>(srcPix, unpPix, _premult, _premultChannel);
-                double t_r = unpPix[0];
-                double t_g = unpPix[1];
-                double t_b = unpPix[2];
-                double t_a = unpPix[3];
-                grade<processR,processG,processB,processA>(&t_r,&t_g,&t_b,&t_a);
-                tmpPix[0] = (float)t_r;
-                tmpPix[1] = (float)t_g;
-                tmpPix[2] = (float)t_b;
-                tmpPix[3] = (float)t_a;
-                ofxsPremultMaskMixPix<PIX, nComponents, maxValue, true>(tmpPix, _premult, _premultChannel, x, y, srcPix, _doMasking, _maskImg, (float)_mix, _maskInvert, dstPix);
-                // increment the dst pixel
-                dstPix += nComponents;
-            }
-        }
+        // the unprocessed channels go through premult, mask and mix like the processed ones
+        this->setCopyUnprocessed(false);
     }
 };
 
@@ -550,9 +307,9 @@ SaturationPlugin::setupAndProcess(SaturationProcessorBase &processor, const OFX:
     _processB->getValue(processB);
     _processA->getValue(processA);
 
-    processor.setValues(saturation, luminanceMath,
-                        clampBlack, clampWhite, premult, premultChannel, mix,
-                        processR, processG, processB, processA);
+    processor.setValues(processR, processG, processB, processA,
+                        premult, premultChannel, mix);
+    processor.setKernel(SaturationKernel(saturation, luminanceMath, clampBlack, clampWhite));
     processor.process();
 }
 
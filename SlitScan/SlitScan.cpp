@@ -35,22 +35,27 @@ Rocquencourt - B.P. 105
 78153 Le Chesnay Cedex - France
 */
 
+#include "SlitScan.h"
+
 #include <cmath> // for floor
 #include <climits> // for INT_MAX
 #include <cassert>
+#include <memory>
+#include <list>
+#include <vector>
+#include <algorithm>
 
 #include "ofxsImageEffect.h"
 #include "ofxsMultiThread.h"
 
-#include "ofxsPixelProcessor.h"
-#include "ofxsMaskMix.h"
-#include "ofxsMerging.h"
+#include "ofxsProcessing.H"
 #include "ofxsMacros.h"
 
 #define kPluginName "SlitScan"
 #define kPluginGrouping "Time"
 #define kPluginDescription \
-"Apply per-pixel retiming: the time is computed for each pixel from the retime map (by default, it is a vertical ramp, to get the SlitScan effect, originally by Douglas Trumbull)."
+"Apply per-pixel retiming: the time is computed for each pixel from the retime map (by default, it is a vertical ramp, to get the SlitScan effect, originally by Douglas Trumbull).\n" \
+"The source time of each pixel is offset + gain * value, where value is in [0,1]. It is relative to the current time, unless \"Absolute\" is checked."
 
 #define kPluginIdentifier "net.sf.openfx.SlitScan"
 // History:
@@ -65,9 +70,785 @@ Rocquencourt - B.P. 105
 #define kSupportsMultipleClipDepths false
 #define kRenderThreadSafety eRenderFullySafe
 
-void getSlitScanPluginID(OFX::PluginFactoryArray &ids)
+#define kClipRetimeMap "RetimeMap"
+
+#define kParamRetimeFunction "retimeFunction"
+#define kParamRetimeFunctionLabel "Retime Function"
+#define kParamRetimeFunctionHint "The function that gives the retime value (in [0,1]) of each pixel."
+#define kParamRetimeFunctionOptionHorizontalSlit "Horizontal Slit"
+#define kParamRetimeFunctionOptionHorizontalSlitHint "The value is a vertical ramp, from 0 at the bottom of the project frame to 1 at the top: each row of the output comes from a different time."
+#define kParamRetimeFunctionOptionVerticalSlit "Vertical Slit"
+#define kParamRetimeFunctionOptionVerticalSlitHint "The value is a horizontal ramp, from 0 at the left of the project frame to 1 at the right: each column of the output comes from a different time."
+#define kParamRetimeFunctionOptionRetimeMap "Retime Map"
+#define kParamRetimeFunctionOptionRetimeMapHint "The value is the first channel of the RetimeMap input (red, or alpha for an alpha-only input), clamped to [0,1]."
+enum RetimeFunctionEnum {
+    eRetimeFunctionHorizontalSlit = 0,
+    eRetimeFunctionVerticalSlit,
+    eRetimeFunctionRetimeMap,
+};
+#define kParamRetimeFunctionDefault eRetimeFunctionHorizontalSlit
+
+#define kParamRetimeGain "retimeGain"
+#define kParamRetimeGainLabel "Gain"
+#define kParamRetimeGainHint "The retime value is multiplied by this gain, in frames. With the default value, the bottom of the image is at the current time and the top of the image is 10 frames before."
+#define kParamRetimeGainDefault -10.
+
+#define kParamRetimeOffset "retimeOffset"
+#define kParamRetimeOffsetLabel "Offset"
+#define kParamRetimeOffsetHint "Offset added to the retime value multiplied by the gain, in frames."
+
+#define kParamRetimeAbsolute "retimeAbsolute"
+#define kParamRetimeAbsoluteLabel "Absolute"
+#define kParamRetimeAbsoluteHint "If checked, the source time is offset + gain * value. If not checked, it is relative to the current time."
+
+#define kParamFilter "filter"
+#define kParamFilterLabel "Filter"
+#define kParamFilterHint "How input images are combined to compute the output image."
+#define kParamFilterOptionNearest "Nearest"
+#define kParamFilterOptionNearestHint "Pick input image with nearest integer time. Pixels that come from the same input frame are copied in bulk, which is much faster."
+#define kParamFilterOptionLinear "Linear"
+#define kParamFilterOptionLinearHint "Blend the two nearest images with linear interpolation."
+enum FilterEnum {
+    eFilterNearest = 0,
+    eFilterLinear,
+};
+#define kParamFilterDefault eFilterNearest
+
+#define kFrameCacheSize 8 // maximum number of source frames held during a render (must be at least 2)
+
+using namespace OFX;
+
+// Computes the source time of each output pixel from the retime function.
+struct SlitScanRetime
+{
+    RetimeFunctionEnum function;
+    double base; // source time for a retime value of 0
+    double gain;
+    double timeMin; // frame range of the source clip
+    double timeMax;
+    OfxPointD renderScale;
+    double par;
+    OfxPointD projectOffset;
+    OfxPointD projectSize;
+    const OFX::Image *mapImg; // has the same depth as the source
+
+    SlitScanRetime()
+    : function(eRetimeFunctionHorizontalSlit)
+    , base(0.)
+    , gain(0.)
+    , timeMin(INT_MIN)
+    , timeMax(INT_MAX)
+    , par(1.)
+    , mapImg(0)
+    {
+        renderScale.x = renderScale.y = 1.;
+        projectOffset.x = projectOffset.y = 0.;
+        projectSize.x = projectSize.y = 1.;
+    }
+
+    // retime value at pixel (x,y), in [0,1]
+    template <class PIX, int maxValue>
+    double getValue(int x, int y) const
+    {
+        double v = 0.;
+        switch (function) {
+            case eRetimeFunctionHorizontalSlit:
+                if (projectSize.y > 0.) {
+                    v = ((y + 0.5) / renderScale.y - projectOffset.y) / projectSize.y;
+                }
+                break;
+            case eRetimeFunctionVerticalSlit:
+                if (projectSize.x > 0.) {
+                    v = ((x + 0.5) * par / renderScale.x - projectOffset.x) / projectSize.x;
+                }
+                break;
+            case eRetimeFunctionRetimeMap: {
+                const PIX *mapPix = mapImg ? (const PIX *) mapImg->getPixelAddress(x, y) : 0;
+                if (mapPix) {
+                    v = (double)mapPix[0] / maxValue;
+                }
+                break;
+            }
+        }
+        // also maps NaN to 0
+        return std::max(0., std::min(v, 1.));
+    }
+
+    // source time at pixel (x,y), within the source frame range
+    template <class PIX, int maxValue>
+    double getTime(int x, int y) const
+    {
+        return std::max(timeMin, std::min(base + gain * getValue<PIX, maxValue>(x, y), timeMax));
+    }
+};
+
+// A horizontal run of pixels [x1,x2) on row y, whose source time is within [frame,frame+1) (Linear filter)
+// or rounds to frame (Nearest filter).
+struct SlitScanRun
+{
+    int frame;
+    int y;
+    int x1;
+    int x2;
+};
+
+// order by frame, then from bottom to top, then from left to right
+inline bool
+operator<(const SlitScanRun &a, const SlitScanRun &b)
+{
+    if (a.frame != b.frame) {
+        return a.frame < b.frame;
+    }
+    if (a.y != b.y) {
+        return a.y < b.y;
+    }
+    return a.x1 < b.x1;
+}
+
+struct SlitScanRunRowLess
+{
+    bool operator()(const SlitScanRun &r, int y) const { return r.y < y; }
+};
+
+// A bounded cache of source frames, keyed by integer time.
+// Frames are fetched once and released in least-recently-used order when the cache is full,
+// or when the cache is destroyed at the end of the render.
+class SlitScanFrameCache
+{
+public:
+    explicit SlitScanFrameCache(size_t capacity)
+    : _entries()
+    , _capacity(capacity)
+    {
+        assert(_capacity >= 2);
+    }
+
+    ~SlitScanFrameCache()
+    {
+        for (std::list<Entry>::iterator it = _entries.begin(); it != _entries.end(); ++it) {
+            delete it->image;
+        }
+    }
+
+    // return true if the frame is in the cache (image may be NULL if the host gave no image),
+    // and make it the most recently used.
+    bool find(int frame, const OFX::Image **image)
+    {
+        for (std::list<Entry>::iterator it = _entries.begin(); it != _entries.end(); ++it) {
+            if (it->frame == frame) {
+                _entries.splice(_entries.begin(), _entries, it);
+                *image = _entries.front().image;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // add a frame, which becomes the most recently used. The cache takes ownership of the image.
+    void insert(int frame, const OFX::Image *image)
+    {
+        if (_entries.size() >= _capacity) {
+            delete _entries.back().image;
+            _entries.pop_back();
+        }
+        Entry e;
+        e.frame = frame;
+        e.image = image;
+        _entries.push_front(e);
+    }
+
+private:
+    struct Entry
+    {
+        int frame;
+        const OFX::Image *image;
+    };
+
+    std::list<Entry> _entries; // most recently used first
+    size_t _capacity;
+};
+
+class SlitScanProcessorBase : public OFX::ImageProcessor
+{
+protected:
+    const OFX::Image *_srcImg0; // source at time frame
+    const OFX::Image *_srcImg1; // source at time frame+1 (Linear filter only)
+    float _weightMax; // maximum weight of _srcImg1 (0 if frame+1 is past the source range)
+    const SlitScanRun *_runsBegin; // runs that use these source images, sorted by row
+    const SlitScanRun *_runsEnd;
+    const SlitScanRetime *_retime;
+    FilterEnum _filter;
+
+public:
+    SlitScanProcessorBase(OFX::ImageEffect &instance)
+    : OFX::ImageProcessor(instance)
+    , _srcImg0(0)
+    , _srcImg1(0)
+    , _weightMax(1.f)
+    , _runsBegin(0)
+    , _runsEnd(0)
+    , _retime(0)
+    , _filter(eFilterNearest)
+    {
+    }
+
+    void setSrcImgs(const OFX::Image *img0, const OFX::Image *img1, float weightMax)
+    {
+        _srcImg0 = img0;
+        _srcImg1 = img1;
+        _weightMax = weightMax;
+    }
+
+    void setRuns(const SlitScanRun *begin, const SlitScanRun *end) { _runsBegin = begin; _runsEnd = end; }
+
+    void setValues(const SlitScanRetime *retime, FilterEnum filter)
+    {
+        _retime = retime;
+        _filter = filter;
+    }
+};
+
+template <class PIX, int nComponents, int maxValue>
+class SlitScanProcessor : public SlitScanProcessorBase
+{
+public:
+    SlitScanProcessor(OFX::ImageEffect &instance)
+    : SlitScanProcessorBase(instance)
+    {
+    }
+
+private:
+    void multiThreadProcessImages(OfxRectI procWindow)
+    {
+        assert(_dstImg && _retime);
+        // only process the runs that are on the rows of procWindow
+        const SlitScanRun *run = std::lower_bound(_runsBegin, _runsEnd, procWindow.y1, SlitScanRunRowLess());
+        for (; run != _runsEnd && run->y < procWindow.y2; ++run) {
+            if (_effect.abort()) {
+                break;
+            }
+            const int x1 = std::max(run->x1, procWindow.x1);
+            const int x2 = std::min(run->x2, procWindow.x2);
+            if (x1 >= x2) {
+                continue;
+            }
+            if (_filter == eFilterNearest) {
+                copyRun(x1, x2, run->y);
+            } else {
+                blendRun(x1, x2, run->y, run->frame);
+            }
+        }
+    }
+
+    // copy pixels [x1,x2) of row y from the source frame
+    void copyRun(int x1, int x2, int y)
+    {
+        PIX *dstPix = (PIX *) _dstImg->getPixelAddress(x1, y);
+        assert(dstPix);
+        // the part of the run that is inside the source image
+        int sx1 = x2;
+        int sx2 = x2;
+        if (_srcImg0) {
+            const OfxRectI &bounds = _srcImg0->getBounds();
+            if (bounds.y1 <= y && y < bounds.y2) {
+                sx1 = std::max(x1, std::min(bounds.x1, x2));
+                sx2 = std::max(sx1, std::min(bounds.x2, x2));
+            }
+        }
+        // images are black and transparent outside of their bounds
+        std::fill(dstPix, dstPix + (sx1 - x1) * nComponents, PIX());
+        dstPix += (sx1 - x1) * nComponents;
+        if (sx1 < sx2) {
+            const PIX *srcPix = (const PIX *) _srcImg0->getPixelAddress(sx1, y);
+            assert(srcPix);
+            std::copy(srcPix, srcPix + (sx2 - sx1) * nComponents, dstPix);
+            dstPix += (sx2 - sx1) * nComponents;
+        }
+        std::fill(dstPix, dstPix + (x2 - sx2) * nComponents, PIX());
+    }
+
+    // blend pixels [x1,x2) of row y from the source frames frame and frame+1
+    void blendRun(int x1, int x2, int y, int frame)
+    {
+        PIX *dstPix = (PIX *) _dstImg->getPixelAddress(x1, y);
+        assert(dstPix);
+        for (int x = x1; x < x2; ++x) {
+            const float w = std::min((float)(_retime->getTime<PIX, maxValue>(x, y) - frame), _weightMax);
+            const PIX *srcPix0 = _srcImg0 ? (const PIX *) _srcImg0->getPixelAddress(x, y) : 0;
+            const PIX *srcPix1 = _srcImg1 ? (const PIX *) _srcImg1->getPixelAddress(x, y) : 0;
+            for (int c = 0; c < nComponents; ++c) {
+                const float v0 = srcPix0 ? (float)srcPix0[c] : 0.f;
+                const float v1 = srcPix1 ? (float)srcPix1[c] : 0.f;
+                const float v = v0 + w * (v1 - v0);
+                // v is between v0 and v1, so there is no need to clamp
+                dstPix[c] = (maxValue == 1) ? PIX(v) : PIX(std::floor(v + 0.5f));
+            }
+            dstPix += nComponents;
+        }
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/** @brief The plugin that does our work */
+class SlitScanPlugin : public OFX::ImageEffect
+{
+public:
+    /** @brief ctor */
+    SlitScanPlugin(OfxImageEffectHandle handle)
+    : ImageEffect(handle)
+    , _dstClip(0)
+    , _srcClip(0)
+    , _retimeMapClip(0)
+    , _retimeFunction(0)
+    , _retimeGain(0)
+    , _retimeOffset(0)
+    , _retimeAbsolute(0)
+    , _filter(0)
+    {
+        _dstClip = fetchClip(kOfxImageEffectOutputClipName);
+        assert(_dstClip && (_dstClip->getPixelComponents() == ePixelComponentRGB || _dstClip->getPixelComponents() == ePixelComponentRGBA || _dstClip->getPixelComponents() == ePixelComponentAlpha));
+        _srcClip = fetchClip(kOfxImageEffectSimpleSourceClipName);
+        assert(_srcClip && (_srcClip->getPixelComponents() == ePixelComponentRGB || _srcClip->getPixelComponents() == ePixelComponentRGBA || _srcClip->getPixelComponents() == ePixelComponentAlpha));
+        _retimeMapClip = fetchClip(kClipRetimeMap);
+        assert(_retimeMapClip && (_retimeMapClip->getPixelComponents() == ePixelComponentRGB || _retimeMapClip->getPixelComponents() == ePixelComponentRGBA || _retimeMapClip->getPixelComponents() == ePixelComponentAlpha));
+        _retimeFunction = fetchChoiceParam(kParamRetimeFunction);
+        _retimeGain = fetchDoubleParam(kParamRetimeGain);
+        _retimeOffset = fetchDoubleParam(kParamRetimeOffset);
+        _retimeAbsolute = fetchBooleanParam(kParamRetimeAbsolute);
+        _filter = fetchChoiceParam(kParamFilter);
+        assert(_retimeFunction && _retimeGain && _retimeOffset && _retimeAbsolute && _filter);
+    }
+
+private:
+    /* Override the render */
+    virtual void render(const OFX::RenderArguments &args) OVERRIDE FINAL;
+
+    virtual bool isIdentity(const IsIdentityArguments &args, Clip * &identityClip, double &identityTime) OVERRIDE FINAL;
+
+    /** Override the get frames needed action */
+    virtual void getFramesNeeded(const OFX::FramesNeededArguments &args, OFX::FramesNeededSetter &frames) OVERRIDE FINAL;
+
+private:
+    template<int nComponents>
+    void renderForComponents(const OFX::RenderArguments &args);
+
+    template <class PIX, int nComponents, int maxValue>
+    void renderForBitDepth(const OFX::RenderArguments &args);
+
+    /* get the source frame from the cache, or fetch it */
+    const OFX::Image* getSourceFrame(SlitScanFrameCache &cache, int frame, const OFX::RenderArguments &args, OFX::BitDepthEnum dstBitDepth, OFX::PixelComponentEnum dstComponents);
+
+    /* source time for a retime value of 0, and gain */
+    void getRetimeParams(double time, double *base, double *gain);
+
+    // do not need to delete these, the ImageEffect is managing them for us
+    OFX::Clip *_dstClip;
+    OFX::Clip *_srcClip;
+    OFX::Clip *_retimeMapClip;
+
+    OFX::ChoiceParam *_retimeFunction;
+    OFX::DoubleParam *_retimeGain;
+    OFX::DoubleParam *_retimeOffset;
+    OFX::BooleanParam *_retimeAbsolute;
+    OFX::ChoiceParam *_filter;
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// basic plugin render function, just a skelington to instantiate templates from
+
+void
+SlitScanPlugin::getRetimeParams(double time, double *base, double *gain)
+{
+    double offset;
+    _retimeOffset->getValueAtTime(time, offset);
+    bool absolute;
+    _retimeAbsolute->getValueAtTime(time, absolute);
+    _retimeGain->getValueAtTime(time, *gain);
+    *base = absolute ? offset : (time + offset);
+
+    int retimeFunction_i;
+    _retimeFunction->getValueAtTime(time, retimeFunction_i);
+    if ((RetimeFunctionEnum)retimeFunction_i == eRetimeFunctionRetimeMap && !(_retimeMapClip && _retimeMapClip->isConnected())) {
+        // the retime value is 0 everywhere
+        *gain = 0.;
+    }
+}
+
+const OFX::Image*
+SlitScanPlugin::getSourceFrame(SlitScanFrameCache &cache, int frame, const OFX::RenderArguments &args, OFX::BitDepthEnum dstBitDepth, OFX::PixelComponentEnum dstComponents)
+{
+    const OFX::Image *cached = 0;
+    if (cache.find(frame, &cached)) {
+        return cached;
+    }
+    std::auto_ptr<const OFX::Image> src((_srcClip && _srcClip->isConnected()) ?
+                                        _srcClip->fetchImage(frame) : 0);
+    if (src.get()) {
+        if (src->getRenderScale().x != args.renderScale.x ||
+            src->getRenderScale().y != args.renderScale.y ||
+            (src->getField() != OFX::eFieldNone /* for DaVinci Resolve */ && src->getField() != args.fieldToRender)) {
+            setPersistentMessage(OFX::Message::eMessageError, "", "OFX Host gave image with wrong scale or field properties");
+            OFX::throwSuiteStatusException(kOfxStatFailed);
+        }
+        OFX::BitDepthEnum    srcBitDepth      = src->getPixelDepth();
+        OFX::PixelComponentEnum srcComponents = src->getPixelComponents();
+        if (srcBitDepth != dstBitDepth || srcComponents != dstComponents) {
+            OFX::throwSuiteStatusException(kOfxStatErrImageFormat);
+        }
+    }
+    cache.insert(frame, src.get());
+
+    return src.release();
+}
+
+// the overridden render function
+void
+SlitScanPlugin::render(const OFX::RenderArguments &args)
+{
+    OFX::PixelComponentEnum dstComponents  = _dstClip->getPixelComponents();
+
+    assert(kSupportsMultipleClipPARs   || !_srcClip || _srcClip->getPixelAspectRatio() == _dstClip->getPixelAspectRatio());
+    assert(kSupportsMultipleClipDepths || !_srcClip || _srcClip->getPixelDepth()       == _dstClip->getPixelDepth());
+    assert(dstComponents == OFX::ePixelComponentAlpha || dstComponents == OFX::ePixelComponentRGB || dstComponents == OFX::ePixelComponentRGBA);
+    if (dstComponents == OFX::ePixelComponentRGBA) {
+        renderForComponents<4>(args);
+    } else if (dstComponents == OFX::ePixelComponentAlpha) {
+        renderForComponents<1>(args);
+    } else {
+        assert(dstComponents == OFX::ePixelComponentRGB);
+        renderForComponents<3>(args);
+    }
+}
+
+template<int nComponents>
+void
+SlitScanPlugin::renderForComponents(const OFX::RenderArguments &args)
+{
+    OFX::BitDepthEnum dstBitDepth    = _dstClip->getPixelDepth();
+    switch (dstBitDepth) {
+        case OFX::eBitDepthUByte:
+            renderForBitDepth<unsigned char, nComponents, 255>(args);
+            break;
+
+        case OFX::eBitDepthUShort:
+            renderForBitDepth<unsigned short, nComponents, 65535>(args);
+            break;
+
+        case OFX::eBitDepthFloat:
+            renderForBitDepth<float, nComponents, 1>(args);
+            break;
+        default:
+            OFX::throwSuiteStatusException(kOfxStatErrUnsupported);
+    }
+}
+
+// Each output pixel is assigned a source frame, and the render window is cut into horizontal runs of pixels
+// that use the same source frame. The runs are then sorted by frame, so that each source frame
+// is fetched only once, and all the runs that use it are processed together.
+template <class PIX, int nComponents, int maxValue>
+void
+SlitScanPlugin::renderForBitDepth(const OFX::RenderArguments &args)
+{
+    const double time = args.time;
+    std::auto_ptr<OFX::Image> dst(_dstClip->fetchImage(time));
+    if (!dst.get()) {
+        OFX::throwSuiteStatusException(kOfxStatFailed);
+    }
+    OFX::BitDepthEnum         dstBitDepth    = dst->getPixelDepth();
+    OFX::PixelComponentEnum   dstComponents  = dst->getPixelComponents();
+    if (dstBitDepth != _dstClip->getPixelDepth() ||
+        dstComponents != _dstClip->getPixelComponents()) {
+        setPersistentMessage(OFX::Message::eMessageError, "", "OFX Host gave image with wrong depth or components");
+        OFX::throwSuiteStatusException(kOfxStatFailed);
+    }
+    if (dst->getRenderScale().x != args.renderScale.x ||
+        dst->getRenderScale().y != args.renderScale.y ||
+        (dst->getField() != OFX::eFieldNone /* for DaVinci Resolve */ && dst->getField() != args.fieldToRender)) {
+        setPersistentMessage(OFX::Message::eMessageError, "", "OFX Host gave image with wrong scale or field properties");
+        OFX::throwSuiteStatusException(kOfxStatFailed);
+    }
+
+    SlitScanRetime retime;
+    int retimeFunction_i;
+    _retimeFunction->getValueAtTime(time, retimeFunction_i);
+    retime.function = (RetimeFunctionEnum)retimeFunction_i;
+    getRetimeParams(time, &retime.base, &retime.gain);
+    if (_srcClip && _srcClip->isConnected()) {
+        OfxRangeD range = _srcClip->getFrameRange();
+        retime.timeMin = range.min;
+        retime.timeMax = range.max;
+    }
+    retime.renderScale = args.renderScale;
+    retime.par = _srcClip ? _srcClip->getPixelAspectRatio() : 1.;
+    retime.projectOffset = getProjectOffset();
+    retime.projectSize = getProjectSize();
+
+    int filter_i;
+    _filter->getValueAtTime(time, filter_i);
+    FilterEnum filter = (FilterEnum)filter_i;
+
+    // fetch the retime map
+    std::auto_ptr<const OFX::Image> map((retime.function == eRetimeFunctionRetimeMap && _retimeMapClip && _retimeMapClip->isConnected()) ?
+                                        _retimeMapClip->fetchImage(time) : 0);
+    if (map.get()) {
+        if (map->getRenderScale().x != args.renderScale.x ||
+            map->getRenderScale().y != args.renderScale.y ||
+            (map->getField() != OFX::eFieldNone /* for DaVinci Resolve */ && map->getField() != args.fieldToRender)) {
+            setPersistentMessage(OFX::Message::eMessageError, "", "OFX Host gave image with wrong scale or field properties");
+            OFX::throwSuiteStatusException(kOfxStatFailed);
+        }
+        if (map->getPixelDepth() != dstBitDepth) {
+            OFX::throwSuiteStatusException(kOfxStatErrImageFormat);
+        }
+    }
+    retime.mapImg = map.get();
+
+    // cut the render window into runs of pixels that use the same source frame
+    const OfxRectI& renderWindow = args.renderWindow;
+    std::vector<SlitScanRun> runs;
+    for (int y = renderWindow.y1; y < renderWindow.y2; ++y) {
+        if (abort()) {
+            return;
+        }
+        SlitScanRun run;
+        run.frame = 0;
+        run.y = y;
+        run.x1 = renderWindow.x1;
+        for (int x = renderWindow.x1; x < renderWindow.x2; ++x) {
+            const double t = retime.getTime<PIX, maxValue>(x, y);
+            const int frame = (int)std::floor(filter == eFilterNearest ? (t + 0.5) : t);
+            if (x == renderWindow.x1) {
+                run.frame = frame;
+            } else if (frame != run.frame) {
+                run.x2 = x;
+                runs.push_back(run);
+                run.frame = frame;
+                run.x1 = x;
+            }
+        }
+        run.x2 = renderWindow.x2;
+        if (run.x1 < run.x2) {
+            runs.push_back(run);
+        }
+    }
+    std::sort(runs.begin(), runs.end());
+
+    SlitScanProcessor<PIX, nComponents, maxValue> processor(*this);
+    processor.setDstImg(dst.get());
+    processor.setRenderWindow(renderWindow);
+    processor.setValues(&retime, filter);
+
+    SlitScanFrameCache cache(kFrameCacheSize);
+    std::vector<SlitScanRun>::const_iterator groupEnd;
+    for (std::vector<SlitScanRun>::const_iterator groupBegin = runs.begin(); groupBegin != runs.end(); groupBegin = groupEnd) {
+        if (abort()) {
+            return;
+        }
+        const int frame = groupBegin->frame;
+        groupEnd = groupBegin;
+        while (groupEnd != runs.end() && groupEnd->frame == frame) {
+            ++groupEnd;
+        }
+        const OFX::Image *src0 = getSourceFrame(cache, frame, args, dstBitDepth, dstComponents);
+        const OFX::Image *src1 = 0;
+        float weightMax = 1.f;
+        if (filter == eFilterLinear) {
+            if (frame + 1 <= retime.timeMax) {
+                src1 = getSourceFrame(cache, frame + 1, args, dstBitDepth, dstComponents);
+            } else {
+                // frame+1 is past the end of the source range, and has no weight
+                weightMax = 0.f;
+            }
+        }
+        processor.setSrcImgs(src0, src1, weightMax);
+        processor.setRuns(&*groupBegin, &*groupBegin + (groupEnd - groupBegin));
+
+        // Call the base class process member, this will call the derived templated process code
+        processor.process();
+    }
+}
+
+bool
+SlitScanPlugin::isIdentity(const IsIdentityArguments &args, Clip * &identityClip, double &identityTime)
+{
+    double base, gain;
+    getRetimeParams(args.time, &base, &gain);
+    if (gain != 0.) {
+        return false;
+    }
+    if (_srcClip && _srcClip->isConnected()) {
+        // same as the render, see SlitScanRetime::getTime()
+        OfxRangeD range = _srcClip->getFrameRange();
+        base = std::max(range.min, std::min(base, range.max));
+    }
+    int filter_i;
+    _filter->getValueAtTime(args.time, filter_i);
+    if ((FilterEnum)filter_i == eFilterNearest) {
+        identityTime = std::floor(base + 0.5);
+    } else if (base == std::floor(base)) {
+        identityTime = base;
+    } else {
+        return false;
+    }
+    identityClip = _srcClip;
+
+    return true;
+}
+
+void
+SlitScanPlugin::getFramesNeeded(const OFX::FramesNeededArguments &args,
+                                OFX::FramesNeededSetter &frames)
+{
+    const double time = args.time;
+    double base, gain;
+    getRetimeParams(time, &base, &gain);
+    int filter_i;
+    _filter->getValueAtTime(time, filter_i);
+    const double tmin = base + std::min(0., gain);
+    const double tmax = base + std::max(0., gain);
+    OfxRangeD range;
+    if ((FilterEnum)filter_i == eFilterNearest) {
+        range.min = std::floor(tmin + 0.5);
+        range.max = std::floor(tmax + 0.5);
+    } else {
+        range.min = std::floor(tmin);
+        range.max = std::ceil(tmax);
+    }
+    frames.setFramesNeeded(*_srcClip, range);
+
+    range.min = range.max = time;
+    frames.setFramesNeeded(*_retimeMapClip, range);
+}
+
+mDeclarePluginFactory(SlitScanPluginFactory, {}, {});
+
+void SlitScanPluginFactory::describe(OFX::ImageEffectDescriptor &desc)
+{
+    // basic labels
+    desc.setLabel(kPluginName);
+    desc.setPluginGrouping(kPluginGrouping);
+    desc.setPluginDescription(kPluginDescription);
+
+    desc.addSupportedContext(eContextFilter);
+    desc.addSupportedContext(eContextGeneral);
+    desc.addSupportedBitDepth(eBitDepthUByte);
+    desc.addSupportedBitDepth(eBitDepthUShort);
+    desc.addSupportedBitDepth(eBitDepthFloat);
+
+    // set a few flags
+    desc.setSingleInstance(false);
+    desc.setHostFrameThreading(false);
+    desc.setSupportsMultiResolution(kSupportsMultiResolution);
+    desc.setSupportsTiles(kSupportsTiles);
+    desc.setTemporalClipAccess(true);
+    desc.setRenderTwiceAlways(false);
+    desc.setSupportsMultipleClipPARs(kSupportsMultipleClipPARs);
+    desc.setSupportsMultipleClipDepths(kSupportsMultipleClipDepths);
+    desc.setRenderThreadSafety(kRenderThreadSafety);
+}
+
+void SlitScanPluginFactory::describeInContext(OFX::ImageEffectDescriptor &desc, OFX::ContextEnum /*context*/)
 {
-    //static SlitScanPluginFactory p(kPluginIdentifier, kPluginVersionMajor, kPluginVersionMinor);
-    //ids.push_back(&p);
+    // Source clip only in the filter context
+    // create the mandated source clip
+    ClipDescriptor *srcClip = desc.defineClip(kOfxImageEffectSimpleSourceClipName);
+    srcClip->addSupportedComponent(ePixelComponentRGBA);
+    srcClip->addSupportedComponent(ePixelComponentRGB);
+    srcClip->addSupportedComponent(ePixelComponentAlpha);
+    srcClip->setTemporalClipAccess(true);
+    srcClip->setSupportsTiles(kSupportsTiles);
+    srcClip->setIsMask(false);
+
+    ClipDescriptor *retimeMapClip = desc.defineClip(kClipRetimeMap);
+    retimeMapClip->addSupportedComponent(ePixelComponentRGBA);
+    retimeMapClip->addSupportedComponent(ePixelComponentRGB);
+    retimeMapClip->addSupportedComponent(ePixelComponentAlpha);
+    retimeMapClip->setTemporalClipAccess(false);
+    retimeMapClip->setOptional(true);
+    retimeMapClip->setSupportsTiles(kSupportsTiles);
+    retimeMapClip->setIsMask(false);
+
+    // create the mandated output clip
+    ClipDescriptor *dstClip = desc.defineClip(kOfxImageEffectOutputClipName);
+    dstClip->addSupportedComponent(ePixelComponentRGBA);
+    dstClip->addSupportedComponent(ePixelComponentRGB);
+    dstClip->addSupportedComponent(ePixelComponentAlpha);
+    dstClip->setSupportsTiles(kSupportsTiles);
+
+    // make some pages and to things in
+    PageParamDescriptor *page = desc.definePageParam("Controls");
+
+    {
+        ChoiceParamDescriptor *param = desc.defineChoiceParam(kParamRetimeFunction);
+        param->setLabel(kParamRetimeFunctionLabel);
+        param->setHint(kParamRetimeFunctionHint);
+        assert(param->getNOptions() == eRetimeFunctionHorizontalSlit);
+        param->appendOption(kParamRetimeFunctionOptionHorizontalSlit, kParamRetimeFunctionOptionHorizontalSlitHint);
+        assert(param->getNOptions() == eRetimeFunctionVerticalSlit);
+        param->appendOption(kParamRetimeFunctionOptionVerticalSlit, kParamRetimeFunctionOptionVerticalSlitHint);
+        assert(param->getNOptions() == eRetimeFunctionRetimeMap);
+        param->appendOption(kParamRetimeFunctionOptionRetimeMap, kParamRetimeFunctionOptionRetimeMapHint);
+        param->setDefault((int)kParamRetimeFunctionDefault);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+    {
+        DoubleParamDescriptor *param = desc.defineDoubleParam(kParamRetimeGain);
+        param->setLabel(kParamRetimeGainLabel);
+        param->setHint(kParamRetimeGainHint);
+        param->setDefault(kParamRetimeGainDefault);
+        param->setDisplayRange(-100., 100.);
+        param->setAnimates(true); // can animate
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+    {
+        DoubleParamDescriptor *param = desc.defineDoubleParam(kParamRetimeOffset);
+        param->setLabel(kParamRetimeOffsetLabel);
+        param->setHint(kParamRetimeOffsetHint);
+        param->setDefault(0.);
+        param->setDisplayRange(-100., 100.);
+        param->setAnimates(true); // can animate
+        param->setLayoutHint(eLayoutHintNoNewLine);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+    {
+        BooleanParamDescriptor *param = desc.defineBooleanParam(kParamRetimeAbsolute);
+        param->setLabel(kParamRetimeAbsoluteLabel);
+        param->setHint(kParamRetimeAbsoluteHint);
+        param->setDefault(false);
+        param->setAnimates(true); // can animate
+        if (page) {
+            page->addChild(*param);
+        }
+    }
+    {
+        ChoiceParamDescriptor *param = desc.defineChoiceParam(kParamFilter);
+        param->setLabel(kParamFilterLabel);
+        param->setHint(kParamFilterHint);
+        assert(param->getNOptions() == eFilterNearest);
+        param->appendOption(kParamFilterOptionNearest, kParamFilterOptionNearestHint);
+        assert(param->getNOptions() == eFilterLinear);
+        param->appendOption(kParamFilterOptionLinear, kParamFilterOptionLinearHint);
+        param->setDefault((int)kParamFilterDefault);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
 }
 
+OFX::ImageEffect* SlitScanPluginFactory::createInstance(OfxImageEffectHandle handle, OFX::ContextEnum /*context*/)
+{
+    return new SlitScanPlugin(handle);
+}
+
+void getSlitScanPluginID(OFX::PluginFactoryArray &ids)
+{
+    static SlitScanPluginFactory p(kPluginIdentifier, kPluginVersionMajor, kPluginVersionMinor);
+    ids.push_back(&p);
+}
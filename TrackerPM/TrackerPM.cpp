@@ -70,10 +70,13 @@
  
  */
 #include "TrackerPM.h"
+#include "TrackerPMCorrelator.h"
 
 #include <cmath>
 #include <map>
 #include <limits>
+#include <vector>
+#include <algorithm>
 
 #include "ofxsProcessing.H"
 #include "ofxsTracking.h"
@@ -111,6 +114,20 @@
 #define kParamScoreOptionZNCC "ZNCC"
 #define kParamScoreOptionZNCCHint "Zero-mean Normalized Cross-Correlation, less sensitive to illumination changes"
 
+#define kParamSearch "search"
+#define kParamSearchLabel "Search"
+#define kParamSearchHint "Search strategy used to find the pattern in the search window"
+#define kParamSearchOptionExhaustive "Exhaustive"
+#define kParamSearchOptionExhaustiveHint "Compute the score at every integer position of the search window"
+#define kParamSearchOptionCoarseToFine "Coarse-to-Fine"
+#define kParamSearchOptionCoarseToFineHint "Build a Gaussian pyramid of the pattern and of the search window, do an exhaustive search at the coarsest level only, and refine the best candidates at each finer level. Much faster on large search windows, but may miss a match made of fine details only"
+
+// the coarsest level of the pyramid is the last one where the pattern is at least this size
+#define kTrackerPMPyramidMinPatternSize 4
+#define kTrackerPMPyramidMaxLevels 6
+// number of best candidates refined at each level of the pyramid
+#define kTrackerPMPyramidCandidates 4
+
 using namespace OFX;
 
 enum TrackerScoreEnum
@@ -121,6 +138,12 @@ enum TrackerScoreEnum
     eTrackerZNCC
 };
 
+enum TrackerSearchEnum
+{
+    eTrackerSearchExhaustive = 0,
+    eTrackerSearchCoarseToFine
+};
+
 class TrackerPMProcessorBase;
 ////////////////////////////////////////////////////////////////////////////////
 /** @brief The plugin that does our work */
@@ -131,6 +154,7 @@ public:
     TrackerPMPlugin(OfxImageEffectHandle handle)
     : GenericTrackerPlugin(handle)
     , _score(0)
+    , _search(0)
     , _center(0)
     , _offset(0)
     , _innerBtmLeft(0)
@@ -141,7 +165,8 @@ public:
         _maskClip = getContext() == OFX::eContextFilter ? NULL : fetchClip(getContext() == OFX::eContextPaint ? "Brush" : "Mask");
         assert(!_maskClip || _maskClip->getPixelComponents() == ePixelComponentAlpha);
         _score = fetchChoiceParam(kParamScore);
-        assert(_score);
+        _search = fetchChoiceParam(kParamSearch);
+        assert(_score && _search);
         
         _center = fetchDouble2DParam(kParamTrackingCenterPoint);
         _offset = fetchDouble2DParam(kParamTrackingOffset);
@@ -186,10 +211,12 @@ private:
                          const OFX::Image* maskImg,
                          OfxTime otherTime,
                          const OfxRectD& trackSearchBounds,
-                         const OFX::Image* otherImg);
+                         const OFX::Image* otherImg,
+                         TrackerSearchEnum search);
 
     OFX::Clip *_maskClip;
     ChoiceParam* _score;
+    ChoiceParam* _search;
     
     OFX::Double2DParam* _center;
     OFX::Double2DParam* _offset;
@@ -200,6 +227,123 @@ private:
 };
 
 
+// floor(a/2), also for negative values
+static inline int
+halfFloor(int a)
+{
+    return (a >= 0) ? (a / 2) : -((1 - a) / 2);
+}
+
+// One level of the pyramids used by the coarse-to-fine search.
+// Pixel (x,y) is stored at index (y - rect.y1) * (rect.x2 - rect.x1) + (x - rect.x1).
+struct TrackerPMLevel
+{
+    OfxRectI rect;
+    int nComps;
+    std::vector<float> values; //!< nComps values per pixel
+    std::vector<float> weights; //!< one weight per pixel
+
+    TrackerPMLevel()
+    : rect()
+    , nComps(0)
+    , values()
+    , weights()
+    {
+        rect.x1 = rect.y1 = rect.x2 = rect.y2 = 0;
+    }
+
+    void init(const OfxRectI& r, int n)
+    {
+        rect = r;
+        nComps = n;
+        const size_t nPix = (size_t)(r.x2 - r.x1) * (r.y2 - r.y1);
+        values.assign(nPix * n, 0.f);
+        weights.assign(nPix, 0.f);
+    }
+
+    size_t index(int x, int y) const
+    {
+        return (size_t)(y - rect.y1) * (rect.x2 - rect.x1) + (x - rect.x1);
+    }
+
+    // pixel (x,y), or the nearest pixel if (x,y) is outside of rect (like in the exhaustive search)
+    const float* nearestPixel(int x, int y) const
+    {
+        x = std::max(rect.x1, std::min(x, rect.x2 - 1));
+        y = std::max(rect.y1, std::min(y, rect.y2 - 1));
+        return &values[index(x, y) * nComps];
+    }
+
+    // set this level to src reduced by a factor of 2, using the separable binomial kernel [1 3 3 1]/8.
+    // Values are averaged using the pixel weights, and the weight of the result is the filtered weight.
+    void reduce(const TrackerPMLevel& src)
+    {
+        static const float kernel[4] = { 1.f/8, 3.f/8, 3.f/8, 1.f/8 };
+        OfxRectI r;
+        r.x1 = halfFloor(src.rect.x1);
+        r.y1 = halfFloor(src.rect.y1);
+        r.x2 = halfFloor(src.rect.x2 - 1) + 1;
+        r.y2 = halfFloor(src.rect.y2 - 1) + 1;
+        init(r, src.nComps);
+        float *dstVal = &values[0];
+        float *dstW = &weights[0];
+        for (int y = r.y1; y < r.y2; ++y) {
+            for (int x = r.x1; x < r.x2; ++x, ++dstW, dstVal += nComps) {
+                float wsum = 0.f;
+                for (int i = 0; i < 4; ++i) {
+                    const int sy = 2 * y - 1 + i;
+                    if (sy < src.rect.y1 || src.rect.y2 <= sy) {
+                        continue;
+                    }
+                    for (int j = 0; j < 4; ++j) {
+                        const int sx = 2 * x - 1 + j;
+                        if (sx < src.rect.x1 || src.rect.x2 <= sx) {
+                            continue;
+                        }
+                        const size_t idx = src.index(sx, sy);
+                        const float w = kernel[i] * kernel[j] * src.weights[idx];
+                        wsum += w;
+                        for (int c = 0; c < nComps; ++c) {
+                            dstVal[c] += w * src.values[idx * nComps + c];
+                        }
+                    }
+                }
+                if (wsum > 0.f) {
+                    for (int c = 0; c < nComps; ++c) {
+                        dstVal[c] /= wsum;
+                    }
+                }
+                *dstW = wsum;
+            }
+        }
+    }
+};
+
+// a candidate position of the coarse-to-fine search
+struct TrackerPMCandidate
+{
+    double score;
+    int x;
+    int y;
+};
+
+// insert c into best, which is sorted by increasing score and holds at most n candidates
+static void
+keepBestCandidates(const TrackerPMCandidate& c, size_t n, std::vector<TrackerPMCandidate>* best)
+{
+    if (best->size() == n && !(c.score < best->back().score)) {
+        return;
+    }
+    std::vector<TrackerPMCandidate>::iterator it = best->begin();
+    while (it != best->end() && it->score <= c.score) {
+        ++it;
+    }
+    best->insert(it, c);
+    if (best->size() > n) {
+        best->pop_back();
+    }
+}
+
 class TrackerPMProcessorBase : public OFX::ImageProcessor
 {
 protected:
@@ -228,6 +372,13 @@ public:
     virtual bool setValues(const OFX::Image *ref, const OFX::Image *other, const OFX::Image *mask,
                            const OfxRectI& pattern, const OfxPointI& centeri) = 0;
 
+    /** @brief find the best match in the render window using a coarse-to-fine search, instead of process() */
+    virtual void processCoarseToFine() = 0;
+
+    /** @brief find the best match in the render window using FFTs, instead of process().
+        return false if the FFT engine does not apply to this score or is not worth it. */
+    virtual bool processFFT() = 0;
+
     /**
      * @brief Retrieves the results of the track. Must be called once process() returns so it is thread safe.
      **/
@@ -436,13 +587,44 @@ private:
         ///that minimize the sum of squared differences between the pattern in the ref image
         ///and the pattern in the other image.
 
-        const int scoreComps = std::min(nComponents,3);
         double refMean[3];
-        if (scoreTypeE == eTrackerZNCC) {
-            for (int c = 0; c < 3; ++c) {
-                refMean[c] = 0;
+        computeRefMean<scoreTypeE>(refMean);
+
+        ///we're not interested in the alpha channel for RGBA images
+        for (int y = procWindow.y1; y < procWindow.y2; ++y) {
+            if (_effect.abort()) {
+                break;
+            }
+            
+            for (int x = procWindow.x1; x < procWindow.x2; ++x) {
+                double score = computeScore<scoreTypeE>(x, y, refMean);
+                if (score < bestScore) {
+                    bestScore = score;
+                    point.x = x;
+                    point.y = y;
+                }
             }
         }
+        
+        // do the subpixel refinement, only if the score is a possible winner
+        // TODO: only do this for the best match
+        _bestMatchMutex.lock();
+        if (_bestMatch.second < bestScore) {
+            _bestMatchMutex.unlock();
+        } else {
+            // don't block other threads
+            _bestMatchMutex.unlock();
+            refineAndSetBestMatch<scoreTypeE>(point, bestScore, refMean);
+        }
+    }
+
+    template<enum TrackerScoreEnum scoreTypeE>
+    void computeRefMean(double refMean[3])
+    {
+        const int scoreComps = std::min(nComponents,3);
+        for (int c = 0; c < 3; ++c) {
+            refMean[c] = 0;
+        }
         if (scoreTypeE == eTrackerZNCC) {
             // sliding pointers
             long patternIdx = 0; // sliding index
@@ -461,67 +643,341 @@ private:
                 refMean[c] /= _weightTotal;
             }
         }
+    }
 
-        ///we're not interested in the alpha channel for RGBA images
-        for (int y = procWindow.y1; y < procWindow.y2; ++y) {
-            if (_effect.abort()) {
-                break;
+    // compute the subpixel position around the integer position point, and set it as the best match if it is better
+    template<enum TrackerScoreEnum scoreTypeE>
+    void refineAndSetBestMatch(const OfxPointI& point, double bestScore, const double refMean[3])
+    {
+        double dx = 0.;
+        double dy = 0.;
+        // compute subpixel position.
+        double scorepc = computeScore<scoreTypeE>(point.x - 1, point.y, refMean);
+        double scorenc = computeScore<scoreTypeE>(point.x + 1, point.y, refMean);
+        if (bestScore < scorepc && bestScore <= scorenc) {
+            // don't simplify the denominator in the following expression,
+            // 2*bestScore - scorenc - scorepc may cause an underflow.
+            double factor = 1./((bestScore - scorenc) + (bestScore - scorepc));
+            if (factor != 0.) {
+                dx = 0.5 * (scorenc - scorepc) * factor;
+                assert(-0.5 < dx && dx <= 0.5);
             }
-            
-            for (int x = procWindow.x1; x < procWindow.x2; ++x) {
-                double score = computeScore<scoreTypeE>(x, y, refMean);
-                if (score < bestScore) {
-                    bestScore = score;
-                    point.x = x;
-                    point.y = y;
+        }
+        double scorecp = computeScore<scoreTypeE>(point.x, point.y - 1, refMean);
+        double scorecn = computeScore<scoreTypeE>(point.x, point.y + 1, refMean);
+        if (bestScore < scorecp && bestScore <= scorecn) {
+            // don't simplify the denominator in the following expression,
+            // 2*bestScore - scorenc - scorepc may cause an underflow.
+            double factor = 1./((bestScore - scorecn) + (bestScore - scorecp));
+            if (factor != 0.) {
+                dy = 0.5 * (scorecn - scorecp) /((bestScore - scorecn) + (bestScore - scorecp));
+                assert(-0.5 < dy && dy <= 0.5);
+            }
+        }
+        // check again...
+        {
+            OFX::MultiThread::AutoMutex lock(_bestMatchMutex);
+            if (_bestMatch.second > bestScore) {
+                _bestMatch.second = bestScore;
+                _bestMatch.first.x = point.x + dx;
+                _bestMatch.first.y = point.y + dy;
+            }
+        }
+    }
+
+    virtual void processCoarseToFine()
+    {
+        coarseToFine<scoreType>();
+    }
+
+    // score of the pattern level at position (x,y) of the other level.
+    // This is the same as computeScore(), on the levels of the pyramid.
+    template<enum TrackerScoreEnum scoreTypeE>
+    static double levelScore(const TrackerPMLevel& pattern, const double patternMean[3], const TrackerPMLevel& other, int x, int y)
+    {
+        const int nComps = pattern.nComps;
+        double otherMean[3] = { 0., 0., 0. };
+        if (scoreTypeE == eTrackerZNCC) {
+            double weightTotal = 0.;
+            const float *weightPtr = &pattern.weights[0];
+            for (int i = pattern.rect.y1; i < pattern.rect.y2; ++i) {
+                for (int j = pattern.rect.x1; j < pattern.rect.x2; ++j, ++weightPtr) {
+                    const float *otherPix = other.nearestPixel(x + j, y + i);
+                    for (int c = 0; c < nComps; ++c) {
+                        otherMean[c] += *weightPtr * otherPix[c];
+                    }
+                    weightTotal += *weightPtr;
                 }
             }
+            if (weightTotal <= 0.) {
+                return std::numeric_limits<double>::infinity();
+            }
+            for (int c = 0; c < nComps; ++c) {
+                otherMean[c] /= weightTotal;
+            }
         }
-        
-        // do the subpixel refinement, only if the score is a possible winner
-        // TODO: only do this for the best match
-        double dx = 0.;
-        double dy = 0.;
 
-        _bestMatchMutex.lock();
-        if (_bestMatch.second < bestScore) {
-            _bestMatchMutex.unlock();
-        } else {
-            // don't block other threads
-            _bestMatchMutex.unlock();
-            // compute subpixel position.
-            double scorepc = computeScore<scoreTypeE>(point.x - 1, point.y, refMean);
-            double scorenc = computeScore<scoreTypeE>(point.x + 1, point.y, refMean);
-            if (bestScore < scorepc && bestScore <= scorenc) {
-                // don't simplify the denominator in the following expression,
-                // 2*bestScore - scorenc - scorepc may cause an underflow.
-                double factor = 1./((bestScore - scorenc) + (bestScore - scorepc));
-                if (factor != 0.) {
-                    dx = 0.5 * (scorenc - scorepc) * factor;
-                    assert(-0.5 < dx && dx <= 0.5);
+        double score = 0.;
+        double otherSsq = 0.;
+        const float *weightPtr = &pattern.weights[0];
+        const float *patternPtr = &pattern.values[0];
+        for (int i = pattern.rect.y1; i < pattern.rect.y2; ++i) {
+            for (int j = pattern.rect.x1; j < pattern.rect.x2; ++j, ++weightPtr, patternPtr += nComps) {
+                const double weight = *weightPtr;
+                if (weight == 0.) {
+                    continue;
                 }
+                const float *otherPix = other.nearestPixel(x + j, y + i);
+                for (int c = 0; c < nComps; ++c) {
+                    switch (scoreTypeE) {
+                        case eTrackerSSD: {
+                            const double d = (double)patternPtr[c] - otherPix[c];
+                            score += weight * weight * d * d;
+                        }   break;
+                        case eTrackerSAD:
+                            score += weight * std::abs((double)patternPtr[c] - otherPix[c]);
+                            break;
+                        case eTrackerNCC:
+                            score -= weight * (double)patternPtr[c] * otherPix[c];
+                            otherSsq += weight * (double)otherPix[c] * otherPix[c];
+                            break;
+                        case eTrackerZNCC: {
+                            const double o = otherPix[c] - otherMean[c];
+                            score -= weight * (patternPtr[c] - patternMean[c]) * o;
+                            otherSsq += weight * o * o;
+                        }   break;
+                    }
+                }
+            }
+        }
+        if (scoreTypeE == eTrackerNCC || scoreTypeE == eTrackerZNCC) {
+            double sdev = std::sqrt(otherSsq);
+            if (sdev != 0.) {
+                score /= sdev;
+            } else {
+                score = std::numeric_limits<double>::infinity();
             }
-            double scorecp = computeScore<scoreTypeE>(point.x, point.y - 1, refMean);
-            double scorecn = computeScore<scoreTypeE>(point.x, point.y + 1, refMean);
-            if (bestScore < scorecp && bestScore <= scorecn) {
-                // don't simplify the denominator in the following expression,
-                // 2*bestScore - scorenc - scorepc may cause an underflow.
-                double factor = 1./((bestScore - scorecn) + (bestScore - scorecp));
-                if (factor != 0.) {
-                    dy = 0.5 * (scorecn - scorecp) /((bestScore - scorecn) + (bestScore - scorecp));
-                    assert(-0.5 < dy && dy <= 0.5);
+        }
+        return score;
+    }
+
+    // exhaustive search at the coarsest level of the pyramids, then refine the best candidates
+    // in a neighborhood of their position at each finer level. The finest level uses computeScore().
+    template<enum TrackerScoreEnum scoreTypeE>
+    void coarseToFine()
+    {
+        assert(_patternImg.get() && _patternData && _weightImg.get() && _weightData && _otherImg && _weightTotal > 0.);
+        const int scoreComps = std::min(nComponents, 3);
+        const OfxRectI& window = _renderWindow;
+
+        // the number of levels is limited by the pattern size, and it is useless to go further
+        // once the search window is a single pixel
+        const int patternW = _refRectPixel.x2 - _refRectPixel.x1;
+        const int patternH = _refRectPixel.y2 - _refRectPixel.y1;
+        const int windowW = window.x2 - window.x1;
+        const int windowH = window.y2 - window.y1;
+        int nLevels = 1;
+        while (nLevels < kTrackerPMPyramidMaxLevels &&
+               (patternW >> nLevels) >= kTrackerPMPyramidMinPatternSize &&
+               (patternH >> nLevels) >= kTrackerPMPyramidMinPatternSize &&
+               ((windowW >> (nLevels - 1)) > 1 || (windowH >> (nLevels - 1)) > 1)) {
+            ++nLevels;
+        }
+        if (nLevels == 1) {
+            // nothing to gain
+            process();
+            return;
+        }
+
+        // level 0 of the pyramids
+        std::vector<TrackerPMLevel> pattern(nLevels);
+        std::vector<TrackerPMLevel> other(nLevels);
+        std::vector<OfxRectI> searchWindow(nLevels);
+        pattern[0].init(_refRectPixel, scoreComps);
+        {
+            const PIX *patternPtr = _patternData;
+            for (size_t k = 0; k < pattern[0].weights.size(); ++k, patternPtr += nComponents) {
+                pattern[0].weights[k] = _weightData[k];
+                for (int c = 0; c < scoreComps; ++c) {
+                    pattern[0].values[k * scoreComps + c] = patternPtr[c];
                 }
             }
-            // check again...
-            {
-                OFX::MultiThread::AutoMutex lock(_bestMatchMutex);
-                if (_bestMatch.second > bestScore) {
-                    _bestMatch.second = bestScore;
-                    _bestMatch.first.x = point.x + dx;
-                    _bestMatch.first.y = point.y + dy;
+        }
+        extractOther(&other[0]);
+        searchWindow[0] = window;
+        for (int l = 1; l < nLevels; ++l) {
+            pattern[l].reduce(pattern[l - 1]);
+            other[l].reduce(other[l - 1]);
+            searchWindow[l].x1 = halfFloor(searchWindow[l - 1].x1);
+            searchWindow[l].y1 = halfFloor(searchWindow[l - 1].y1);
+            searchWindow[l].x2 = halfFloor(searchWindow[l - 1].x2 - 1) + 1;
+            searchWindow[l].y2 = halfFloor(searchWindow[l - 1].y2 - 1) + 1;
+        }
+        if (_effect.abort()) {
+            return;
+        }
+
+        // exhaustive search at the coarsest level
+        std::vector<TrackerPMCandidate> best;
+        {
+            const int l = nLevels - 1;
+            double patternMean[3];
+            levelMean(pattern[l], patternMean);
+            for (int y = searchWindow[l].y1; y < searchWindow[l].y2; ++y) {
+                for (int x = searchWindow[l].x1; x < searchWindow[l].x2; ++x) {
+                    TrackerPMCandidate cand = { levelScore<scoreTypeE>(pattern[l], patternMean, other[l], x, y), x, y };
+                    keepBestCandidates(cand, kTrackerPMPyramidCandidates, &best);
                 }
             }
+        }
 
+        // refine the candidates at each finer level
+        double refMean[3];
+        computeRefMean<scoreTypeE>(refMean);
+        for (int l = nLevels - 2; l >= 0; --l) {
+            if (_effect.abort()) {
+                return;
+            }
+            double patternMean[3];
+            if (l > 0) {
+                levelMean(pattern[l], patternMean);
+            }
+            const OfxRectI& win = searchWindow[l];
+            const size_t nBest = (l > 0) ? kTrackerPMPyramidCandidates : 1;
+            std::vector<TrackerPMCandidate> coarse;
+            coarse.swap(best);
+            std::vector<TrackerPMCandidate> visited;
+            for (size_t k = 0; k < coarse.size(); ++k) {
+                if (coarse[k].score == std::numeric_limits<double>::infinity()) {
+                    continue;
+                }
+                // the neighborhood of (2x+0.5,2y+0.5) at this level
+                for (int y = std::max(win.y1, 2 * coarse[k].y - 1); y <= std::min(win.y2 - 1, 2 * coarse[k].y + 2); ++y) {
+                    for (int x = std::max(win.x1, 2 * coarse[k].x - 1); x <= std::min(win.x2 - 1, 2 * coarse[k].x + 2); ++x) {
+                        bool done = false;
+                        for (size_t v = 0; v < visited.size() && !done; ++v) {
+                            done = (visited[v].x == x && visited[v].y == y);
+                        }
+                        if (done) {
+                            continue;
+                        }
+                        TrackerPMCandidate cand = { 0., x, y };
+                        visited.push_back(cand);
+                        cand.score = (l > 0) ? levelScore<scoreTypeE>(pattern[l], patternMean, other[l], x, y) : computeScore<scoreTypeE>(x, y, refMean);
+                        keepBestCandidates(cand, nBest, &best);
+                    }
+                }
+            }
+        }
+        if (best.empty() || best[0].score == std::numeric_limits<double>::infinity()) {
+            return;
+        }
+        OfxPointI point;
+        point.x = best[0].x;
+        point.y = best[0].y;
+        refineAndSetBestMatch<scoreTypeE>(point, best[0].score, refMean);
+    }
+
+    virtual bool processFFT()
+    {
+        if (scoreType != eTrackerNCC && scoreType != eTrackerZNCC) {
+            return false;
+        }
+        if (!trackerPMUseFFT(_refRectPixel.x2 - _refRectPixel.x1, _refRectPixel.y2 - _refRectPixel.y1,
+                             _renderWindow.x2 - _renderWindow.x1, _renderWindow.y2 - _renderWindow.y1)) {
+            return false;
+        }
+        correlateFFT<scoreType>();
+        return true;
+    }
+
+    // Compute the NCC or ZNCC score on the whole render window at once, see trackerPMBestMatchFFT().
+    template<enum TrackerScoreEnum scoreTypeE>
+    void correlateFFT()
+    {
+        assert(scoreTypeE == eTrackerNCC || scoreTypeE == eTrackerZNCC);
+        assert(_patternImg.get() && _patternData && _weightImg.get() && _weightData && _otherImg && _weightTotal > 0.);
+        const int scoreComps = std::min(nComponents, 3);
+        const int patternW = _refRectPixel.x2 - _refRectPixel.x1;
+        const int patternH = _refRectPixel.y2 - _refRectPixel.y1;
+        const size_t patternSize = (size_t)patternW * patternH;
+
+        TrackerPMLevel other;
+        extractOther(&other);
+        assert(other.rect.x2 - other.rect.x1 - patternW + 1 == _renderWindow.x2 - _renderWindow.x1 &&
+               other.rect.y2 - other.rect.y1 - patternH + 1 == _renderWindow.y2 - _renderWindow.y1);
+        std::vector<float> pattern(patternSize * scoreComps);
+        for (size_t k = 0; k < patternSize; ++k) {
+            for (int c = 0; c < scoreComps; ++c) {
+                pattern[k * scoreComps + c] = _patternData[k * nComponents + c];
+            }
+        }
+
+        double refMean[3];
+        computeRefMean<scoreTypeE>(refMean); // zero for NCC
+
+        int u, v;
+        double bestScore;
+        bool found = trackerPMBestMatchFFT(scoreTypeE == eTrackerZNCC,
+                                           &other.values[0], other.rect.x2 - other.rect.x1, other.rect.y2 - other.rect.y1,
+                                           &pattern[0], _weightData, patternW, patternH,
+                                           scoreComps, refMean, _weightTotal,
+                                           &u, &v, &bestScore);
+        if (!found || _effect.abort()) {
+            return;
+        }
+        OfxPointI point;
+        point.x = _renderWindow.x1 + u;
+        point.y = _renderWindow.y1 + v;
+        // use the exact score, so that the subpixel refinement is the same as with the exhaustive search
+        bestScore = computeScore<scoreTypeE>(point.x, point.y, refMean);
+        refineAndSetBestMatch<scoreTypeE>(point, bestScore, refMean);
+    }
+
+    // extract the pixels of the other image covered by the pattern when it is at any position of the render window
+    void extractOther(TrackerPMLevel* other)
+    {
+        const int scoreComps = std::min(nComponents, 3);
+        OfxRectI otherRect;
+        otherRect.x1 = _renderWindow.x1 + _refRectPixel.x1;
+        otherRect.y1 = _renderWindow.y1 + _refRectPixel.y1;
+        otherRect.x2 = _renderWindow.x2 + _refRectPixel.x2 - 1;
+        otherRect.y2 = _renderWindow.y2 + _refRectPixel.y2 - 1;
+        other->init(otherRect, scoreComps);
+        const OfxRectI& bounds = _otherImg->getBounds();
+        float *otherVal = &other->values[0];
+        for (int y = otherRect.y1; y < otherRect.y2; ++y) {
+            // take nearest pixel in other image (more chance to get a track than with black)
+            const int othery = std::max(bounds.y1, std::min(y, bounds.y2 - 1));
+            for (int x = otherRect.x1; x < otherRect.x2; ++x, otherVal += scoreComps) {
+                const int otherx = std::max(bounds.x1, std::min(x, bounds.x2 - 1));
+                const PIX *otherPix = (const PIX *) _otherImg->getPixelAddress(otherx, othery);
+                assert(otherPix);
+                for (int c = 0; c < scoreComps; ++c) {
+                    otherVal[c] = otherPix[c];
+                }
+            }
+        }
+        std::fill(other->weights.begin(), other->weights.end(), 1.f);
+    }
+
+    // weighted mean of a pattern level
+    static void levelMean(const TrackerPMLevel& pattern, double mean[3])
+    {
+        double weightTotal = 0.;
+        for (int c = 0; c < 3; ++c) {
+            mean[c] = 0.;
+        }
+        for (size_t k = 0; k < pattern.weights.size(); ++k) {
+            for (int c = 0; c < pattern.nComps; ++c) {
+                mean[c] += pattern.weights[k] * pattern.values[k * pattern.nComps + c];
+            }
+            weightTotal += pattern.weights[k];
+        }
+        if (weightTotal > 0.) {
+            for (int c = 0; c < pattern.nComps; ++c) {
+                mean[c] /= weightTotal;
+            }
         }
     }
 
@@ -682,7 +1138,8 @@ TrackerPMPlugin::setupAndProcess(TrackerPMProcessorBase &processor,
                                  const OFX::Image* maskImg,
                                  OfxTime otherTime,
                                  const OfxRectD& trackSearchBounds,
-                                 const OFX::Image* otherImg)
+                                 const OFX::Image* otherImg,
+                                 TrackerSearchEnum search)
 {
     const double par = _srcClip->getPixelAspectRatio();
     const OfxPointD rsOne = {1., 1.};
@@ -720,8 +1177,12 @@ TrackerPMPlugin::setupAndProcess(TrackerPMProcessorBase &processor,
         // can't track: erase any existing track
         _center->deleteKeyAtTime(otherTime);
     } else {
-        // Call the base class process member, this will call the derived templated process code
-        processor.process();
+        if (search == eTrackerSearchCoarseToFine) {
+            processor.processCoarseToFine();
+        } else if (!processor.processFFT()) {
+            // Call the base class process member, this will call the derived templated process code
+            processor.process();
+        }
 
         //////////////////////////////////
         // TODO: subpixel interpolation //
@@ -773,23 +1234,26 @@ TrackerPMPlugin::trackInternalForDepth(OfxTime refTime,
     int scoreI;
     _score->getValueAtTime(refTime, scoreI);
     TrackerScoreEnum typeE = (TrackerScoreEnum)scoreI;
+    int searchI;
+    _search->getValueAtTime(refTime, searchI);
+    TrackerSearchEnum search = (TrackerSearchEnum)searchI;
 
     switch (typeE) {
         case eTrackerSSD: {
             TrackerPMProcessor<PIX, nComponents, maxValue, eTrackerSSD> fred(*this);
-            setupAndProcess(fred, refTime, refBounds, refCenter, refCenterWithOffset, refImg, maskImg, otherTime, trackSearchBounds, otherImg);
+            setupAndProcess(fred, refTime, refBounds, refCenter, refCenterWithOffset, refImg, maskImg, otherTime, trackSearchBounds, otherImg, search);
         }   break;
         case eTrackerSAD: {
             TrackerPMProcessor<PIX, nComponents, maxValue, eTrackerSAD> fred(*this);
-            setupAndProcess(fred, refTime, refBounds, refCenter, refCenterWithOffset, refImg, maskImg, otherTime, trackSearchBounds, otherImg);
+            setupAndProcess(fred, refTime, refBounds, refCenter, refCenterWithOffset, refImg, maskImg, otherTime, trackSearchBounds, otherImg, search);
         }   break;
         case eTrackerNCC: {
             TrackerPMProcessor<PIX, nComponents, maxValue, eTrackerNCC> fred(*this);
-            setupAndProcess(fred, refTime, refBounds, refCenter, refCenterWithOffset,  refImg, maskImg, otherTime, trackSearchBounds, otherImg);
+            setupAndProcess(fred, refTime, refBounds, refCenter, refCenterWithOffset,  refImg, maskImg, otherTime, trackSearchBounds, otherImg, search);
         }   break;
         case eTrackerZNCC: {
             TrackerPMProcessor<PIX, nComponents, maxValue, eTrackerZNCC> fred(*this);
-            setupAndProcess(fred, refTime, refBounds, refCenter, refCenterWithOffset, refImg, maskImg, otherTime, trackSearchBounds, otherImg);
+            setupAndProcess(fred, refTime, refBounds, refCenter, refCenterWithOffset, refImg, maskImg, otherTime, trackSearchBounds, otherImg, search);
         }   break;
     }
 }
@@ -1058,6 +1522,21 @@ void TrackerPMPluginFactory::describeInContext(OFX::ImageEffectDescriptor &desc,
             page->addChild(*param);
         }
     }
+
+    // search
+    {
+        ChoiceParamDescriptor* param = desc.defineChoiceParam(kParamSearch);
+        param->setLabel(kParamSearchLabel);
+        param->setHint(kParamSearchHint);
+        assert(param->getNOptions() == eTrackerSearchExhaustive);
+        param->appendOption(kParamSearchOptionExhaustive, kParamSearchOptionExhaustiveHint);
+        assert(param->getNOptions() == eTrackerSearchCoarseToFine);
+        param->appendOption(kParamSearchOptionCoarseToFine, kParamSearchOptionCoarseToFineHint);
+        param->setDefault((int)eTrackerSearchExhaustive);
+        if (page) {
+            page->addChild(*param);
+        }
+    }
 }
 
 
@@ -0,0 +1,394 @@
+/*
+ Basic tracker with exhaustive search algorithm OFX plugin: FFT correlation.
+ 
+ Copyright (C) 2014 INRIA
+ 
+ Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+ 
+ Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+ 
+ Redistributions in binary form must reproduce the above copyright notice, this
+ list of conditions and the following disclaimer in the documentation and/or
+ other materials provided with the distribution.
+ 
+ Neither the name of the {organization} nor the names of its
+ contributors may be used to endorse or promote products derived from
+ this software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ INRIA
+ Domaine de Voluceau
+ Rocquencourt - B.P. 105
+ 78153 Le Chesnay Cedex - France
+ 
+ 
+ The skeleton for this source file is from:
+ OFX Basic Example plugin, a plugin that illustrates the use of the OFX Support library.
+ 
+ Copyright (C) 2004-2005 The Open Effects Association Ltd
+ Author Bruno Nicoletti bruno@thefoundry.co.uk
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice,
+ this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ * Neither the name The Open Effects Association Ltd, nor the names of its
+ contributors may be used to endorse or promote products derived from this
+ software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ 
+ The Open Effects Association Ltd
+ 1 Wardour St
+ London W1D 6PA
+ England
+ 
+ */
+
+/*
+ The FFT engine of the NCC and ZNCC scores of TrackerPM. It has no dependency on the OFX
+ API, so that it can be compared with the exhaustive search outside of a host (see tests/).
+ */
+
+#ifndef TrackerPM_TrackerPMCorrelator_h
+#define TrackerPM_TrackerPMCorrelator_h
+
+#include <cmath>
+#include <cassert>
+#include <limits>
+#include <vector>
+#include <algorithm>
+#include <complex>
+
+#ifndef M_PI
+#define M_PI        3.14159265358979323846264338327950288   /* pi             */
+#endif
+
+// NCC and ZNCC scores are computed using FFTs when (pattern area) x (search window area) is at least this
+#define kTrackerPMFFTMinCost (1 << 18)
+// with FFTs, the other image is considered constant under the pattern if its variance is below this (relative to the max)
+#define kTrackerPMFFTRelativeTolerance 1e-9
+
+typedef std::complex<double> TrackerPMComplex;
+typedef std::vector<TrackerPMComplex> TrackerPMSpectrum;
+
+inline int
+nextPowerOfTwo(int n)
+{
+    int p = 1;
+    while (p < n) {
+        p <<= 1;
+    }
+    return p;
+}
+
+// in-place radix-2 FFT of n values (n must be a power of two).
+// The inverse transform is not normalized.
+inline void
+fft1D(TrackerPMComplex* data, int n, bool inverse)
+{
+    // bit-reversal permutation
+    for (int i = 1, j = 0; i < n; ++i) {
+        int bit = n >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j) {
+            std::swap(data[i], data[j]);
+        }
+    }
+    std::vector<TrackerPMComplex> twiddle(n / 2);
+    for (int len = 2; len <= n; len <<= 1) {
+        const int half = len / 2;
+        const double angle = (inverse ? 2. : -2.) * M_PI / len;
+        for (int k = 0; k < half; ++k) {
+            twiddle[k] = std::polar(1., angle * k);
+        }
+        for (int i = 0; i < n; i += len) {
+            for (int k = 0; k < half; ++k) {
+                const TrackerPMComplex u = data[i + k];
+                const TrackerPMComplex v = data[i + k + half] * twiddle[k];
+                data[i + k] = u + v;
+                data[i + k + half] = u - v;
+            }
+        }
+    }
+}
+
+// in-place 2D FFT of a w x h array stored by rows (w and h must be powers of two)
+inline void
+fft2D(TrackerPMSpectrum& data, int w, int h, bool inverse)
+{
+    for (int y = 0; y < h; ++y) {
+        fft1D(&data[(size_t)y * w], w, inverse);
+    }
+    std::vector<TrackerPMComplex> column(h);
+    for (int x = 0; x < w; ++x) {
+        for (int y = 0; y < h; ++y) {
+            column[y] = data[(size_t)y * w + x];
+        }
+        fft1D(&column[0], h, inverse);
+        for (int y = 0; y < h; ++y) {
+            data[(size_t)y * w + x] = column[y];
+        }
+    }
+}
+
+// Cross-correlation of kernels with images, for all positions where the kernel fits in the image:
+// result(u,v) = sum_{j,i} kernel(j,i) * image(u+j,v+i), for 0 <= u <= imageW-kernelW, 0 <= v <= imageH-kernelH.
+// The FFT computes a circular correlation, but there is no wrap-around on these positions
+// since the FFT size is at least the image size.
+class TrackerPMCorrelator
+{
+public:
+    TrackerPMCorrelator(int imageW, int imageH, int kernelW, int kernelH)
+    : _imageW(imageW)
+    , _imageH(imageH)
+    , _kernelW(kernelW)
+    , _kernelH(kernelH)
+    , _fftW(nextPowerOfTwo(imageW))
+    , _fftH(nextPowerOfTwo(imageH))
+    {
+        assert(kernelW <= imageW && kernelH <= imageH);
+    }
+
+    int resultWidth() const { return _imageW - _kernelW + 1; }
+    int resultHeight() const { return _imageH - _kernelH + 1; }
+
+    // spectrum of a w x h array (either the image or the kernel), padded with zeroes
+    void transform(const std::vector<double>& src, int w, int h, TrackerPMSpectrum* spectrum) const
+    {
+        spectrum->assign((size_t)_fftW * _fftH, TrackerPMComplex(0.));
+        for (int y = 0; y < h; ++y) {
+            for (int x = 0; x < w; ++x) {
+                (*spectrum)[(size_t)y * _fftW + x] = src[(size_t)y * w + x];
+            }
+        }
+        fft2D(*spectrum, _fftW, _fftH, false);
+    }
+
+    // sum += image * conj(kernel), which is the spectrum of the correlation
+    void accumulate(const TrackerPMSpectrum& image, const TrackerPMSpectrum& kernel, TrackerPMSpectrum* sum) const
+    {
+        if (sum->empty()) {
+            sum->assign(image.size(), TrackerPMComplex(0.));
+        }
+        for (size_t k = 0; k < image.size(); ++k) {
+            (*sum)[k] += image[k] * std::conj(kernel[k]);
+        }
+    }
+
+    // the correlation corresponding to a spectrum computed by accumulate(). spectrum is destroyed.
+    void inverse(TrackerPMSpectrum& spectrum, std::vector<double>* result) const
+    {
+        fft2D(spectrum, _fftW, _fftH, true);
+        const double norm = 1. / ((double)_fftW * _fftH);
+        const int rw = resultWidth();
+        const int rh = resultHeight();
+        result->resize((size_t)rw * rh);
+        for (int v = 0; v < rh; ++v) {
+            for (int u = 0; u < rw; ++u) {
+                (*result)[(size_t)v * rw + u] = spectrum[(size_t)v * _fftW + u].real() * norm;
+            }
+        }
+    }
+
+    // the sums of a w x h image over all the kernel-sized boxes, times scale, using a summed-area table.
+    // This is the correlation with a constant kernel.
+    void boxSums(const std::vector<double>& image, double scale, std::vector<double>* result) const
+    {
+        const int w = _imageW;
+        const int h = _imageH;
+        std::vector<double> sat((size_t)(w + 1) * (h + 1), 0.);
+        for (int y = 0; y < h; ++y) {
+            double row = 0.;
+            for (int x = 0; x < w; ++x) {
+                row += image[(size_t)y * w + x];
+                sat[(size_t)(y + 1) * (w + 1) + x + 1] = sat[(size_t)y * (w + 1) + x + 1] + row;
+            }
+        }
+        const int rw = resultWidth();
+        const int rh = resultHeight();
+        result->resize((size_t)rw * rh);
+        for (int v = 0; v < rh; ++v) {
+            for (int u = 0; u < rw; ++u) {
+                (*result)[(size_t)v * rw + u] = scale * (sat[(size_t)(v + _kernelH) * (w + 1) + u + _kernelW] -
+                                                         sat[(size_t)v * (w + 1) + u + _kernelW] -
+                                                         sat[(size_t)(v + _kernelH) * (w + 1) + u] +
+                                                         sat[(size_t)v * (w + 1) + u]);
+            }
+        }
+    }
+
+private:
+    int _imageW;
+    int _imageH;
+    int _kernelW;
+    int _kernelH;
+    int _fftW;
+    int _fftH;
+};
+
+/// Whether the NCC and ZNCC scores of a pattern on a search window should be computed with FFTs
+inline bool
+trackerPMUseFFT(int patternW, int patternH, int windowW, int windowH)
+{
+    const double patternArea = (double)patternW * patternH;
+    const double windowArea = (double)windowW * windowH;
+    return patternArea * windowArea >= kTrackerPMFFTMinCost;
+}
+
+/// Find the best NCC (zncc = false) or ZNCC score of a pattern at all the positions of a search window, using FFTs.
+/// With o the other image, p the pattern, w the weights and W their sum, the NCC score is
+///   -sum(w.p.o) / sqrt(sum(w.o^2))
+/// and the ZNCC score is
+///   -sum(w.(p-mean(p)).o) / sqrt(sum(w.o^2) - sum(w.o)^2/W)
+/// (summed over the components). The sums involving p are correlations computed with FFTs.
+/// The sums of w.o and w.o^2 are computed with summed-area tables if the weights are uniform, else with FFTs.
+///
+/// other holds the otherW x otherH pixels covered by the pattern at all the positions, and the pattern and
+/// weights are patternW x patternH. Pixels have nComps values, stored by rows. patternMean is the weighted
+/// mean of the pattern (only used for ZNCC) and weightTotal is W.
+/// The best position (*u,*v) is relative to the first position, and the first best one is returned, in row order.
+/// Returns false if the score is infinite at all positions.
+inline bool
+trackerPMBestMatchFFT(bool zncc,
+                      const float* other, int otherW, int otherH,
+                      const float* pattern, const float* weights, int patternW, int patternH,
+                      int nComps, const double patternMean[3], double weightTotal,
+                      int* bestU, int* bestV, double* bestScore)
+{
+    assert(nComps >= 1 && nComps <= 3);
+    const size_t patternSize = (size_t)patternW * patternH;
+    const size_t otherSize = (size_t)otherW * otherH;
+    TrackerPMCorrelator correlator(otherW, otherH, patternW, patternH);
+
+    bool uniform = true;
+    for (size_t k = 1; k < patternSize && uniform; ++k) {
+        uniform = (weights[k] == weights[0]);
+    }
+
+    std::vector<double> image(otherSize);
+    std::vector<double> kernel(patternSize);
+    TrackerPMSpectrum otherSpectrum[3];
+    TrackerPMSpectrum kernelSpectrum;
+    TrackerPMSpectrum sumSpectrum;
+
+    // numerator: correlation of w.(p-mean(p)) with o
+    for (int c = 0; c < nComps; ++c) {
+        for (size_t k = 0; k < otherSize; ++k) {
+            image[k] = other[k * nComps + c];
+        }
+        correlator.transform(image, otherW, otherH, &otherSpectrum[c]);
+        const double mean = zncc ? patternMean[c] : 0.;
+        for (size_t k = 0; k < patternSize; ++k) {
+            kernel[k] = weights[k] * ((double)pattern[k * nComps + c] - mean);
+        }
+        correlator.transform(kernel, patternW, patternH, &kernelSpectrum);
+        correlator.accumulate(otherSpectrum[c], kernelSpectrum, &sumSpectrum);
+    }
+    std::vector<double> numerator;
+    correlator.inverse(sumSpectrum, &numerator);
+
+    // sum(w.o^2), and sum(w.o) for ZNCC
+    std::vector<double> sumSq;
+    std::vector<double> sum[3];
+    for (size_t k = 0; k < otherSize; ++k) {
+        double sq = 0.;
+        for (int c = 0; c < nComps; ++c) {
+            const double o = other[k * nComps + c];
+            sq += o * o;
+        }
+        image[k] = sq;
+    }
+    if (uniform) {
+        correlator.boxSums(image, weights[0], &sumSq);
+        if (zncc) {
+            for (int c = 0; c < nComps; ++c) {
+                for (size_t k = 0; k < otherSize; ++k) {
+                    image[k] = other[k * nComps + c];
+                }
+                correlator.boxSums(image, weights[0], &sum[c]);
+            }
+        }
+    } else {
+        for (size_t k = 0; k < patternSize; ++k) {
+            kernel[k] = weights[k];
+        }
+        TrackerPMSpectrum weightSpectrum;
+        correlator.transform(kernel, patternW, patternH, &weightSpectrum);
+        TrackerPMSpectrum imageSpectrum;
+        correlator.transform(image, otherW, otherH, &imageSpectrum);
+        sumSpectrum.clear();
+        correlator.accumulate(imageSpectrum, weightSpectrum, &sumSpectrum);
+        correlator.inverse(sumSpectrum, &sumSq);
+        if (zncc) {
+            for (int c = 0; c < nComps; ++c) {
+                sumSpectrum.clear();
+                correlator.accumulate(otherSpectrum[c], weightSpectrum, &sumSpectrum);
+                correlator.inverse(sumSpectrum, &sum[c]);
+            }
+        }
+    }
+
+    // scores, in the same order as the exhaustive search
+    double maxSq = 0.;
+    for (size_t k = 0; k < sumSq.size(); ++k) {
+        maxSq = std::max(maxSq, sumSq[k]);
+    }
+    const double tolerance = kTrackerPMFFTRelativeTolerance * maxSq;
+    *bestScore = std::numeric_limits<double>::infinity();
+    *bestU = -1;
+    *bestV = -1;
+    const int resultW = correlator.resultWidth();
+    const int resultH = correlator.resultHeight();
+    for (int v = 0; v < resultH; ++v) {
+        for (int u = 0; u < resultW; ++u) {
+            const size_t k = (size_t)v * resultW + u;
+            double ssq = sumSq[k];
+            if (zncc) {
+                for (int c = 0; c < nComps; ++c) {
+                    ssq -= sum[c][k] * sum[c][k] / weightTotal;
+                }
+            }
+            // otherwise the other image is constant (ZNCC) or zero (NCC), and the score is infinite
+            if (ssq > tolerance) {
+                const double score = -numerator[k] / std::sqrt(ssq);
+                if (score < *bestScore) {
+                    *bestScore = score;
+                    *bestU = u;
+                    *bestV = v;
+                }
+            }
+        }
+    }
+    return *bestScore != std::numeric_limits<double>::infinity();
+}
+
+#endif // TrackerPM_TrackerPMCorrelator_h
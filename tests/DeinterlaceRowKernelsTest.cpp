@@ -0,0 +1,215 @@
+/*
+ Compare the vectorized Yadif line functions of Deinterlace with the scalar filter_line_c.
+
+ Synthetic interlaced frames are deinterlaced like DeinterlaceProcessor does, line by line and
+ in tiles, once with the scalar code only and once with each line function available on this CPU.
+ The results must have exactly the same bits (any NaN is equal to any NaN).
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cfloat>
+#include <limits>
+#include <vector>
+
+#include "DeinterlaceYadif.h"
+
+static int s_failures = 0;
+
+enum PatternEnum
+{
+    ePatternRandom,     // random values over the full range
+    ePatternSmallRange, // a few close values, so that the spatial scores are often equal
+    ePatternMoving,     // a diagonal edge and a bar moving between the fields, which makes combing
+    ePatternSpecial,    // float images: NaN, infinities, denormals and signed zeroes among the values
+};
+
+static const char*
+patternName(PatternEnum p)
+{
+    switch (p) {
+        case ePatternRandom: return "random";
+        case ePatternSmallRange: return "small range";
+        case ePatternMoving: return "moving edges";
+        case ePatternSpecial: return "special values";
+    }
+    return "?";
+}
+
+template <typename Comp>
+static bool
+sameBits(Comp a, Comp b)
+{
+    if (a != a) {
+        return b != b;
+    }
+    return std::memcmp(&a, &b, sizeof(Comp)) == 0;
+}
+
+// one of the three frames (t = 0, 1, 2) of an interlaced sequence, where the two fields of a frame
+// are taken at different times
+template <typename Comp>
+static void
+makeFrame(PatternEnum pattern, int t, int ch, int w, int h, int stride, Comp *frame)
+{
+    const bool isFloat = ((Comp)0.5f != 0);
+    const double maxValue = isFloat ? 1. : (sizeof(Comp) == 1 ? 255. : 65535.);
+    const float inf = std::numeric_limits<float>::infinity();
+    const float special[] = { std::numeric_limits<float>::quiet_NaN(), inf, -inf, -0.f, 0.f,
+                              std::numeric_limits<float>::denorm_min(), 1e-40f, FLT_MAX, -FLT_MAX, 1.f, 0.5f };
+    const int nSpecial = (int)(sizeof(special) / sizeof(special[0]));
+    // a small range at the bottom or at the top of the values
+    const double smallBase = (t == 1) ? maxValue - 3 * (isFloat ? 0.25 : 1.) : 0.;
+
+    for (int y = 0; y < h; ++y) {
+        // time of the field of this line
+        const double time = 2 * t + (y & 1);
+        for (int x = 0; x < w; ++x) {
+            for (int c = 0; c < ch; ++c) {
+                double v = 0.;
+                switch (pattern) {
+                    case ePatternRandom:
+                        v = (std::rand() % 7 == 0) ? maxValue : (std::rand() % 7 == 0) ? 0. : maxValue * (std::rand() / (double)RAND_MAX);
+                        break;
+                    case ePatternSmallRange:
+                        v = smallBase + (std::rand() % 4) * (isFloat ? 0.25 : 1.);
+                        break;
+                    case ePatternMoving: {
+                        const bool edge = (x + 2 * time + c) > y * 0.7 + w * 0.3;
+                        const bool bar = ((x - (int)(3 * time)) % 11 + 11) % 11 < 3;
+                        v = maxValue * (edge ? (bar ? 0.3 : 0.9) : (bar ? 0.6 : 0.1));
+                        break;
+                    }
+                    case ePatternSpecial:
+                        v = (std::rand() % 3 == 0) ? maxValue * (std::rand() / (double)RAND_MAX) : 0.;
+                        break;
+                }
+                Comp value = isFloat ? (Comp)v : (Comp)(v + 0.5);
+                if (pattern == ePatternSpecial && isFloat && std::rand() % 3 != 0) {
+                    value = (Comp)special[std::rand() % nSpecial];
+                }
+                frame[y * stride + x * ch + c] = value;
+            }
+        }
+    }
+}
+
+// deinterlace cur like DeinterlaceProcessor, with the lines cut into three tiles at x1 and x2
+template <int ch, typename Comp, typename Diff>
+static void
+deinterlace(const Comp *prev, const Comp *cur, const Comp *next, Comp *dst,
+            int w, int h, int stride, int parity, int tff, int mode, int x1, int x2,
+            typename DeinterlaceRowKernels::YadifLine<Comp>::Function line)
+{
+    for (int y = 0; y < h; ++y) {
+        const int xs[3] = { 0, x1, x2 };
+        const int xe[3] = { x1, x2, w };
+        for (int k = 0; k < 3; ++k) {
+            if (xs[k] >= xe[k]) {
+                continue;
+            }
+            const int o = y * stride + xs[k] * ch;
+            if ((y ^ parity) & 1) {
+                filter_line<ch, Comp, Diff>(&dst[o], &prev[o], &cur[o], &next[o], xs[k], xe[k], w,
+                                            y + 1 < h ? stride : -stride, y ? -stride : stride,
+                                            parity ^ tff, y == 1 || y + 2 == h ? 2 : mode, line);
+            } else {
+                std::memcpy(&dst[o], &cur[o], (xe[k] - xs[k]) * ch * sizeof(Comp));
+            }
+        }
+    }
+}
+
+template <int ch, typename Comp, typename Diff>
+static void
+testLineFunction(const char* name, typename DeinterlaceRowKernels::YadifLine<Comp>::Function line)
+{
+    const bool isFloat = ((Comp)0.5f != 0);
+    int errors = 0;
+    int trials = 0;
+    for (int p = ePatternRandom; p <= ePatternSpecial; ++p) {
+        const PatternEnum pattern = (PatternEnum)p;
+        if (pattern == ePatternSpecial && !isFloat) {
+            continue;
+        }
+        for (int trial = 0; trial < 100; ++trial, ++trials) {
+            // from the narrowest image that has vectorized pixels to a few vectors per line
+            const int w = 3 + std::rand() % 60;
+            const int h = 3 + std::rand() % 12;
+            const int stride = w * ch + std::rand() % 5;
+            std::vector<Comp> frames[3];
+            for (int t = 0; t < 3; ++t) {
+                frames[t].resize(stride * h);
+                makeFrame<Comp>(pattern, t, ch, w, h, stride, &frames[t][0]);
+            }
+            const int parity = std::rand() % 2;
+            const int tff = std::rand() % 2;
+            const int mode = (std::rand() % 2) * 2;
+            const int x1 = std::rand() % w;
+            const int x2 = x1 + 1 + std::rand() % (w - x1);
+            std::vector<Comp> expected(stride * h);
+            std::vector<Comp> result(stride * h);
+            deinterlace<ch, Comp, Diff>(&frames[0][0], &frames[1][0], &frames[2][0], &expected[0],
+                                        w, h, stride, parity, tff, mode, x1, x2, 0);
+            deinterlace<ch, Comp, Diff>(&frames[0][0], &frames[1][0], &frames[2][0], &result[0],
+                                        w, h, stride, parity, tff, mode, x1, x2, line);
+            for (int y = 0; y < h; ++y) {
+                for (int i = 0; i < w * ch; ++i) {
+                    if (!sameBits(result[y * stride + i], expected[y * stride + i])) {
+                        if (errors < 5) {
+                            std::printf("FAILED: %s, %d-byte components, %d channels, %s: %dx%d image, line %d, component %d: %g instead of %g\n",
+                                        name, (int)sizeof(Comp), ch, patternName(pattern), w, h, y, i,
+                                        (double)result[y * stride + i], (double)expected[y * stride + i]);
+                        }
+                        ++errors;
+                    }
+                }
+            }
+        }
+    }
+    if (errors) {
+        ++s_failures;
+    }
+    std::printf("%s, %d-byte components, %d channels: %d images, %d differences\n", name, (int)sizeof(Comp), ch, trials, errors);
+}
+
+// the line functions are instantiated for 1, 3 and 4 channels by the plugin
+template <int ch>
+static void
+testLineFunctions(const char* name,
+                  DeinterlaceRowKernels::YadifLine<unsigned char>::Function line8,
+                  DeinterlaceRowKernels::YadifLine<unsigned short>::Function line16,
+                  DeinterlaceRowKernels::YadifLine<float>::Function line32)
+{
+    testLineFunction<ch, unsigned char, int>(name, line8);
+    testLineFunction<ch, unsigned short, int>(name, line16);
+    testLineFunction<ch, float, float>(name, line32);
+}
+
+int
+main()
+{
+    std::srand(1);
+#if kDeinterlaceRowKernelsSSE2
+    testLineFunctions<1>("SSE2", &DeinterlaceRowKernels::yadifLineSSE2<1, unsigned char>, &DeinterlaceRowKernels::yadifLineSSE2<1, unsigned short>, &DeinterlaceRowKernels::yadifLineSSE2<1, float>);
+    testLineFunctions<3>("SSE2", &DeinterlaceRowKernels::yadifLineSSE2<3, unsigned char>, &DeinterlaceRowKernels::yadifLineSSE2<3, unsigned short>, &DeinterlaceRowKernels::yadifLineSSE2<3, float>);
+    testLineFunctions<4>("SSE2", &DeinterlaceRowKernels::yadifLineSSE2<4, unsigned char>, &DeinterlaceRowKernels::yadifLineSSE2<4, unsigned short>, &DeinterlaceRowKernels::yadifLineSSE2<4, float>);
+#endif
+#if kDeinterlaceRowKernelsAVX2
+    if (DeinterlaceRowKernels::cpuHasAVX2()) {
+        testLineFunctions<1>("AVX2", &DeinterlaceRowKernels::yadifLineAVX2<1, unsigned char>, &DeinterlaceRowKernels::yadifLineAVX2<1, unsigned short>, &DeinterlaceRowKernels::yadifLineAVX2<1, float>);
+        testLineFunctions<3>("AVX2", &DeinterlaceRowKernels::yadifLineAVX2<3, unsigned char>, &DeinterlaceRowKernels::yadifLineAVX2<3, unsigned short>, &DeinterlaceRowKernels::yadifLineAVX2<3, float>);
+        testLineFunctions<4>("AVX2", &DeinterlaceRowKernels::yadifLineAVX2<4, unsigned char>, &DeinterlaceRowKernels::yadifLineAVX2<4, unsigned short>, &DeinterlaceRowKernels::yadifLineAVX2<4, float>);
+    } else {
+        std::printf("AVX2 is not supported by this CPU\n");
+    }
+#endif
+
+    if (s_failures) {
+        std::printf("%d failures\n", s_failures);
+        return 1;
+    }
+    std::printf("all tests passed\n");
+    return 0;
+}
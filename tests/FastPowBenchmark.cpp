@@ -0,0 +1,138 @@
+/*
+ Time the three ways the Gamma plugin can compute its gamma function on a float image:
+ std::pow, fastPow (scalar and SSE2), and the levels table of 8-bit and 16-bit images,
+ including the time to build the table with std::pow.
+
+ The values are the levels of a 16-bit image, divided by 65535 like ofxsUnPremult does, so
+ that all methods compute the same function. Run with "make -C tests bench".
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <cmath>
+#include <vector>
+
+#include "ColorKernels.h"
+
+#define kBenchmarkValues (1 << 22)
+#define kBenchmarkRuns 5
+#define kBenchmarkGamma 2.2f
+
+// the fastest of kBenchmarkRuns runs, in nanoseconds per value
+template <class Method>
+static double
+timeMethod(const Method& method, const std::vector<float>& src, std::vector<float>* dst)
+{
+    double best = 0.;
+    for (int run = 0; run < kBenchmarkRuns; ++run) {
+        const std::clock_t start = std::clock();
+        method(src, dst);
+        const double t = (std::clock() - start) / (double)CLOCKS_PER_SEC;
+        if (run == 0 || t < best) {
+            best = t;
+        }
+    }
+    return best * 1e9 / src.size();
+}
+
+struct StdPow
+{
+    void operator()(const std::vector<float>& src, std::vector<float>* dst) const
+    {
+        const float y = 1.f / kBenchmarkGamma;
+        for (size_t i = 0; i < src.size(); ++i) {
+            (*dst)[i] = std::pow(src[i], y);
+        }
+    }
+};
+
+struct FastPow
+{
+    void operator()(const std::vector<float>& src, std::vector<float>* dst) const
+    {
+        const float y = 1.f / kBenchmarkGamma;
+        for (size_t i = 0; i < src.size(); ++i) {
+            (*dst)[i] = fastPow(src[i], y);
+        }
+    }
+};
+
+#if kPixelKernelSSE2
+struct FastPowSSE2
+{
+    void operator()(const std::vector<float>& src, std::vector<float>* dst) const
+    {
+        const __m128 y = _mm_set1_ps(1.f / kBenchmarkGamma);
+        for (size_t i = 0; i + 4 <= src.size(); i += 4) {
+            _mm_storeu_ps(&(*dst)[i], fastPowSSE2(_mm_loadu_ps(&src[i]), y));
+        }
+    }
+};
+#endif
+
+// the table is built at each run, as the plugin does at each render
+struct LevelsLUT
+{
+    explicit LevelsLUT(int maxValue)
+    : _maxValue(maxValue)
+    {
+    }
+
+    void operator()(const std::vector<float>& src, std::vector<float>* dst) const
+    {
+        const GammaKernel kernel(RGBAValues(kBenchmarkGamma));
+        std::vector<float> lut;
+        buildLevelsLUT(kernel, _maxValue, &lut);
+        for (size_t i = 0; i + 4 <= src.size(); i += 4) {
+            processFromLevelsLUT<true, true, true, true>(&lut[0], _maxValue, &src[i], &(*dst)[i]);
+        }
+    }
+
+    int _maxValue;
+};
+
+// maximum relative difference with std::pow
+static double
+maxError(const std::vector<float>& result, const std::vector<float>& reference)
+{
+    double worst = 0.;
+    for (size_t i = 0; i < result.size(); ++i) {
+        if (reference[i] > 0.f) {
+            worst = std::max(worst, std::fabs((double)result[i] - reference[i]) / reference[i]);
+        }
+    }
+    return worst;
+}
+
+int
+main()
+{
+    std::srand(1);
+    std::vector<float> src16(kBenchmarkValues);
+    std::vector<float> src8(kBenchmarkValues);
+    for (int i = 0; i < kBenchmarkValues; ++i) {
+        src16[i] = (std::rand() % 65536) / 65535.f;
+        src8[i] = (std::rand() % 256) / 255.f;
+    }
+    std::vector<float> reference16(kBenchmarkValues);
+    std::vector<float> reference8(kBenchmarkValues);
+    std::vector<float> dst(kBenchmarkValues);
+
+    std::printf("%d values, gamma %g, best of %d runs\n", kBenchmarkValues, kBenchmarkGamma, kBenchmarkRuns);
+    double t = timeMethod(StdPow(), src16, &reference16);
+    std::printf("std::pow:              %6.2f ns/value\n", t);
+    StdPow()(src8, &reference8);
+    t = timeMethod(FastPow(), src16, &dst);
+    std::printf("fastPow:               %6.2f ns/value, max relative error %.2g\n", t, maxError(dst, reference16));
+#if kPixelKernelSSE2
+    t = timeMethod(FastPowSSE2(), src16, &dst);
+    std::printf("fastPowSSE2:           %6.2f ns/value, max relative error %.2g\n", t, maxError(dst, reference16));
+#endif
+    t = timeMethod(LevelsLUT(255), src8, &dst);
+    std::printf("levels table (8-bit):  %6.2f ns/value, max relative error %.2g\n", t, maxError(dst, reference8));
+    t = timeMethod(LevelsLUT(65535), src16, &dst);
+    std::printf("levels table (16-bit): %6.2f ns/value, max relative error %.2g\n", t, maxError(dst, reference16));
+
+    return 0;
+}
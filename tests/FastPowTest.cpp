@@ -0,0 +1,159 @@
+/*
+ Check fastPow against std::pow, and fastPowSSE2 against fastPow.
+
+ The relative error must stay below the bound given in FastPow.h, 2e-7 + 1.5e-7 * |y * log2(x)|,
+ wherever the result is a normal float, and the largest results must be finite. fastPowSSE2 must
+ give exactly the same bits as fastPow, including on special values (NaN, infinities, zeroes,
+ denormals and negative values).
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <cfloat>
+#include <limits>
+
+#include "FastPow.h"
+
+static int s_failures = 0;
+
+static bool
+sameBits(float x, float y)
+{
+    if (x != x) {
+        return y != y;
+    }
+    return std::memcmp(&x, &y, sizeof(float)) == 0;
+}
+
+// uniform random in [0,1)
+static double
+random01()
+{
+    return std::rand() / (RAND_MAX + 1.);
+}
+
+static void
+check(bool ok, const char* what, float x, float y, float result)
+{
+    if (!ok) {
+        if (s_failures < 10) {
+            std::printf("FAILED: %s: fastPow(%g, %g) = %g\n", what, x, y, result);
+        }
+        ++s_failures;
+    }
+}
+
+#if kPixelKernelSSE2
+static float
+fastPowSSE2Scalar(float x, float y)
+{
+    float r[4];
+    _mm_storeu_ps(r, fastPowSSE2(_mm_set1_ps(x), _mm_set1_ps(y)));
+    return r[0];
+}
+#endif
+
+static void
+checkSSE2(float x, float y)
+{
+#if kPixelKernelSSE2
+    const float r = fastPowSSE2Scalar(x, y);
+    check(sameBits(r, fastPow(x, y)), "SSE2 and scalar results differ", x, y, r);
+#else
+    (void)x;
+    (void)y;
+#endif
+}
+
+// random x over the whole range of normal floats, and y such that the result is a normal float
+static void
+testAccuracy()
+{
+    double worst = 0.;
+    for (int k = 0; k < 2000000; ++k) {
+        const float x = std::ldexp((float)(1. + random01()), (int)(random01() * 253) - 126);
+        const double l2 = std::log2((double)x);
+        const double zMax = (k % 2) ? 20. : 126.;
+        const float y = (float)((2 * random01() - 1) * zMax / std::max(1., std::fabs(l2)));
+        const double z = y * l2;
+        if (z <= -125.5 || z >= 127.99) {
+            continue;
+        }
+        const double expected = std::pow((double)x, (double)y);
+        const float r = fastPow(x, y);
+        const double error = std::fabs(r - expected) / expected;
+        worst = std::max(worst, error / (2e-7 + 1.5e-7 * std::fabs(z)));
+        check(error <= 2e-7 + 1.5e-7 * std::fabs(z), "relative error above the bound", x, y, r);
+        checkSSE2(x, y);
+    }
+    std::printf("accuracy: the worst error is %.2f times the bound\n", worst);
+}
+
+static void
+testSpecialValues()
+{
+    const float inf = std::numeric_limits<float>::infinity();
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    const float denorm = std::numeric_limits<float>::denorm_min();
+    const float xs[] = { nan, -nan, inf, -inf, 0.f, -0.f, denorm, -denorm, 1e-40f, FLT_MIN, -1.f, -FLT_MAX, FLT_MAX, 1.f, 0.5f, 2.f };
+    const float ys[] = { 0.f, -0.f, 1.f, -1.f, 0.4545f, 2.2f, 1e-8f, -1e-8f, 100.f, -100.f, 1e8f, -1e8f, inf, -inf };
+    const int nX = (int)(sizeof(xs) / sizeof(xs[0]));
+    const int nY = (int)(sizeof(ys) / sizeof(ys[0]));
+    for (int i = 0; i < nX; ++i) {
+        for (int j = 0; j < nY; ++j) {
+            const float x = xs[i];
+            const float y = ys[j];
+            const float r = fastPow(x, y);
+            checkSSE2(x, y);
+            if (x != x) {
+                check(r != r, "NaN is not returned unchanged", x, y, r);
+            } else if (x == inf) {
+                // same as std::pow
+                check(sameBits(r, (float)std::pow(x, y)), "+inf does not give the result of std::pow", x, y, r);
+            } else if (x <= FLT_MIN) {
+                // zero, denormals, negative values and -inf are clamped to FLT_MIN
+                check(sameBits(r, fastPow(FLT_MIN, y)), "values below FLT_MIN are not clamped", x, y, r);
+            } else {
+                // the result is clamped to [2^-126, 2^127.99]
+                check(r == r && r >= FLT_MIN && r <= FLT_MAX, "the result is not clamped", x, y, r);
+            }
+        }
+    }
+}
+
+// at the top of the range, the result is finite, and results above 2^127.99 are clamped
+static void
+testLargestResults()
+{
+    const float clamped = (float)std::pow(2., 127.99);
+    for (int k = 0; k <= 1000; ++k) {
+        const float z = 127.f + k / 1000.f;
+        const float r = fastPow(2.f, z);
+        checkSSE2(2.f, z);
+        if (z < 127.99f) {
+            const double expected = std::pow(2., (double)z);
+            check(std::fabs(r - expected) / expected <= 2e-7 + 1.5e-7 * z, "relative error above the bound", 2.f, z, r);
+        } else {
+            check(std::fabs(r - clamped) / clamped <= 2e-7 + 1.5e-7 * z, "the result is not clamped to 2^127.99", 2.f, z, r);
+        }
+        check(r <= FLT_MAX, "the result is not finite", 2.f, z, r);
+    }
+}
+
+int
+main()
+{
+    std::srand(1);
+    testAccuracy();
+    testLargestResults();
+    testSpecialValues();
+
+    if (s_failures) {
+        std::printf("%d failures\n", s_failures);
+        return 1;
+    }
+    std::printf("all tests passed\n");
+    return 0;
+}
@@ -0,0 +1,201 @@
+/*
+ Compare the incremental mode of FrameBlend with the full recomputation, over runs of consecutive frames.
+
+ At each render time, the Sum (and count) and the Min and Max of a sliding range of frames are
+ updated from the previous time as the plugin does, by removing the frames that left the range and
+ adding the frames that entered it, and compared with the results over all frames of the range.
+ Some frames are excluded by the foreground matte. The render times mostly increase by one frame, but
+ they also stay, go backward or jump, so that the full recomputation is also used.
+
+ The values are multiples of 1/256, so that all sums are exact and must be equal.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <vector>
+#include <algorithm>
+
+#include "FrameBlendIncremental.h"
+
+static int s_failures = 0;
+
+// the value of the pixel component at frame f, and whether the foreground matte excludes it
+static unsigned int
+hashFrame(int seed, int f)
+{
+    unsigned int h = (unsigned int)(seed * 7919 + f * 131) * 2654435761u;
+    h ^= h >> 13;
+    h *= 0x5bd1e995;
+    h ^= h >> 15;
+    return h;
+}
+
+static float
+frameValue(int seed, int f)
+{
+    const unsigned int h = hashFrame(seed, f);
+    // sometimes few distinct values, to get ties
+    return (seed % 2) ? (float)((int)(h % 20001) - 10000) / 256.f : (float)(h % 4);
+}
+
+static bool
+frameMasked(int seed, int f)
+{
+    return (seed % 3 == 0) && (hashFrame(seed + 1, f) % 4 == 0);
+}
+
+// the state of the incremental mode at one pixel component, as kept by the plugin
+struct State
+{
+    bool valid;
+    int firstFrame;
+    int count;
+    double sum;
+    std::vector<float> value;
+    std::vector<int> frame;
+    unsigned short head;
+    unsigned short size;
+
+    State()
+    : valid(false)
+    , firstFrame(0)
+    , count(0)
+    , sum(0.)
+    , value()
+    , frame()
+    , head(0)
+    , size(0)
+    {
+    }
+};
+
+// update the state for the range of n frames starting at firstFrame, and return true if it was incremental
+template <bool isMin>
+static bool
+update(State* s, bool sum, int seed, int firstFrame, int n, int interval)
+{
+    std::vector<int> frames;
+    std::vector<int> leavingFrames;
+    const bool incremental = s->valid && FrameBlendIncremental::moveRange(s->firstFrame, firstFrame, n, interval, sum, &frames, &leavingFrames);
+    if (!incremental) {
+        s->count = 0;
+        s->sum = 0.;
+        s->value.resize(n);
+        s->frame.resize(n);
+        s->head = 0;
+        s->size = 0;
+        for (int i = 0; i < n; ++i) {
+            frames.push_back(firstFrame + i * interval);
+        }
+    }
+    s->firstFrame = firstFrame;
+    for (size_t i = 0; i < leavingFrames.size(); ++i) {
+        if (!frameMasked(seed, leavingFrames[i])) {
+            if (sum) {
+                s->sum -= frameValue(seed, leavingFrames[i]);
+            }
+            --s->count;
+        }
+    }
+    if (!sum) {
+        FrameBlendIncremental::dequeRemoveBefore(&s->frame[0], n, firstFrame, s->head, s->size);
+    }
+    for (size_t i = 0; i < frames.size(); ++i) {
+        if (!frameMasked(seed, frames[i])) {
+            const float v = frameValue(seed, frames[i]);
+            if (sum) {
+                s->sum += v;
+            } else {
+                FrameBlendIncremental::dequeAdd<isMin>(&s->value[0], &s->frame[0], n, s->head, s->size, v, frames[i]);
+            }
+            ++s->count;
+        }
+    }
+    s->valid = true;
+
+    return incremental;
+}
+
+static void
+check(bool ok, const char* what, int seed, int t, double result, double expected)
+{
+    if (!ok) {
+        if (s_failures < 10) {
+            std::printf("FAILED: %s, run %d, time %d: %g instead of %g\n", what, seed, t, result, expected);
+        }
+        ++s_failures;
+    }
+}
+
+int
+main()
+{
+    const float inf = std::numeric_limits<float>::infinity();
+    int nIncremental = 0;
+    int nRenders = 0;
+    for (int seed = 0; seed < 3000; ++seed) {
+        std::srand(seed);
+        const int n = 1 + std::rand() % 25;
+        const int interval = 1 + std::rand() % 3;
+        const int rangeMin = -(std::rand() % 30);
+        State sumState;
+        State minState;
+        State maxState;
+        int t = std::rand() % 100 - 50;
+        for (int k = 0; k < 100; ++k) {
+            switch (std::rand() % 20) {
+                case 0:
+                    // same frame
+                    break;
+                case 1:
+                    t -= 1 + std::rand() % 3;
+                    break;
+                case 2:
+                    t += std::rand() % 60 - 30;
+                    break;
+                default:
+                    // the next frame, or the next frame of the range
+                    t += (std::rand() % 2) ? 1 : interval;
+                    break;
+            }
+            const int firstFrame = t + rangeMin;
+            nIncremental += update<true>(&sumState, true, seed, firstFrame, n, interval);
+            update<true>(&minState, false, seed, firstFrame, n, interval);
+            update<false>(&maxState, false, seed, firstFrame, n, interval);
+            ++nRenders;
+
+            // the full recomputation
+            int count = 0;
+            double sum = 0.;
+            float vMin = inf;
+            float vMax = -inf;
+            for (int i = 0; i < n; ++i) {
+                const int f = firstFrame + i * interval;
+                if (!frameMasked(seed, f)) {
+                    const float v = frameValue(seed, f);
+                    sum += v;
+                    vMin = std::min(vMin, v);
+                    vMax = std::max(vMax, v);
+                    ++count;
+                }
+            }
+            check(sumState.sum == sum, "sum", seed, t, sumState.sum, sum);
+            check(sumState.count == count, "count (sum)", seed, t, sumState.count, count);
+            check(minState.count == count, "count (min)", seed, t, minState.count, count);
+            check(maxState.count == count, "count (max)", seed, t, maxState.count, count);
+            const float rMin = FrameBlendIncremental::dequeResult(&minState.value[0], minState.head, minState.size, inf);
+            const float rMax = FrameBlendIncremental::dequeResult(&maxState.value[0], maxState.head, maxState.size, -inf);
+            check(rMin == vMin, "min", seed, t, rMin, vMin);
+            check(rMax == vMax, "max", seed, t, rMax, vMax);
+        }
+    }
+    std::printf("%d of %d sums were computed incrementally\n", nIncremental, nRenders);
+
+    if (s_failures) {
+        std::printf("%d failures\n", s_failures);
+        return 1;
+    }
+    std::printf("all tests passed\n");
+    return 0;
+}
@@ -0,0 +1,177 @@
+/*
+ Check the Median and Percentile selection of FrameBlend against std::nth_element.
+
+ The values are passed to FrameBlendSelector in the same order and with the same passes as in the
+ plugin. For 8-bit and 16-bit values, the result must be exactly the value of rank
+ round(percentile/100*(count-1)). For float values, it must be exact when the values are few
+ distinct values spread over their range, and otherwise within 1/256 of the range of the values.
+ NaN values are ignored.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <algorithm>
+
+#include "FrameBlendSelection.h"
+
+static int s_failures = 0;
+
+// uniform random in [0,1)
+static double
+random01()
+{
+    return std::rand() / (RAND_MAX + 1.);
+}
+
+// select the value of the given percentile, as the plugin does at one pixel component
+template <class PIX, int maxValue>
+static float
+select(const std::vector<PIX>& values, double percentile)
+{
+    typedef FrameBlendSelector<PIX, maxValue> Selector;
+    FrameBlendSelection s;
+    const int nPasses = Selector::passes();
+    for (int pass = 0; pass < nPasses; ++pass) {
+        if (pass == 0) {
+            Selector::init(s);
+        } else {
+            Selector::selectBucket(s, percentile);
+        }
+        for (size_t i = 0; i < values.size(); ++i) {
+            Selector::add(s, values[i]);
+        }
+    }
+    if (maxValue != 1) {
+        Selector::selectBucket(s, percentile);
+    }
+    return Selector::value(s);
+}
+
+// the value of the given percentile, and the range of the values (NaN values are ignored)
+template <class PIX>
+static float
+expectedValue(const std::vector<PIX>& values, double percentile, float* range)
+{
+    std::vector<float> v;
+    for (size_t i = 0; i < values.size(); ++i) {
+        if (values[i] == values[i]) {
+            v.push_back((float)values[i]);
+        }
+    }
+    if (v.empty()) {
+        *range = 0.f;
+        return 0.f;
+    }
+    const int k = frameBlendPercentileRank(percentile, (int)v.size());
+    std::nth_element(v.begin(), v.begin() + k, v.end());
+    const float result = v[k];
+    *range = *std::max_element(v.begin(), v.end()) - *std::min_element(v.begin(), v.end());
+    return result;
+}
+
+template <class PIX, int maxValue>
+static void
+check(const char* what, const std::vector<PIX>& values, double percentile, bool exact)
+{
+    float range;
+    const float expected = expectedValue(values, percentile, &range);
+    const float result = select<PIX, maxValue>(values, percentile);
+    const bool ok = exact ? (result == expected) : (std::fabs(result - expected) <= range / 256. * (1. + 1e-5));
+    if (!ok) {
+        if (s_failures < 10) {
+            std::printf("FAILED: %s, %d values, percentile %g: %.9g instead of %.9g (range %g)\n",
+                        what, (int)values.size(), percentile, result, expected, range);
+        }
+        ++s_failures;
+    }
+}
+
+static double
+randomPercentile()
+{
+    switch (std::rand() % 4) {
+        case 0:
+            return 50.;
+        case 1:
+            return (std::rand() % 2) ? 0. : 100.;
+        default:
+            return random01() * 100.;
+    }
+}
+
+static int
+randomCount()
+{
+    return (std::rand() % 4) ? 1 + std::rand() % 40 : 1 + std::rand() % 500;
+}
+
+template <class PIX, int maxValue>
+static void
+testInteger(const char* what)
+{
+    for (int k = 0; k < 20000; ++k) {
+        const int n = randomCount();
+        // sometimes only a few distinct values, to get ties
+        const int nDistinct = (k % 2) ? maxValue + 1 : 1 + std::rand() % 4;
+        std::vector<PIX> values(n);
+        for (int i = 0; i < n; ++i) {
+            values[i] = (PIX)(((long)std::rand() * (maxValue + 1) / ((long)RAND_MAX + 1) / ((maxValue + 1) / nDistinct)) * ((maxValue + 1) / nDistinct));
+        }
+        check<PIX, maxValue>(what, values, randomPercentile(), true);
+    }
+    // the largest count
+    std::vector<PIX> values(kFrameBlendSelectionMaxValues);
+    for (int i = 0; i < kFrameBlendSelectionMaxValues; ++i) {
+        values[i] = (PIX)(i % 3 ? maxValue : 0);
+    }
+    check<PIX, maxValue>(what, values, 50., true);
+    check<PIX, maxValue>(what, values, 33., true);
+}
+
+static void
+testFloat()
+{
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    for (int k = 0; k < 20000; ++k) {
+        const int n = randomCount();
+        const float lo = (float)((random01() - 0.5) * std::ldexp(1., std::rand() % 20 - 10));
+        const float width = (float)std::ldexp(1., std::rand() % 20 - 10);
+        std::vector<float> values(n);
+        if (k % 2) {
+            // random values, with NaN values
+            for (int i = 0; i < n; ++i) {
+                values[i] = (std::rand() % 10 == 0) ? nan : (float)(lo + width * random01());
+            }
+            check<float, 1>("float", values, randomPercentile(), false);
+        } else {
+            // at most 16 distinct values, evenly spread over the range: each one is alone in its interval
+            const int nDistinct = 1 + std::rand() % 16;
+            for (int i = 0; i < n; ++i) {
+                values[i] = lo + width * (std::rand() % nDistinct) / 15.f;
+            }
+            check<float, 1>("float (few distinct values)", values, randomPercentile(), true);
+        }
+    }
+    // no value, and only NaN values
+    check<float, 1>("float (no value)", std::vector<float>(), 50., true);
+    check<float, 1>("float (only NaN)", std::vector<float>(5, nan), 50., true);
+}
+
+int
+main()
+{
+    std::srand(1);
+    testInteger<unsigned char, 255>("8-bit");
+    testInteger<unsigned short, 65535>("16-bit");
+    testFloat();
+
+    if (s_failures) {
+        std::printf("%d failures\n", s_failures);
+        return 1;
+    }
+    std::printf("all tests passed\n");
+    return 0;
+}
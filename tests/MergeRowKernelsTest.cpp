@@ -0,0 +1,147 @@
+/*
+ Compare the vectorized row kernels of Merge with the scalar MergeImages2D::mergePixel.
+
+ The results must have exactly the same bits, including on special values (NaN, infinities,
+ denormals, signed zeroes). The only exception is the payload of NaN results, which may come
+ from either operand, so that any NaN is equal to any NaN.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <cfloat>
+#include <limits>
+#include <vector>
+
+#include "MergeRowKernels.h"
+
+using namespace MergeImages2D;
+
+static int s_failures = 0;
+
+static bool
+sameBits(float x, float y)
+{
+    if (x != x) {
+        return y != y;
+    }
+    return std::memcmp(&x, &y, sizeof(float)) == 0;
+}
+
+static const char*
+functionName(MergingFunctionEnum f)
+{
+    switch (f) {
+        case eMergeATop: return "atop";
+        case eMergeDarken: return "darken";
+        case eMergeIn: return "in";
+        case eMergeLighten: return "lighten";
+        case eMergeMultiply: return "multiply";
+        case eMergeOut: return "out";
+        case eMergeOver: return "over";
+        case eMergePlus: return "plus";
+        case eMergeScreen: return "screen";
+        case eMergeUnder: return "under";
+        default: return "?";
+    }
+}
+
+// Every pair of values appears in every component of A and B, and the row lengths
+// cover the vectorized loop and its scalar tail.
+template <MergingFunctionEnum f>
+static void
+testFunction(bool alphaMasking, const std::vector<float>& values)
+{
+    MergeRowKernels::MergeRowFunction row = MergeRowKernels::getRowFunction<f>(alphaMasking);
+    if (!row) {
+        std::printf("%s%s: no row kernel\n", functionName(f), alphaMasking ? " (alpha masking)" : "");
+        return;
+    }
+    const int nValues = (int)values.size();
+    const int n = nValues * nValues + 3; // not a multiple of the pixels per iteration
+    std::vector<float> A(4 * n);
+    std::vector<float> B(4 * n);
+    for (int x = 0; x < n; ++x) {
+        for (int c = 0; c < 4; ++c) {
+            // shift the pairs by component, so that each color meets various alphas
+            const int k = (x + 5 * c) % (nValues * nValues);
+            A[4 * x + c] = values[k / nValues];
+            B[4 * x + c] = values[k % nValues];
+        }
+    }
+    std::vector<float> expected(4 * n);
+    for (int x = 0; x < n; ++x) {
+        mergePixel<f, float, 4, 1>(alphaMasking, &A[4 * x], &B[4 * x], &expected[4 * x]);
+    }
+
+    int errors = 0;
+    for (int len = n - 7; len <= n; ++len) {
+        std::vector<float> dst(4 * n, -7.f);
+        row(&A[0], &B[0], len, &dst[0]);
+        for (int i = 0; i < 4 * n; ++i) {
+            const float e = (i < 4 * len) ? expected[i] : -7.f;
+            if (!sameBits(dst[i], e)) {
+                if (errors < 5) {
+                    std::printf("FAILED: %s%s, %d pixels: pixel %d comp %d, A=%g B=%g: %g instead of %g\n",
+                                functionName(f), alphaMasking ? " (alpha masking)" : "", len, i / 4, i % 4,
+                                A[i], B[i], dst[i], e);
+                }
+                ++errors;
+            }
+        }
+    }
+    // in place, as used by Merge with the normalized row buffers
+    std::vector<float> dst(A);
+    row(&dst[0], &B[0], n, &dst[0]);
+    for (int i = 0; i < 4 * n; ++i) {
+        if (!sameBits(dst[i], expected[i])) {
+            if (errors < 5) {
+                std::printf("FAILED: %s%s, in place: pixel %d comp %d\n",
+                            functionName(f), alphaMasking ? " (alpha masking)" : "", i / 4, i % 4);
+            }
+            ++errors;
+        }
+    }
+    if (errors) {
+        ++s_failures;
+    }
+}
+
+static void
+testAll(bool alphaMasking, const std::vector<float>& values)
+{
+    testFunction<eMergeATop>(alphaMasking, values);
+    testFunction<eMergeDarken>(alphaMasking, values);
+    testFunction<eMergeIn>(alphaMasking, values);
+    testFunction<eMergeLighten>(alphaMasking, values);
+    testFunction<eMergeMultiply>(alphaMasking, values);
+    testFunction<eMergeOut>(alphaMasking, values);
+    testFunction<eMergeOver>(alphaMasking, values);
+    testFunction<eMergePlus>(alphaMasking, values);
+    testFunction<eMergeScreen>(alphaMasking, values);
+    testFunction<eMergeUnder>(alphaMasking, values);
+}
+
+int
+main()
+{
+    const float inf = std::numeric_limits<float>::infinity();
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    const float denorm = std::numeric_limits<float>::denorm_min();
+    const float values[] = {
+        0.f, -0.f, 1.f, 0.5f, 0.25f, 0.1f, 0.9f, 1e-3f, 0.333f, // usual values
+        -0.5f, -1.f, 2.f, 3.5f, 1e20f, FLT_MAX, -FLT_MAX, // out of range
+        FLT_MIN, denorm, -denorm, 1e-40f, // smallest and denormal values
+        inf, -inf, nan, -nan,
+    };
+    std::vector<float> v(values, values + sizeof(values) / sizeof(values[0]));
+
+    testAll(false, v);
+    testAll(true, v);
+
+    if (s_failures) {
+        std::printf("%d failures\n", s_failures);
+        return 1;
+    }
+    std::printf("all tests passed\n");
+    return 0;
+}
@@ -0,0 +1,163 @@
+/*
+ Compare the row functions of the color kernels with their pixel function.
+
+ PixelKernelProcessor applies the row function of a kernel directly to RGBA float rows, and
+ process() everywhere else, so both must give exactly the same bits, for every combination of
+ processed channels and on special values (NaN, infinities, denormals, signed zeroes).
+ Any NaN is equal to any NaN.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <cfloat>
+#include <limits>
+#include <vector>
+
+#include "ColorKernels.h"
+
+static int s_failures = 0;
+
+static bool
+sameBits(float x, float y)
+{
+    if (x != x) {
+        return y != y;
+    }
+    return std::memcmp(&x, &y, sizeof(float)) == 0;
+}
+
+static std::vector<float> s_values;
+
+// every value appears in every component, and the rows have various lengths
+template <class Kernel, bool processR, bool processG, bool processB, bool processA>
+static void
+testChannels(const char* name, const Kernel& kernel)
+{
+    const int nValues = (int)s_values.size();
+    const int n = nValues + 3;
+    std::vector<float> src(4 * n);
+    for (int x = 0; x < n; ++x) {
+        for (int c = 0; c < 4; ++c) {
+            src[4 * x + c] = s_values[(x + 7 * c) % nValues];
+        }
+    }
+    std::vector<float> expected(4 * n);
+    for (int x = 0; x < n; ++x) {
+        kernel.template process<processR, processG, processB, processA>(&src[4 * x], &expected[4 * x]);
+    }
+
+    int errors = 0;
+    for (int len = n - 3; len <= n; ++len) {
+        std::vector<float> dst(4 * n, -7.f);
+        kernel.template processRow<processR, processG, processB, processA>(&src[0], &dst[0], len);
+        for (int i = 0; i < 4 * n; ++i) {
+            const float e = (i < 4 * len) ? expected[i] : -7.f;
+            if (!sameBits(dst[i], e)) {
+                if (errors < 5) {
+                    std::printf("FAILED: %s %c%c%c%c, %d pixels: pixel %d comp %d, src=%g: %g instead of %g\n",
+                                name, processR ? 'R' : 'r', processG ? 'G' : 'g', processB ? 'B' : 'b', processA ? 'A' : 'a',
+                                len, i / 4, i % 4, src[i], dst[i], e);
+                }
+                ++errors;
+            }
+        }
+    }
+    // in place, as on the destination rows
+    std::vector<float> dst(src);
+    kernel.template processRow<processR, processG, processB, processA>(&dst[0], &dst[0], n);
+    for (int i = 0; i < 4 * n; ++i) {
+        if (!sameBits(dst[i], expected[i])) {
+            if (errors < 5) {
+                std::printf("FAILED: %s %c%c%c%c, in place: pixel %d comp %d\n",
+                            name, processR ? 'R' : 'r', processG ? 'G' : 'g', processB ? 'B' : 'b', processA ? 'A' : 'a',
+                            i / 4, i % 4);
+            }
+            ++errors;
+        }
+    }
+    if (errors) {
+        ++s_failures;
+    }
+}
+
+template <class Kernel>
+static void
+testKernel(const char* name, const Kernel& kernel)
+{
+    testChannels<Kernel, false, false, false, false>(name, kernel);
+    testChannels<Kernel, false, false, false, true >(name, kernel);
+    testChannels<Kernel, false, false, true , false>(name, kernel);
+    testChannels<Kernel, false, false, true , true >(name, kernel);
+    testChannels<Kernel, false, true , false, false>(name, kernel);
+    testChannels<Kernel, false, true , false, true >(name, kernel);
+    testChannels<Kernel, false, true , true , false>(name, kernel);
+    testChannels<Kernel, false, true , true , true >(name, kernel);
+    testChannels<Kernel, true , false, false, false>(name, kernel);
+    testChannels<Kernel, true , false, false, true >(name, kernel);
+    testChannels<Kernel, true , false, true , false>(name, kernel);
+    testChannels<Kernel, true , false, true , true >(name, kernel);
+    testChannels<Kernel, true , true , false, false>(name, kernel);
+    testChannels<Kernel, true , true , false, true >(name, kernel);
+    testChannels<Kernel, true , true , true , false>(name, kernel);
+    testChannels<Kernel, true , true , true , true >(name, kernel);
+}
+
+static RGBAValues
+rgba(double r, double g, double b, double a)
+{
+    RGBAValues v;
+    v.r = r;
+    v.g = g;
+    v.b = b;
+    v.a = a;
+    return v;
+}
+
+int
+main()
+{
+    const float inf = std::numeric_limits<float>::infinity();
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    const float denorm = std::numeric_limits<float>::denorm_min();
+    const float values[] = {
+        0.f, -0.f, 1.f, 0.5f, 0.25f, 0.1f, 0.9f, 1e-3f, 0.7f, 0.333f, // usual values
+        -0.5f, -1.f, 2.f, 3.5f, 1e20f, FLT_MAX, -FLT_MAX, // out of range
+        FLT_MIN, denorm, -denorm, 1e-40f, // smallest and denormal values
+        inf, -inf, nan, -nan,
+    };
+    s_values.assign(values, values + sizeof(values) / sizeof(values[0]));
+
+    testKernel("add", AddKernel(rgba(0.5, -2., 1e-3, 7.)));
+    testKernel("add -0", AddKernel(rgba(-0., 0., 1e30, -1e30)));
+    testKernel("multiply", MultiplyKernel(rgba(1.5, -2., 0.3, 7.)));
+    testKernel("multiply 0", MultiplyKernel(rgba(0., -0., 1e30, 1.)));
+    testKernel("invert", InvertKernel());
+    for (int fastPow = 0; fastPow < 2; ++fastPow) {
+        GammaKernel gamma(rgba(2.2, 0.45, 1., 3.));
+        gamma.setFastPow(fastPow);
+        testKernel(fastPow ? "gamma (fast)" : "gamma", gamma);
+        GammaKernel extreme(rgba(1e-8, 100., 0.1, 1.0001));
+        extreme.setFastPow(fastPow);
+        testKernel(fastPow ? "extreme gamma (fast)" : "extreme gamma", extreme);
+        GammaKernel one(rgba(1., 1., 2., 1.));
+        one.setFastPow(fastPow);
+        testKernel(fastPow ? "gamma 1 (fast)" : "gamma 1", one);
+        // a gamma of 1 leaves the values unchanged
+        for (size_t i = 0; i < s_values.size(); ++i) {
+            const float unpPix[4] = { s_values[i], s_values[i], s_values[i], s_values[i] };
+            float tmpPix[4];
+            one.process<true, true, true, true>(unpPix, tmpPix);
+            if (!sameBits(tmpPix[0], unpPix[0]) || !sameBits(tmpPix[3], unpPix[3])) {
+                std::printf("FAILED: gamma 1%s changes %g into %g\n", fastPow ? " (fast)" : "", unpPix[0], tmpPix[0]);
+                ++s_failures;
+            }
+        }
+    }
+
+    if (s_failures) {
+        std::printf("%d failures\n", s_failures);
+        return 1;
+    }
+    std::printf("all tests passed\n");
+    return 0;
+}
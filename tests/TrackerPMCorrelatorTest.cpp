@@ -0,0 +1,218 @@
+/*
+ Compare the FFT engine of TrackerPM with the exhaustive search, on random patterns.
+
+ The exhaustive search computes the NCC and ZNCC scores at each position like
+ TrackerPMProcessor::computeScore(). The FFT engine must find the same best match,
+ and the same score within float tolerance.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "TrackerPMCorrelator.h"
+
+// relative tolerance on the scores. The ZNCC denominator sum(w.o^2) - sum(w.o)^2/W is computed
+// from sums over the whole search window, and loses a few digits on low-contrast positions.
+#define kScoreTolerance 1e-6
+
+static int s_failures = 0;
+
+struct TestImages
+{
+    int patternW, patternH, windowW, windowH, nComps;
+    std::vector<float> other; // (windowW + patternW - 1) x (windowH + patternH - 1)
+    std::vector<float> pattern;
+    std::vector<float> weights;
+    double weightTotal;
+
+    int otherW() const { return windowW + patternW - 1; }
+    int otherH() const { return windowH + patternH - 1; }
+};
+
+// uniform random in [0,1)
+static double
+random01()
+{
+    return std::rand() / (RAND_MAX + 1.);
+}
+
+// Random 8-bit other image. If planted, the pattern is a scaled and noisy copy of the other image at (x,y).
+static void
+makeImages(int patternW, int patternH, int windowW, int windowH, int nComps, bool uniformWeights,
+           bool planted, int x, int y, TestImages* t)
+{
+    t->patternW = patternW;
+    t->patternH = patternH;
+    t->windowW = windowW;
+    t->windowH = windowH;
+    t->nComps = nComps;
+    const int ow = t->otherW();
+    const int oh = t->otherH();
+    t->other.resize((size_t)ow * oh * nComps);
+    for (size_t k = 0; k < t->other.size(); ++k) {
+        t->other[k] = (float)(int)(256 * random01());
+    }
+    t->pattern.resize((size_t)patternW * patternH * nComps);
+    t->weights.resize((size_t)patternW * patternH);
+    t->weightTotal = 0.;
+    for (int i = 0; i < patternH; ++i) {
+        for (int j = 0; j < patternW; ++j) {
+            const size_t k = (size_t)i * patternW + j;
+            for (int c = 0; c < nComps; ++c) {
+                if (planted) {
+                    const float o = t->other[((size_t)(y + i) * ow + x + j) * nComps + c];
+                    t->pattern[k * nComps + c] = (float)(int)(0.8 * o + 5 + 7 * random01());
+                } else {
+                    t->pattern[k * nComps + c] = (float)(int)(256 * random01());
+                }
+            }
+            t->weights[k] = uniformWeights ? 1.f : (float)(int)(100 * random01()) / 99.f;
+            t->weightTotal += t->weights[k];
+        }
+    }
+}
+
+static void
+patternMean(const TestImages& t, bool zncc, double mean[3])
+{
+    mean[0] = mean[1] = mean[2] = 0.;
+    if (!zncc) {
+        return;
+    }
+    for (size_t k = 0; k < t.weights.size(); ++k) {
+        for (int c = 0; c < t.nComps; ++c) {
+            mean[c] += t.weights[k] * t.pattern[k * t.nComps + c];
+        }
+    }
+    for (int c = 0; c < t.nComps; ++c) {
+        mean[c] /= t.weightTotal;
+    }
+}
+
+// the score at position (u,v), computed like TrackerPMProcessor::computeScore()
+static double
+bruteForceScore(const TestImages& t, bool zncc, const double refMean[3], int u, int v)
+{
+    const int ow = t.otherW();
+    double otherMean[3] = { 0., 0., 0. };
+    if (zncc) {
+        for (int i = 0; i < t.patternH; ++i) {
+            for (int j = 0; j < t.patternW; ++j) {
+                const double w = t.weights[(size_t)i * t.patternW + j];
+                for (int c = 0; c < t.nComps; ++c) {
+                    otherMean[c] += w * t.other[((size_t)(v + i) * ow + u + j) * t.nComps + c];
+                }
+            }
+        }
+        for (int c = 0; c < t.nComps; ++c) {
+            otherMean[c] /= t.weightTotal;
+        }
+    }
+    double score = 0.;
+    double otherSsq = 0.;
+    for (int i = 0; i < t.patternH; ++i) {
+        for (int j = 0; j < t.patternW; ++j) {
+            const size_t k = (size_t)i * t.patternW + j;
+            const double w = t.weights[k];
+            for (int c = 0; c < t.nComps; ++c) {
+                const double p = t.pattern[k * t.nComps + c] - refMean[c];
+                const double o = t.other[((size_t)(v + i) * ow + u + j) * t.nComps + c] - otherMean[c];
+                score -= w * p * o;
+                otherSsq += w * o * o;
+            }
+        }
+    }
+    const double sdev = std::sqrt(otherSsq);
+    return (sdev != 0.) ? score / sdev : std::numeric_limits<double>::infinity();
+}
+
+static void
+check(bool ok, const char* name, const char* what)
+{
+    if (!ok) {
+        std::printf("FAILED: %s: %s\n", name, what);
+        ++s_failures;
+    }
+}
+
+// compare the two engines. If planted, the best match must be at (x,y).
+static void
+compare(const char* name, const TestImages& t, bool zncc, bool planted, int x, int y)
+{
+    double refMean[3];
+    patternMean(t, zncc, refMean);
+
+    double bruteBest = std::numeric_limits<double>::infinity();
+    int bruteU = -1;
+    int bruteV = -1;
+    std::vector<double> brute((size_t)t.windowW * t.windowH);
+    for (int v = 0; v < t.windowH; ++v) {
+        for (int u = 0; u < t.windowW; ++u) {
+            const double score = bruteForceScore(t, zncc, refMean, u, v);
+            brute[(size_t)v * t.windowW + u] = score;
+            if (score < bruteBest) {
+                bruteBest = score;
+                bruteU = u;
+                bruteV = v;
+            }
+        }
+    }
+
+    int u, v;
+    double score;
+    const bool found = trackerPMBestMatchFFT(zncc, &t.other[0], t.otherW(), t.otherH(),
+                                             &t.pattern[0], &t.weights[0], t.patternW, t.patternH,
+                                             t.nComps, refMean, t.weightTotal, &u, &v, &score);
+    check(found, name, "no match found with FFTs");
+    if (!found) {
+        return;
+    }
+    const double tolerance = kScoreTolerance * std::max(1., std::fabs(bruteBest));
+    check(std::fabs(score - bruteBest) <= tolerance, name, "best scores differ");
+    // with random patterns, several positions may have the same score within the tolerance
+    check(std::fabs(brute[(size_t)v * t.windowW + u] - bruteBest) <= tolerance, name, "best matches differ");
+    if (planted) {
+        check(u == x && v == y && bruteU == x && bruteV == y, name, "the planted match was not found");
+    }
+    std::printf("%s: %s %dx%d pattern, %dx%d window, %d comps: best (%d,%d) %.12g, FFT (%d,%d) %.12g\n",
+                name, zncc ? "ZNCC" : "NCC", t.patternW, t.patternH, t.windowW, t.windowH, t.nComps,
+                bruteU, bruteV, bruteBest, u, v, score);
+}
+
+int
+main()
+{
+    std::srand(1);
+    TestImages t;
+    for (int zncc = 0; zncc < 2; ++zncc) {
+        makeImages(21, 17, 40, 33, 3, true, true, 7, 12, &t);
+        compare("planted, uniform weights", t, zncc, true, 7, 12);
+
+        makeImages(24, 17, 40, 33, 3, false, true, 30, 2, &t);
+        compare("planted, mask weights", t, zncc, true, 30, 2);
+
+        makeImages(19, 23, 37, 29, 1, true, true, 0, 28, &t);
+        compare("planted, one component", t, zncc, true, 0, 28);
+
+        makeImages(16, 16, 32, 32, 3, false, false, 0, 0, &t);
+        compare("random pattern", t, zncc, false, 0, 0);
+
+        // at the threshold of the FFT engine: 32x32 pattern and 16x16 window
+        check(trackerPMUseFFT(32, 32, 16, 16), "threshold", "the FFT engine is not used at the threshold");
+        check(!trackerPMUseFFT(32, 32, 16, 15), "threshold", "the FFT engine is used below the threshold");
+        makeImages(32, 32, 16, 16, 3, true, true, 9, 4, &t);
+        compare("threshold, planted", t, zncc, true, 9, 4);
+        makeImages(32, 32, 16, 16, 3, false, false, 0, 0, &t);
+        compare("threshold, random pattern", t, zncc, false, 0, 0);
+    }
+
+    if (s_failures) {
+        std::printf("%d failures\n", s_failures);
+        return 1;
+    }
+    std::printf("all tests passed\n");
+    return 0;
+}